@@ -54,7 +54,6 @@ OPTS += -DHAVE_USLEEP
 #OPTS += -DSQLITE4_OMIT_ANALYZE
 #OPTS += -DSQLITE4_OMIT_AUTOMATIC_INDEX
 OPTS += -DSQLITE4_OMIT_VIRTUALTABLE=1
-OPTS += -DSQLITE4_OMIT_XFER_OPT
 #OPTS += -DSQLITE4_THREADSAFE=0
 
 # This is how we compile
@@ -71,7 +70,7 @@ LIBOBJ+= vdbe.o parse.o \
          callback.o complete.o ctime.o date.o delete.o env.o expr.o \
          fault.o fkey.o fts5.o fts5func.o \
          func.o global.o hash.o \
-         icu.o insert.o kv.o kvlsm.o kvldb.o kvmem.o legacy.o \
+         icu.o insert.o kv.o kvcache.o kvephm.o kvlsm.o kvldb.o kvmem.o legacy.o \
          lsm_ckpt.o lsm_file.o lsm_log.o lsm_main.o lsm_mem.o lsm_mutex.o \
          lsm_shared.o lsm_str.o lsm_sorted.o lsm_tree.o \
          lsm_unix.o lsm_varint.o \
@@ -80,10 +79,10 @@ LIBOBJ+= vdbe.o parse.o \
          opcodes.o os.o \
          pragma.o prepare.o printf.o \
          random.o resolve.o rowset.o rtree.o select.o status.o \
-         tokenize.o trigger.o \
+         threads.o tokenize.o trigger.o \
          update.o util.o varint.o \
-         vdbeapi.o vdbeaux.o vdbecodec.o vdbecursor.o \
-         vdbemem.o vdbetrace.o \
+         vdbeapi.o vdbeaux.o vdbecodec.o vdbecursor.o vdbehash.o \
+         vdbejoin.o vdbemem.o vdbeset.o vdbesort.o vdbetopn.o vdbetrace.o \
          walker.o where.o utf.o
 
 LIBOBJ += bt_unix.o bt_pager.o bt_main.o bt_varint.o kvbt.o bt_lock.o bt_log.o
@@ -123,6 +122,8 @@ SRC = \
   $(TOP)/src/kv.c \
   $(TOP)/src/kv.h \
   $(TOP)/src/kvbt.c \
+  $(TOP)/src/kvcache.c \
+  $(TOP)/src/kvephm.c \
   $(TOP)/src/kvlsm.c \
   $(TOP)/src/kvldb.c \
   $(TOP)/src/kvldb.h \
@@ -172,6 +173,7 @@ SRC = \
   $(TOP)/src/sqliteLimit.h \
   $(TOP)/src/status.c \
   $(TOP)/src/tclsqlite.c \
+  $(TOP)/src/threads.c \
   $(TOP)/src/tokenize.c \
   $(TOP)/src/trigger.c \
   $(TOP)/src/utf.c \
@@ -184,7 +186,12 @@ SRC = \
   $(TOP)/src/vdbeaux.c \
   $(TOP)/src/vdbecodec.c \
   $(TOP)/src/vdbecursor.c \
+  $(TOP)/src/vdbehash.c \
+  $(TOP)/src/vdbejoin.c \
   $(TOP)/src/vdbemem.c \
+  $(TOP)/src/vdbeset.c \
+  $(TOP)/src/vdbesort.c \
+  $(TOP)/src/vdbetopn.c \
   $(TOP)/src/vdbetrace.c \
   $(TOP)/src/vdbeInt.h \
   $(TOP)/src/walker.c \
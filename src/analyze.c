@@ -847,7 +847,11 @@ static int analysisLoader(
       v = v*10 + c - '0';
       z++;
     }
-    if( i==0 ) pTable->nRowEst = v;
+    if( i==0 ){
+      /* A partial index contains only some of the rows of the table */
+      if( pIndex==0 || pIndex->pPartIdxWhere==0 ) pTable->nRowEst = v;
+      pTable->tabFlags |= TF_HasStat1;
+    }
     if( pIndex==0 ) break;
     pIndex->aiRowEst[i] = v;
     if( *z==' ' ) z++;
@@ -1023,6 +1027,10 @@ int sqlite4AnalysisLoad(sqlite4 *db, int iDb){
     pIdx->aSample = 0;
 #endif
   }
+  for(i=sqliteHashFirst(&db->aDb[iDb].pSchema->tblHash);i;i=sqliteHashNext(i)){
+    Table *pTab = sqliteHashData(i);
+    pTab->tabFlags &= ~TF_HasStat1;
+  }
 
   /* Check to make sure the sqlite_stat1 table exists */
   sInfo.db = db;
@@ -297,6 +297,8 @@ static void freeIndex(sqlite4 *db, Index *p){
   sqlite4DeleteIndexSamples(db, p);
 #endif
   sqlite4Fts5IndexFree(db, p);
+  sqlite4ExprDelete(db, p->pPartIdxWhere);
+  sqlite4ExprListDelete(db, p->aColExpr);
   sqlite4DbFree(db, p->zColAff);
   sqlite4DbFree(db, p);
 }
@@ -348,6 +350,9 @@ void sqlite4ResetInternalSchema(sqlite4 *db, int iDb){
   int i, j;
   assert( iDb<db->nDb );
 
+  /* Cached statements may refer to the schema objects about to be freed */
+  sqlite4VdbeStmtCacheClear(db);
+
   if( iDb>=0 ){
     /* Case 1:  Reset the single schema identified by iDb */
     Db *pDb = &db->aDb[iDb];
@@ -1075,7 +1080,7 @@ void sqlite4AddPrimaryKey(
     }
     if( pList->nExpr>1 ) iCol = -1;
   }
-  pPk = sqlite4CreateIndex(pParse, 0, pList, 0, onError, 0, sortOrder, 1);
+  pPk = sqlite4CreateIndex(pParse, 0, pList, 0, 0, onError, 0, sortOrder, 1);
 
   if( iCol>=0 && iCol<pTab->nCol
    && (zType = pTab->aCol[iCol].zType)!=0
@@ -1151,6 +1156,46 @@ void sqlite4AddCollateType(Parse *pParse, Token *pToken){
   }
 }
 
+/*
+** This routine is called by the parser for each "name=value" pair in the
+** WITH(...) clause that may follow the column list of a CREATE TABLE
+** statement. The only option currently recognized is "format", which
+** selects the record format used to store the rows of the table:
+**
+**   format=varint    The default format. Each column is located by
+**                    summing the sizes of all columns that precede it.
+**
+**   format=offsets   A fixed-width table of offsets follows a short
+**                    header, so any column can be located directly.
+**
+** Since the option is part of the CREATE TABLE text saved in the schema
+** table, it survives a schema reload. Rows of either format can be read
+** regardless of the option, so changing it never invalidates old rows.
+*/
+void sqlite4AddTableOption(Parse *pParse, Token *pName, Token *pValue){
+  Table *p;
+  sqlite4 *db = pParse->db;
+  char *zName;
+  char *zValue;
+
+  if( (p = pParse->pNewTable)==0 ) return;
+  zName = sqlite4NameFromToken(db, pName);
+  zValue = sqlite4NameFromToken(db, pValue);
+  if( zName && zValue ){
+    if( sqlite4_stricmp(zName, "format")!=0 ){
+      sqlite4ErrorMsg(pParse, "unknown table option: %s", zName);
+    }else if( sqlite4_stricmp(zValue, "offsets")==0 ){
+      p->tabFlags |= TF_RowOffsets;
+    }else if( sqlite4_stricmp(zValue, "varint")==0 ){
+      p->tabFlags &= ~TF_RowOffsets;
+    }else{
+      sqlite4ErrorMsg(pParse, "unknown row format: %s", zValue);
+    }
+  }
+  sqlite4DbFree(db, zName);
+  sqlite4DbFree(db, zValue);
+}
+
 /*
 ** This function returns the collation sequence for database native text
 ** encoding identified by the string zName, length nName.
@@ -1518,7 +1563,7 @@ void sqlite4EndTable(
     sSrc.a[0].iCursor = -1;
     sNC.pParse = pParse;
     sNC.pSrcList = &sSrc;
-    sNC.isCheck = 1;
+    sNC.isCheck = NC_IsCheck;
     if( sqlite4ResolveExprNames(&sNC, p->pCheck) ){
       return;
     }
@@ -2264,6 +2309,14 @@ void sqlite4EncodeIndexValue(
 ** Generate code that will erase and refill index *pIdx.  This is
 ** used to initialize a newly created index or to recompute the
 ** content of an index in response to a REINDEX command.
+**
+** Except for fts5 indexes, the index is filled in two passes. The first
+** scans the table and adds the key (and value) of each index entry to a
+** sorter. The second reads the entries back from the sorter in key order
+** and writes them to the index. Writing keys in order is much cheaper
+** for the KV store than writing them in table order, and the sorter
+** sorts and merges large inputs using up to "PRAGMA threads" worker
+** threads while the table is still being scanned.
 */
 static void sqlite4RefillIndex(Parse *pParse, Index *pIdx, int bCreate){
   Table *pTab = pIdx->pTable;    /* The table that is indexed */
@@ -2300,14 +2353,13 @@ static void sqlite4RefillIndex(Parse *pParse, Index *pIdx, int bCreate){
   sqlite4OpenIndex(pParse, iIdx, iDb, pIdx, OP_OpenWrite);
   if( bCreate ) sqlite4VdbeChangeP5(v, 1);
 
-  /* Loop through the contents of the PK index. At each row, insert the
-  ** corresponding entry into the auxiliary index.  */
-  addr1 = sqlite4VdbeAddOp2(v, OP_Rewind, iTab, 0);
-
   if( pIdx->eIndexType==SQLITE4_INDEX_FTS5 ){
     int regData;
     int i;
 
+    /* Loop through the contents of the PK index. At each row, insert the
+    ** corresponding entry into the auxiliary index.  */
+    addr1 = sqlite4VdbeAddOp2(v, OP_Rewind, iTab, 0);
     regKey = sqlite4GetTempRange(pParse, pTab->nCol+1);
     regData = regKey+1;
 
@@ -2316,10 +2368,41 @@ static void sqlite4RefillIndex(Parse *pParse, Index *pIdx, int bCreate){
       sqlite4VdbeAddOp3(v, OP_Column, iTab, i, regData+i);
     }
     sqlite4Fts5CodeUpdate(pParse, pIdx, pParse->iNewidxReg, regKey, regData, 0);
+    sqlite4VdbeAddOp2(v, OP_Next, iTab, addr1+1);
+    sqlite4VdbeJumpHere(v, addr1);
   }else{
-    int regData = 0;
+    int iSorter = pParse->nTab++; /* Cursor used for the sorter */
+    int regData = 0;              /* Register containing index value */
+    int iSkip = 0;                /* Jump here for rows not in a partial idx */
+    int addr2;                    /* Address of top of write loop */
+
     regKey = sqlite4GetTempRange(pParse, 2);
+    if( pIdx->nCover>0 ) regData = regKey+1;
+    sqlite4VdbeAddOp1(v, OP_SorterOpen, iSorter);
+    sqlite4VdbeChangeP5(v, 1);
+
+    /* Loop through the contents of the PK index. At each row, add the
+    ** corresponding index entry to the sorter.  */
+    addr1 = sqlite4VdbeAddOp2(v, OP_Rewind, iTab, 0);
+    if( pIdx->pPartIdxWhere ){
+      iSkip = sqlite4VdbeMakeLabel(v);
+      sqlite4PartialIndexSkip(pParse, pIdx, iTab, 0, iSkip);
+    }
     sqlite4EncodeIndexKey(pParse, pPk, iTab, pIdx, iIdx, 0, regKey);
+    if( regData ){
+      sqlite4EncodeIndexValue(pParse, iTab, pIdx, regData);
+    }
+    sqlite4VdbeAddOp3(v, OP_Insert, iSorter, regData, regKey);
+    if( iSkip ) sqlite4VdbeResolveLabel(v, iSkip);
+    sqlite4VdbeAddOp2(v, OP_Next, iTab, addr1+1);
+    sqlite4VdbeJumpHere(v, addr1);
+
+    /* Copy the sorted entries into the index.  */
+    addr1 = sqlite4VdbeAddOp2(v, OP_SorterSort, iSorter, 0);
+    addr2 = sqlite4VdbeAddOp2(v, OP_RowKey, iSorter, regKey);
+    if( regData ){
+      sqlite4VdbeAddOp2(v, OP_RowData, iSorter, regData);
+    }
     if( pIdx->onError!=OE_None ){
       const char *zErr = "indexed columns are not unique";
       int addrTest;
@@ -2328,17 +2411,13 @@ static void sqlite4RefillIndex(Parse *pParse, Index *pIdx, int bCreate){
       sqlite4HaltConstraint(pParse, OE_Abort, (char *)zErr, P4_STATIC);
       sqlite4VdbeJumpHere(v, addrTest);
     }
-    if( pIdx->nCover>0 ){
-      regData = regKey+1;
-      sqlite4EncodeIndexValue(pParse, iTab, pIdx, regData);
-    }
-    sqlite4VdbeAddOp3(v, OP_Insert, iIdx, regData, regKey);  
+    sqlite4VdbeAddOp3(v, OP_Insert, iIdx, regData, regKey);
+    sqlite4VdbeAddOp2(v, OP_SorterNext, iSorter, addr2);
+    sqlite4VdbeJumpHere(v, addr1);
+    sqlite4VdbeAddOp1(v, OP_Close, iSorter);
     sqlite4ReleaseTempRange(pParse, regKey, 2);
   }
 
-  sqlite4VdbeAddOp2(v, OP_Next, iTab, addr1+1);
-  sqlite4VdbeJumpHere(v, addr1);
-
   sqlite4VdbeAddOp1(v, OP_Close, iTab);
   sqlite4VdbeAddOp1(v, OP_Close, iIdx);
 }
@@ -2604,6 +2683,30 @@ void sqlite4CreateUsingIndex(
   sqlite4SrcListDelete(db, p->pTblName);
 }
 
+/*
+** Resolve the names in expression pExpr, which is either the WHERE clause
+** of a partial index on table pTab or an expression indexed by it (eType
+** is NC_PartIdx or NC_IdxExpr, respectively). As for a CHECK constraint,
+** column references are resolved against cursor -1, so that the
+** expression may later be evaluated against either an array of registers
+** or a cursor open on the table. Return non-zero if an error occurs.
+*/
+static int resolveIndexExpr(Parse *pParse, Table *pTab, int eType, Expr *pExpr){
+  SrcList sSrc;                   /* Fake SrcList for pTab */
+  NameContext sNC;                /* Name context for pTab */
+
+  memset(&sNC, 0, sizeof(sNC));
+  memset(&sSrc, 0, sizeof(sSrc));
+  sSrc.nSrc = 1;
+  sSrc.a[0].zName = pTab->zName;
+  sSrc.a[0].pTab = pTab;
+  sSrc.a[0].iCursor = -1;
+  sNC.pParse = pParse;
+  sNC.pSrcList = &sSrc;
+  sNC.isCheck = (u8)eType;
+  return sqlite4ResolveExprNames(&sNC, pExpr);
+}
+
 /*
 ** Parameter zName points to a nul-terminated buffer containing a column
 ** name. If table pTab has a column of the specified name, return its
@@ -2648,8 +2751,9 @@ Index *sqlite4CreateIndex(
   CreateIndex *pCI,  /* Name of index to create etc. */
   ExprList *pList,   /* A list of columns to be indexed */
   IdList *pCovering, /* Covering list (or NULL) */
+  Expr *pPIWhere,    /* WHERE clause of a partial index (or NULL) */
   int onError,       /* OE_Abort, OE_Ignore, OE_Replace, or OE_None */
-  Token *pEnd,       /* The ")" that closes the CREATE INDEX statement */
+  Token *pEnd,       /* The last token of the CREATE INDEX statement */
   int sortOrder,     /* Sort order of primary key when pList==NULL */
   int bPrimaryKey    /* True to create the tables primary key */
 ){
@@ -2663,6 +2767,7 @@ Index *sqlite4CreateIndex(
   int iDb;             /* Index of the database that is being written */
   Token *pName = 0;    /* Unqualified name of the index to create */
   ExprListItem *pListItem; /* For looping over pList */
+  int nIdxExpr = 0;    /* Number of columns that are expressions */
   int nExtra = 0;
   char *zExtra;
 
@@ -2745,18 +2850,32 @@ Index *sqlite4CreateIndex(
     pList->a[0].sortOrder = (u8)sortOrder;
   }
 
+  /* Items of a CREATE INDEX column list that consist of a single name,
+  ** perhaps with a COLLATE clause, are columns of the table. Give each
+  ** such item a name, and discard its expression unless it carries the
+  ** collation sequence. Any other item without a name is an expression.
+  */
+  for(i=0; i<pList->nExpr; i++){
+    Expr *pExpr = pList->a[i].pExpr;
+    if( pList->a[i].zName==0
+     && ALWAYS(pExpr) && (pExpr->op==TK_ID || pExpr->op==TK_STRING)
+    ){
+      pList->a[i].zName = sqlite4DbStrDup(db, pExpr->u.zToken);
+      if( pList->a[i].zName==0 ) goto exit_create_index;
+      if( (pExpr->flags & EP_ExpCollate)==0 ){
+        sqlite4ExprDelete(db, pExpr);
+        pList->a[i].pExpr = 0;
+      }
+    }
+  }
+
   /* Figure out how many bytes of space are required to store explicitly
   ** specified collation sequence names.
   */
   for(i=0; i<pList->nExpr; i++){
     Expr *pExpr = pList->a[i].pExpr;
-    if( pExpr ){
-      CollSeq *pColl = pExpr->pColl;
-      /* Either pColl!=0 or there was an OOM failure.  But if an OOM
-      ** failure we have quit before reaching this point. */
-      if( ALWAYS(pColl) ){
-        nExtra += (1 + sqlite4Strlen30(pColl->zName));
-      }
+    if( pExpr && (pExpr->flags & EP_ExpCollate) ){
+      nExtra += (1 + sqlite4Strlen30(pExpr->pColl->zName));
     }
   }
 
@@ -2775,6 +2894,16 @@ Index *sqlite4CreateIndex(
     }
   }
 
+  /* If this is a partial index, resolve the names in its WHERE clause.
+  ** The index takes ownership of the expression.  */
+  if( pPIWhere ){
+    pIndex->pPartIdxWhere = pPIWhere;
+    pPIWhere = 0;
+    if( resolveIndexExpr(pParse, pTab, NC_PartIdx, pIndex->pPartIdxWhere) ){
+      goto exit_create_index;
+    }
+  }
+
   /* Scan the names of the columns of the table to be indexed and
   ** load the column indices into the Index structure.  Report an error
   ** if any column is not found.
@@ -2785,20 +2914,40 @@ Index *sqlite4CreateIndex(
   */
   for(i=0, pListItem=pList->a; i<pList->nExpr; i++, pListItem++){
     char *zColl;                   /* Collation sequence name */
+    Expr *pExpr = pListItem->pExpr;
 
-    j = findTableColumn(pParse, pTab, pListItem->zName);
-    if( j<0 ) goto exit_create_index;
+    if( pListItem->zName ){
+      j = findTableColumn(pParse, pTab, pListItem->zName);
+      if( j<0 ) goto exit_create_index;
+    }else{
+      /* An expression. Its names are resolved in the same way as those
+      ** of a partial index WHERE clause. If it turns out to be a plain
+      ** reference to a column of the table (e.g. "t1.a"), it is indexed
+      ** as that column.  */
+      if( resolveIndexExpr(pParse, pTab, NC_IdxExpr, pExpr) ){
+        goto exit_create_index;
+      }
+      if( pExpr->op==TK_COLUMN && pExpr->iColumn>=0 ){
+        j = pExpr->iColumn;
+      }else{
+        j = XN_EXPR;
+        nIdxExpr++;
+      }
+    }
 
     pIndex->aiColumn[i] = j;
-    if( pListItem->pExpr && pListItem->pExpr->pColl ){
+    if( pExpr && (pExpr->flags & EP_ExpCollate) ){
       int nColl;
-      zColl = pListItem->pExpr->pColl->zName;
+      zColl = pExpr->pColl->zName;
       nColl = sqlite4Strlen30(zColl) + 1;
       assert( nExtra>=nColl );
       memcpy(zExtra, zColl, nColl);
       zColl = zExtra;
       zExtra += nColl;
       nExtra -= nColl;
+    }else if( j==XN_EXPR ){
+      CollSeq *pColl = sqlite4ExprCollSeq(pParse, pExpr);
+      zColl = (pColl ? pColl->zName : db->pDfltColl->zName);
     }else{
       zColl = pTab->aCol[j].zColl;
       if( !zColl ){
@@ -2810,9 +2959,30 @@ Index *sqlite4CreateIndex(
     }
     pIndex->azColl[i] = zColl;
     pIndex->aSortOrder[i] = (u8)pListItem->sortOrder;
+
+    /* The collation sequence of an expression is stored in azColl[] only,
+    ** so that the expression compares equal to the same expression in
+    ** a WHERE clause. */
+    if( j==XN_EXPR ){
+      pExpr->flags &= ~EP_ExpCollate;
+      pExpr->pColl = 0;
+    }
   }
   sqlite4DefaultRowEst(pIndex);
 
+  /* If any columns are expressions, the index takes ownership of pList
+  ** as Index.aColExpr. Only the XN_EXPR entries are retained.  */
+  if( nIdxExpr ){
+    for(i=0; i<pList->nExpr; i++){
+      if( pIndex->aiColumn[i]!=XN_EXPR ){
+        sqlite4ExprDelete(db, pList->a[i].pExpr);
+        pList->a[i].pExpr = 0;
+      }
+    }
+    pIndex->aColExpr = pList;
+    pList = 0;
+  }
+
   /* Scan the names of any covered columns. */
   for(i=0; i<nCover; i++){
     if( pCovering->nId ){
@@ -2947,9 +3117,12 @@ Index *sqlite4CreateIndex(
   /* Clean up before exiting */
 exit_create_index:
   if( pIndex ){
+    sqlite4ExprDelete(db, pIndex->pPartIdxWhere);
+    sqlite4ExprListDelete(db, pIndex->aColExpr);
     sqlite4DbFree(db, pIndex->zColAff);
     sqlite4DbFree(db, pIndex);
   }
+  sqlite4ExprDelete(db, pPIWhere);
   sqlite4ExprListDelete(db, pList);
   sqlite4SrcListDelete(db, pTblName);
   sqlite4IdListDelete(db, pCovering);
@@ -2981,6 +3154,10 @@ void sqlite4DefaultRowEst(Index *pIdx){
   tRowcnt n;
   assert( a!=0 );
   a[0] = pIdx->pTable->nRowEst;
+  if( pIdx->pPartIdxWhere ){
+    /* Guess that a partial index contains half of the rows of the table */
+    a[0] = a[0] / 2;
+  }
   if( a[0]<10 ) a[0] = 10;
   n = 10;
   for(i=1; i<=pIdx->nColumn; i++){
@@ -3508,7 +3685,7 @@ void sqlite4Savepoint(Parse *pParse, int op, Token *pName){
 */
 int sqlite4OpenTempDatabase(Parse *pParse){
   sqlite4 *db = pParse->db;
-  if( db->aDb[1].pKV==0 && !pParse->explain ){
+  if( db->aDb[1].pKV==0 && (pParse->explain==0 || pParse->explain==3) ){
     int rc;
     rc = sqlite4KVStoreOpen(db, "temp", ":memory:", &db->aDb[1].pKV,
                             SQLITE4_KVOPEN_TEMPORARY);
@@ -357,6 +357,7 @@ void sqlite4SchemaClear(sqlite4_env *pEnv, Schema *pSchema){
   sqlite4HashClear(&temp1);
   sqlite4HashClear(&pSchema->fkeyHash);
   pSchema->pSeqTab = 0;
+  sqlite4VdbeRowidHwmClear(pEnv, pSchema);
   if( pSchema->flags & DB_SchemaLoaded ){
     pSchema->iGeneration++;
     pSchema->flags &= ~DB_SchemaLoaded;
@@ -1165,18 +1165,21 @@ static void currentTimeFunc(
 void sqlite4RegisterDateTimeFunctions(sqlite4_env *pEnv){
   static FuncDef aDateTimeFuncs[] = {
 #ifndef SQLITE4_OMIT_DATETIME_FUNCS
-    FUNCTION(julianday,        -1, 0, 0, juliandayFunc ),
-    FUNCTION(date,             -1, 0, 0, dateFunc      ),
-    FUNCTION(time,             -1, 0, 0, timeFunc      ),
-    FUNCTION(datetime,         -1, 0, 0, datetimeFunc  ),
-    FUNCTION(strftime,         -1, 0, 0, strftimeFunc  ),
-    FUNCTION(current_time,      0, 0, 0, ctimeFunc     ),
-    FUNCTION(current_timestamp, 0, 0, 0, ctimestampFunc),
-    FUNCTION(current_date,      0, 0, 0, cdateFunc     ),
+    VFUNCTION(julianday,       -1, 0, 0, juliandayFunc ),
+    VFUNCTION(date,            -1, 0, 0, dateFunc      ),
+    VFUNCTION(time,            -1, 0, 0, timeFunc      ),
+    VFUNCTION(datetime,        -1, 0, 0, datetimeFunc  ),
+    VFUNCTION(strftime,        -1, 0, 0, strftimeFunc  ),
+    VFUNCTION(current_time,     0, 0, 0, ctimeFunc     ),
+    VFUNCTION(current_timestamp, 0, 0, 0, ctimestampFunc),
+    VFUNCTION(current_date,     0, 0, 0, cdateFunc     ),
 #else
-    STR_FUNCTION(current_time,      0, "%H:%M:%S",          0, currentTimeFunc),
-    STR_FUNCTION(current_date,      0, "%Y-%m-%d",          0, currentTimeFunc),
-    STR_FUNCTION(current_timestamp, 0, "%Y-%m-%d %H:%M:%S", 0, currentTimeFunc),
+    {0, SQLITE4_FUNC_VOLATILE, "%H:%M:%S", 0, currentTimeFunc, 0, 0,
+     "current_time", 0, 0},
+    {0, SQLITE4_FUNC_VOLATILE, "%Y-%m-%d", 0, currentTimeFunc, 0, 0,
+     "current_date", 0, 0},
+    {0, SQLITE4_FUNC_VOLATILE, "%Y-%m-%d %H:%M:%S", 0, currentTimeFunc, 0, 0,
+     "current_timestamp", 0, 0},
 #endif
   };
   int i;
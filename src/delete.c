@@ -541,8 +541,7 @@ void sqlite4EncodeIndexKey(
 
   /* Assemble the values for the key in the array of temp registers */
   for(i=0; i<pIdx->nColumn; i++){
-    int regVal = regTmp + i;
-    sqlite4VdbeAddOp3(v, OP_Column, iPkCsr, pIdx->aiColumn[i], regVal);
+    sqlite4CodeIndexColumn(pParse, pIdx, i, iPkCsr, 0, regTmp + i);
   }
   for(i=0; i<nPkCol; i++){
     int iCol = pPk->aiColumn[i];
@@ -563,6 +562,68 @@ void sqlite4EncodeIndexKey(
   sqlite4ReleaseTempRange(pParse, regTmp, nTmpReg);
 }
 
+/*
+** Generate code to load the value of the iCol'th column of index pIdx
+** for a row of its table into register regOut. If regContent is non-zero,
+** the values of the row are read from the array of registers that starts
+** at regContent. Otherwise, they are read from the row that cursor iCsr,
+** which is open on the table, points to.
+**
+** If the column is an expression (XN_EXPR), it is evaluated in the same
+** way as the WHERE clause of a partial index.
+*/
+void sqlite4CodeIndexColumn(
+  Parse *pParse,                  /* Parse context */
+  Index *pIdx,                    /* Index to load a column value for */
+  int iCol,                       /* Column of pIdx to load */
+  int iCsr,                       /* Cursor open on table (if regContent==0) */
+  int regContent,                 /* First register of row (or 0) */
+  int regOut                      /* Store the value here */
+){
+  Vdbe *v = pParse->pVdbe;
+  int iTblCol = pIdx->aiColumn[iCol];
+
+  if( iTblCol==XN_EXPR ){
+    pParse->ckBase = regContent;
+    pParse->iPartIdxTab = iCsr;
+    sqlite4ExprCachePush(pParse);
+    sqlite4ExprCode(pParse, pIdx->aColExpr->a[iCol].pExpr, regOut);
+    sqlite4ExprCachePop(pParse, 1);
+    pParse->ckBase = 0;
+  }else if( regContent ){
+    sqlite4VdbeAddOp2(v, OP_SCopy, regContent+iTblCol, regOut);
+  }else{
+    sqlite4VdbeAddOp3(v, OP_Column, iCsr, iTblCol, regOut);
+  }
+}
+
+/*
+** If pIdx is a partial index, generate code to jump to label iLabel if
+** a row does not satisfy the WHERE clause of the index, and so has no
+** entry in it. If regContent is non-zero, the values of the row are read
+** from the array of registers that starts at regContent (as for a CHECK
+** constraint). Otherwise, they are read from the row that cursor iCsr, 
+** which is open on the table, points to.
+**
+** If pIdx is not a partial index, this function is a no-op.
+*/
+void sqlite4PartialIndexSkip(
+  Parse *pParse,                  /* Parse context */
+  Index *pIdx,                    /* Index that may be a partial index */
+  int iCsr,                       /* Cursor open on table (if regContent==0) */
+  int regContent,                 /* First register of row (or 0) */
+  int iLabel                      /* Jump here if row is not in pIdx */
+){
+  if( pIdx->pPartIdxWhere ){
+    pParse->ckBase = regContent;
+    pParse->iPartIdxTab = iCsr;
+    sqlite4ExprCachePush(pParse);
+    sqlite4ExprIfFalse(pParse, pIdx->pPartIdxWhere, iLabel,SQLITE4_JUMPIFNULL);
+    sqlite4ExprCachePop(pParse, 1);
+    pParse->ckBase = 0;
+  }
+}
+
 /*
 ** This routine generates VDBE code that causes the deletion of all
 ** index entries associated with a single row of a single table.
@@ -610,12 +671,15 @@ void sqlite4GenerateRowIndexDelete(
       sqlite4Fts5CodeUpdate(pParse, pIdx, 0, iReg+pTab->nCol, iReg, 1);
     }else if( pIdx!=pPk && (aRegIdx==0 || aRegIdx[i]>0) ){
       int addrNotFound;
+      int iSkip = sqlite4VdbeMakeLabel(v);
+      sqlite4PartialIndexSkip(pParse, pIdx, iPkCsr, 0, iSkip);
       sqlite4EncodeIndexKey(pParse, pPk, baseCur+iPk,pIdx,baseCur+i,0,regKey);
       addrNotFound = sqlite4VdbeAddOp4(v,
           OP_NotFound, baseCur+i, 0, regKey, 0, P4_INT32
       );
       sqlite4VdbeAddOp1(v, OP_Delete, baseCur+i);
       sqlite4VdbeJumpHere(v, addrNotFound);
+      sqlite4VdbeResolveLabel(v, iSkip);
     }
   }
 
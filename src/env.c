@@ -17,8 +17,14 @@
 /*
 ** Default factory objects
 */
-static KVFactory memFactory = {
+static KVFactory ephmFactory = {
    0,
+   "ephm",
+   sqlite4KVStoreOpenEphemeral,
+   1
+};
+static KVFactory memFactory = {
+   &ephmFactory,
    "temp",
    sqlite4KVStoreOpenMem,
    1
@@ -64,6 +70,7 @@ struct sqlite4_env sqlite4DefaultEnv = {
    &sqlite4BuiltinFactory,    /* pFactory */
    sqlite4OsRandomness,       /* xRandomness */
    sqlite4OsCurrentTime,      /* xCurrentTime */
+   SQLITE4_MAX_WORKER_THREADS, /* mxWorker */
    /* All the rest should always be initialized to zero */
    0,                         /* isInit */
    0,                         /* pFactoryMutex */
@@ -437,6 +444,19 @@ int sqlite4_env_config(sqlite4_env *pEnv, int op, ...){
       break;
     }
 
+    /*
+    ** sqlite4_env_config(p, SQLITE4_ENVCONFIG_WORKER_THREADS, nMax);
+    **
+    ** Set the maximum number of worker threads that a single sorter
+    ** may use. "PRAGMA threads" cannot be set higher than this value.
+    ** Zero disables worker threads. A negative value leaves the limit
+    ** unchanged.
+    */
+    case SQLITE4_ENVCONFIG_WORKER_THREADS: {
+      int nMax = va_arg(ap, int);
+      if( nMax>=0 ) pEnv->mxWorker = nMax;
+      break;
+    }
 
     default: {
       rc = SQLITE4_ERROR;
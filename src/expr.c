@@ -258,6 +258,26 @@ static int codeCompare(
   return addr;
 }
 
+/*
+** Generate code for one operand of a comparison, as for
+** sqlite4ExprCodeTemp(). If the operand is a table column loaded by a
+** new OP_Column instruction, set OPFLAG_EPHEM on that instruction. The
+** comparison consumes the value before the cursor moves on to the next
+** row, so text and blobs need not be copied out of the cursor's buffer.
+*/
+static int codeCompareOperand(Parse *pParse, Expr *pExpr, int *pReg){
+  Vdbe *v = pParse->pVdbe;
+  int iAddr = sqlite4VdbeCurrentAddr(v);
+  int r = sqlite4ExprCodeTemp(pParse, pExpr, pReg);
+  if( pExpr->op==TK_COLUMN && sqlite4VdbeCurrentAddr(v)>iAddr ){
+    VdbeOp *pOp = sqlite4VdbeGetOp(v, iAddr);
+    if( pOp->opcode==OP_Column && pOp->p3==r ){
+      pOp->p5 |= OPFLAG_EPHEM;
+    }
+  }
+  return r;
+}
+
 #if SQLITE4_MAX_EXPR_DEPTH>0
 /*
 ** Check that argument nHeight is less than or equal to the maximum
@@ -1399,6 +1419,7 @@ Index *sqlite4FindExistingInIndex(Parse *pParse, Expr *pX, int bReqUnique){
 
     for(pIdx=pTab->pIndex; pIdx; pIdx=pIdx->pNext){
       if( (pIdx->aiColumn[0]==iCol)
+       && pIdx->pPartIdxWhere==0
        && sqlite4FindCollSeq(db, pIdx->azColl[0], 0)==pReq
        && (!bReqUnique || (pIdx->nColumn==1 && pIdx->onError!=OE_None))
       ){
@@ -1551,6 +1572,7 @@ int sqlite4FindInIndex(Parse *pParse, Expr *pX, int *prNotFound, int *piCov){
 
     for(pIdx=pTab->pIndex; pIdx && eType==0 && affinity_ok; pIdx=pIdx->pNext){
       if( (pIdx->aiColumn[0]==iCol)
+       && pIdx->pPartIdxWhere==0
        && (iCol<0 || sqlite4FindCollSeq(db, pIdx->azColl[0], 0)==pReq)
        && (!mustBeUnique || (pIdx->nColumn==1 && pIdx->onError!=OE_None))
       ){
@@ -1705,9 +1727,13 @@ int sqlite4CodeSubselect(
       ** if either column has NUMERIC or INTEGER affinity. If neither
       ** 'x' nor the SELECT... statement are columns, then numeric affinity
       ** is used.
+      **
+      ** If rMayHaveNull is non-zero, the table is only used for membership
+      ** tests, not iterated through in order. So it may be a hash set.
       */
       pExpr->iTable = pParse->nTab++;
-      addr = sqlite4VdbeAddOp2(v, OP_OpenEphemeral, pExpr->iTable, 1);
+      addr = sqlite4VdbeAddOp3(v, OP_OpenEphemeral, pExpr->iTable, 1,
+                               rMayHaveNull!=0);
       memset(&keyInfo, 0, sizeof(keyInfo));
       keyInfo.nField = 1;
 
@@ -2343,14 +2369,19 @@ int sqlite4ExprCodeTarget(Parse *pParse, Expr *pExpr, int target){
       /* Otherwise, fall thru into the TK_COLUMN case */
     }
     case TK_COLUMN: {
-      if( pExpr->iTable<0 ){
-        /* This only happens when coding check constraints */
-        assert( pParse->ckBase>0 );
-        inReg = pExpr->iColumn + pParse->ckBase;
-      }else{
-        inReg = sqlite4ExprCodeGetColumn(pParse, pExpr->pTab,
-                                 pExpr->iColumn, pExpr->iTable, target);
+      int iTab = pExpr->iTable;
+      if( iTab<0 ){
+        if( pParse->ckBase>0 ){
+          /* Coding a CHECK constraint or a partial index WHERE clause
+          ** against an array of registers */
+          inReg = pExpr->iColumn + pParse->ckBase;
+          break;
+        }
+        /* Coding a partial index WHERE clause against a table cursor */
+        iTab = pParse->iPartIdxTab;
       }
+      inReg = sqlite4ExprCodeGetColumn(pParse, pExpr->pTab,
+                               pExpr->iColumn, iTab, target);
       break;
     }
     case TK_INTEGER: {
@@ -2455,8 +2486,8 @@ int sqlite4ExprCodeTarget(Parse *pParse, Expr *pExpr, int target){
       testcase( op==TK_GE );
       testcase( op==TK_EQ );
       testcase( op==TK_NE );
-      r1 = sqlite4ExprCodeTemp(pParse, pExpr->pLeft, &regFree1);
-      r2 = sqlite4ExprCodeTemp(pParse, pExpr->pRight, &regFree2);
+      r1 = codeCompareOperand(pParse, pExpr->pLeft, &regFree1);
+      r2 = codeCompareOperand(pParse, pExpr->pRight, &regFree2);
       codeCompare(pParse, pExpr->pLeft, pExpr->pRight, op,
                   r1, r2, inReg, SQLITE4_STOREP2);
       testcase( regFree1==0 );
@@ -2467,8 +2498,8 @@ int sqlite4ExprCodeTarget(Parse *pParse, Expr *pExpr, int target){
     case TK_ISNOT: {
       testcase( op==TK_IS );
       testcase( op==TK_ISNOT );
-      r1 = sqlite4ExprCodeTemp(pParse, pExpr->pLeft, &regFree1);
-      r2 = sqlite4ExprCodeTemp(pParse, pExpr->pRight, &regFree2);
+      r1 = codeCompareOperand(pParse, pExpr->pLeft, &regFree1);
+      r2 = codeCompareOperand(pParse, pExpr->pRight, &regFree2);
       op = (op==TK_IS) ? TK_EQ : TK_NE;
       codeCompare(pParse, pExpr->pLeft, pExpr->pRight, op,
                   r1, r2, inReg, SQLITE4_STOREP2 | SQLITE4_NULLEQ);
@@ -3528,8 +3559,8 @@ void sqlite4ExprIfTrue(Parse *pParse, Expr *pExpr, int dest, int jumpIfNull){
       testcase( op==TK_EQ );
       testcase( op==TK_NE );
       testcase( jumpIfNull==0 );
-      r1 = sqlite4ExprCodeTemp(pParse, pExpr->pLeft, &regFree1);
-      r2 = sqlite4ExprCodeTemp(pParse, pExpr->pRight, &regFree2);
+      r1 = codeCompareOperand(pParse, pExpr->pLeft, &regFree1);
+      r2 = codeCompareOperand(pParse, pExpr->pRight, &regFree2);
       codeCompare(pParse, pExpr->pLeft, pExpr->pRight, op,
                   r1, r2, dest, jumpIfNull);
       testcase( regFree1==0 );
@@ -3540,8 +3571,8 @@ void sqlite4ExprIfTrue(Parse *pParse, Expr *pExpr, int dest, int jumpIfNull){
     case TK_ISNOT: {
       testcase( op==TK_IS );
       testcase( op==TK_ISNOT );
-      r1 = sqlite4ExprCodeTemp(pParse, pExpr->pLeft, &regFree1);
-      r2 = sqlite4ExprCodeTemp(pParse, pExpr->pRight, &regFree2);
+      r1 = codeCompareOperand(pParse, pExpr->pLeft, &regFree1);
+      r2 = codeCompareOperand(pParse, pExpr->pRight, &regFree2);
       op = (op==TK_IS) ? TK_EQ : TK_NE;
       codeCompare(pParse, pExpr->pLeft, pExpr->pRight, op,
                   r1, r2, dest, SQLITE4_NULLEQ);
@@ -3673,8 +3704,8 @@ void sqlite4ExprIfFalse(Parse *pParse, Expr *pExpr, int dest, int jumpIfNull){
       testcase( op==TK_EQ );
       testcase( op==TK_NE );
       testcase( jumpIfNull==0 );
-      r1 = sqlite4ExprCodeTemp(pParse, pExpr->pLeft, &regFree1);
-      r2 = sqlite4ExprCodeTemp(pParse, pExpr->pRight, &regFree2);
+      r1 = codeCompareOperand(pParse, pExpr->pLeft, &regFree1);
+      r2 = codeCompareOperand(pParse, pExpr->pRight, &regFree2);
       codeCompare(pParse, pExpr->pLeft, pExpr->pRight, op,
                   r1, r2, dest, jumpIfNull);
       testcase( regFree1==0 );
@@ -3685,8 +3716,8 @@ void sqlite4ExprIfFalse(Parse *pParse, Expr *pExpr, int dest, int jumpIfNull){
     case TK_ISNOT: {
       testcase( pExpr->op==TK_IS );
       testcase( pExpr->op==TK_ISNOT );
-      r1 = sqlite4ExprCodeTemp(pParse, pExpr->pLeft, &regFree1);
-      r2 = sqlite4ExprCodeTemp(pParse, pExpr->pRight, &regFree2);
+      r1 = codeCompareOperand(pParse, pExpr->pLeft, &regFree1);
+      r2 = codeCompareOperand(pParse, pExpr->pRight, &regFree2);
       op = (pExpr->op==TK_IS) ? TK_NE : TK_EQ;
       codeCompare(pParse, pExpr->pLeft, pExpr->pRight, op,
                   r1, r2, dest, SQLITE4_NULLEQ);
@@ -3747,8 +3778,13 @@ void sqlite4ExprIfFalse(Parse *pParse, Expr *pExpr, int dest, int jumpIfNull){
 ** this routine is used, it does not hurt to get an extra 2 - that
 ** just might result in some slightly slower code.  But returning
 ** an incorrect 0 or 1 could lead to a malfunction.
+**
+** If pB contains a TK_COLUMN with a negative Expr.iTable, as do the 
+** WHERE clauses of partial indexes, it is considered to refer to the 
+** same table as a TK_COLUMN in pA with an Expr.iTable value of iTab.
+** Pass -1 as iTab if this mapping is not required.
 */
-int sqlite4ExprCompare(Expr *pA, Expr *pB){
+int sqlite4ExprCompare(Expr *pA, Expr *pB, int iTab){
   if( pA==0||pB==0 ){
     return pB==pA ? 0 : 2;
   }
@@ -3758,18 +3794,31 @@ int sqlite4ExprCompare(Expr *pA, Expr *pB){
     return 2;
   }
   if( (pA->flags & EP_Distinct)!=(pB->flags & EP_Distinct) ) return 2;
-  if( pA->op!=pB->op ) return 2;
-  if( sqlite4ExprCompare(pA->pLeft, pB->pLeft) ) return 2;
-  if( sqlite4ExprCompare(pA->pRight, pB->pRight) ) return 2;
-  if( sqlite4ExprListCompare(pA->x.pList, pB->x.pList) ) return 2;
-  if( pA->iTable!=pB->iTable || pA->iColumn!=pB->iColumn ) return 2;
+  if( pA->op!=pB->op ){
+    /* pA may be a constant that has been factored out into a register */
+    if( pA->op!=TK_REGISTER || pA->op2!=pB->op || pB->op==TK_COLUMN ){
+      return 2;
+    }
+  }
+  if( sqlite4ExprCompare(pA->pLeft, pB->pLeft, iTab) ) return 2;
+  if( sqlite4ExprCompare(pA->pRight, pB->pRight, iTab) ) return 2;
+  if( sqlite4ExprListCompare(pA->x.pList, pB->x.pList, iTab) ) return 2;
+  if( pA->iTable!=pB->iTable && pA->op!=TK_REGISTER
+   && (pA->op!=TK_COLUMN || pA->iTable!=iTab || pB->iTable>=0)
+  ){
+    return 2;
+  }
+  if( pA->iColumn!=pB->iColumn ) return 2;
   if( ExprHasProperty(pA, EP_IntValue) ){
     if( !ExprHasProperty(pB, EP_IntValue) || pA->u.iValue!=pB->u.iValue ){
       return 2;
     }
   }else if( pA->op!=TK_COLUMN && pA->u.zToken ){
     if( ExprHasProperty(pB, EP_IntValue) || NEVER(pB->u.zToken==0) ) return 2;
-    if( strcmp(pA->u.zToken,pB->u.zToken)!=0 ){
+    if( pA->op==TK_FUNCTION ){
+      /* Function names are not case sensitive */
+      if( sqlite4_stricmp(pA->u.zToken,pB->u.zToken)!=0 ) return 2;
+    }else if( strcmp(pA->u.zToken,pB->u.zToken)!=0 ){
       return 2;
     }
   }
@@ -3789,8 +3838,10 @@ int sqlite4ExprCompare(Expr *pA, Expr *pB){
 **
 ** Two NULL pointers are considered to be the same.  But a NULL pointer
 ** always differs from a non-NULL pointer.
+**
+** The iTab parameter is passed through to sqlite4ExprCompare().
 */
-int sqlite4ExprListCompare(ExprList *pA, ExprList *pB){
+int sqlite4ExprListCompare(ExprList *pA, ExprList *pB, int iTab){
   int i;
   if( pA==0 && pB==0 ) return 0;
   if( pA==0 || pB==0 ) return 1;
@@ -3799,7 +3850,43 @@ int sqlite4ExprListCompare(ExprList *pA, ExprList *pB){
     Expr *pExprA = pA->a[i].pExpr;
     Expr *pExprB = pB->a[i].pExpr;
     if( pA->a[i].sortOrder!=pB->a[i].sortOrder ) return 1;
-    if( sqlite4ExprCompare(pExprA, pExprB) ) return 1;
+    if( sqlite4ExprCompare(pExprA, pExprB, iTab) ) return 1;
+  }
+  return 0;
+}
+
+/*
+** Return true if it can be proven that whenever expression pE1 is true,
+** pE2 is also true. This is used to determine whether or not a partial
+** index may be used to implement a query with WHERE term pE1, where pE2
+** is the WHERE clause of the index. TK_COLUMN nodes in pE2 with negative
+** Expr.iTable values refer to the table with cursor iTab in pE1.
+**
+** Like sqlite4ExprCompare(), this routine may return false even if pE1
+** does imply pE2. The only consequence is that an index is not used.
+** It recognizes the following:
+**
+**   *  pE1 and pE2 are identical,
+**   *  pE2 is an OR expression and pE1 implies either side of it, and
+**   *  pE2 is "x IS NOT NULL" and pE1 is a comparison of x with another
+**      expression that is not true when x is NULL.
+*/
+int sqlite4ExprImpliesExpr(Expr *pE1, Expr *pE2, int iTab){
+  if( sqlite4ExprCompare(pE1, pE2, iTab)==0 ){
+    return 1;
+  }
+  if( pE2->op==TK_OR
+   && (sqlite4ExprImpliesExpr(pE1, pE2->pLeft, iTab)
+       || sqlite4ExprImpliesExpr(pE1, pE2->pRight, iTab))
+  ){
+    return 1;
+  }
+  if( pE2->op==TK_NOTNULL
+   && (pE1->op==TK_EQ || pE1->op==TK_NE || pE1->op==TK_LT 
+    || pE1->op==TK_LE || pE1->op==TK_GT || pE1->op==TK_GE)
+   && sqlite4ExprCompare(pE1->pLeft, pE2->pLeft, iTab)==0
+  ){
+    return 1;
   }
   return 0;
 }
@@ -3931,7 +4018,7 @@ static int analyzeAggregate(Walker *pWalker, Expr *pExpr){
         */
         AggInfoFunc *pItem = pAggInfo->aFunc;
         for(i=0; i<pAggInfo->nFunc; i++, pItem++){
-          if( sqlite4ExprCompare(pItem->pExpr, pExpr)==0 ){
+          if( sqlite4ExprCompare(pItem->pExpr, pExpr, -1)==0 ){
             break;
           }
         }
@@ -209,6 +209,8 @@ static int locateFkeyIndex(
   for(pIdx=pParent->pIndex; pIdx; pIdx=pIdx->pNext){
     if( pIdx->nColumn==nCol 
      && pIdx->onError!=OE_None
+     && pIdx->pPartIdxWhere==0
+     && pIdx->aColExpr==0
      && pIdx->aiColumn[0]!=-1
     ){ 
       /* pIdx is a UNIQUE index (or a PRIMARY KEY) and has the right number
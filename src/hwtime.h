@@ -27,15 +27,15 @@
 
   #if defined(__GNUC__)
 
-  __inline__ sqlite_uint64 sqlite4Hwtime(void){
+  static __inline__ sqlite4_uint64 sqlite4Hwtime(void){
      unsigned int lo, hi;
      __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
-     return (sqlite_uint64)hi << 32 | lo;
+     return (sqlite4_uint64)hi << 32 | lo;
   }
 
   #elif defined(_MSC_VER)
 
-  __declspec(naked) __inline sqlite_uint64 __cdecl sqlite4Hwtime(void){
+  static __declspec(naked) __inline sqlite4_uint64 __cdecl sqlite4Hwtime(void){
      __asm {
         rdtsc
         ret       ; return value at EDX:EAX
@@ -46,15 +46,15 @@
 
 #elif (defined(__GNUC__) && defined(__x86_64__))
 
-  __inline__ sqlite_uint64 sqlite4Hwtime(void){
-      unsigned long val;
-      __asm__ __volatile__ ("rdtsc" : "=A" (val));
-      return val;
+  static __inline__ sqlite4_uint64 sqlite4Hwtime(void){
+      unsigned int lo, hi;
+      __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+      return (sqlite4_uint64)hi << 32 | lo;
   }
  
 #elif (defined(__GNUC__) && defined(__ppc__))
 
-  __inline__ sqlite_uint64 sqlite4Hwtime(void){
+  static __inline__ sqlite4_uint64 sqlite4Hwtime(void){
       unsigned long long retval;
       unsigned long junk;
       __asm__ __volatile__ ("\n\
@@ -69,16 +69,12 @@
 
 #else
 
-  #error Need implementation of sqlite4Hwtime() for your platform.
-
   /*
-  ** To compile without implementing sqlite4Hwtime() for your platform,
-  ** you can remove the above #error and use the following
-  ** stub function.  You will lose timing support for many
-  ** of the debugging and testing utilities, but it should at
-  ** least compile and run.
+  ** There is no cycle counter for this platform. Statement profiles
+  ** (see sqlite4_stmt_profile()) still report execution and KV call
+  ** counts, but every cycle count is zero.
   */
-  sqlite_uint64 sqlite4Hwtime(void){ return ((sqlite_uint64)0); }
+  static sqlite4_uint64 sqlite4Hwtime(void){ return ((sqlite4_uint64)0); }
 
 #endif
 
@@ -137,7 +137,14 @@ const char *sqlite4IndexAffinityStr(Vdbe *v, Index *pIdx){
       int i;
       for(i=0; i<p->nColumn; i++){
         int iCol = p->aiColumn[i];
-        zAff[n++] = (iCol<0) ? SQLITE4_AFF_INTEGER : pTab->aCol[iCol].affinity;
+        if( iCol==XN_EXPR ){
+          char aff = sqlite4ExprAffinity(p->aColExpr->a[i].pExpr);
+          zAff[n++] = (aff ? aff : SQLITE4_AFF_NONE);
+        }else if( iCol<0 ){
+          zAff[n++] = SQLITE4_AFF_INTEGER;
+        }else{
+          zAff[n++] = pTab->aCol[iCol].affinity;
+        }
       }
     }
     zAff[n] = 0;
@@ -381,14 +388,15 @@ void sqlite4AutoincrementEnd(Parse *pParse){
 #endif /* SQLITE4_OMIT_AUTOINCREMENT */
 
 
+#ifndef SQLITE4_OMIT_XFER_OPT
 /* Forward declaration */
-/*static FIXME: make static when this function gets used. */ int xferOptimization(
+static void xferOptimization(
   Parse *pParse,        /* Parser context */
   Table *pDest,         /* The table we are inserting into */
   Select *pSelect,      /* A SELECT statement to use as the data source */
-  int onError,          /* How to handle constraint errors */
   int iDbDest           /* The database of pDest */
 );
+#endif
 
 /*
 ** This routine is call to handle SQL of the following forms:
@@ -429,6 +437,7 @@ void sqlite4AutoincrementEnd(Parse *pParse){
 ** template.  This is the 2nd template.
 **
 **         open a write cursor to <table>
+**         if <table> is not empty goto the 3rd or 4th template
 **         open read cursor on <table2>
 **         transfer all records in <table2> over to <table>
 **         close cursors
@@ -438,6 +447,7 @@ void sqlite4AutoincrementEnd(Parse *pParse){
 **           transfer all records from the read to the write cursors
 **           close cursors
 **         end foreach
+**         halt
 **
 ** The 3rd template is for when the second template does not apply
 ** and the SELECT clause does not read from <table> at any time.
@@ -615,6 +625,21 @@ void sqlite4Insert(
   if( pParse->nested==0 ) sqlite4VdbeCountChanges(v);
   sqlite4BeginWriteOperation(pParse, pSelect || pTrigger, iDb);
 
+#ifndef SQLITE4_OMIT_XFER_OPT
+  /* If the statement is of the form
+  **
+  **       INSERT INTO <table1> SELECT * FROM <table2>;
+  **
+  ** and <table1> is empty when the statement runs, then the rows of
+  ** <table2> can be copied across without being decoded. This is the 2nd
+  ** template. It is followed by the code for the 3rd or 4th, which is
+  ** used if <table1> turns out not to be empty.
+  */
+  if( pColumn==0 && pSelect ){
+    xferOptimization(pParse, pTab, pSelect, iDb);
+  }
+#endif /* SQLITE4_OMIT_XFER_OPT */
+
   /* If this is an AUTOINCREMENT table, look up the sequence number in the
   ** sqlite_sequence table and store it in memory cell regAutoinc.
   */
@@ -986,7 +1011,8 @@ insert_cleanup:
 */
 const char *indexColumnName(Index *pIdx, int iCol){
   int iTbl = pIdx->aiColumn[iCol];
-  assert( iTbl>=-1 && iTbl<pIdx->pTable->nCol );
+  assert( iTbl==XN_EXPR || (iTbl>=-1 && iTbl<pIdx->pTable->nCol) );
+  if( iTbl==XN_EXPR ) return "<expr>";
   if( iTbl<0 ){
     assert( pIdx->eIndexType==SQLITE4_INDEX_PRIMARYKEY && pIdx->nColumn==1 );
     return "rowid";
@@ -1285,10 +1311,21 @@ void sqlite4GenerateConstraintChecks(
     int regPk;                    /* PK of conflicting row (for REPLACE) */
     int regKey = aRegIdx[iCur];   /* Write encoded index key for pIdx here */
     int iIdx = baseCur+iCur;      /* Cursor for index pIdx */
+    int iSkip = 0;                /* Jump here if row is not in pIdx */
 
     /* If regKey is 0, pIdx will not be updated. */
     if( regKey==0 ) continue;
 
+    /* If pIdx is a partial index and the new row does not satisfy its
+    ** WHERE clause, no key is required and no UNIQUE constraint applies.
+    ** Leave regKey set to NULL so that sqlite4CompleteInsertion() does 
+    ** not write an entry to the index.  */
+    if( pIdx->pPartIdxWhere ){
+      sqlite4VdbeAddOp2(v, OP_Null, 0, regKey);
+      iSkip = sqlite4VdbeMakeLabel(v);
+      sqlite4PartialIndexSkip(pParse, pIdx, 0, regContent, iSkip);
+    }
+
     /* Create an index key. Primary key indexes consists of just the primary
     ** key values. Other indexes consists of the indexed columns followed by
     ** the primary key values.  */
@@ -1304,8 +1341,7 @@ void sqlite4GenerateConstraintChecks(
       regPk = regTmp + nTmpReg - 1;
 
       for(i=0; i<pIdx->nColumn; i++){
-        int idx = pIdx->aiColumn[i];
-        sqlite4VdbeAddOp2(v, OP_SCopy, regContent+idx, regTmp+i);
+        sqlite4CodeIndexColumn(pParse, pIdx, i, 0, regContent, regTmp+i);
       }
       if( pIdx!=pPk ){
         for(i=0; i<pPk->nColumn; i++){
@@ -1384,6 +1420,7 @@ void sqlite4GenerateConstraintChecks(
     }
 
     sqlite4ReleaseTempRange(pParse, regTmp, nTmpReg);
+    if( iSkip ) sqlite4VdbeResolveLabel(v, iSkip);
   }
   
   if( pbMayReplace ){
@@ -1447,6 +1484,9 @@ void sqlite4CompleteInsertion(
   }else{
     sqlite4VdbeAddOp3(v, OP_MakeRecord, regContent, pTab->nCol, regRec);
     sqlite4TableAffinityStr(v, pTab);
+    if( pTab->tabFlags & TF_RowOffsets ){
+      sqlite4VdbeChangeP5(v, OPFLAG_ROWOFFSETS);
+    }
     sqlite4ExprCacheAffinityChange(pParse, regContent, pTab->nCol);
   }
   regCover = sqlite4GetTempReg(pParse);
@@ -1462,6 +1502,11 @@ void sqlite4CompleteInsertion(
     else if( aRegIdx[i] ){
       int regData = 0;
       int flags = 0;
+      int addrSkip = 0;
+      if( pIdx->pPartIdxWhere ){
+        /* The key register is NULL if the row is not in the partial index */
+        addrSkip = sqlite4VdbeAddOp1(v, OP_IsNull, aRegIdx[i]);
+      }
       if( pIdx->eIndexType==SQLITE4_INDEX_PRIMARYKEY ){
         regData = regRec;
         flags = pik_flags;
@@ -1481,6 +1526,7 @@ void sqlite4CompleteInsertion(
       }
       sqlite4VdbeAddOp3(v, OP_Insert, baseCur+i, regData, aRegIdx[i]);
       sqlite4VdbeChangeP5(v, flags);
+      if( addrSkip ) sqlite4VdbeJumpHere(v, addrSkip);
     }
   }
 }
@@ -1543,3 +1589,279 @@ void sqlite4CloseAllIndexes(
 */
 int sqlite4_xferopt_count;
 #endif /* SQLITE4_TEST */
+
+
+#ifndef SQLITE4_OMIT_XFER_OPT
+/*
+** Check to collation names to see if they are compatible.
+*/
+static int xferCompatibleCollation(const char *z1, const char *z2){
+  if( z1==0 ){
+    return z2==0;
+  }
+  if( z2==0 ){
+    return 0;
+  }
+  return sqlite4_stricmp(z1, z2)==0;
+}
+
+/*
+** Check to see if index pSrc is compatible as a source of data
+** for index pDest in an insert transfer optimization. That is, return
+** true if the two indexes encode their keys and data in exactly the
+** same way, so that the entries of pSrc may be copied into pDest with
+** only the table number at the start of each key changed.
+**
+**    *   The index is over the same set of columns
+**    *   The same DESC and ASC markings occurs on all columns
+**    *   The same onError processing (OE_Abort, OE_Ignore, etc)
+**    *   The same collating sequence on each column
+**    *   The same set of covered columns
+**
+** The PRIMARY KEY of each table is compatible only with the PRIMARY KEY
+** of the other.
+*/
+static int xferCompatibleIndex(Index *pDest, Index *pSrc){
+  int i;
+  assert( pDest && pSrc );
+  assert( pDest->pTable!=pSrc->pTable );
+  if( pDest->nColumn!=pSrc->nColumn || pDest->nCover!=pSrc->nCover ){
+    return 0;   /* Different number of columns */
+  }
+  if( pDest->onError!=pSrc->onError || pDest->fIndex!=pSrc->fIndex ){
+    return 0;   /* Different conflict resolution strategies */
+  }
+  if( (pDest->eIndexType==SQLITE4_INDEX_PRIMARYKEY)
+   != (pSrc->eIndexType==SQLITE4_INDEX_PRIMARYKEY)
+  ){
+    return 0;   /* Only a PRIMARY KEY is compatible with a PRIMARY KEY */
+  }
+  if( pDest->pFts || pSrc->pFts ){
+    return 0;   /* FTS indexes are never compatible */
+  }
+  for(i=0; i<pSrc->nColumn; i++){
+    if( pSrc->aiColumn[i]!=pDest->aiColumn[i] ){
+      return 0;   /* Different columns indexed */
+    }
+    if( pSrc->aiColumn[i]==XN_EXPR && sqlite4ExprCompare(
+          pSrc->aColExpr->a[i].pExpr, pDest->aColExpr->a[i].pExpr, -1)
+    ){
+      return 0;   /* Different expressions indexed */
+    }
+    if( pSrc->aSortOrder[i]!=pDest->aSortOrder[i] ){
+      return 0;   /* Different sort orders */
+    }
+    if( !xferCompatibleCollation(pSrc->azColl[i],pDest->azColl[i]) ){
+      return 0;   /* Different collating sequences */
+    }
+  }
+  for(i=0; i<pSrc->nCover; i++){
+    if( pSrc->aiCover[i]!=pDest->aiCover[i] ){
+      return 0;   /* Different columns covered */
+    }
+  }
+  if( sqlite4ExprCompare(pSrc->pPartIdxWhere, pDest->pPartIdxWhere, -1) ){
+    return 0;   /* Different WHERE clauses (or only one is partial) */
+  }
+
+  /* If no test above fails then the indices must be compatible */
+  return 1;
+}
+
+/*
+** Attempt the transfer optimization on INSERTs of the form
+**
+**     INSERT INTO tab1 SELECT * FROM tab2;
+**
+** The xfer optimization copies the entries of each index of tab2 directly
+** into the corresponding index of tab1. Because the key and data formats
+** of the two tables are the same, neither the table rows nor the index
+** keys need to be decoded or rebuilt - only the table number at the start
+** of each key is changed (see OP_Transfer). The source entries are read
+** in key order, so each index of tab1 is written in key order as well.
+**
+** Each row of tab2 is known to satisfy the PRIMARY KEY and UNIQUE
+** constraints of tab1, as tab2 has the same constraints. But that is not
+** enough to rule out conflicts with rows already in tab1. So the code
+** generated here checks whether or not tab1 is empty first. If it is not,
+** it jumps to the code that follows it, which is generated by the caller
+** to do the INSERT row by row. Otherwise it copies the rows and halts.
+**
+** This routine generates no code if the optimization does not apply.
+** The conditions are the same as for SQLite 3: the SELECT must read
+** every column of a single real table with no WHERE, GROUP BY, ORDER BY,
+** LIMIT or DISTINCT. tab1 must have no triggers or foreign keys, and
+** no CHECK constraints that tab2 does not share. The two tables must
+** have the same columns (with compatible affinities, collations, NOT NULL
+** constraints and default values) and every index of tab1 must have a
+** compatible index on tab2.
+*/
+static void xferOptimization(
+  Parse *pParse,        /* Parser context */
+  Table *pDest,         /* The table we are inserting into */
+  Select *pSelect,      /* A SELECT statement to use as the data source */
+  int iDbDest           /* The database of pDest */
+){
+  ExprList *pEList;                /* The result set of the SELECT */
+  Table *pSrc;                     /* The table in the FROM clause of SELECT */
+  Index *pSrcIdx, *pDestIdx;       /* Source and destination indices */
+  SrcListItem *pItem;              /* An element of pSelect->pSrc */
+  int i;                           /* Loop counter */
+  int iDbSrc;                      /* The database of pSrc */
+  int iSrc, iDest;                 /* Cursors from source and destination */
+  int addr1, addr2;                /* Loop addresses */
+  int emptyDestTest;               /* Address of test for empty pDest */
+  int regScratch;                  /* Scratch register for OP_Transfer */
+  Vdbe *v;                         /* The VDBE we are building */
+  sqlite4 *db = pParse->db;
+
+  if( pParse->pTriggerTab ){
+    return;   /* The OP_Halt would end the whole trigger program */
+  }
+  if( sqlite4TriggerList(pParse, pDest) ){
+    return;   /* tab1 must not have triggers */
+  }
+  if( pDest->tabFlags & TF_Autoincrement ){
+    return;   /* tab1 must not be an AUTOINCREMENT table */
+  }
+  if( IsVirtual(pDest) || IsKvstore(pDest) ){
+    return;   /* tab1 must be an ordinary table */
+  }
+  assert( pSelect );
+  if( pSelect->pSrc->nSrc!=1 ){
+    return;   /* FROM clause must have exactly one term */
+  }
+  if( pSelect->pSrc->a[0].pSelect ){
+    return;   /* FROM clause cannot contain a subquery */
+  }
+  if( pSelect->pWhere ){
+    return;   /* SELECT may not have a WHERE clause */
+  }
+  if( pSelect->pOrderBy ){
+    return;   /* SELECT may not have an ORDER BY clause */
+  }
+  /* Do not need to test for a HAVING clause.  If HAVING is present but
+  ** there is no ORDER BY, we will get an error. */
+  if( pSelect->pGroupBy ){
+    return;   /* SELECT may not have a GROUP BY clause */
+  }
+  if( pSelect->pLimit ){
+    return;   /* SELECT may not have a LIMIT clause */
+  }
+  assert( pSelect->pOffset==0 );  /* Must be so if pLimit==0 */
+  if( pSelect->pPrior ){
+    return;   /* SELECT may not be a compound query */
+  }
+  if( pSelect->selFlags & SF_Distinct ){
+    return;   /* SELECT may not be DISTINCT */
+  }
+  pEList = pSelect->pEList;
+  assert( pEList!=0 );
+  if( pEList->nExpr!=1 ){
+    return;   /* The result set must have exactly one expression */
+  }
+  assert( pEList->a[0].pExpr );
+  if( pEList->a[0].pExpr->op!=TK_ALL ){
+    return;   /* The result set must be the special operator "*" */
+  }
+
+  /* At this point we have established that the statement is of the
+  ** correct syntactic form to participate in this optimization.  Now
+  ** we have to check the semantics.
+  */
+  pItem = pSelect->pSrc->a;
+  pSrc = sqlite4FindTable(db, pItem->zName, pItem->zDatabase);
+  if( pSrc==0 ){
+    return;   /* FROM clause does not contain a real table */
+  }
+  if( pSrc==pDest ){
+    return;   /* tab1 and tab2 may not be the same table */
+  }
+  if( pSrc->pSelect || IsVirtual(pSrc) || IsKvstore(pSrc) ){
+    return;   /* tab2 must be an ordinary table */
+  }
+  if( pDest->nCol!=pSrc->nCol ){
+    return;   /* Number of columns must be the same in tab1 and tab2 */
+  }
+  if( (pDest->tabFlags & TF_RowOffsets)!=(pSrc->tabFlags & TF_RowOffsets) ){
+    return;   /* Rows must use the same record format */
+  }
+  for(i=0; i<pDest->nCol; i++){
+    Column *pDestCol = &pDest->aCol[i];
+    Column *pSrcCol = &pSrc->aCol[i];
+    if( pDestCol->affinity!=pSrcCol->affinity ){
+      return;   /* Affinity must be the same on all columns */
+    }
+    if( !xferCompatibleCollation(pDestCol->zColl, pSrcCol->zColl) ){
+      return;   /* Collating sequence must be the same on all columns */
+    }
+    if( pDestCol->notNull && !pSrcCol->notNull ){
+      return;   /* tab2 must be NOT NULL if tab1 is */
+    }
+    /* A record written before a column was added by ALTER TABLE does
+    ** not contain a value for it. The default value is used instead, so
+    ** the two tables must agree on default values.  */
+    if( (pDestCol->zDflt==0)!=(pSrcCol->zDflt==0) 
+     || (pDestCol->zDflt && strcmp(pDestCol->zDflt, pSrcCol->zDflt)!=0)
+    ){
+      return;   /* Default values must be the same on all columns */
+    }
+  }
+  for(pDestIdx=pDest->pIndex; pDestIdx; pDestIdx=pDestIdx->pNext){
+    for(pSrcIdx=pSrc->pIndex; pSrcIdx; pSrcIdx=pSrcIdx->pNext){
+      if( xferCompatibleIndex(pDestIdx, pSrcIdx) ) break;
+    }
+    if( pSrcIdx==0 ){
+      return;   /* pDestIdx has no corresponding index in pSrc */
+    }
+  }
+#ifndef SQLITE4_OMIT_CHECK
+  if( pDest->pCheck && sqlite4ExprCompare(pSrc->pCheck, pDest->pCheck, -1) ){
+    return;   /* Tables have different CHECK constraints.  Ticket #2252 */
+  }
+#endif
+  if( sqlite4FkRequired(pParse, pDest, 0) ){
+    return;   /* Foreign key processing is required on tab1 */
+  }
+
+#ifdef SQLITE4_TEST
+  sqlite4_xferopt_count++;
+#endif
+  iDbSrc = sqlite4SchemaToIndex(db, pSrc->pSchema);
+  v = sqlite4GetVdbe(pParse);
+  sqlite4CodeVerifySchema(pParse, iDbSrc);
+  iSrc = pParse->nTab++;
+  iDest = pParse->nTab++;
+  regScratch = ++pParse->nMem;
+
+  /* If tab1 is not empty, jump to the code that inserts row by row. */
+  sqlite4OpenPrimaryKey(pParse, iDest, iDbDest, pDest, OP_OpenWrite);
+  addr1 = sqlite4VdbeAddOp1(v, OP_Rewind, iDest);
+  emptyDestTest = sqlite4VdbeAddOp0(v, OP_Goto);
+  sqlite4VdbeJumpHere(v, addr1);
+  sqlite4VdbeAddOp1(v, OP_Close, iDest);
+
+  /* Copy the PRIMARY KEY index (the table rows) first, then each of the
+  ** other indexes. */
+  for(pDestIdx=pDest->pIndex; pDestIdx; pDestIdx=pDestIdx->pNext){
+    for(pSrcIdx=pSrc->pIndex; ALWAYS(pSrcIdx); pSrcIdx=pSrcIdx->pNext){
+      if( xferCompatibleIndex(pDestIdx, pSrcIdx) ) break;
+    }
+    assert( pSrcIdx );
+    sqlite4OpenIndex(pParse, iSrc, iDbSrc, pSrcIdx, OP_OpenRead);
+    sqlite4OpenIndex(pParse, iDest, iDbDest, pDestIdx, OP_OpenWrite);
+    addr1 = sqlite4VdbeAddOp1(v, OP_Rewind, iSrc);
+    addr2 = sqlite4VdbeAddOp3(v, OP_Transfer, iDest, iSrc, regScratch);
+    if( pDestIdx->eIndexType==SQLITE4_INDEX_PRIMARYKEY ){
+      sqlite4VdbeChangeP5(v, OPFLAG_NCHANGE);
+    }
+    sqlite4VdbeAddOp2(v, OP_Next, iSrc, addr2);
+    sqlite4VdbeJumpHere(v, addr1);
+    sqlite4VdbeAddOp1(v, OP_Close, iSrc);
+    sqlite4VdbeAddOp1(v, OP_Close, iDest);
+  }
+  sqlite4VdbeAddOp2(v, OP_Halt, SQLITE4_OK, 0);
+  sqlite4VdbeJumpHere(v, emptyDestTest);
+  sqlite4VdbeAddOp1(v, OP_Close, iDest);
+}
+#endif /* SQLITE4_OMIT_XFER_OPT */
@@ -93,7 +93,13 @@ int sqlite4KVStoreOpen(
   sqlite4_kvfactory xFactory;
 
   if( (flags & SQLITE4_KVOPEN_TEMPORARY)!=0 || zUri==0 || zUri[0]==0 ){
-    zStorageName = "temp";
+    /* Temporary stores that will never need a rollback use the arena
+    ** based ephemeral store. Others use the general in-memory store. */
+    if( (flags & SQLITE4_KVOPEN_NO_TRANSACTIONS)!=0 ){
+      zStorageName = "ephm";
+    }else{
+      zStorageName = "temp";
+    }
   }else{
     zStorageName = sqlite4_uri_parameter(zUri, "kv");
     if( zStorageName==0 ){
@@ -114,6 +120,28 @@ int sqlite4KVStoreOpen(
     return SQLITE4_ERROR;
   }
   rc = xFactory(pEnv, &pNew, zUri, flags);
+  if( pNew ){
+    pNew->aMeta = 0;
+    pNew->nMeta = 0;
+    pNew->bMetaDirty = 0;
+  }
+
+  /* If the "rowcache=N" URI parameter was specified, stack a row cache of
+  ** N entries on top of the new store. */
+  if( rc==SQLITE4_OK && pNew && (flags & SQLITE4_KVOPEN_TEMPORARY)==0 ){
+    const char *zCache = sqlite4_uri_parameter(zUri, "rowcache");
+    int nCache = 0;
+    if( zCache && sqlite4GetInt32(zCache, &nCache) && nCache>0 ){
+      KVStore *pCache;
+      rc = sqlite4KVStoreOpenCache(pEnv, &pCache, pNew, nCache);
+      if( rc==SQLITE4_OK ){
+        pNew = pCache;
+      }else{
+        pNew->pStoreVfunc->xClose(pNew);
+        pNew = 0;
+      }
+    }
+  }
   *ppKVStore = pNew;
   if( pNew ){
     sqlite4_randomness(pEnv, sizeof(pNew->kvId), &pNew->kvId);
@@ -136,6 +164,128 @@ static void binToHex(char *zOut, int mxOut, const KVByteArray *a, KVSize n){
   zOut[i*2] = 0;
 }
 
+/*
+** Key for the meta-data
+*/
+static const KVByteArray metadataKey[] = { 0x00, 0x00 };
+
+/*
+** The meta-array is cached in the KVStore.aMeta[] array.  The cached copy
+** always holds at least as many entries as are stored in the database.
+** If KVStore.bMetaDirty is set, then aMeta[] holds changes that have not
+** yet been written to the database.  They are written in a single xReplace
+** when the write transaction commits, or before a nested transaction is
+** opened.
+**
+** The cache is discarded when a write transaction is rolled back and when
+** a new read transaction is opened, unless the storage engine reports,
+** through the SQLITE4_KVCTRL_CHANGE_COUNTER control, that no other
+** connection can have modified the database since the cache was loaded
+** or since this connection last committed a write transaction.
+*/
+
+/*
+** Discard the cached copy of the meta-array, if any.
+*/
+static void kvMetaDiscard(KVStore *p){
+  sqlite4_free(p->pEnv, p->aMeta);
+  p->aMeta = 0;
+  p->nMeta = 0;
+  p->bMetaDirty = 0;
+}
+
+/*
+** Query the engine change counter.  Return SQLITE4_OK and set *piChng
+** if the engine supports the SQLITE4_KVCTRL_CHANGE_COUNTER control, or
+** some other value otherwise.
+*/
+int sqlite4KVStoreChangeCounter(KVStore *p, unsigned int *piChng){
+  if( p->pStoreVfunc->xControl==0 ) return SQLITE4_NOTFOUND;
+  return p->pStoreVfunc->xControl(p, SQLITE4_KVCTRL_CHANGE_COUNTER, piChng);
+}
+
+/*
+** Make sure that p->aMeta[] holds at least nMeta entries, loading the
+** meta-array from the database if it is not already cached.
+*/
+static int kvMetaLoad(KVStore *p, int nMeta){
+  int rc = SQLITE4_OK;
+  int nNew = nMeta;
+  KVCursor *pCur = 0;
+  const KVByteArray *aData = 0;
+  KVSize nData = 0;
+  unsigned int *aNew;
+  int i;
+
+  if( p->aMeta && p->nMeta>=nMeta ) return SQLITE4_OK;
+
+  if( p->aMeta==0 ){
+    rc = sqlite4KVStoreOpenCursor(p, &pCur);
+    if( rc==SQLITE4_OK ){
+      rc = sqlite4KVCursorSeek(pCur, metadataKey, sizeof(metadataKey), 0);
+      if( rc==SQLITE4_NOTFOUND ){
+        rc = SQLITE4_OK;
+      }else if( rc==SQLITE4_OK ){
+        rc = sqlite4KVCursorData(pCur, 0, -1, &aData, &nData);
+      }
+    }
+    if( rc==SQLITE4_OK && nData/4>nNew ) nNew = nData/4;
+    p->iMetaChng = 0;
+    p->bMetaChng = (sqlite4KVStoreChangeCounter(p, &p->iMetaChng)==SQLITE4_OK);
+  }
+
+  if( rc==SQLITE4_OK ){
+    aNew = (unsigned int*)sqlite4_realloc(p->pEnv, p->aMeta,
+                                          (nNew+1)*sizeof(unsigned int));
+    if( aNew==0 ){
+      rc = SQLITE4_NOMEM;
+    }else{
+      for(i=p->nMeta; i<nNew; i++){
+        int j = i*4;
+        if( j+3<nData ){
+          aNew[i] = (aData[j]<<24) | (aData[j+1]<<16)
+                  | (aData[j+2]<<8) | aData[j+3];
+        }else{
+          aNew[i] = 0;
+        }
+      }
+      p->aMeta = aNew;
+      p->nMeta = nNew;
+    }
+  }
+
+  sqlite4KVCursorClose(pCur);
+  return rc;
+}
+
+/*
+** Write the cached meta-array to the database if it has been modified.
+*/
+static int kvMetaFlush(KVStore *p){
+  int rc = SQLITE4_OK;
+  if( p->bMetaDirty ){
+    KVSize nNew = sizeof(u32) * p->nMeta;
+    KVByteArray *aNew = (KVByteArray*)sqlite4_malloc(p->pEnv, nNew);
+    if( aNew==0 ){
+      rc = SQLITE4_NOMEM;
+    }else{
+      int i;
+      for(i=0; i<p->nMeta; i++){
+        u32 iVal = p->aMeta[i];
+        aNew[i*4+0] = (iVal>>24)&0xff;
+        aNew[i*4+1] = (iVal>>16)&0xff;
+        aNew[i*4+2] = (iVal>>8) &0xff;
+        aNew[i*4+3] = (iVal>>0) &0xff;
+      }
+      rc = sqlite4KVStoreReplace(p, metadataKey, sizeof(metadataKey),
+                                 aNew, nNew);
+      sqlite4_free(p->pEnv, aNew);
+      if( rc==SQLITE4_OK ) p->bMetaDirty = 0;
+    }
+  }
+  return rc;
+}
+
 /*
 ** The following wrapper functions invoke the underlying methods of
 ** the storage object and add optional tracing.
@@ -163,6 +313,7 @@ int sqlite4KVStoreOpenCursor(KVStore *p, KVCursor **ppKVCursor){
   if( pCur ){
     sqlite4_randomness(pCur->pEnv, sizeof(pCur->curId), &pCur->curId);
     pCur->fTrace = p->fTrace;
+    pCur->aProfile = 0;
     pCur->pStore = p;
   }
   kvTrace(p, "xOpenCursor(%d,%d) -> %s",
@@ -177,6 +328,7 @@ int sqlite4KVCursorSeek(
   int rc;
   assert( dir==0 || dir==(+1) || dir==(-1) || dir==(-2) );  
   rc = p->pStoreVfunc->xSeek(p,pKey,nKey,dir);
+  if( p->aProfile ) p->aProfile[KVPROFILE_SEEK]++;
   if( p->fTrace ){
     char zKey[52];
     binToHex(zKey, sizeof(zKey), pKey, nKey);
@@ -188,12 +340,14 @@ int sqlite4KVCursorSeek(
 int sqlite4KVCursorNext(KVCursor *p){
   int rc;
   rc = p->pStoreVfunc->xNext(p);
+  if( p->aProfile ) p->aProfile[KVPROFILE_STEP]++;
   kvTrace(p->pStore, "xNext(%d) -> %s", p->curId, kvErrName(rc));
   return rc;
 }
 int sqlite4KVCursorPrev(KVCursor *p){
   int rc;
   rc = p->pStoreVfunc->xPrev(p);
+  if( p->aProfile ) p->aProfile[KVPROFILE_STEP]++;
   kvTrace(p->pStore, "xPrev(%d) -> %s", p->curId, kvErrName(rc));
   return rc;
 }
@@ -212,6 +366,7 @@ int sqlite4KVCursorReset(KVCursor *p){
 int sqlite4KVCursorKey(KVCursor *p, const KVByteArray **ppKey, KVSize *pnKey){
   int rc;
   rc = p->pStoreVfunc->xKey(p, ppKey, pnKey);
+  if( p->aProfile && rc==SQLITE4_OK ) p->aProfile[KVPROFILE_BYTE] += *pnKey;
   if( p->fTrace ){
     if( rc==SQLITE4_OK ){
       char zKey[52];
@@ -232,6 +387,7 @@ int sqlite4KVCursorData(
 ){
   int rc;
   rc = p->pStoreVfunc->xData(p, ofst, n, ppData, pnData);
+  if( p->aProfile && rc==SQLITE4_OK ) p->aProfile[KVPROFILE_BYTE] += *pnData;
   if( p->fTrace ){
     if( rc==SQLITE4_OK ){
       char zData[52];
@@ -256,9 +412,26 @@ int sqlite4KVCursorClose(KVCursor *p){
   return rc;
 }
 int sqlite4KVStoreBegin(KVStore *p, int iLevel){
-  int rc;
+  int iOld = p->iTransLevel;
+  int rc = SQLITE4_OK;
+  if( p->aMeta && iOld>0 && iLevel>2 ){
+    rc = kvMetaFlush(p);
+    if( rc!=SQLITE4_OK ) return rc;
+  }
   rc = p->pStoreVfunc->xBegin(p, iLevel);
   kvTrace(p, "xBegin(%d,%d) -> %s", p->kvId, iLevel, kvErrName(rc));
+
+  /* The change counter is read once the read transaction is open, so
+  ** that it describes the snapshot the new transaction will read. */
+  if( p->aMeta && iOld==0 ){
+    unsigned int iChng = 0;
+    if( rc!=SQLITE4_OK || p->bMetaChng==0
+     || sqlite4KVStoreChangeCounter(p, &iChng)!=SQLITE4_OK
+     || iChng!=p->iMetaChng
+    ){
+      kvMetaDiscard(p);
+    }
+  }
   assert( p->iTransLevel==iLevel || rc!=SQLITE4_OK );
   return rc;
 }
@@ -267,22 +440,38 @@ int sqlite4KVStoreCommitPhaseOne(KVStore *p, int iLevel){
   assert( iLevel>=0 );
   assert( iLevel<=p->iTransLevel );
   if( p->iTransLevel==iLevel ) return SQLITE4_OK;
+  rc = kvMetaFlush(p);
+  if( rc!=SQLITE4_OK ) return rc;
   if( p->pStoreVfunc->xCommitPhaseOne ){
     rc = p->pStoreVfunc->xCommitPhaseOne(p, iLevel);
-  }else{
-    rc = SQLITE4_OK;
   }
   kvTrace(p, "xCommitPhaseOne(%d,%d) -> %s", p->kvId, iLevel, kvErrName(rc));
   assert( p->iTransLevel>iLevel );
   return rc;
 }
 int sqlite4KVStoreCommitPhaseTwo(KVStore *p, int iLevel){
+  unsigned int iChng = 0;
+  int bChng = 0;
+  int bWrite;
   int rc;
   assert( iLevel>=0 );
   assert( iLevel<=p->iTransLevel );
   if( p->iTransLevel==iLevel ) return SQLITE4_OK;
+
+  /* The cached meta-array already holds this connection's own changes.
+  ** If a write transaction is being committed, record the change counter
+  ** it is committed with, so that the next transaction does not have to
+  ** reload the meta-array unless another connection writes meanwhile. */
+  bWrite = (p->aMeta && iLevel<2 && p->iTransLevel>=2);
+  if( bWrite ){
+    bChng = (sqlite4KVStoreChangeCounter(p, &iChng)==SQLITE4_OK);
+  }
   rc = p->pStoreVfunc->xCommitPhaseTwo(p, iLevel);
   kvTrace(p, "xCommitPhaseTwo(%d,%d) -> %s", p->kvId, iLevel, kvErrName(rc));
+  if( rc==SQLITE4_OK && bWrite ){
+    p->iMetaChng = iChng;
+    p->bMetaChng = bChng;
+  }
   assert( p->iTransLevel==iLevel || rc!=SQLITE4_OK );
   return rc;
 }
@@ -296,6 +485,8 @@ int sqlite4KVStoreRollback(KVStore *p, int iLevel){
   int rc;
   assert( iLevel>=0 );
   assert( iLevel<=p->iTransLevel );
+  /* Closing a read transaction does not invalidate the meta-array */
+  if( p->iTransLevel>=2 ) kvMetaDiscard(p);
   rc = p->pStoreVfunc->xRollback(p, iLevel);
   kvTrace(p, "xRollback(%d,%d) -> %s", p->kvId, iLevel, kvErrName(rc));
   assert( p->iTransLevel==iLevel || rc!=SQLITE4_OK );
@@ -306,6 +497,7 @@ int sqlite4KVStoreRevert(KVStore *p, int iLevel){
   assert( iLevel>0 );
   assert( iLevel<=p->iTransLevel );
   if( p->pStoreVfunc->xRevert ){
+    kvMetaDiscard(p);
     rc = p->pStoreVfunc->xRevert(p, iLevel);
     kvTrace(p, "xRevert(%d,%d) -> %s", p->kvId, iLevel, kvErrName(rc));
   }else{
@@ -321,55 +513,20 @@ int sqlite4KVStoreClose(KVStore *p){
   int rc;
   if( p ){
     kvTrace(p, "xClose(%d)", p->kvId);
+    kvMetaDiscard(p);
     rc = p->pStoreVfunc->xClose(p);
   }
   return rc;
 }
 
-/*
-** Key for the meta-data
-*/
-static const KVByteArray metadataKey[] = { 0x00, 0x00 };
-
-static void writeMetaArray(KVByteArray *aMeta, int iElem, u32 iVal){
-  int i = sizeof(u32) * iElem;
-  aMeta[i+0] = (iVal>>24)&0xff;
-  aMeta[i+1] = (iVal>>16)&0xff;
-  aMeta[i+2] = (iVal>>8) &0xff;
-  aMeta[i+3] = (iVal>>0) &0xff;
-}
-
 /*
 ** Read nMeta unsigned 32-bit integers of metadata beginning at iStart.
 */
 int sqlite4KVStoreGetMeta(KVStore *p, int iStart, int nMeta, unsigned int *a){
-  KVCursor *pCur;
   int rc;
-  int i, j;
-  KVSize nData;
-  const KVByteArray *aData;
-
-  rc = sqlite4KVStoreOpenCursor(p, &pCur);
+  rc = kvMetaLoad(p, iStart+nMeta);
   if( rc==SQLITE4_OK ){
-    rc = sqlite4KVCursorSeek(pCur, metadataKey, sizeof(metadataKey), 0);
-    if( rc==SQLITE4_NOTFOUND ){
-      rc = SQLITE4_OK;
-      nData = 0;
-    }else if( rc==SQLITE4_OK ){
-      rc = sqlite4KVCursorData(pCur, 0, -1, &aData, &nData);
-    }
-    if( rc==SQLITE4_OK ){
-      i = 0;
-      j = iStart*4;
-      while( i<nMeta && j+3<nData ){
-        a[i] = (aData[j]<<24) | (aData[j+1]<<16)
-                     | (aData[j+2]<<8) | aData[j+3];
-        i++;
-        j += 4;
-      }
-      while( i<nMeta ) a[i++] = 0;
-    }
-    sqlite4KVCursorClose(pCur);
+    memcpy(a, &p->aMeta[iStart], nMeta*sizeof(unsigned int));
   }
   return rc;
 }
@@ -393,6 +550,10 @@ int sqlite4KVStoreGetSchema(KVStore *p, unsigned int *piVal){
 
 /*
 ** Write nMeta unsigned 32-bit integers beginning with iStart.
+**
+** The new values are written to the cached meta-array only.  They are
+** written to the database when the current write transaction commits,
+** or immediately if there is no write transaction open.
 */
 int sqlite4KVStorePutMeta(
   sqlite4 *db,            /* Database connection.  Needed to malloc */
@@ -401,47 +562,16 @@ int sqlite4KVStorePutMeta(
   int nMeta,              /* number of 32-bit integers to be written */
   unsigned int *a         /* The integers to write */
 ){
-  KVCursor *pCur;
   int rc;
 
-
-  rc = sqlite4KVStoreOpenCursor(p, &pCur);
+  UNUSED_PARAMETER(db);
+  rc = kvMetaLoad(p, iStart+nMeta);
   if( rc==SQLITE4_OK ){
-    const KVByteArray *aData;     /* Original database meta-array value */
-    KVSize nData;                 /* Size of aData[] in bytes */
-    KVByteArray *aNew;            /* New database meta-array value */
-    KVSize nNew;                  /* Size of aNew[] in bytes */
-
-    /* Read the current meta-array value from the database */
-    rc = sqlite4KVCursorSeek(pCur, metadataKey, sizeof(metadataKey), 0);
-    if( rc==SQLITE4_OK ){
-      rc = sqlite4KVCursorData(pCur, 0, -1, &aData, &nData);
-    }else if( rc==SQLITE4_NOTFOUND ){
-      nData = 0;
-      aData = 0;
-      rc = SQLITE4_OK;
-    }
-
-    /* Encode and write the new meta-array value to the database */
-    if( rc==SQLITE4_OK ){
-      nNew = sizeof(a[0]) * (iStart+nMeta);
-      if( nNew<nData ) nNew = nData;
-      aNew = sqlite4DbMallocRaw(db, nNew);
-      if( aNew==0 ){
-        rc = SQLITE4_NOMEM;
-      }else{
-        int i;
-        memcpy(aNew, aData, nData);
-        for(i=iStart; i<iStart+nMeta; i++){
-          writeMetaArray(aNew, i, a[i]);
-        }
-        rc = sqlite4KVStoreReplace(p, metadataKey, sizeof(metadataKey),
-                                   aNew, nNew);
-        sqlite4DbFree(db, aNew);
-      }
+    memcpy(&p->aMeta[iStart], a, nMeta*sizeof(unsigned int));
+    p->bMetaDirty = 1;
+    if( p->iTransLevel<2 ){
+      rc = kvMetaFlush(p);
     }
-
-    sqlite4KVCursorClose(pCur);
   }
   return rc;
 }
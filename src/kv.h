@@ -151,6 +151,15 @@
 ** of the same name is not executed.
 */
 
+/*
+** Indexes into the array of call counters that a KV cursor updates if its
+** sqlite4_kvcursor.aProfile pointer is not NULL.
+*/
+#define KVPROFILE_SEEK  0         /* Number of xSeek calls */
+#define KVPROFILE_STEP  1         /* Number of xNext and xPrev calls */
+#define KVPROFILE_BYTE  2         /* Bytes returned by xKey and xData */
+#define KVPROFILE_N     3         /* Size of the array */
+
 /* Typedefs of datatypes */
 typedef struct sqlite4_kvstore KVStore;
 typedef struct sqlite4_kv_methods KVStoreMethods;
@@ -161,7 +170,9 @@ typedef sqlite4_kvsize KVSize;
 int sqlite4OpenBtree(sqlite4_env*, KVStore**, const char *, unsigned);
 int sqlite4KVStoreOpenLdb(sqlite4_env*, KVStore**, const char *, unsigned);
 int sqlite4KVStoreOpenMem(sqlite4_env*, KVStore**, const char *, unsigned);
+int sqlite4KVStoreOpenEphemeral(sqlite4_env*, KVStore**, const char*, unsigned);
 int sqlite4KVStoreOpenLsm(sqlite4_env*, KVStore**, const char *, unsigned);
+int sqlite4KVStoreOpenCache(sqlite4_env*, KVStore**, KVStore*, int);
 int sqlite4KVStoreOpen(
   sqlite4*,
   const char *zLabel, 
@@ -203,6 +214,7 @@ int sqlite4KVStoreClose(KVStore *p);
 
 int sqlite4KVStoreGetMeta(KVStore *p, int, int, unsigned int*);
 int sqlite4KVStorePutMeta(sqlite4*, KVStore *p, int, int, unsigned int*);
+int sqlite4KVStoreChangeCounter(KVStore *p, unsigned int*);
 
 int sqlite4KVStorePutSchema(KVStore *p, unsigned int iVal);
 int sqlite4KVStoreGetSchema(KVStore *p, unsigned int *piVal);
@@ -239,6 +239,11 @@ static int btClose(KVStore *pKVStore){
 
 static int btControl(KVStore *pKVStore, int op, void *pArg){
   KVBt *p = (KVBt *)pKVStore;
+  if( op==SQLITE4_KVCTRL_CHANGE_COUNTER ){
+    /* The b-tree engine does not maintain a change counter, so callers
+    ** must assume that the database may have changed. */
+    return SQLITE4_NOTFOUND;
+  }
   return sqlite4BtControl(p->pDb, op, pArg);
 }
 
@@ -0,0 +1,737 @@
+/*
+** 2016 March 2
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** A read-through row cache that can be stacked on top of any key/value
+** storage engine that presents the interface defined by kv.h.
+**
+** The cache remembers the exact key and value of recent point lookups
+** (xSeek calls with dir==0) in a sharded LRU hash table.  A later point
+** lookup of the same key is answered from the cache without visiting
+** the underlying store at all.  Range seeks, xNext and xPrev are passed
+** straight through.
+**
+** Entries are invalidated:
+**
+**   *  Individually, when the same connection writes or deletes the
+**      key using xReplace or xDelete.
+**
+**   *  All at once, when a transaction that wrote to the store is
+**      rolled back.
+**
+**   *  All at once, when a read transaction is opened and the database
+**      may have been modified by some other connection, cached or not,
+**      in this process or another, since the cache was last validated.
+**      This is detected using the change counter reported by the
+**      underlying store (SQLITE4_KVCTRL_CHANGE_COUNTER).  If the store
+**      does not support a change counter, the cache is discarded at the
+**      start of every read transaction.
+**
+** The cache is enabled for a database by adding the "rowcache=N" URI
+** parameter to the database name, where N is the maximum number of
+** entries held by the cache.
+*/
+#include "sqliteInt.h"
+
+/*
+** Number of independent LRU shards.  Must be a power of two.
+*/
+#define KVCACHE_NSHARD 8
+
+/* Forward declarations of objects */
+typedef struct KVCache KVCache;
+typedef struct KVCacheCsr KVCacheCsr;
+typedef struct KVCacheEntry KVCacheEntry;
+typedef struct KVCacheShard KVCacheShard;
+
+/*
+** One cached key/value pair.  The key is stored in aKey[0..nKey-1] and
+** the value immediately follows it.
+*/
+struct KVCacheEntry {
+  KVCacheEntry *pHashNext;        /* Next entry in the same hash bucket */
+  KVCacheEntry *pLruPrev;         /* Next more recently used entry */
+  KVCacheEntry *pLruNext;         /* Next less recently used entry */
+  unsigned int iHash;             /* Hash of aKey[] */
+  KVSize nKey;                    /* Size of the key in bytes */
+  KVSize nData;                   /* Size of the value in bytes */
+  KVByteArray aKey[1];            /* Key followed by value */
+};
+
+/*
+** A single shard of the cache.  Each shard is a hash table with its own
+** LRU list and its own share of the total entry limit.
+*/
+struct KVCacheShard {
+  int nEntry;                     /* Number of entries in this shard */
+  int nHash;                      /* Number of slots in apHash[] */
+  KVCacheEntry **apHash;          /* Hash table of entries */
+  KVCacheEntry *pLruFirst;        /* Most recently used entry */
+  KVCacheEntry *pLruLast;         /* Least recently used entry */
+};
+
+/*
+** An instance of an open connection to a cached store.  A subclass
+** of KVStore.
+*/
+struct KVCache {
+  KVStore base;                   /* Base class, must be first */
+  KVStore *pReal;                 /* The underlying storage engine */
+  unsigned int iChng;             /* Change counter cache is valid for */
+  int bChng;                      /* True if iChng is valid */
+  int bDirty;                     /* True if written since last commit */
+  int nHit;                       /* Point lookups answered from the cache */
+  int nMiss;                      /* Point lookups passed to pReal */
+  int mxEntry;                    /* Maximum entries in each shard */
+  KVCacheShard aShard[KVCACHE_NSHARD];
+};
+
+/*
+** An instance of an open cursor on a cached store.  A subclass of
+** KVCursor.
+**
+** If bCached is true, the cursor is pointing to an entry that was found
+** in the cache.  A copy of that entry's key and value are stored in
+** aBuf[].  In that case the position of pReal is undefined.
+*/
+struct KVCacheCsr {
+  KVCursor base;                  /* Base class. Must be first */
+  KVCursor *pReal;                /* Cursor on the underlying store */
+  int bCached;                    /* True if positioned on a cache hit */
+  KVSize nKey;                    /* Size of key in aBuf[] */
+  KVSize nData;                   /* Size of value following key in aBuf[] */
+  int nAlloc;                     /* Allocated size of aBuf[] */
+  KVByteArray *aBuf;              /* Copy of the cached key and value */
+};
+
+/*
+** Compute a hash of key aKey[0..nKey-1].
+*/
+static unsigned int kvcacheHash(const KVByteArray *aKey, KVSize nKey){
+  unsigned int h = 0;
+  KVSize i;
+  for(i=0; i<nKey; i++){
+    h = (h<<3) ^ (h>>29) ^ aKey[i];
+  }
+  return h;
+}
+
+/*
+** Return the shard that key hash iHash belongs to.
+*/
+static KVCacheShard *kvcacheShard(KVCache *p, unsigned int iHash){
+  return &p->aShard[iHash & (KVCACHE_NSHARD-1)];
+}
+
+/*
+** Return a pointer to the slot in the hash table of pShard that contains
+** or would contain the entry for aKey[0..nKey-1].
+*/
+static KVCacheEntry **kvcacheFindSlot(
+  KVCacheShard *pShard,
+  unsigned int iHash,
+  const KVByteArray *aKey,
+  KVSize nKey
+){
+  KVCacheEntry **pp;
+  if( pShard->nHash==0 ) return 0;
+  pp = &pShard->apHash[(iHash/KVCACHE_NSHARD) % pShard->nHash];
+  while( *pp ){
+    KVCacheEntry *pEntry = *pp;
+    if( pEntry->iHash==iHash && pEntry->nKey==nKey
+     && memcmp(pEntry->aKey, aKey, nKey)==0
+    ){
+      break;
+    }
+    pp = &pEntry->pHashNext;
+  }
+  return pp;
+}
+
+/*
+** Unlink entry pEntry from the LRU list of pShard.
+*/
+static void kvcacheLruRemove(KVCacheShard *pShard, KVCacheEntry *pEntry){
+  if( pEntry->pLruPrev ){
+    pEntry->pLruPrev->pLruNext = pEntry->pLruNext;
+  }else{
+    pShard->pLruFirst = pEntry->pLruNext;
+  }
+  if( pEntry->pLruNext ){
+    pEntry->pLruNext->pLruPrev = pEntry->pLruPrev;
+  }else{
+    pShard->pLruLast = pEntry->pLruPrev;
+  }
+}
+
+/*
+** Link entry pEntry in as the most recently used entry of pShard.
+*/
+static void kvcacheLruPush(KVCacheShard *pShard, KVCacheEntry *pEntry){
+  pEntry->pLruPrev = 0;
+  pEntry->pLruNext = pShard->pLruFirst;
+  if( pShard->pLruFirst ){
+    pShard->pLruFirst->pLruPrev = pEntry;
+  }else{
+    pShard->pLruLast = pEntry;
+  }
+  pShard->pLruFirst = pEntry;
+}
+
+/*
+** Remove the entry for key aKey[0..nKey-1] from the cache, if there
+** is one.
+*/
+static void kvcacheRemove(KVCache *p, const KVByteArray *aKey, KVSize nKey){
+  unsigned int iHash = kvcacheHash(aKey, nKey);
+  KVCacheShard *pShard = kvcacheShard(p, iHash);
+  KVCacheEntry **pp = kvcacheFindSlot(pShard, iHash, aKey, nKey);
+  if( pp && *pp ){
+    KVCacheEntry *pEntry = *pp;
+    *pp = pEntry->pHashNext;
+    kvcacheLruRemove(pShard, pEntry);
+    pShard->nEntry--;
+    sqlite4_free(p->base.pEnv, pEntry);
+  }
+}
+
+/*
+** Remove all entries from the cache.
+*/
+static void kvcacheClear(KVCache *p){
+  int i;
+  for(i=0; i<KVCACHE_NSHARD; i++){
+    KVCacheShard *pShard = &p->aShard[i];
+    KVCacheEntry *pEntry;
+    KVCacheEntry *pNext;
+    for(pEntry=pShard->pLruFirst; pEntry; pEntry=pNext){
+      pNext = pEntry->pLruNext;
+      sqlite4_free(p->base.pEnv, pEntry);
+    }
+    if( pShard->nHash ){
+      memset(pShard->apHash, 0, pShard->nHash*sizeof(KVCacheEntry*));
+    }
+    pShard->nEntry = 0;
+    pShard->pLruFirst = 0;
+    pShard->pLruLast = 0;
+  }
+}
+
+/*
+** Add a copy of key aKey[0..nKey-1] and value aData[0..nData-1] to the
+** cache, evicting the least recently used entry of the shard if it is
+** full.  The caller has already checked that the key is not present.
+** Failure to allocate memory is not an error - the entry is simply
+** not cached.
+*/
+static void kvcacheInsert(
+  KVCache *p,
+  const KVByteArray *aKey, KVSize nKey,
+  const KVByteArray *aData, KVSize nData
+){
+  sqlite4_env *pEnv = p->base.pEnv;
+  unsigned int iHash = kvcacheHash(aKey, nKey);
+  KVCacheShard *pShard = kvcacheShard(p, iHash);
+  KVCacheEntry **pp;
+  KVCacheEntry *pEntry;
+
+  if( pShard->nHash==0 ){
+    int nByte = p->mxEntry * sizeof(KVCacheEntry*);
+    pShard->apHash = (KVCacheEntry**)sqlite4_malloc(pEnv, nByte);
+    if( pShard->apHash==0 ) return;
+    memset(pShard->apHash, 0, nByte);
+    pShard->nHash = p->mxEntry;
+  }
+
+  if( pShard->nEntry>=p->mxEntry ){
+    KVCacheEntry *pVictim = pShard->pLruLast;
+    pp = kvcacheFindSlot(pShard, pVictim->iHash, pVictim->aKey, pVictim->nKey);
+    assert( *pp==pVictim );
+    *pp = pVictim->pHashNext;
+    kvcacheLruRemove(pShard, pVictim);
+    pShard->nEntry--;
+    sqlite4_free(pEnv, pVictim);
+  }
+
+  pEntry = (KVCacheEntry*)sqlite4_malloc(pEnv, sizeof(KVCacheEntry)+nKey+nData);
+  if( pEntry==0 ) return;
+  pEntry->iHash = iHash;
+  pEntry->nKey = nKey;
+  pEntry->nData = nData;
+  memcpy(pEntry->aKey, aKey, nKey);
+  if( nData ) memcpy(&pEntry->aKey[nKey], aData, nData);
+
+  pp = kvcacheFindSlot(pShard, iHash, aKey, nKey);
+  assert( *pp==0 );
+  pEntry->pHashNext = 0;
+  *pp = pEntry;
+  kvcacheLruPush(pShard, pEntry);
+  pShard->nEntry++;
+}
+
+/*
+** Look up key aKey[0..nKey-1] in the cache.  Return the entry if it is
+** found, or NULL otherwise.  A successful lookup makes the entry the
+** most recently used entry of its shard.
+*/
+static KVCacheEntry *kvcacheLookup(
+  KVCache *p,
+  const KVByteArray *aKey, KVSize nKey
+){
+  unsigned int iHash = kvcacheHash(aKey, nKey);
+  KVCacheShard *pShard = kvcacheShard(p, iHash);
+  KVCacheEntry **pp = kvcacheFindSlot(pShard, iHash, aKey, nKey);
+  KVCacheEntry *pEntry = pp ? *pp : 0;
+  if( pEntry && pShard->pLruFirst!=pEntry ){
+    kvcacheLruRemove(pShard, pEntry);
+    kvcacheLruPush(pShard, pEntry);
+  }
+  return pEntry;
+}
+
+/*
+** Called just after a read transaction has been opened on the underlying
+** store.  Discard the entire cache unless the store's change counter
+** shows that the database has not been modified since the cache was
+** last validated.
+*/
+static void kvcacheValidate(KVCache *p){
+  unsigned int iChng = 0;
+  int rc;
+  rc = sqlite4KVStoreChangeCounter(p->pReal, &iChng);
+  if( rc!=SQLITE4_OK || p->bChng==0 || iChng!=p->iChng ){
+    kvcacheClear(p);
+  }
+  p->bChng = (rc==SQLITE4_OK);
+  p->iChng = iChng;
+}
+
+/*
+** Store the key and value that cursor pReal currently points to in the
+** cache.
+*/
+static int kvcacheFill(KVCache *p, KVCursor *pReal){
+  const KVByteArray *aKey;
+  const KVByteArray *aData;
+  KVSize nKey;
+  KVSize nData;
+  int rc;
+
+  rc = sqlite4KVCursorKey(pReal, &aKey, &nKey);
+  if( rc==SQLITE4_OK ){
+    rc = sqlite4KVCursorData(pReal, 0, -1, &aData, &nData);
+  }
+  if( rc==SQLITE4_OK ){
+    kvcacheInsert(p, aKey, nKey, aData, nData);
+  }
+  return rc;
+}
+
+/*
+** If the cursor is currently positioned on a cache hit, move the
+** underlying cursor to the same entry.  The dir argument is passed
+** to xSeek.
+*/
+static int kvcacheRestore(KVCacheCsr *pCsr, int dir){
+  int rc = SQLITE4_OK;
+  if( pCsr->bCached ){
+    pCsr->bCached = 0;
+    rc = sqlite4KVCursorSeek(pCsr->pReal, pCsr->aBuf, pCsr->nKey, dir);
+  }
+  return rc;
+}
+
+/*
+** Begin a transaction or subtransaction.
+*/
+static int kvcacheBegin(KVStore *pKVStore, int iLevel){
+  KVCache *p = (KVCache*)pKVStore;
+  int iOld = p->pReal->iTransLevel;
+  int rc;
+  rc = sqlite4KVStoreBegin(p->pReal, iLevel);
+  p->base.iTransLevel = p->pReal->iTransLevel;
+  if( rc==SQLITE4_OK && iOld==0 ){
+    kvcacheValidate(p);
+  }
+  return rc;
+}
+
+/*
+** Phase one of a two-phase commit.
+*/
+static int kvcacheCommitPhaseOne(KVStore *pKVStore, int iLevel){
+  KVCache *p = (KVCache*)pKVStore;
+  int rc;
+  rc = sqlite4KVStoreCommitPhaseOne(p->pReal, iLevel);
+  p->base.iTransLevel = p->pReal->iTransLevel;
+  return rc;
+}
+
+/*
+** Phase two of a two-phase commit.  The cache already reflects this
+** connection's own writes, so the change counter value that the write
+** transaction is committed with is recorded before committing.  That
+** way the next read transaction only discards the cache if some other
+** connection has written to the database since.
+*/
+static int kvcacheCommitPhaseTwo(KVStore *pKVStore, int iLevel){
+  KVCache *p = (KVCache*)pKVStore;
+  unsigned int iChng = 0;
+  int bChng = 0;
+  int rc;
+  if( iLevel<2 && p->bDirty ){
+    bChng = (sqlite4KVStoreChangeCounter(p->pReal, &iChng)==SQLITE4_OK);
+  }
+  rc = sqlite4KVStoreCommitPhaseTwo(p->pReal, iLevel);
+  p->base.iTransLevel = p->pReal->iTransLevel;
+  if( rc==SQLITE4_OK && iLevel<2 && p->bDirty ){
+    p->bChng = bChng;
+    p->iChng = iChng;
+    p->bDirty = 0;
+  }
+  return rc;
+}
+
+/*
+** Rollback a transaction or subtransaction.  Values read within the
+** transaction being rolled back may have been cached, so if anything
+** was written the entire cache is discarded.
+*/
+static int kvcacheRollback(KVStore *pKVStore, int iLevel){
+  KVCache *p = (KVCache*)pKVStore;
+  int rc;
+  rc = sqlite4KVStoreRollback(p->pReal, iLevel);
+  p->base.iTransLevel = p->pReal->iTransLevel;
+  if( p->bDirty ){
+    kvcacheClear(p);
+    if( iLevel<2 ) p->bDirty = 0;
+  }
+  return rc;
+}
+
+/*
+** Revert a transaction back to what it was when it started.
+*/
+static int kvcacheRevert(KVStore *pKVStore, int iLevel){
+  KVCache *p = (KVCache*)pKVStore;
+  int rc;
+  rc = sqlite4KVStoreRevert(p->pReal, iLevel);
+  p->base.iTransLevel = p->pReal->iTransLevel;
+  if( p->bDirty ){
+    kvcacheClear(p);
+  }
+  return rc;
+}
+
+/*
+** Insert or replace an entry.  Any cached copy of the entry is
+** discarded.
+*/
+static int kvcacheReplace(
+  KVStore *pKVStore,
+  const KVByteArray *aKey, KVSize nKey,
+  const KVByteArray *aData, KVSize nData
+){
+  KVCache *p = (KVCache*)pKVStore;
+  int rc;
+  kvcacheRemove(p, aKey, nKey);
+  rc = sqlite4KVStoreReplace(p->pReal, aKey, nKey, aData, nData);
+  p->bDirty = 1;
+  return rc;
+}
+
+/*
+** Create a new cursor object.
+*/
+static int kvcacheOpenCursor(KVStore *pKVStore, KVCursor **ppKVCursor){
+  KVCache *p = (KVCache*)pKVStore;
+  KVCacheCsr *pCsr;
+  int rc = SQLITE4_OK;
+
+  pCsr = (KVCacheCsr*)sqlite4_malloc(pKVStore->pEnv, sizeof(KVCacheCsr));
+  if( pCsr==0 ){
+    rc = SQLITE4_NOMEM;
+  }else{
+    memset(pCsr, 0, sizeof(KVCacheCsr));
+    rc = sqlite4KVStoreOpenCursor(p->pReal, &pCsr->pReal);
+    if( rc!=SQLITE4_OK ){
+      sqlite4_free(pKVStore->pEnv, pCsr);
+      pCsr = 0;
+    }else{
+      pCsr->base.pStore = pKVStore;
+      pCsr->base.pStoreVfunc = pKVStore->pStoreVfunc;
+      pCsr->base.pEnv = pKVStore->pEnv;
+    }
+  }
+  *ppKVCursor = (KVCursor*)pCsr;
+  return rc;
+}
+
+/*
+** Reset a cursor.
+*/
+static int kvcacheReset(KVCursor *pKVCursor){
+  KVCacheCsr *pCsr = (KVCacheCsr*)pKVCursor;
+  pCsr->bCached = 0;
+  return sqlite4KVCursorReset(pCsr->pReal);
+}
+
+/*
+** Destroy a cursor object.
+*/
+static int kvcacheCloseCursor(KVCursor *pKVCursor){
+  KVCacheCsr *pCsr = (KVCacheCsr*)pKVCursor;
+  int rc;
+  rc = sqlite4KVCursorClose(pCsr->pReal);
+  sqlite4_free(pKVCursor->pEnv, pCsr->aBuf);
+  sqlite4_free(pKVCursor->pEnv, pCsr);
+  return rc;
+}
+
+/*
+** Move a cursor to the next entry.
+*/
+static int kvcacheNextEntry(KVCursor *pKVCursor){
+  KVCacheCsr *pCsr = (KVCacheCsr*)pKVCursor;
+  int rc = kvcacheRestore(pCsr, +1);
+  if( rc==SQLITE4_INEXACT ){
+    rc = SQLITE4_OK;
+  }else if( rc==SQLITE4_OK ){
+    rc = sqlite4KVCursorNext(pCsr->pReal);
+  }
+  return rc;
+}
+
+/*
+** Move a cursor to the previous entry.
+*/
+static int kvcachePrevEntry(KVCursor *pKVCursor){
+  KVCacheCsr *pCsr = (KVCacheCsr*)pKVCursor;
+  int rc = kvcacheRestore(pCsr, -1);
+  if( rc==SQLITE4_INEXACT ){
+    rc = SQLITE4_OK;
+  }else if( rc==SQLITE4_OK ){
+    rc = sqlite4KVCursorPrev(pCsr->pReal);
+  }
+  return rc;
+}
+
+/*
+** Seek a cursor.  Exact-match seeks are answered from the cache if
+** possible.  Exact-match seeks that miss the cache but find an entry in
+** the underlying store add that entry to the cache.
+*/
+static int kvcacheSeek(
+  KVCursor *pKVCursor,
+  const KVByteArray *aKey,
+  KVSize nKey,
+  int dir
+){
+  KVCacheCsr *pCsr = (KVCacheCsr*)pKVCursor;
+  KVCache *p = (KVCache*)pKVCursor->pStore;
+  int rc;
+
+  pCsr->bCached = 0;
+  if( dir==0 ){
+    KVCacheEntry *pEntry = kvcacheLookup(p, aKey, nKey);
+    if( pEntry==0 ){
+      p->nMiss++;
+    }else{
+      int nReq = pEntry->nKey + pEntry->nData;
+      if( nReq>pCsr->nAlloc ){
+        KVByteArray *aNew;
+        aNew = (KVByteArray*)sqlite4_realloc(pKVCursor->pEnv, pCsr->aBuf, nReq);
+        if( aNew==0 ) return SQLITE4_NOMEM;
+        pCsr->aBuf = aNew;
+        pCsr->nAlloc = nReq;
+      }
+      memcpy(pCsr->aBuf, pEntry->aKey, nReq);
+      pCsr->nKey = pEntry->nKey;
+      pCsr->nData = pEntry->nData;
+      pCsr->bCached = 1;
+      p->nHit++;
+      return SQLITE4_OK;
+    }
+  }
+
+  rc = sqlite4KVCursorSeek(pCsr->pReal, aKey, nKey, dir);
+  if( rc==SQLITE4_OK && dir==0 ){
+    rc = kvcacheFill(p, pCsr->pReal);
+  }
+  return rc;
+}
+
+/*
+** Delete the entry that the cursor is pointing to.  Any cached copy
+** of the entry is discarded.
+*/
+static int kvcacheDelete(KVCursor *pKVCursor){
+  KVCacheCsr *pCsr = (KVCacheCsr*)pKVCursor;
+  KVCache *p = (KVCache*)pKVCursor->pStore;
+  const KVByteArray *aKey;
+  KVSize nKey;
+  int rc;
+
+  rc = kvcacheRestore(pCsr, 0);
+  if( rc==SQLITE4_OK ){
+    rc = sqlite4KVCursorKey(pCsr->pReal, &aKey, &nKey);
+  }
+  if( rc==SQLITE4_OK ){
+    kvcacheRemove(p, aKey, nKey);
+    rc = sqlite4KVCursorDelete(pCsr->pReal);
+    p->bDirty = 1;
+  }
+  return rc;
+}
+
+/*
+** Return the key of the entry the cursor is pointing to.
+*/
+static int kvcacheKey(
+  KVCursor *pKVCursor,         /* The cursor whose key is desired */
+  const KVByteArray **paKey,   /* Make this point to the key */
+  KVSize *pN                   /* Make this point to the size of the key */
+){
+  KVCacheCsr *pCsr = (KVCacheCsr*)pKVCursor;
+  if( pCsr->bCached ){
+    *paKey = pCsr->aBuf;
+    *pN = pCsr->nKey;
+    return SQLITE4_OK;
+  }
+  return sqlite4KVCursorKey(pCsr->pReal, paKey, pN);
+}
+
+/*
+** Return the data of the entry the cursor is pointing to.
+*/
+static int kvcacheData(
+  KVCursor *pKVCursor,         /* The cursor from which to take the data */
+  KVSize ofst,                 /* Offset into the data to begin reading */
+  KVSize n,                    /* Number of bytes requested */
+  const KVByteArray **paData,  /* Pointer to the data written here */
+  KVSize *pNData               /* Number of bytes delivered */
+){
+  KVCacheCsr *pCsr = (KVCacheCsr*)pKVCursor;
+  if( pCsr->bCached ){
+    KVSize nOut = pCsr->nData - ofst;
+    if( n>=0 && nOut>n ) nOut = n;
+    if( nOut<0 ) nOut = 0;
+    *paData = &pCsr->aBuf[pCsr->nKey + ofst];
+    *pNData = nOut;
+    return SQLITE4_OK;
+  }
+  return sqlite4KVCursorData(pCsr->pReal, ofst, n, paData, pNData);
+}
+
+/*
+** Destructor for the cache and the underlying store.
+*/
+static int kvcacheClose(KVStore *pKVStore){
+  KVCache *p = (KVCache*)pKVStore;
+  sqlite4_env *pEnv = pKVStore->pEnv;
+  int rc;
+  int i;
+
+  rc = sqlite4KVStoreClose(p->pReal);
+  kvcacheClear(p);
+  for(i=0; i<KVCACHE_NSHARD; i++){
+    sqlite4_free(pEnv, p->aShard[i].apHash);
+  }
+  sqlite4_free(pEnv, p);
+  return rc;
+}
+
+static int kvcacheControl(KVStore *pKVStore, int op, void *pArg){
+  KVCache *p = (KVCache*)pKVStore;
+  if( op==SQLITE4_KVCTRL_ROWCACHE_STATUS ){
+    int *aStat = (int*)pArg;
+    aStat[0] = p->nHit;
+    aStat[1] = p->nMiss;
+    p->nHit = 0;
+    p->nMiss = 0;
+    return SQLITE4_OK;
+  }
+  return p->pReal->pStoreVfunc->xControl(p->pReal, op, pArg);
+}
+
+static int kvcacheGetMeta(KVStore *pKVStore, unsigned int *piVal){
+  return sqlite4KVStoreGetSchema(((KVCache*)pKVStore)->pReal, piVal);
+}
+
+static int kvcachePutMeta(KVStore *pKVStore, unsigned int iVal){
+  return sqlite4KVStorePutSchema(((KVCache*)pKVStore)->pReal, iVal);
+}
+
+static int kvcacheGetMethod(
+  sqlite4_kvstore *pKVStore,
+  const char *zMethod,
+  void **ppArg,
+  void (**pxFunc)(sqlite4_context *, int, sqlite4_value **),
+  void (**pxDestroy)(void *)
+){
+  KVStore *pReal = ((KVCache*)pKVStore)->pReal;
+  if( pReal->pStoreVfunc->xGetMethod==0 ) return SQLITE4_NOTFOUND;
+  return pReal->pStoreVfunc->xGetMethod(
+      pReal, zMethod, ppArg, pxFunc, pxDestroy
+  );
+}
+
+/*
+** Wrap the open store pReal in a row cache that holds up to nEntry
+** entries.  If successful, ownership of pReal passes to the new object
+** written to *ppKVStore.  If an error occurs, pReal is left open and
+** *ppKVStore is set to NULL.
+*/
+int sqlite4KVStoreOpenCache(
+  sqlite4_env *pEnv,          /* Run-time environment */
+  KVStore **ppKVStore,        /* OUT: write the new KVStore here */
+  KVStore *pReal,             /* Store to wrap */
+  int nEntry                  /* Maximum number of entries to cache */
+){
+  static const KVStoreMethods kvcacheMethods = {
+    1,                            /* iVersion */
+    sizeof(KVStoreMethods),       /* szSelf */
+    kvcacheReplace,               /* xReplace */
+    kvcacheOpenCursor,            /* xOpenCursor */
+    kvcacheSeek,                  /* xSeek */
+    kvcacheNextEntry,             /* xNext */
+    kvcachePrevEntry,             /* xPrev */
+    kvcacheDelete,                /* xDelete */
+    kvcacheKey,                   /* xKey */
+    kvcacheData,                  /* xData */
+    kvcacheReset,                 /* xReset */
+    kvcacheCloseCursor,           /* xCloseCursor */
+    kvcacheBegin,                 /* xBegin */
+    kvcacheCommitPhaseOne,        /* xCommitPhaseOne */
+    kvcacheCommitPhaseTwo,        /* xCommitPhaseTwo */
+    kvcacheRollback,              /* xRollback */
+    kvcacheRevert,                /* xRevert */
+    kvcacheClose,                 /* xClose */
+    kvcacheControl,               /* xControl */
+    kvcacheGetMeta,               /* xGetMeta */
+    kvcachePutMeta,               /* xPutMeta */
+    kvcacheGetMethod              /* xGetMethod */
+  };
+  KVCache *pNew;
+
+  *ppKVStore = 0;
+  pNew = (KVCache*)sqlite4_malloc(pEnv, sizeof(KVCache));
+  if( pNew==0 ) return SQLITE4_NOMEM;
+  memset(pNew, 0, sizeof(KVCache));
+
+  pNew->base.pStoreVfunc = &kvcacheMethods;
+  pNew->base.pEnv = pEnv;
+  pNew->base.iTransLevel = pReal->iTransLevel;
+  pNew->pReal = pReal;
+  pNew->mxEntry = (nEntry + KVCACHE_NSHARD - 1) / KVCACHE_NSHARD;
+  *ppKVStore = (KVStore*)pNew;
+  return SQLITE4_OK;
+}
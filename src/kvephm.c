@@ -0,0 +1,542 @@
+/*
+** 2016 March 16
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** An in-memory key/value store used for ephemeral tables and indexes
+** (stores opened with both SQLITE4_KVOPEN_TEMPORARY and
+** SQLITE4_KVOPEN_NO_TRANSACTIONS). These are used to implement
+** subqueries, IN(...) lists, DISTINCT, automatic indexes and so on.
+**
+** Because such a store is never shared and is discarded as a whole when
+** the statement is done with it, it does not need the transaction logs
+** and reference counts of the general purpose in-memory store in kvmem.c.
+** Instead, the content is held in a skiplist. All nodes, keys and values
+** are allocated from a bump arena and are freed in one shot when the
+** store is closed.
+**
+** Memory used by deleted entries, and by values that are overwritten with
+** larger values, is not reclaimed until the store is closed. A deleted
+** node remains readable so that a cursor that points to it can still
+** move to the next or previous entry.
+*/
+#include "sqliteInt.h"
+
+/*
+** Maximum height of the skiplist. Each node is promoted to the next level
+** with probability 1/4, so this is ample for any realistic number of
+** entries.
+*/
+#define KVEPHM_MAX_HEIGHT 16
+
+/*
+** The first arena chunk is KVEPHM_CHUNK_MIN bytes. Each subsequent chunk
+** is twice the size of its predecessor, up to KVEPHM_CHUNK_MAX bytes.
+** Small stores, such as those used for short IN(...) lists, therefore
+** only need a single small allocation.
+*/
+#define KVEPHM_CHUNK_MIN   1024
+#define KVEPHM_CHUNK_MAX   (256*1024)
+
+/* Forward declarations of object names */
+typedef struct KVEphm KVEphm;
+typedef struct KVEphmChunk KVEphmChunk;
+typedef struct KVEphmCursor KVEphmCursor;
+typedef struct KVEphmNode KVEphmNode;
+
+/*
+** A chunk of memory that nodes and values are allocated from.
+*/
+struct KVEphmChunk {
+  KVEphmChunk *pNext;             /* Next (older) chunk */
+};
+
+/*
+** A single entry in the skiplist. The key is stored immediately after
+** the apNext[] array. aData points to the value, which is initially
+** stored immediately after the key.
+*/
+struct KVEphmNode {
+  KVSize nKey;                    /* Size of key in bytes */
+  KVSize nData;                   /* Size of value in bytes, or -1 if deleted */
+  KVSize nDataAlloc;              /* Space available at aData[] */
+  KVByteArray *aData;             /* Value */
+  KVEphmNode *pPrev;              /* Previous entry in key order */
+  int nHeight;                    /* Number of entries in apNext[] */
+  KVEphmNode *apNext[1];          /* Next entry at each level */
+};
+
+/*
+** An ephemeral key/value store. This is a subclass of KVStore.
+*/
+struct KVEphm {
+  KVStore base;                   /* Base class, must be first */
+  KVEphmChunk *pChunk;            /* List of chunks, most recent first */
+  u8 *aFree;                      /* Unused space in current chunk */
+  int nFree;                      /* Size of aFree[] in bytes */
+  int szChunk;                    /* Size of most recently allocated chunk */
+  int nHeight;                    /* Current height of the skiplist */
+  u32 iRand;                      /* PRNG state used to pick node heights */
+  KVEphmNode *pLast;              /* Entry with the largest key */
+  KVEphmNode *apHead[KVEPHM_MAX_HEIGHT];  /* First entry at each level */
+  unsigned int iMeta;             /* Schema cookie value */
+};
+
+/*
+** A cursor used for scanning an ephemeral store. pNode is the current
+** entry, which may have been deleted since the cursor moved to it.
+*/
+struct KVEphmCursor {
+  KVCursor base;                  /* Base class, must be first */
+  KVEphmNode *pNode;              /* Current entry, or NULL */
+};
+
+/*
+** Return a pointer to the key of node pNode.
+*/
+#define kvephmNodeKey(pNode) ((KVByteArray*)&(pNode)->apNext[(pNode)->nHeight])
+
+/*
+** Compare key aKey/nKey with the key of node pNode using memcmp() order.
+*/
+static int kvephmCompare(
+  const KVByteArray *aKey, KVSize nKey,
+  KVEphmNode *pNode
+){
+  int c = memcmp(aKey, kvephmNodeKey(pNode), nKey<pNode->nKey?nKey:pNode->nKey);
+  if( c==0 ) c = (nKey>pNode->nKey) - (nKey<pNode->nKey);
+  return c;
+}
+
+/*
+** Allocate nByte bytes (rounded up to a multiple of 8) from the arena.
+** Return NULL if an OOM error occurs.
+*/
+static void *kvephmAlloc(KVEphm *p, int nByte){
+  void *pRet;
+  nByte = ROUND8(nByte);
+  if( nByte>p->nFree ){
+    int nHdr = ROUND8(sizeof(KVEphmChunk));
+    int nChunk;
+    KVEphmChunk *pNew;
+
+    if( p->szChunk==0 ){
+      nChunk = KVEPHM_CHUNK_MIN;
+    }else{
+      nChunk = p->szChunk*2;
+      if( nChunk>KVEPHM_CHUNK_MAX ) nChunk = KVEPHM_CHUNK_MAX;
+    }
+    p->szChunk = nChunk;
+    if( nChunk<nByte+nHdr ) nChunk = nByte+nHdr;
+
+    pNew = (KVEphmChunk*)sqlite4_malloc(p->base.pEnv, nChunk);
+    if( pNew==0 ) return 0;
+    pNew->pNext = p->pChunk;
+    p->pChunk = pNew;
+    p->aFree = &((u8*)pNew)[nHdr];
+    p->nFree = nChunk - nHdr;
+  }
+  pRet = (void*)p->aFree;
+  p->aFree += nByte;
+  p->nFree -= nByte;
+  return pRet;
+}
+
+/*
+** Choose a height for a new node.
+*/
+static int kvephmRandomHeight(KVEphm *p){
+  int nHeight = 1;
+  u32 x = p->iRand;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  p->iRand = x;
+  while( nHeight<KVEPHM_MAX_HEIGHT && (x & 3)==0 ){
+    nHeight++;
+    x = x >> 2;
+  }
+  return nHeight;
+}
+
+/*
+** Search for key aKey/nKey. Return the first entry with a key greater
+** than or equal to aKey, or NULL if there is no such entry. If apSlot
+** is not NULL, set apSlot[i] to point to the level i pointer that refers
+** to the returned entry (or that would refer to a new entry with key
+** aKey) for all levels of the skiplist. If ppLess is not NULL, set
+** *ppLess to the last entry with a key smaller than aKey, or NULL.
+*/
+static KVEphmNode *kvephmFind(
+  KVEphm *p,
+  const KVByteArray *aKey, KVSize nKey,
+  KVEphmNode ***apSlot,
+  KVEphmNode **ppLess
+){
+  KVEphmNode **apNext = p->apHead;
+  KVEphmNode *pLess = 0;
+  int i;
+
+  for(i=KVEPHM_MAX_HEIGHT-1; i>=0; i--){
+    if( i<p->nHeight ){
+      while( apNext[i] && kvephmCompare(aKey, nKey, apNext[i])>0 ){
+        pLess = apNext[i];
+        apNext = pLess->apNext;
+      }
+    }
+    if( apSlot ) apSlot[i] = &apNext[i];
+  }
+  if( ppLess ) *ppLess = pLess;
+  return apNext[0];
+}
+
+/*
+** Implementation of the xReplace method.
+**
+** Insert or replace the entry with the key aKey[0..nKey-1]. If an entry
+** with the same key already exists and its value buffer is large enough,
+** the new value overwrites it in place. Otherwise, new space is taken
+** from the arena.
+*/
+static int kvephmReplace(
+  KVStore *pKVStore,
+  const KVByteArray *aKey, KVSize nKey,
+  const KVByteArray *aData, KVSize nData
+){
+  KVEphm *p = (KVEphm*)pKVStore;
+  KVEphmNode **apSlot[KVEPHM_MAX_HEIGHT];
+  KVEphmNode *pLess;
+  KVEphmNode *pNode;
+  int nHeight;
+  int i;
+
+  pNode = kvephmFind(p, aKey, nKey, apSlot, &pLess);
+  if( pNode && kvephmCompare(aKey, nKey, pNode)==0 ){
+    if( nData>pNode->nDataAlloc ){
+      KVByteArray *aNew = (KVByteArray*)kvephmAlloc(p, nData);
+      if( aNew==0 ) return SQLITE4_NOMEM;
+      pNode->aData = aNew;
+      pNode->nDataAlloc = nData;
+    }
+    if( nData ) memcpy(pNode->aData, aData, nData);
+    pNode->nData = nData;
+    return SQLITE4_OK;
+  }
+
+  nHeight = kvephmRandomHeight(p);
+  pNode = (KVEphmNode*)kvephmAlloc(p,
+      sizeof(KVEphmNode) + (nHeight-1)*sizeof(KVEphmNode*) + nKey + nData
+  );
+  if( pNode==0 ) return SQLITE4_NOMEM;
+  pNode->nKey = nKey;
+  pNode->nData = nData;
+  pNode->nDataAlloc = nData;
+  pNode->nHeight = nHeight;
+  memcpy(kvephmNodeKey(pNode), aKey, nKey);
+  pNode->aData = &kvephmNodeKey(pNode)[nKey];
+  if( nData ) memcpy(pNode->aData, aData, nData);
+
+  if( nHeight>p->nHeight ) p->nHeight = nHeight;
+  for(i=0; i<nHeight; i++){
+    pNode->apNext[i] = *apSlot[i];
+    *apSlot[i] = pNode;
+  }
+  pNode->pPrev = pLess;
+  if( pNode->apNext[0] ){
+    pNode->apNext[0]->pPrev = pNode;
+  }else{
+    p->pLast = pNode;
+  }
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new cursor object.
+*/
+static int kvephmOpenCursor(KVStore *pKVStore, KVCursor **ppKVCursor){
+  KVEphmCursor *pCur;
+  pCur = (KVEphmCursor*)sqlite4_malloc(pKVStore->pEnv, sizeof(KVEphmCursor));
+  if( pCur==0 ){
+    *ppKVCursor = 0;
+    return SQLITE4_NOMEM;
+  }
+  memset(pCur, 0, sizeof(KVEphmCursor));
+  pCur->base.pStore = pKVStore;
+  pCur->base.pStoreVfunc = pKVStore->pStoreVfunc;
+  pCur->base.pEnv = pKVStore->pEnv;
+  *ppKVCursor = (KVCursor*)pCur;
+  return SQLITE4_OK;
+}
+
+/*
+** Reset a cursor.
+*/
+static int kvephmReset(KVCursor *pKVCursor){
+  ((KVEphmCursor*)pKVCursor)->pNode = 0;
+  return SQLITE4_OK;
+}
+
+/*
+** Destroy a cursor object.
+*/
+static int kvephmCloseCursor(KVCursor *pKVCursor){
+  if( pKVCursor ) sqlite4_free(pKVCursor->pEnv, pKVCursor);
+  return SQLITE4_OK;
+}
+
+/*
+** Move a cursor to the next entry. If the current entry has been
+** deleted, move to the first entry with a larger key.
+*/
+static int kvephmNextEntry(KVCursor *pKVCursor){
+  KVEphmCursor *pCur = (KVEphmCursor*)pKVCursor;
+  KVEphmNode *pNode = pCur->pNode;
+  if( pNode ){
+    if( pNode->nData<0 ){
+      KVEphm *p = (KVEphm*)pKVCursor->pStore;
+      KVByteArray *aKey = kvephmNodeKey(pNode);
+      KVEphmNode *pNext = kvephmFind(p, aKey, pNode->nKey, 0, 0);
+      if( pNext && kvephmCompare(aKey, pNode->nKey, pNext)==0 ){
+        pNext = pNext->apNext[0];
+      }
+      pNode = pNext;
+    }else{
+      pNode = pNode->apNext[0];
+    }
+  }
+  pCur->pNode = pNode;
+  return pNode ? SQLITE4_OK : SQLITE4_NOTFOUND;
+}
+
+/*
+** Move a cursor to the previous entry. If the current entry has been
+** deleted, move to the last entry with a smaller key.
+*/
+static int kvephmPrevEntry(KVCursor *pKVCursor){
+  KVEphmCursor *pCur = (KVEphmCursor*)pKVCursor;
+  KVEphmNode *pNode = pCur->pNode;
+  if( pNode ){
+    if( pNode->nData<0 ){
+      KVEphm *p = (KVEphm*)pKVCursor->pStore;
+      KVEphmNode *pLess;
+      kvephmFind(p, kvephmNodeKey(pNode), pNode->nKey, 0, &pLess);
+      pNode = pLess;
+    }else{
+      pNode = pNode->pPrev;
+    }
+  }
+  pCur->pNode = pNode;
+  return pNode ? SQLITE4_OK : SQLITE4_NOTFOUND;
+}
+
+/*
+** Seek a cursor. Return SQLITE4_OK if an exact match for aKey is found.
+** Otherwise, if direction is +1 (or -1), move to the first entry larger
+** (or the last entry smaller) than aKey and return SQLITE4_INEXACT, or
+** return SQLITE4_NOTFOUND if there is no such entry.
+*/
+static int kvephmSeek(
+  KVCursor *pKVCursor,
+  const KVByteArray *aKey,
+  KVSize nKey,
+  int direction
+){
+  KVEphmCursor *pCur = (KVEphmCursor*)pKVCursor;
+  KVEphm *p = (KVEphm*)pKVCursor->pStore;
+  KVEphmNode *pLess;
+  KVEphmNode *pNode;
+
+  pNode = kvephmFind(p, aKey, nKey, 0, &pLess);
+  if( pNode && kvephmCompare(aKey, nKey, pNode)==0 ){
+    pCur->pNode = pNode;
+    return SQLITE4_OK;
+  }
+  if( direction<0 ){
+    pNode = pLess;
+  }else if( direction==0 ){
+    pNode = 0;
+  }
+  pCur->pNode = pNode;
+  return pNode ? SQLITE4_INEXACT : SQLITE4_NOTFOUND;
+}
+
+/*
+** Delete the entry that the cursor is pointing to. The node is unlinked
+** from the skiplist, but the cursor continues to point to it so that
+** subsequent xNext and xPrev calls work as expected.
+*/
+static int kvephmDelete(KVCursor *pKVCursor){
+  KVEphmCursor *pCur = (KVEphmCursor*)pKVCursor;
+  KVEphm *p = (KVEphm*)pKVCursor->pStore;
+  KVEphmNode *pNode = pCur->pNode;
+  KVEphmNode **apSlot[KVEPHM_MAX_HEIGHT];
+  int i;
+
+  if( pNode==0 || pNode->nData<0 ) return SQLITE4_OK;
+  kvephmFind(p, kvephmNodeKey(pNode), pNode->nKey, apSlot, 0);
+  for(i=0; i<pNode->nHeight; i++){
+    assert( *apSlot[i]==pNode );
+    *apSlot[i] = pNode->apNext[i];
+  }
+  if( pNode->apNext[0] ){
+    pNode->apNext[0]->pPrev = pNode->pPrev;
+  }else{
+    p->pLast = pNode->pPrev;
+  }
+  pNode->nData = -1;
+  return SQLITE4_OK;
+}
+
+/*
+** Return the key of the entry the cursor is pointing to.
+*/
+static int kvephmKey(
+  KVCursor *pKVCursor,
+  const KVByteArray **paKey,
+  KVSize *pN
+){
+  KVEphmNode *pNode = ((KVEphmCursor*)pKVCursor)->pNode;
+  if( pNode==0 ){
+    *paKey = 0;
+    *pN = 0;
+    return SQLITE4_DONE;
+  }
+  *paKey = kvephmNodeKey(pNode);
+  *pN = pNode->nKey;
+  return SQLITE4_OK;
+}
+
+/*
+** Return the value of the entry the cursor is pointing to.
+*/
+static int kvephmData(
+  KVCursor *pKVCursor,
+  KVSize ofst,
+  KVSize n,
+  const KVByteArray **paData,
+  KVSize *pNData
+){
+  KVEphmNode *pNode = ((KVEphmCursor*)pKVCursor)->pNode;
+  if( pNode==0 || pNode->nData<0 ){
+    *paData = 0;
+    *pNData = 0;
+    return SQLITE4_DONE;
+  }
+  *paData = pNode->aData + ofst;
+  *pNData = pNode->nData - ofst;
+  return SQLITE4_OK;
+}
+
+/*
+** An ephemeral store does not support transactions. These methods only
+** track the transaction level as required by kv.c.
+*/
+static int kvephmBegin(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int kvephmCommitPhaseOne(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+static int kvephmCommitPhaseTwo(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int kvephmRollback(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int kvephmRevert(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+
+/*
+** Close the store. All entries are freed along with the arena.
+*/
+static int kvephmClose(KVStore *pKVStore){
+  KVEphm *p = (KVEphm*)pKVStore;
+  if( p ){
+    sqlite4_env *pEnv = p->base.pEnv;
+    KVEphmChunk *pChunk = p->pChunk;
+    while( pChunk ){
+      KVEphmChunk *pNext = pChunk->pNext;
+      sqlite4_free(pEnv, pChunk);
+      pChunk = pNext;
+    }
+    sqlite4_free(pEnv, p);
+  }
+  return SQLITE4_OK;
+}
+
+static int kvephmControl(KVStore *pKVStore, int op, void *pArg){
+  if( op==SQLITE4_KVCTRL_CHANGE_COUNTER ){
+    /* An ephemeral store is private to a single statement. */
+    *(unsigned int*)pArg = 0;
+    return SQLITE4_OK;
+  }
+  return SQLITE4_NOTFOUND;
+}
+
+static int kvephmGetMeta(KVStore *pKVStore, unsigned int *piVal){
+  *piVal = ((KVEphm*)pKVStore)->iMeta;
+  return SQLITE4_OK;
+}
+
+static int kvephmPutMeta(KVStore *pKVStore, unsigned int iVal){
+  ((KVEphm*)pKVStore)->iMeta = iVal;
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new ephemeral store and return a pointer to it.
+*/
+int sqlite4KVStoreOpenEphemeral(
+  sqlite4_env *pEnv,              /* Runtime environment */
+  KVStore **ppKVStore,            /* OUT: Write the new KVStore here */
+  const char *zName,              /* Name of store (ignored) */
+  unsigned openFlags              /* Flags (ignored) */
+){
+  static const KVStoreMethods kvephmMethods = {
+    1,                            /* iVersion */
+    sizeof(KVStoreMethods),       /* szSelf */
+    kvephmReplace,                /* xReplace */
+    kvephmOpenCursor,             /* xOpenCursor */
+    kvephmSeek,                   /* xSeek */
+    kvephmNextEntry,              /* xNext */
+    kvephmPrevEntry,              /* xPrev */
+    kvephmDelete,                 /* xDelete */
+    kvephmKey,                    /* xKey */
+    kvephmData,                   /* xData */
+    kvephmReset,                  /* xReset */
+    kvephmCloseCursor,            /* xCloseCursor */
+    kvephmBegin,                  /* xBegin */
+    kvephmCommitPhaseOne,         /* xCommitPhaseOne */
+    kvephmCommitPhaseTwo,         /* xCommitPhaseTwo */
+    kvephmRollback,               /* xRollback */
+    kvephmRevert,                 /* xRevert */
+    kvephmClose,                  /* xClose */
+    kvephmControl,                /* xControl */
+    kvephmGetMeta,                /* xGetMeta */
+    kvephmPutMeta,                /* xPutMeta */
+    0                             /* xGetMethod */
+  };
+  KVEphm *pNew;
+
+  *ppKVStore = 0;
+  pNew = (KVEphm*)sqlite4_malloc(pEnv, sizeof(KVEphm));
+  if( pNew==0 ) return SQLITE4_NOMEM;
+  memset(pNew, 0, sizeof(KVEphm));
+  pNew->base.pStoreVfunc = &kvephmMethods;
+  pNew->base.pEnv = pEnv;
+  pNew->nHeight = 1;
+  pNew->iRand = 0x2545f491;
+  *ppKVStore = (KVStore*)pNew;
+  return SQLITE4_OK;
+}
@@ -546,6 +546,13 @@ static int kvldbClose(KVStore *pKVStore){
 static int kvldbControl(KVStore *pKVStore, int op, void *pArg){
     int rc = SQLITE4_OK;
     printf("kvldbControl start\n");
+    switch( op ){
+        case SQLITE4_KVCTRL_CHANGE_COUNTER:
+            /* leveldb holds an exclusive lock on the database directory,
+            ** so no other connection can modify it. */
+            *(unsigned int*)pArg = 0;
+            break;
+    }
     printf("rc=  %d\n", rc);
     printf("kvldbControl finish\n");
     return rc;
@@ -400,6 +400,15 @@ static int kvlsmControl(KVStore *pKVStore, int op, void *pArg){
       break;
     }
 
+    case SQLITE4_KVCTRL_CHANGE_COUNTER: {
+      /* The counter is only meaningful while a read transaction is open */
+      if( p->pCsr==0
+       || lsm_info(p->pDb, LSM_INFO_CHANGE_COUNTER, (unsigned int*)pArg)
+      ){
+        rc = SQLITE4_NOTFOUND;
+      }
+      break;
+    }
 
     default:
       rc = SQLITE4_NOTFOUND;
@@ -929,6 +929,12 @@ static int kvmemClose(KVStore *pKVStore){
 }
 
 static int kvmemControl(KVStore *pKVStore, int op, void *pArg){
+  if( op==SQLITE4_KVCTRL_CHANGE_COUNTER ){
+    /* An in-memory store is only ever accessed by the connection that
+    ** opened it, so no other connection can modify it. */
+    *(unsigned int*)pArg = 0;
+    return SQLITE4_OK;
+  }
   return SQLITE4_NOTFOUND;
 }
 
@@ -460,6 +460,14 @@ int lsm_set_user_version(lsm_db *, unsigned int);
 **   This value should be followed by a single argument of type 
 **   (unsigned int *). If successful, the location pointed to is populated 
 **   with the database compression id before returning.
+**
+** LSM_INFO_CHANGE_COUNTER:
+**   This value should be followed by a single argument of type 
+**   (unsigned int *). The location pointed to is set to a counter that
+**   is incremented by each write transaction committed to the database
+**   by any connection. The value returned is that of the snapshot read
+**   by the current read transaction. If no read transaction is open,
+**   LSM_MISUSE is returned.
 */
 #define LSM_INFO_NWRITE           1
 #define LSM_INFO_NREAD            2
@@ -474,6 +482,7 @@ int lsm_set_user_version(lsm_db *, unsigned int);
 #define LSM_INFO_TREE_SIZE       11
 #define LSM_INFO_FREELIST_SIZE   12
 #define LSM_INFO_COMPRESSION_ID  13
+#define LSM_INFO_CHANGE_COUNTER  14
 
 
 /* 
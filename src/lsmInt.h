@@ -282,6 +282,7 @@ struct TreeHeader {
   TreeRoot oldroot;               /* Root and height of the previous tree */
   u32 iOldShmid;                  /* Last shm-id used by previous tree */
   u32 iUsrVersion;                /* get/set_user_version() value */
+  u32 iChange;                    /* Incremented by each write transaction */
   i64 iOldLog;                    /* Log offset associated with old tree */
   u32 oldcksum0;
   u32 oldcksum1;
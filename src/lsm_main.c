@@ -645,6 +645,16 @@ int lsm_info(lsm_db *pDb, int eParam, ...){
       break;
     }
 
+    case LSM_INFO_CHANGE_COUNTER: {
+      unsigned int *piOut = va_arg(ap, unsigned int *);
+      if( pDb->iReader>=0 || pDb->bRoTrans ){
+        *piOut = pDb->treehdr.iChange;
+      }else{
+        rc = LSM_MISUSE;
+      }
+      break;
+    }
+
     default:
       rc = LSM_MISUSE;
       break;
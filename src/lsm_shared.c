@@ -1379,6 +1379,7 @@ int lsmBeginWriteTrans(lsm_db *pDb){
     TreeHeader *p = &pDb->treehdr;
     pShm->bWriter = 1;
     p->root.iTransId++;
+    p->iChange++;
     if( lsmTreeHasOld(pDb) && p->iOldLog==pDb->pClient->iLogOff ){
       lsmTreeDiscardOld(pDb);
       pDb->bDiscardOld = 1;
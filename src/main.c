@@ -141,6 +141,7 @@ sqlite4_mutex *sqlite4_db_mutex(sqlite4 *db){
 */
 int sqlite4_db_release_memory(sqlite4 *db){
   sqlite4_mutex_enter(db->mutex);
+  sqlite4VdbeStmtCacheClear(db);
   sqlite4_mutex_leave(db->mutex);
   return SQLITE4_OK;
 }
@@ -160,6 +161,19 @@ int sqlite4_db_config(sqlite4 *db, int op, ...){
       rc = setupLookaside(db, pBuf, sz, cnt);
       break;
     }
+    case SQLITE4_DBCONFIG_STMTCACHE_SIZE: {
+      int nNew = va_arg(ap, int);
+      int *pRes = va_arg(ap, int*);
+      sqlite4_mutex_enter(db->mutex);
+      if( nNew>=0 ){
+        db->mxStmtCache = nNew;
+        sqlite4VdbeStmtCacheLimit(db, nNew);
+      }
+      if( pRes ) *pRes = db->mxStmtCache;
+      sqlite4_mutex_leave(db->mutex);
+      rc = SQLITE4_OK;
+      break;
+    }
     default: {
       static const struct {
         int op;      /* The opcode */
@@ -379,6 +393,10 @@ int sqlite4_close(sqlite4 *db, unsigned int flags){
   */
   sqlite4VtabRollback(db);
 
+  /* Statements in the statement cache have already been finalized by
+  ** the application. Delete them now. */
+  sqlite4VdbeStmtCacheClear(db);
+
   /* If there are any outstanding VMs, return SQLITE4_BUSY. */
   if( db->pVdbe ){
     sqlite4Error(db, SQLITE4_BUSY, 
@@ -708,6 +726,32 @@ void sqlite4_profile(
 }
 #endif /* SQLITE4_OMIT_TRACE */
 
+#ifndef SQLITE4_OMIT_PROGRESS_CALLBACK
+/*
+** This routine sets the progress callback for an Sqlite database to the
+** given callback function with the given argument. The progress callback
+** will be invoked every nOps opcodes.
+*/
+void sqlite4_progress_handler(
+  sqlite4 *db, 
+  int nOps,
+  int (*xProgress)(void*), 
+  void *pArg
+){
+  sqlite4_mutex_enter(db->mutex);
+  if( nOps>0 ){
+    db->xProgress = xProgress;
+    db->nProgressOps = nOps;
+    db->pProgressArg = pArg;
+  }else{
+    db->xProgress = 0;
+    db->nProgressOps = 0;
+    db->pProgressArg = 0;
+  }
+  sqlite4_mutex_leave(db->mutex);
+}
+#endif
+
 /*
 ** Return UTF-8 encoded English language explanation of the most recent
 ** error.
@@ -1147,7 +1191,14 @@ static int openDatabase(
   memcpy(db->aLimit, aHardLimit, sizeof(db->aLimit));
   db->nextAutovac = -1;
   db->nextPagesize = 0;
+  db->mxSorterMem = SQLITE4_DEFAULT_SORTER_MEMORY;
+  db->nWorker = SQLITE4_DEFAULT_WORKER_THREADS;
+  db->mxStmtCache = SQLITE4_DEFAULT_STMTCACHE_SIZE;
+  if( db->nWorker>pEnv->mxWorker ) db->nWorker = pEnv->mxWorker;
   db->flags |=  SQLITE4_AutoIndex
+                 | SQLITE4_HashJoin
+                 | SQLITE4_BatchLookup
+                 | SQLITE4_SkipScan
                  | SQLITE4_EnableTrigger
                  | SQLITE4_ForeignKeys
             ;
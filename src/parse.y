@@ -119,6 +119,7 @@ explain ::= .           { sqlite4BeginParse(pParse, 0); }
 %ifndef SQLITE4_OMIT_EXPLAIN
 explain ::= EXPLAIN.              { sqlite4BeginParse(pParse, 1); }
 explain ::= EXPLAIN QUERY PLAN.   { sqlite4BeginParse(pParse, 2); }
+explain ::= EXPLAIN PROFILE.      { sqlite4BeginParse(pParse, 3); }
 %endif  SQLITE4_OMIT_EXPLAIN
 cmdx ::= cmd.           { sqlite4FinishCoding(pParse); }
 
@@ -171,6 +172,11 @@ temp(A) ::= .      {A = 0;}
 create_table_args ::= LP columnlist conslist_opt(X) RP(Y). {
   sqlite4EndTable(pParse,&X,&Y,0);
 }
+create_table_args ::= LP columnlist conslist_opt(X) RP(Y)
+                      WITH LP table_optlist RP(Z). {
+  if( X.z==0 ) X = Y;
+  sqlite4EndTable(pParse,&X,&Z,0);
+}
 create_table_args ::= AS select(S). {
   sqlite4EndTable(pParse,0,0,S);
   sqlite4SelectDelete(pParse->db, S);
@@ -209,7 +215,7 @@ id(A) ::= INDEXED(X).    {A = X;}
   CONFLICT DATABASE DEFERRED DESC DETACH EACH END EXCLUSIVE EXPLAIN FAIL FOR
   IGNORE IMMEDIATE INITIALLY INSTEAD LIKE_KW MATCH NO PLAN
   QUERY KEY OF OFFSET PRAGMA RAISE RELEASE REPLACE RESTRICT ROW ROLLBACK
-  SAVEPOINT TEMP TRIGGER VIEW VIRTUAL
+  SAVEPOINT TEMP TRIGGER VIEW VIRTUAL WITH
 %ifdef SQLITE4_OMIT_COMPOUND_SELECT
   EXCEPT INTERSECT UNION
 %endif SQLITE4_OMIT_COMPOUND_SELECT
@@ -253,6 +259,13 @@ nm(A) ::= id(X).         {A = X;}
 nm(A) ::= STRING(X).     {A = X;}
 nm(A) ::= JOIN_KW(X).    {A = X;}
 
+// Options that may follow the column list of a CREATE TABLE statement,
+// for example "WITH (format=offsets)".
+//
+table_optlist ::= table_optlist COMMA table_opt.
+table_optlist ::= table_opt.
+table_opt ::= nm(X) EQ nm(Y).   {sqlite4AddTableOption(pParse,&X,&Y);}
+
 // A typetoken is really one or more tokens that form a type name such
 // as can be found after the column name in a CREATE TABLE statement.
 // Multiple tokens are concatenated to form the value of the typetoken.
@@ -305,7 +318,7 @@ ccons ::= NULL onconf.
 ccons ::= NOT NULL onconf(R).  {sqlite4AddNotNull(pParse, R);}
 ccons ::= PRIMARY KEY sortorder(Z) onconf(R) autoinc(I).
                                {sqlite4AddPrimaryKey(pParse,0,R,I,Z);}
-ccons ::= UNIQUE onconf(R).    {sqlite4CreateIndex(pParse,0,0,0,R,0,0,0);}
+ccons ::= UNIQUE onconf(R).    {sqlite4CreateIndex(pParse,0,0,0,0,R,0,0,0);}
 ccons ::= CHECK LP expr(X) RP. {sqlite4AddCheckConstraint(pParse,X.pExpr);}
 ccons ::= REFERENCES nm(T) idxlist_opt(TA) refargs(R).
                                {sqlite4CreateForeignKey(pParse,0,&T,TA,R);}
@@ -356,7 +369,7 @@ tcons ::= CONSTRAINT nm.
 tcons ::= PRIMARY KEY LP idxlist(X) autoinc(I) RP onconf(R).
                              {sqlite4AddPrimaryKey(pParse,X,R,I,0);}
 tcons ::= UNIQUE LP idxlist(X) RP onconf(R).
-                             {sqlite4CreateIndex(pParse,0,X,0,R,0,0,0);}
+                             {sqlite4CreateIndex(pParse,0,X,0,0,R,0,0,0);}
 tcons ::= CHECK LP expr(E) RP onconf.
                              {sqlite4AddCheckConstraint(pParse,E.pExpr);}
 tcons ::= FOREIGN KEY LP idxlist(FA) RP
@@ -1143,9 +1156,18 @@ createindex(C) ::= createkw(S) uniqueflag(U) INDEX ifnotexists(NE)
   C.pTblName = sqlite4SrcListAppend(pParse->db, 0, &Y, 0);
 }
 
-cmd ::= createindex(C) LP idxlist(Z) RP(E) covering_opt(F). {
+cmd ::= createindex(C) LP eidxlist(Z) RP(E) covering_opt(F) partidx_opt(W). {
   Token *pEnd = (F.pList ? &F.sEnd : &E);
-  sqlite4CreateIndex(pParse, &C, Z, F.pList, C.bUnique, pEnd, SQLITE4_SO_ASC,0);
+  Token sWhereEnd;
+  if( W.pExpr ){
+    /* The WHERE clause of a partial index is part of the stored SQL */
+    sWhereEnd.z = W.zEnd;
+    sWhereEnd.n = 0;
+    pEnd = &sWhereEnd;
+  }
+  sqlite4CreateIndex(
+      pParse, &C, Z, F.pList, W.pExpr, C.bUnique, pEnd, SQLITE4_SO_ASC, 0
+  );
 }
 
 %type uniqueflag {int}
@@ -1182,6 +1204,25 @@ idxlist(A) ::= nm(Y) collate(C) sortorder(Z). {
   if( A ) A->a[A->nExpr-1].sortOrder = (u8)Z;
 }
 
+// The columns of a CREATE INDEX statement may be arbitrary expressions.
+// An expression that is a single identifier (with an optional COLLATE
+// clause) is a column of the table. sqlite4CreateIndex() tells the two
+// apart.
+//
+%type eidxlist {ExprList*}
+%destructor eidxlist {sqlite4ExprListDelete(pParse->db, $$);}
+
+eidxlist(A) ::= eidxlist(X) COMMA expr(Y) sortorder(Z). {
+  A = sqlite4ExprListAppend(pParse, X, Y.pExpr);
+  sqlite4ExprListCheckLength(pParse, A, "index");
+  if( A ) A->a[A->nExpr-1].sortOrder = (u8)Z;
+}
+eidxlist(A) ::= expr(Y) sortorder(Z). {
+  A = sqlite4ExprListAppend(pParse, 0, Y.pExpr);
+  sqlite4ExprListCheckLength(pParse, A, "index");
+  if( A ) A->a[A->nExpr-1].sortOrder = (u8)Z;
+}
+
 %type collate {Token}
 collate(C) ::= .                 {C.z = 0; C.n = 0;}
 collate(C) ::= COLLATE ids(X).   {C = X;}
@@ -1225,6 +1266,11 @@ covering_opt(A) ::= COVERING LP inscollist(X) RP(Y). {
   A.sEnd = Y;
 }
 
+%type partidx_opt {ExprSpan}
+%destructor partidx_opt {sqlite4ExprDelete(pParse->db, $$.pExpr);}
+partidx_opt(A) ::= . { A.pExpr = 0; A.zStart = A.zEnd = 0; }
+partidx_opt(A) ::= WHERE expr(X). { A = X; }
+
 
 ///////////////////////////// The DROP INDEX command /////////////////////////
 //
@@ -73,6 +73,10 @@ static int flagPragma(Parse *pParse, const char *zLeft, const char *zRight){
   } aPragma[] = {
     { "reverse_unordered_selects", SQLITE4_ReverseOrder  },
     { "automatic_index",           SQLITE4_AutoIndex  },
+    { "hash_join",                 SQLITE4_HashJoin  },
+    { "batch_lookup",              SQLITE4_BatchLookup  },
+    { "stmt_profile",              SQLITE4_StmtProfile  },
+    { "skip_scan",                 SQLITE4_SkipScan  },
 #ifdef SQLITE4_DEBUG
     { "sql_trace",                SQLITE4_SqlTrace      },
     { "vdbe_listing",             SQLITE4_VdbeListing   },
@@ -176,6 +180,12 @@ void sqlite4Pragma(
   int rc = SQLITE4_OK;            /* Error code */
   KVStore *pKV;                   /* KV store corresponding to db iDb */
 
+  /* Many pragmas take effect while they are being compiled, so the VM
+  ** cannot be reused from the statement cache. Some of them change the
+  ** way other statements are compiled, so discard the cache as well. */
+  if( v ) sqlite4VdbeNoStmtCache(v);
+  sqlite4VdbeStmtCacheClear(db);
+
   /* Interpret the [database.] part of the pragma statement. iDb is the
   ** index of the database this pragma is being applied to in db.aDb[]. */
   iDb = sqlite4TwoPartName(pParse, pId1, pId2, &pPragma);
@@ -395,9 +405,15 @@ void sqlite4Pragma(
       for(i=0; i<pIdx->nColumn; i++){
         int cnum = pIdx->aiColumn[i];
         sqlite4VdbeAddOp2(v, OP_Integer, i, 1);
-        sqlite4VdbeAddOp2(v, OP_Integer, cnum, 2);
         assert( pTab->nCol>cnum );
-        sqlite4VdbeAddOp4(v, OP_String8, 0, 3, 0, pTab->aCol[cnum].zName, 0);
+        if( cnum==XN_EXPR ){
+          /* An indexed expression has neither a column number nor a name */
+          sqlite4VdbeAddOp2(v, OP_Null, 0, 2);
+          sqlite4VdbeAddOp2(v, OP_Null, 0, 3);
+        }else{
+          sqlite4VdbeAddOp2(v, OP_Integer, cnum, 2);
+          sqlite4VdbeAddOp4(v, OP_String8, 0, 3, 0, pTab->aCol[cnum].zName, 0);
+        }
         sqlite4VdbeAddOp2(v, OP_ResultRow, 1, 3);
       }
     }
@@ -717,6 +733,7 @@ void sqlite4Pragma(
         int iPkCsr;
         Index *pPk;
         int iCsr;
+        int regIdxCnt;            /* Entry counts for partial indexes */
 
         /* Do nothing for views or sqlite_kvstore */
         if( IsView(pTab) || IsKvstore(pTab) ) continue;
@@ -731,6 +748,28 @@ void sqlite4Pragma(
         }
         sqlite4OpenAllIndexes(pParse, pTab, baseCsr, OP_OpenRead);
 
+        /* A partial index is expected to contain one entry for each row
+        ** that satisfies its WHERE clause. These are counted in register
+        ** regIdxCnt+i, where i is the offset of the index cursor. These
+        ** registers, and any used to evaluate the WHERE clauses and indexed
+        ** expressions, are allocated above the array used to build keys
+        ** for this table. */
+        for(pIdx=pTab->pIndex; pIdx; pIdx=pIdx->pNext){
+          if( (pPk->nColumn+pIdx->nColumn)>nMaxArray ){
+            nMaxArray = pPk->nColumn + pIdx->nColumn;
+          }
+        }
+        if( pParse->nMem<regArray+nMaxArray ){
+          pParse->nMem = regArray + nMaxArray;
+        }
+        regIdxCnt = pParse->nMem+1;
+        pParse->nMem += nIdx;
+        for(iCsr=baseCsr, pIdx=pTab->pIndex; pIdx; pIdx=pIdx->pNext, iCsr++){
+          if( pIdx->pPartIdxWhere ){
+            sqlite4VdbeAddOp2(v, OP_Integer, 0, regIdxCnt+iCsr-baseCsr);
+          }
+        }
+
         sqlite4VdbeAddOp2(v, OP_Integer, 0, regRowcnt1);
         addrRewind = sqlite4VdbeAddOp1(v, OP_Rewind, iPkCsr);
 
@@ -743,10 +782,14 @@ void sqlite4Pragma(
             char *zErr;
             int iCol;
             int jmp;
+            int iSkip = sqlite4VdbeMakeLabel(v);
+            if( pIdx->pPartIdxWhere ){
+              sqlite4PartialIndexSkip(pParse, pIdx, iPkCsr, 0, iSkip);
+              sqlite4VdbeAddOp2(v, OP_AddImm, regIdxCnt+iCsr-baseCsr, 1);
+            }
             for(iCol=0; iCol<pIdx->nColumn; iCol++){
               int r = regArray + iCol;
-              sqlite4VdbeAddOp3(v, OP_Column, iPkCsr, pIdx->aiColumn[iCol], r);
-              assert( pIdx->aiColumn[iCol]>=0 );
+              sqlite4CodeIndexColumn(pParse, pIdx, iCol, iPkCsr, 0, r);
             }
             for(iCol=0; iCol<pPk->nColumn; iCol++){
               int reg = regArray + pIdx->nColumn + iCol;
@@ -781,6 +824,7 @@ void sqlite4Pragma(
             sqlite4VdbeAddOp4(v, OP_String8, 0, regTmp, 0, "\n", 0);
             sqlite4VdbeAddOp3(v, OP_Concat, regTmp, regErrstr, regErrstr);
             sqlite4VdbeJumpHere(v, jmp);
+            sqlite4VdbeResolveLabel(v, iSkip);
             sqlite4DbFree(db, zErr);
           }
         }
@@ -800,7 +844,10 @@ void sqlite4Pragma(
             zErr = sqlite4MPrintf(
                 db, "wrong # number of entries in index %s\n", pIdx->zName
             );
-            addrEq = sqlite4VdbeAddOp3(v, OP_Eq, regRowcnt1, 0, regRowcnt2);
+            addrEq = sqlite4VdbeAddOp3(v, OP_Eq, 
+                (pIdx->pPartIdxWhere ? regIdxCnt+iCsr-baseCsr : regRowcnt1),
+                0, regRowcnt2
+            );
             sqlite4VdbeAddOp2(v, OP_AddImm, regErrcnt, 1);
             sqlite4VdbeAddOp4(v, OP_String8, 0, regTmp, 0, zErr, 0);
             sqlite4VdbeAddOp3(v, OP_Concat, regTmp, regErrstr, regErrstr);
@@ -823,7 +870,9 @@ void sqlite4Pragma(
     sqlite4VdbeAddOp3(v, OP_Concat, regErrstr, regResult, regResult);
     sqlite4VdbeJumpHere(v, addrNot);
 
-    pParse->nMem = (regArray + nMaxArray);
+    if( pParse->nMem<regArray+nMaxArray ){
+      pParse->nMem = (regArray + nMaxArray);
+    }
     sqlite4VdbeSetNumCols(v, 1);
     sqlite4VdbeSetColName(v, 0, COLNAME_NAME, "integrity_check", SQLITE4_STATIC);
     sqlite4VdbeAddOp2(v, OP_ResultRow, regResult, 1);
@@ -841,6 +890,42 @@ void sqlite4Pragma(
     sqlite4_db_release_memory(db);
   }else
 
+  /*
+  **   PRAGMA sorter_memory
+  **   PRAGMA sorter_memory = N
+  **
+  ** Query or set the number of bytes of data that a sorter may buffer
+  ** in memory before writing sorted runs to a temporary file. If N is
+  ** zero or negative, sorters never use temporary files.
+  */
+  if( sqlite4_stricmp(zPragma, "sorter_memory")==0 ){
+    if( zRight ){
+      sqlite4Atoi64(zRight, &db->mxSorterMem, sqlite4Strlen30(zRight),
+                    SQLITE4_UTF8);
+    }
+    returnSingleInt(pParse, "sorter_memory", db->mxSorterMem);
+  }else
+
+  /*
+  **   PRAGMA threads
+  **   PRAGMA threads = N
+  **
+  ** Query or set the number of worker threads that each sorter may use
+  ** to sort and merge runs in the background, including the sorters used
+  ** to build indexes for CREATE INDEX and REINDEX. The value is silently
+  ** limited to the maximum configured for the environment using
+  ** SQLITE4_ENVCONFIG_WORKER_THREADS. Zero disables worker threads.
+  */
+  if( sqlite4_stricmp(zPragma, "threads")==0 ){
+    if( zRight ){
+      int n = sqlite4Atoi(zRight);
+      if( n<0 ) n = 0;
+      if( n>db->pEnv->mxWorker ) n = db->pEnv->mxWorker;
+      db->nWorker = n;
+    }
+    returnSingleInt(pParse, "threads", db->nWorker);
+  }else
+
   /*
   **  PRAGMA schema_version
   */
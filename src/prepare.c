@@ -547,13 +547,22 @@ static int sqlite4Prepare(
   if( rc==SQLITE4_OK && pParse->pVdbe && pParse->explain ){
     static const char * const azColName[] = {
        "addr", "opcode", "p1", "p2", "p3", "p4", "p5", "comment",
-       "selectid", "order", "from", "detail"
+       "selectid", "order", "from", "detail",
+       "nexec", "ncycle", "nseek", "nstep", "nbyte"
     };
+    static const u8 aAnalyzeCol[] = { 0,1,2,3,4,5,6,7, 12,13,14,15,16 };
     int iFirst, mx;
     if( pParse->explain==2 ){
       sqlite4VdbeSetNumCols(pParse->pVdbe, 4);
       iFirst = 8;
       mx = 12;
+    }else if( pParse->explain==3 ){
+      sqlite4VdbeSetNumCols(pParse->pVdbe, ArraySize(aAnalyzeCol));
+      for(i=0; i<ArraySize(aAnalyzeCol); i++){
+        sqlite4VdbeSetColName(pParse->pVdbe, i, COLNAME_NAME,
+                              azColName[aAnalyzeCol[i]], SQLITE4_STATIC);
+      }
+      iFirst = mx = 0;
     }else{
       sqlite4VdbeSetNumCols(pParse->pVdbe, 8);
       iFirst = 0;
@@ -615,6 +624,17 @@ static int sqlite4LockAndPrepare(
     return SQLITE4_MISUSE_BKPT;
   }
   sqlite4_mutex_enter(db->mutex);
+  /* If a VM compiled from the same SQL text is in the statement cache,
+  ** return it instead of compiling the statement again. */
+  if( pOld==0 ){
+    Vdbe *pCached = sqlite4VdbeStmtCacheFind(db, zSql, nBytes, pnUsed);
+    if( pCached ){
+      *ppStmt = (sqlite4_stmt*)pCached;
+      sqlite4Error(db, SQLITE4_OK, 0);
+      sqlite4_mutex_leave(db->mutex);
+      return SQLITE4_OK;
+    }
+  }
   rc = sqlite4Prepare(db, zSql, nBytes, pOld, ppStmt, pnUsed);
   if( rc==SQLITE4_SCHEMA ){
     sqlite4_finalize(*ppStmt);
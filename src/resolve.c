@@ -485,6 +485,22 @@ static void resolveMatch(Parse *pParse, NameContext *pNC, Expr *pExpr){
   sqlite4ExprDelete(pParse->db, pLeft);
 }
 
+#ifndef SQLITE4_OMIT_CHECK
+/*
+** Return a description of the kind of expression being resolved by
+** name context pNC, for use in error messages. NameContext.isCheck
+** must be non-zero.
+*/
+static const char *resolveCheckContext(NameContext *pNC){
+  assert( pNC->isCheck );
+  switch( pNC->isCheck ){
+    case NC_PartIdx: return "partial index WHERE clauses";
+    case NC_IdxExpr: return "index expressions";
+  }
+  return "CHECK constraints";
+}
+#endif
+
 /*
 ** This routine is callback for sqlite4WalkExpr().
 **
@@ -622,6 +638,18 @@ static int resolveExprStep(Walker *pWalker, Expr *pExpr){
              nId, zId);
         pNC->nErr++;
       }
+#ifndef SQLITE4_OMIT_CHECK
+      /* The value of an index expression or partial index WHERE clause
+      ** must depend only on the row it is computed from. */
+      if( pParse->nErr==0 && (pDef->flags & SQLITE4_FUNC_VOLATILE)
+       && (pNC->isCheck==NC_PartIdx || pNC->isCheck==NC_IdxExpr)
+      ){
+        sqlite4ErrorMsg(pParse,
+            "non-deterministic functions prohibited in %s",
+            resolveCheckContext(pNC));
+        pNC->nErr++;
+      }
+#endif
       if( is_agg ){
         pExpr->op = TK_AGG_FUNCTION;
         pNC->hasAgg = 1;
@@ -651,7 +679,8 @@ static int resolveExprStep(Walker *pWalker, Expr *pExpr){
         int nRef = pNC->nRef;
 #ifndef SQLITE4_OMIT_CHECK
         if( pNC->isCheck ){
-          sqlite4ErrorMsg(pParse,"subqueries prohibited in CHECK constraints");
+          sqlite4ErrorMsg(pParse, "subqueries prohibited in %s",
+              resolveCheckContext(pNC));
         }
 #endif
         sqlite4WalkSelect(pWalker, pExpr->x.pSelect);
@@ -665,7 +694,8 @@ static int resolveExprStep(Walker *pWalker, Expr *pExpr){
 #ifndef SQLITE4_OMIT_CHECK
     case TK_VARIABLE: {
       if( pNC->isCheck ){
-        sqlite4ErrorMsg(pParse,"parameters prohibited in CHECK constraints");
+        sqlite4ErrorMsg(pParse, "parameters prohibited in %s",
+            resolveCheckContext(pNC));
       }
       break;
     }
@@ -764,7 +794,7 @@ static int resolveOrderByTermToExprList(
   ** result-set entry.
   */
   for(i=0; i<pEList->nExpr; i++){
-    if( sqlite4ExprCompare(pEList->a[i].pExpr, pE)<2 ){
+    if( sqlite4ExprCompare(pEList->a[i].pExpr, pE, -1)<2 ){
       return i+1;
     }
   }
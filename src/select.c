@@ -424,6 +424,7 @@ static void pushOntoSorter(
   int nExpr = pOrderBy->nExpr;
   int regBase = sqlite4GetTempRange(pParse, nExpr+1);
   int regKey = sqlite4GetTempReg(pParse);
+  int addrDone;                   /* Label used to skip the OP_Insert */
 
   /* Assemble the sort-key values in a contiguous array of registers
   ** starting at regBase. The sort-key consists of the result of each 
@@ -438,15 +439,13 @@ static void pushOntoSorter(
   sqlite4VdbeAddOp4Int(v, OP_MakeKey, regBase, nExpr+1, regKey,
                        pOrderBy->iECursor);
 
-  /* Insert an entry into the sorter. The key inserted is the encoded key
-  ** created by the OP_MakeKey coded above. The value is the record
-  ** currently stored in register regData.  */
-  sqlite4VdbeAddOp3(v, OP_Insert, pOrderBy->iECursor, regData, regKey);
-
-  /* Release the temporary registers */
-  sqlite4ReleaseTempReg(pParse, regKey);
-  sqlite4ReleaseTempRange(pParse, regBase, nExpr+1);
-
+  /* If there is a LIMIT, the sorter never needs to hold more than LIMIT
+  ** (plus OFFSET) rows. Once it is full, compare the new key with the
+  ** largest key in the sorter. If the new key is larger, discard the row.
+  ** Otherwise, remove the largest entry to make room for the new one. If
+  ** the sorter is a top-N sorter (OP_TopNOpen), the OP_Last and OP_Delete
+  ** below each require only O(log N) work.  */
+  addrDone = 0;
   if( pSelect->iLimit ){
     int addr1, addr2;
     int iLimit;
@@ -455,14 +454,26 @@ static void pushOntoSorter(
     }else{
       iLimit = pSelect->iLimit;
     }
+    addrDone = sqlite4VdbeMakeLabel(v);
     addr1 = sqlite4VdbeAddOp1(v, OP_IfZero, iLimit);
     sqlite4VdbeAddOp2(v, OP_AddImm, iLimit, -1);
     addr2 = sqlite4VdbeAddOp0(v, OP_Goto);
     sqlite4VdbeJumpHere(v, addr1);
     sqlite4VdbeAddOp1(v, OP_Last, pOrderBy->iECursor);
+    sqlite4VdbeAddOp3(v, OP_IdxLE, pOrderBy->iECursor, addrDone, regKey);
     sqlite4VdbeAddOp1(v, OP_Delete, pOrderBy->iECursor);
     sqlite4VdbeJumpHere(v, addr2);
   }
+
+  /* Insert an entry into the sorter. The key inserted is the encoded key
+  ** created by the OP_MakeKey coded above. The value is the record
+  ** currently stored in register regData.  */
+  sqlite4VdbeAddOp3(v, OP_Insert, pOrderBy->iECursor, regData, regKey);
+  if( addrDone ) sqlite4VdbeResolveLabel(v, addrDone);
+
+  /* Release the temporary registers */
+  sqlite4ReleaseTempReg(pParse, regKey);
+  sqlite4ReleaseTempRange(pParse, regBase, nExpr+1);
 }
 
 /*
@@ -3529,7 +3540,7 @@ static void resetAccumulator(Parse *pParse, AggInfo *pAggInfo){
         pFunc->iDistinct = -1;
       }else{
         KeyInfo *pKeyInfo = keyInfoFromExprList(pParse, pE->x.pList, 0);
-        sqlite4VdbeAddOp4(v, OP_OpenEphemeral, pFunc->iDistinct, 0, 0,
+        sqlite4VdbeAddOp4(v, OP_OpenEphemeral, pFunc->iDistinct, 0, 1,
                           (char*)pKeyInfo, P4_KEYINFO_HANDOFF);
       }
     }
@@ -3625,6 +3636,41 @@ static void updateAccumulator(Parse *pParse, AggInfo *pAggInfo){
   sqlite4ExprCacheClear(pParse);
 }
 
+/*
+** Return true if the GROUP BY query described by pAggInfo may be
+** implemented using a hash table (see OP_AggHashOpen). If so, set *piReg
+** and *pnReg to the first accumulator register and the number of
+** accumulator registers, respectively.
+**
+** A hash table may be used if the accumulator registers are contiguous
+** and none of the aggregate functions is a DISTINCT aggregate, as these
+** require a separate ephemeral table for each group.
+*/
+static int aggHashUsable(AggInfo *pAggInfo, int *piReg, int *pnReg){
+  int iMin = 0;
+  int iMax = 0;
+  int nReg = pAggInfo->nColumn + pAggInfo->nFunc;
+  int i;
+
+  for(i=0; i<pAggInfo->nFunc; i++){
+    if( pAggInfo->aFunc[i].iDistinct>=0 ) return 0;
+  }
+  for(i=0; i<nReg; i++){
+    int iMem;
+    if( i<pAggInfo->nColumn ){
+      iMem = pAggInfo->aCol[i].iMem;
+    }else{
+      iMem = pAggInfo->aFunc[i-pAggInfo->nColumn].iMem;
+    }
+    if( i==0 || iMem<iMin ) iMin = iMem;
+    if( i==0 || iMem>iMax ) iMax = iMem;
+  }
+  if( nReg>0 && iMax-iMin+1!=nReg ) return 0;
+  *piReg = iMin;
+  *pnReg = nReg;
+  return 1;
+}
+
 /*
 ** Generate code for the SELECT statement given in the p argument.  
 **
@@ -3859,7 +3905,7 @@ int sqlite4Select(
   ** Use the SQLITE4_GroupByOrder flag with SQLITE4_TESTCTRL_OPTIMIZER
   ** to disable this optimization for testing purposes.
   */
-  if( sqlite4ExprListCompare(p->pGroupBy, pOrderBy)==0
+  if( sqlite4ExprListCompare(p->pGroupBy, pOrderBy, -1)==0
          && (db->flags & SQLITE4_GroupByOrder)==0 ){
     pOrderBy = 0;
   }
@@ -3880,7 +3926,7 @@ int sqlite4Select(
   ** BY and DISTINCT, and an index or separate temp-table for the other.
   */
   if( (p->selFlags & (SF_Distinct|SF_Aggregate))==SF_Distinct 
-   && sqlite4ExprListCompare(pOrderBy, p->pEList)==0
+   && sqlite4ExprListCompare(pOrderBy, p->pEList, -1)==0
   ){
     p->selFlags &= ~SF_Distinct;
     p->pGroupBy = sqlite4ExprListDup(db, p->pEList, 0);
@@ -3920,18 +3966,24 @@ int sqlite4Select(
   iEnd = sqlite4VdbeMakeLabel(v);
   p->nSelectRow = (double)LARGEST_INT64;
   computeLimitRegisters(pParse, p, iEnd);
-  if( p->iLimit==0 && addrSortIndex>=0 ){
-    sqlite4VdbeGetOp(v, addrSortIndex)->opcode = OP_SorterOpen;
-    p->selFlags |= SF_UseSorter;
+  if( addrSortIndex>=0 ){
+    if( p->iLimit==0 ){
+      sqlite4VdbeGetOp(v, addrSortIndex)->opcode = OP_SorterOpen;
+      p->selFlags |= SF_UseSorter;
+    }else{
+      sqlite4VdbeGetOp(v, addrSortIndex)->opcode = OP_TopNOpen;
+    }
   }
 
-  /* Open a virtual index to use for the distinct set.
+  /* Open a virtual index to use for the distinct set. It is only used to
+  ** test whether or not a row has been seen before, so open it as a hash
+  ** set (P3!=0).
   */
   if( p->selFlags & SF_Distinct ){
     KeyInfo *pKeyInfo;
     distinct = pParse->nTab++;
     pKeyInfo = keyInfoFromExprList(pParse, p->pEList, 0);
-    addrDistinctIndex = sqlite4VdbeAddOp4(v, OP_OpenEphemeral, distinct, 0, 0,
+    addrDistinctIndex = sqlite4VdbeAddOp4(v, OP_OpenEphemeral, distinct, 0, 1,
         (char*)pKeyInfo, P4_KEYINFO_HANDOFF);
   }else{
     distinct = addrDistinctIndex = -1;
@@ -4079,6 +4131,13 @@ int sqlite4Select(
       int addrSortingIdx; /* The OP_OpenEphemeral for the sorting index */
       int addrReset;      /* Subroutine for resetting the accumulator */
       int regReset;       /* Return address register for reset subroutine */
+      int iHashCsr;       /* Cursor for the GROUP BY hash table, or -1 */
+      int addrHashOpen;   /* The OP_AggHashOpen for the hash table */
+      int addrFlush;      /* Subroutine to output groups from hash table */
+      int regFlush;       /* Return address register for flush subroutine */
+      int addrFinal;      /* Output remaining groups from hash table */
+      int iReg, nReg;     /* Accumulator registers */
+      int regKey = 0;     /* Current key from the sorting index */
 
       /* If there is a GROUP BY clause we might need a sorting index to
       ** implement it.  Allocate that sorting index now.  If it turns out
@@ -4091,6 +4150,17 @@ int sqlite4Select(
           sAggInfo.sortingIdx, sAggInfo.nSortingColumn, 
           0, (char*)pKeyInfo, P4_KEYINFO_HANDOFF);
 
+      /* If the input turns out not to be in GROUP BY order, a hash table
+      ** is used to accumulate groups if possible. Open it now. If it is
+      ** not needed, the OP_AggHashOpen is converted to a Noop below.  */
+      iHashCsr = -1;
+      addrHashOpen = -1;
+      if( aggHashUsable(&sAggInfo, &iReg, &nReg) ){
+        iHashCsr = pParse->nTab++;
+        addrHashOpen = sqlite4VdbeAddOp3(v, OP_AggHashOpen, iHashCsr,
+            iReg, nReg);
+      }
+
       /* Initialize memory locations used by GROUP BY aggregate processing
       */
       iUseFlag = ++pParse->nMem;
@@ -4099,6 +4169,9 @@ int sqlite4Select(
       addrOutputRow = sqlite4VdbeMakeLabel(v);
       regReset = ++pParse->nMem;
       addrReset = sqlite4VdbeMakeLabel(v);
+      regFlush = ++pParse->nMem;
+      addrFlush = sqlite4VdbeMakeLabel(v);
+      addrFinal = sqlite4VdbeMakeLabel(v);
       iAMem = pParse->nMem + 1;
       pParse->nMem += pGroupBy->nExpr;
       iBMem = pParse->nMem + 1;
@@ -4139,6 +4212,10 @@ int sqlite4Select(
             (char*)pKeyInfo, P4_KEYINFO);
         j1 = sqlite4VdbeCurrentAddr(v);
         sqlite4VdbeAddOp3(v, OP_Jump, j1+1, 0, j1+1);
+        if( iHashCsr>=0 ){
+          sqlite4VdbeChangeToNoop(v, addrHashOpen);
+          iHashCsr = -1;
+        }
       }else{
         /* Rows are coming out in undetermined order.  We have to push
         ** each row into a sorting index, terminate the first loop,
@@ -4147,10 +4224,12 @@ int sqlite4Select(
         int regBase;
         int nCol = sAggInfo.nColumn;
         int nGroup = pGroupBy->nExpr;
-        int regKey = ++pParse->nMem;
         int regRecord = 0;
+        int addrSpill = 0;    /* OP_AggHashFind instruction */
+        int addrNextRow = 0;  /* Jump from hash table code to next row */
 
         groupBySort = 1;
+        regKey = ++pParse->nMem;
 
         explainTempTable(pParse, 
             isDistinct && !(p->selFlags&SF_Distinct)?"DISTINCT":"GROUP BY");
@@ -4162,6 +4241,24 @@ int sqlite4Select(
         sqlite4ExprCacheClear(pParse);
         regBase = sqlite4GetTempRange(pParse, nGroup);
         sqlite4ExprCodeExprList(pParse, pGroupBy, regBase, 0);
+
+        /* If a hash table is in use, look the group up in the hash table
+        ** and update its accumulators directly from the current row. The
+        ** hash table key is the same as the sorting index key, less the
+        ** sequence number. Rows are only passed to the sorting index if 
+        ** the hash table is full.  */
+        if( iHashCsr>=0 ){
+          int regHashKey = ++pParse->nMem;
+          sqlite4VdbeAddOp4Int(v, OP_MakeKey, regBase, nGroup, regHashKey,
+                                  sAggInfo.sortingIdx);
+          addrSpill = sqlite4VdbeAddOp3(v, OP_AggHashFind, iHashCsr, 0,
+                                           regHashKey);
+          updateAccumulator(pParse, &sAggInfo);
+          sqlite4VdbeAddOp1(v, OP_AggHashSave, iHashCsr);
+          addrNextRow = sqlite4VdbeAddOp0(v, OP_Goto);
+          sqlite4VdbeJumpHere(v, addrSpill);
+        }
+
         sqlite4VdbeAddOp4Int(v, OP_MakeKey, regBase, nGroup, regKey, 
                                 sAggInfo.sortingIdx);
         sqlite4VdbeChangeP5(v, OPFLAG_SEQCOUNT);
@@ -4194,10 +4291,12 @@ int sqlite4Select(
         sqlite4VdbeAddOp3(
             v, OP_Insert, sAggInfo.sortingIdx, regRecord, regKey
         );
+        if( addrNextRow ) sqlite4VdbeJumpHere(v, addrNextRow);
         sqlite4WhereEnd(pWInfo);
 
         sqlite4VdbeAddOp2(v, OP_Null, 0, regKey);
-        sqlite4VdbeAddOp2(v, OP_SorterSort, sAggInfo.sortingIdx, addrEnd);
+        sqlite4VdbeAddOp2(v, OP_SorterSort, sAggInfo.sortingIdx,
+                          iHashCsr>=0 ? addrFinal : addrEnd);
         VdbeComment((v, "GROUP BY sort"));
         sAggInfo.useSortingIdx = 1;
         sqlite4ExprCacheClear(pParse);
@@ -4222,6 +4321,10 @@ int sqlite4Select(
       VdbeComment((v, "output one row"));
       sqlite4VdbeAddOp2(v, OP_IfPos, iAbortFlag, addrEnd);
       VdbeComment((v, "check abort flag"));
+      if( iHashCsr>=0 ){
+        sqlite4VdbeAddOp2(v, OP_Gosub, regFlush, addrFlush);
+        VdbeComment((v, "output smaller groups from hash table"));
+      }
       sqlite4VdbeAddOp2(v, OP_Gosub, regReset, addrReset);
       VdbeComment((v, "reset accumulator"));
 
@@ -4247,10 +4350,37 @@ int sqlite4Select(
       sqlite4VdbeAddOp2(v, OP_Gosub, regOutputRow, addrOutputRow);
       VdbeComment((v, "output final row"));
 
+      /* Output any groups remaining in the hash table. These all have
+      ** keys larger than any group read from the sorting index.  */
+      if( iHashCsr>=0 ){
+        sqlite4VdbeResolveLabel(v, addrFinal);
+        sqlite4VdbeAddOp2(v, OP_Null, 0, regKey);
+        sqlite4VdbeAddOp2(v, OP_Gosub, regFlush, addrFlush);
+        VdbeComment((v, "output remaining groups from hash table"));
+      }
+
       /* Jump over the subroutines
       */
       sqlite4VdbeAddOp2(v, OP_Goto, 0, addrEnd);
 
+      /* Generate a subroutine that outputs each group in the hash table
+      ** with a key smaller than the one in register regKey (or all
+      ** remaining groups if regKey is NULL). The groups are read from
+      ** the hash table in key order, so merging them with the groups
+      ** read from the sorting index returns all groups in key order.
+      */
+      if( iHashCsr>=0 ){
+        int addrTop;
+        sqlite4VdbeResolveLabel(v, addrFlush);
+        addrTop = sqlite4VdbeAddOp3(v, OP_AggHashNext, iHashCsr, 0, regKey);
+        sqlite4VdbeAddOp2(v, OP_Integer, 1, iUseFlag);
+        sqlite4VdbeAddOp2(v, OP_Gosub, regOutputRow, addrOutputRow);
+        sqlite4VdbeAddOp2(v, OP_IfPos, iAbortFlag, addrEnd);
+        sqlite4VdbeAddOp2(v, OP_Goto, 0, addrTop);
+        sqlite4VdbeJumpHere(v, addrTop);
+        sqlite4VdbeAddOp1(v, OP_Return, regFlush);
+      }
+
       /* Generate a subroutine that outputs a single row of the result
       ** set.  This subroutine first looks at the iUseFlag.  If iUseFlag
       ** is less than or equal to zero, the subroutine is a no-op.  If
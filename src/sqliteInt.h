@@ -15,7 +15,6 @@
 #ifndef _SQLITEINT_H_
 #define _SQLITEINT_H_
 
-#define SQLITE4_OMIT_PROGRESS_CALLBACK 1
 #define SQLITE4_OMIT_VIRTUALTABLE 1
 #define SQLITE4_OMIT_LOCALTIME 1
 
@@ -147,6 +146,39 @@
 # define SQLITE4_DEFAULT_MEMSTATUS 1
 #endif
 
+/*
+** The default number of bytes of data an OP_SorterOpen sorter may buffer
+** in memory before it starts writing sorted runs to a temporary file.
+** This can be changed at run-time using "PRAGMA sorter_memory".
+*/
+#if !defined(SQLITE4_DEFAULT_SORTER_MEMORY)
+# define SQLITE4_DEFAULT_SORTER_MEMORY (64*1024*1024)
+#endif
+
+/*
+** SQLITE4_MAX_WORKER_THREADS is the default upper limit on the number of
+** worker threads a single sorter may use. It can be changed for each
+** environment using SQLITE4_ENVCONFIG_WORKER_THREADS. The number of
+** threads actually used by each connection is set by "PRAGMA threads",
+** which defaults to SQLITE4_DEFAULT_WORKER_THREADS. Worker threads are
+** only used if the library is built threadsafe.
+*/
+#if !defined(SQLITE4_MAX_WORKER_THREADS)
+# define SQLITE4_MAX_WORKER_THREADS 8
+#endif
+#if !defined(SQLITE4_DEFAULT_WORKER_THREADS)
+# define SQLITE4_DEFAULT_WORKER_THREADS 0
+#endif
+
+/*
+** The default number of finalized statements each connection keeps for
+** reuse by later calls to sqlite4_prepare() with the same SQL text. This
+** can be changed at run-time using SQLITE4_DBCONFIG_STMTCACHE_SIZE.
+*/
+#if !defined(SQLITE4_DEFAULT_STMTCACHE_SIZE)
+# define SQLITE4_DEFAULT_STMTCACHE_SIZE 32
+#endif
+
 /*
 ** Exactly one of the following macros must be defined in order to
 ** specify which memory allocation subsystem to use.
@@ -601,10 +633,12 @@ typedef struct Module Module;
 typedef struct NameContext NameContext;
 typedef struct Parse Parse;
 typedef struct ParseYColCache ParseYColCache;
+typedef struct RowidHwm RowidHwm;
 typedef struct RowSet RowSet;
 typedef struct Savepoint Savepoint;
 typedef struct Select Select;
 typedef struct Sqlite4InitInfo Sqlite4InitInfo;
+typedef struct SQLiteThread SQLiteThread;
 typedef struct SrcList SrcList;
 typedef struct SrcListItem SrcListItem;
 typedef struct StrAccum StrAccum;
@@ -704,6 +738,27 @@ struct Schema {
   u8 enc;              /* Text encoding used by this database */
   u16 flags;           /* Flags associated with this schema */
   int cache_size;      /* Number of pages to use in the cache */
+  RowidHwm *pRowidHwm; /* Cached largest rowid of tables written to */
+  unsigned int iRowidChng;  /* KV change counter pRowidHwm is valid for */
+  u8 bRowidChng;       /* True if iRowidChng is valid */
+};
+
+/*
+** An instance of the following structure caches the largest rowid
+** currently stored in the table with root number iRoot.  A list of
+** these hangs off of Schema.pRowidHwm.  OP_NewRowid uses the cached
+** value instead of seeking to the end of the table each time a new
+** rowid is required.
+**
+** Entries are created by OP_NewRowid and kept up to date by OP_Insert.
+** They are discarded when the largest row is deleted, when the table
+** is cleared, when a transaction or statement is rolled back and when
+** another connection may have written to the database.
+*/
+struct RowidHwm {
+  int iRoot;           /* Root number of table */
+  i64 iMax;            /* Largest rowid currently in the table */
+  RowidHwm *pNext;     /* Next entry in Schema.pRowidHwm list */
 };
 
 /*
@@ -814,6 +869,8 @@ struct sqlite4 {
   u8 suppressErr;               /* Do not issue error messages if true */
   u8 vtabOnConflict;            /* Value to return for s3_vtab_on_conflict() */
   int nextPagesize;             /* Pagesize after VACUUM if >0 */
+  i64 mxSorterMem;              /* Sorter memory budget in bytes */
+  int nWorker;                  /* Sorter worker threads (PRAGMA threads) */
   int nTable;                   /* Number of tables in the database */
   CollSeq *pDfltColl;           /* The default collating sequence (BINARY) */
   u32 magic;                    /* Magic number for detect library misuse */
@@ -828,6 +885,11 @@ struct sqlite4 {
   int activeVdbeCnt;            /* Number of VDBEs currently executing */
   int writeVdbeCnt;             /* Number of active VDBEs that are writing */
   int vdbeExecCnt;              /* Number of nested calls to VdbeExec() */
+  struct Vdbe *pStmtCache;      /* Finalized VMs available for reuse (MRU) */
+  int nStmtCache;               /* Number of VMs in pStmtCache list */
+  int mxStmtCache;              /* Maximum number of VMs in pStmtCache */
+  int nStmtCacheHit;            /* Prepares satisfied from pStmtCache */
+  int nStmtCacheMiss;           /* Prepares not found in pStmtCache */
   void (*xTrace)(void*,const char*);        /* Trace function */
   void (*xTraceDestroy)(void*);             /* Destructor for trace function */
   void *pTraceArg;                          /* Argument to the trace function */
@@ -913,11 +975,15 @@ struct sqlite4 {
 #define SQLITE4_WriteSchema    0x00020000  /* OK to update SQLITE4_MASTER */
 #define SQLITE4_IgnoreChecks   0x00040000  /* Dont enforce check constraints */
 #define SQLITE4_RecoveryMode   0x00080000  /* Ignore schema errors */
+#define SQLITE4_BatchLookup    0x00100000  /* Sort outer rows before lookups */
+#define SQLITE4_StmtProfile    0x00200000  /* Collect sqlite4_stmt_profile() */
+#define SQLITE4_SkipScan       0x00400000  /* Skip-scan leading index columns */
 #define SQLITE4_ReverseOrder   0x01000000  /* Reverse unordered SELECTs */
 #define SQLITE4_RecTriggers    0x02000000  /* Enable recursive triggers */
 #define SQLITE4_ForeignKeys    0x04000000  /* Enable foreign key constraints */
 #define SQLITE4_AutoIndex      0x08000000  /* Enable automatic indexes */
 #define SQLITE4_PreferBuiltin  0x10000000  /* Preference to built-in funcs */
+#define SQLITE4_HashJoin       0x20000000  /* Automatic indexes use hashing */
 #define SQLITE4_EnableTrigger  0x40000000  /* True to enable triggers */
 
 /*
@@ -964,10 +1030,11 @@ struct sqlite4 {
 #define SQLITE4_FUNC_PRIVATE  0x10 /* Allowed for internal use only */
 #define SQLITE4_FUNC_COUNT    0x20 /* Built-in count(*) aggregate */
 #define SQLITE4_FUNC_COALESCE 0x40 /* Built-in coalesce() or ifnull() func */
+#define SQLITE4_FUNC_VOLATILE 0x80 /* Result may vary for the same arguments */
 
 /*
-** The following three macros, FUNCTION(), LIKEFUNC() and AGGREGATE() are
-** used to create the initializers for the FuncDef structures.
+** The following macros, FUNCTION(), VFUNCTION(), LIKEFUNC() and AGGREGATE()
+** are used to create the initializers for the FuncDef structures.
 **
 **   FUNCTION(zName, nArg, iArg, bNC, xFunc)
 **     Used to create a scalar function definition of a function zName 
@@ -976,6 +1043,12 @@ struct sqlite4 {
 **     as the user-data (sqlite4_context_appdata()) for the function. If 
 **     argument bNC is true, then the SQLITE4_FUNC_NEEDCOLL flag is set.
 **
+**   VFUNCTION(zName, nArg, iArg, bNC, xFunc)
+**     Like FUNCTION except that the SQLITE4_FUNC_VOLATILE flag is set, to
+**     indicate that the function may return different results for the
+**     same arguments (for example random()). Volatile functions may not
+**     be used in index expressions or partial index WHERE clauses.
+**
 **   AGGREGATE(zName, nArg, iArg, bNC, xStep, xFinal)
 **     Used to create an aggregate function definition implemented by
 **     the C functions xStep and xFinal. The first four parameters
@@ -993,6 +1066,9 @@ struct sqlite4 {
 #define FUNCTION(zName, nArg, iArg, bNC, xFunc) \
   {nArg, bNC*SQLITE4_FUNC_NEEDCOLL, \
    SQLITE4_INT_TO_PTR(iArg), 0, xFunc, 0, 0, #zName, 0, 0}
+#define VFUNCTION(zName, nArg, iArg, bNC, xFunc) \
+  {nArg, SQLITE4_FUNC_VOLATILE|(bNC*SQLITE4_FUNC_NEEDCOLL), \
+   SQLITE4_INT_TO_PTR(iArg), 0, xFunc, 0, 0, #zName, 0, 0}
 #define STR_FUNCTION(zName, nArg, pArg, bNC, xFunc) \
   {nArg, bNC*SQLITE4_FUNC_NEEDCOLL, \
    pArg, 0, xFunc, 0, 0, #zName, 0, 0}
@@ -1216,6 +1292,8 @@ struct Table {
 #define TF_Autoincrement   0x08    /* Integer primary key is autoincrement */
 #define TF_Virtual         0x10    /* Is a virtual table */
 #define TF_NeedMetadata    0x20    /* aCol[].zType and aCol[].pColl missing */
+#define TF_RowOffsets      0x40    /* Rows use the offset-table record format */
+#define TF_HasStat1        0x80    /* nRowEst was loaded from sqlite_stat1 */
 
 
 
@@ -1377,6 +1455,8 @@ struct Index {
   IndexSample *aSample;    /* Samples of the left-most key */
 #endif
   Fts5Index *pFts; /* Fts5 data (or NULL if this is not an fts index) */
+  Expr *pPartIdxWhere; /* WHERE clause for partial indices (or NULL) */
+  ExprList *aColExpr;  /* Expressions for XN_EXPR columns (or NULL) */
 
   unsigned bUnordered:1;   /* Use this index for == or IN queries only */
 };
@@ -1388,6 +1468,10 @@ struct Index {
 #define SQLITE4_INDEX_FTS5       3 /* Index is an FTS5 index */
 #define SQLITE4_INDEX_TEMP       4 /* Index is an automatic index */
 
+/* Index.aiColumn[] value for a column that is an expression. The
+** expression itself is stored in Index.aColExpr. */
+#define XN_EXPR (-3)
+
 /* Allowed values for Index.fIndex */
 #define IDX_IntPK             0x01 /* An INTEGER PRIMARY KEY index */
 #define IDX_Unordered         0x02 /* Implemented as a hashing index */
@@ -1980,12 +2064,17 @@ struct NameContext {
   int nErr;            /* Number of errors encountered while resolving names */
   u8 allowAgg;         /* Aggregate functions allowed here */
   u8 hasAgg;           /* True if aggregates are seen */
-  u8 isCheck;          /* True if resolving names in a CHECK constraint */
+  u8 isCheck;          /* NC_IsCheck, NC_PartIdx or NC_IdxExpr, or 0 */
   int nDepth;          /* Depth of subquery recursion. 1 for no recursion */
   AggInfo *pAggInfo;   /* Information about aggregates at this level */
   NameContext *pNext;  /* Next outer name context.  NULL for outermost */
 };
 
+/* Allowed values for NameContext.isCheck */
+#define NC_IsCheck   1    /* Resolving names in a CHECK constraint */
+#define NC_PartIdx   2    /* Resolving names in a partial index WHERE clause */
+#define NC_IdxExpr   3    /* Resolving names in an index expression */
+
 /*
 ** An instance of the following structure contains all information
 ** needed to generate code for a single SELECT statement.
@@ -2173,6 +2262,7 @@ struct Parse {
   int nSet;            /* Number of sets used so far */
   int nOnce;           /* Number of OP_Once instructions so far */
   int ckBase;          /* Base register of data during check constraints */
+  int iPartIdxTab;     /* Table cursor for partial index WHERE clauses */
   int iCacheLevel;     /* ColCache valid when aColCache[].iLevel<=iCacheLevel */
   int iCacheCnt;       /* Counter used to generate aColCache[].lru values */
   int iNewidxReg;      /* First argument to OP_NewIdxid */
@@ -2255,6 +2345,12 @@ struct AuthContext {
 #define OPFLAG_USEKEY        0x04    /* Optimize OP_EncodeData using key content */
 #define OPFLAG_SEQCOUNT      0x08    /* Append sequence number to key */
 #define OPFLAG_CLEARCACHE    0x10    /* Clear pseudo-table cache in OP_Column */
+#define OPFLAG_ROWOFFSETS    0x20    /* OP_MakeRecord uses offset-table format */
+#define OPFLAG_SEEKEQ        0x20    /* OP_SeekGe key is a complete PK */
+#define OPFLAG_EPHEM         0x40    /* OP_Column result may point into row */
+#define OPFLAG_SEEKNEAR      0x80    /* OP_SeekGe may step forward to target */
+#define OPFLAG_KEYPREFIX     0x40    /* OP_SeekXX and OP_MakeKey: first input
+                                     ** register is a key prefix */
 
 /*
  * Each trigger present in the database schema is stored as an instance of
@@ -2418,6 +2514,7 @@ struct sqlite4_env {
   KVFactory *pFactory;              /* List of factories */
   int (*xRandomness)(sqlite4_env*, int, unsigned char*);
   int (*xCurrentTime)(sqlite4_env*, sqlite4_uint64*);
+  int mxWorker;                     /* Max worker threads per sorter */
   /* The above might be initialized to non-zero.  The following need to always
   ** initially be zero, however. */
   int isInit;                       /* True after initialization has finished */
@@ -2443,6 +2540,7 @@ struct Walker {
   union {                                   /* Extra data for callback */
     NameContext *pNC;                          /* Naming context */
     int i;                                     /* Integer value */
+    int *aiCol;                                /* Array of column numbers */
   } u;
 };
 
@@ -2680,6 +2778,7 @@ void sqlite4AddCheckConstraint(Parse*, Expr*);
 void sqlite4AddColumnType(Parse*,Token*);
 void sqlite4AddDefaultValue(Parse*,ExprSpan*);
 void sqlite4AddCollateType(Parse*, Token*);
+void sqlite4AddTableOption(Parse*, Token*, Token*);
 void sqlite4EndTable(Parse*,Token*,Token*,Select*);
 int sqlite4ParseUri(sqlite4_env*,const char*,unsigned int*,char**,char **);
 int sqlite4CodeOnce(Parse *);
@@ -2723,7 +2822,8 @@ void sqlite4SrcListShiftJoinType(SrcList*);
 void sqlite4SrcListAssignCursors(Parse*, SrcList*);
 void sqlite4IdListDelete(sqlite4*, IdList*);
 void sqlite4SrcListDelete(sqlite4*, SrcList*);
-Index *sqlite4CreateIndex(Parse*,CreateIndex*,ExprList*,IdList*,int,Token*,int,int);
+Index *sqlite4CreateIndex(
+    Parse*,CreateIndex*,ExprList*,IdList*,Expr*,int,Token*,int,int);
 void sqlite4DropIndex(Parse*, SrcList*, int);
 int sqlite4Select(Parse*, Select*, SelectDest*);
 Select *sqlite4SelectNew(Parse*,ExprList*,SrcList*,Expr*,ExprList*,
@@ -2773,8 +2873,9 @@ void sqlite4UnlinkAndDeleteIndex(sqlite4*,int,const char*);
 void sqlite4Vacuum(Parse*);
 int sqlite4RunVacuum(char**, sqlite4*);
 char *sqlite4NameFromToken(sqlite4*, Token*);
-int sqlite4ExprCompare(Expr*, Expr*);
-int sqlite4ExprListCompare(ExprList*, ExprList*);
+int sqlite4ExprCompare(Expr*, Expr*, int);
+int sqlite4ExprListCompare(ExprList*, ExprList*, int);
+int sqlite4ExprImpliesExpr(Expr*, Expr*, int);
 void sqlite4ExprAnalyzeAggregates(NameContext*, Expr*);
 void sqlite4ExprAnalyzeAggList(NameContext*,ExprList*);
 Vdbe *sqlite4GetVdbe(Parse*);
@@ -2794,6 +2895,8 @@ int sqlite4ExprNeedsNoAffinityChange(const Expr*, char);
 void sqlite4GenerateRowDelete(Parse*, Table*, int, int, int, Trigger *, int);
 void sqlite4GenerateRowIndexDelete(Parse*, Table*, int, int, int*);
 void sqlite4EncodeIndexKey(Parse *, Index *, int, Index *, int, int, int);
+void sqlite4PartialIndexSkip(Parse*, Index*, int, int, int);
+void sqlite4CodeIndexColumn(Parse*, Index*, int, int, int, int);
 void sqlite4EncodeIndexValue(Parse*, int, Index*, int);
 void sqlite4GenerateConstraintChecks(Parse*,Table*,int,int,
                                      int*,int,int,int,int,int*);
@@ -3005,6 +3108,9 @@ void sqlite4DefaultRowEst(Index*);
 void sqlite4RegisterLikeFunctions(sqlite4*, int);
 int sqlite4IsLikeFunction(sqlite4*,Expr*,int*,char*);
 void sqlite4SchemaClear(sqlite4_env*,Schema*);
+void sqlite4VdbeRowidHwmClear(sqlite4_env*,Schema*);
+int sqlite4ThreadCreate(sqlite4_env*,SQLiteThread**,void*(*)(void*),void*);
+int sqlite4ThreadJoin(sqlite4_env*,SQLiteThread*,void**);
 Schema *sqlite4SchemaGet(sqlite4*);
 int sqlite4SchemaToIndex(sqlite4 *db, Schema *);
 KeyInfo *sqlite4IndexKeyinfo(Parse *, Index *);
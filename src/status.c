@@ -171,6 +171,9 @@ int sqlite4_db_status(
       for(pVdbe=db->pVdbe; pVdbe; pVdbe=pVdbe->pNext){
         sqlite4VdbeDeleteObject(db, pVdbe);
       }
+      for(pVdbe=db->pStmtCache; pVdbe; pVdbe=pVdbe->pNext){
+        sqlite4VdbeDeleteObject(db, pVdbe);
+      }
       db->pnBytesFreed = 0;
 
       *pHighwater = 0;
@@ -192,6 +195,31 @@ int sqlite4_db_status(
       break;
     }
 
+    /*
+    ** Set *pCurrent to the number of statements in the statement cache
+    ** and *pHighwater to its capacity.
+    */
+    case SQLITE4_DBSTATUS_STMTCACHE_USED: {
+      *pCurrent = db->nStmtCache;
+      *pHighwater = db->mxStmtCache;
+      break;
+    }
+
+    /*
+    ** Set *pCurrent to the total number of statement cache hits or misses.
+    ** *pHighwater is always set to zero.
+    */
+    case SQLITE4_DBSTATUS_STMTCACHE_HIT:
+    case SQLITE4_DBSTATUS_STMTCACHE_MISS: {
+      int *pn = (op==SQLITE4_DBSTATUS_STMTCACHE_HIT ? 
+          &db->nStmtCacheHit : &db->nStmtCacheMiss
+      );
+      *pCurrent = *pn;
+      *pHighwater = 0;
+      if( resetFlag ) *pn = 0;
+      break;
+    }
+
     default: {
       rc = SQLITE4_ERROR;
     }
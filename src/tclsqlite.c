@@ -113,6 +113,7 @@ struct SqliteDb {
   Tcl_Interp *interp;        /* The interpreter used for this database */
   char *zTrace;              /* The trace callback routine */
   char *zProfile;            /* The profile callback routine */
+  char *zProgress;           /* The progress callback routine */
   char *zAuth;               /* The authorization callback routine */
   int disableAuth;           /* Disable the authorizer if it exists */
   char *zNull;               /* Text to substitute for an SQL NULL value */
@@ -246,6 +247,9 @@ static void DbDeleteCmd(void *db){
   if( pDb->zProfile ){
     Tcl_Free(pDb->zProfile);
   }
+  if( pDb->zProgress ){
+    Tcl_Free(pDb->zProgress);
+  }
   if( pDb->zAuth ){
     Tcl_Free(pDb->zAuth);
   }
@@ -297,6 +301,25 @@ static void DbProfileHandler(void *cd, const char *zSql, sqlite4_uint64 tm){
 }
 #endif
 
+#ifndef SQLITE4_OMIT_PROGRESS_CALLBACK
+/*
+** This routine is invoked as the 'progress callback' for the database.
+** The TCL script in pDb->zProgress is evaluated. If it returns an error
+** or a non-zero integer, the current statement is interrupted.
+*/
+static int DbProgressHandler(void *cd){
+  SqliteDb *pDb = (SqliteDb*)cd;
+  int rc;
+
+  assert( pDb->zProgress );
+  rc = Tcl_Eval(pDb->interp, pDb->zProgress);
+  if( rc!=TCL_OK || atoi(Tcl_GetStringResult(pDb->interp)) ){
+    return 1;
+  }
+  return 0;
+}
+#endif
+
 static void tclCollateNeeded(
   void *pCtx,
   sqlite4 *db,
@@ -1247,7 +1270,8 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
     "errorcode",          "eval",              "exists",             
     "function",           "interrupt",         
     "nullvalue",          "onecolumn",         "profile",
-    "rekey",              "status",            "total_changes",
+    "progress",           "rekey",             "status",
+    "total_changes",
     "trace",              "transaction",
     "version",            0
   };
@@ -1258,7 +1282,8 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
     DB_ERRORCODE,         DB_EVAL,             DB_EXISTS,            
     DB_FUNCTION,          DB_INTERRUPT,        
     DB_NULLVALUE,         DB_ONECOLUMN,        DB_PROFILE,           
-    DB_REKEY,             DB_STATUS,           DB_TOTAL_CHANGES,    
+    DB_PROGRESS,          DB_REKEY,            DB_STATUS,
+    DB_TOTAL_CHANGES,
     DB_TRACE,             DB_TRANSACTION,
     DB_VERSION
   };
@@ -1924,6 +1949,51 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
     break;
   }
 
+  /*
+  **    $db progress ?N CALLBACK?
+  ** 
+  ** Invoke the given callback every N virtual machine opcodes while executing
+  ** queries. If the callback returns an error or a non-zero integer, the
+  ** current statement is interrupted. With no arguments, return the
+  ** current callback script.
+  */
+  case DB_PROGRESS: {
+    if( objc==2 ){
+      if( pDb->zProgress ){
+        Tcl_AppendResult(interp, pDb->zProgress, 0);
+      }
+    }else if( objc==4 ){
+      char *zProgress;
+      int len;
+      int N;
+      if( TCL_OK!=Tcl_GetIntFromObj(interp, objv[2], &N) ){
+        return TCL_ERROR;
+      }
+      if( pDb->zProgress ){
+        Tcl_Free(pDb->zProgress);
+      }
+      zProgress = Tcl_GetStringFromObj(objv[3], &len);
+      if( zProgress && len>0 ){
+        pDb->zProgress = Tcl_Alloc( len + 1 );
+        memcpy(pDb->zProgress, zProgress, len+1);
+      }else{
+        pDb->zProgress = 0;
+      }
+#ifndef SQLITE4_OMIT_PROGRESS_CALLBACK
+      if( pDb->zProgress ){
+        pDb->interp = interp;
+        sqlite4_progress_handler(pDb->db, N, DbProgressHandler, pDb);
+      }else{
+        sqlite4_progress_handler(pDb->db, 0, 0, 0);
+      }
+#endif
+    }else{
+      Tcl_WrongNumArgs(interp, 2, objv, "N CALLBACK");
+      return TCL_ERROR;
+    }
+    break;
+  }
+
   /*
   **     $db rekey KEY
   **
@@ -0,0 +1,93 @@
+/*
+** 2016 March 14
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains a minimal interface for running a task in a
+** background thread and waiting for it to finish. It is used by the
+** sorter to sort and merge runs in parallel.
+**
+**   sqlite4ThreadCreate()  Start xTask(pIn) running in a new thread.
+**   sqlite4ThreadJoin()    Wait for the thread to finish and free it.
+**
+** If the library is not threadsafe, or threads are not supported on
+** this platform, xTask is run to completion synchronously by
+** sqlite4ThreadCreate() instead. Callers therefore do not need to
+** handle the single-threaded case specially. The same thing happens
+** if a thread cannot be created for any other reason.
+*/
+#include "sqliteInt.h"
+
+#if SQLITE4_OS_UNIX && SQLITE4_THREADSAFE>0
+#include <pthread.h>
+#define SQLITE4_USE_PTHREADS 1
+#endif
+
+/*
+** A running (or, in the synchronous case, finished) task.
+*/
+struct SQLiteThread {
+#ifdef SQLITE4_USE_PTHREADS
+  pthread_t tid;                  /* Thread id */
+  int bDone;                      /* True if the task was run synchronously */
+#endif
+  void *pOut;                     /* Value returned by xTask */
+};
+
+/*
+** Start xTask(pIn) running. If successful, set *ppThread to point to a
+** new thread object and return SQLITE4_OK. The caller must eventually
+** pass the object to sqlite4ThreadJoin(). If an OOM error occurs, set
+** *ppThread to NULL and return SQLITE4_NOMEM. xTask is not run in this
+** case.
+*/
+int sqlite4ThreadCreate(
+  sqlite4_env *pEnv,              /* Environment to allocate from */
+  SQLiteThread **ppThread,        /* OUT: New thread object */
+  void *(*xTask)(void*),          /* Task to run */
+  void *pIn                       /* Argument passed to xTask */
+){
+  SQLiteThread *p;
+
+  *ppThread = 0;
+  p = (SQLiteThread*)sqlite4_malloc(pEnv, sizeof(SQLiteThread));
+  if( p==0 ) return SQLITE4_NOMEM;
+  memset(p, 0, sizeof(SQLiteThread));
+
+#ifdef SQLITE4_USE_PTHREADS
+  if( pthread_create(&p->tid, 0, xTask, pIn)!=0 ){
+    p->bDone = 1;
+    p->pOut = xTask(pIn);
+  }
+#else
+  p->pOut = xTask(pIn);
+#endif
+
+  *ppThread = p;
+  return SQLITE4_OK;
+}
+
+/*
+** Wait for the task started by sqlite4ThreadCreate() to finish. Set
+** *ppOut to the value returned by the task, then free the thread object.
+*/
+int sqlite4ThreadJoin(sqlite4_env *pEnv, SQLiteThread *p, void **ppOut){
+  int rc = SQLITE4_OK;
+
+  assert( p );
+#ifdef SQLITE4_USE_PTHREADS
+  if( p->bDone==0 && pthread_join(p->tid, &p->pOut)!=0 ){
+    rc = SQLITE4_ERROR;
+  }
+#endif
+  if( ppOut ) *ppOut = p->pOut;
+  sqlite4_free(pEnv, p);
+  return rc;
+}
@@ -376,6 +376,31 @@ int sqlite4GetToken(const unsigned char *z, int *tokenType){
   return 1;
 }
 
+#ifndef SQLITE4_OMIT_EXPLAIN
+/*
+** The tokenizer has just read the keywords "EXPLAIN ANALYZE" and z points
+** to the text that follows them. Return true if that text begins a
+** statement that may be profiled by EXPLAIN ANALYZE, or false if ANALYZE
+** is the start of an ANALYZE command being explained.
+*/
+static int isExplainAnalyze(const unsigned char *z){
+  int tokenType;
+  do{
+    z += sqlite4GetToken(z, &tokenType);
+  }while( tokenType==TK_SPACE );
+  switch( tokenType ){
+    case TK_SELECT:
+    case TK_VALUES:
+    case TK_INSERT:
+    case TK_REPLACE:
+    case TK_UPDATE:
+    case TK_DELETE:
+      return 1;
+  }
+  return 0;
+}
+#endif
+
 /*
 ** Run the parser on the given SQL string.  The parser structure is
 ** passed in.  An SQLITE4_ status code is returned.  If an error occurs
@@ -444,6 +469,16 @@ int sqlite4RunParser(Parse *pParse, const char *zSql, char **pzErrMsg){
         /* Fall thru into the default case */
       }
       default: {
+#ifndef SQLITE4_OMIT_EXPLAIN
+        /* "EXPLAIN ANALYZE" followed by a DML statement is EXPLAIN PROFILE.
+        ** The parser cannot tell this apart from EXPLAIN of an ANALYZE
+        ** command with a single token of lookahead. */
+        if( tokenType==TK_ANALYZE && lastTokenParsed==TK_EXPLAIN
+         && isExplainAnalyze((const unsigned char*)&zSql[i])
+        ){
+          tokenType = TK_PROFILE;
+        }
+#endif
         sqlite4Parser(pEngine, tokenType, pParse->sLastToken, pParse);
         lastTokenParsed = tokenType;
         if( pParse->rc!=SQLITE4_OK ){
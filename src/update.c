@@ -79,6 +79,53 @@ void sqlite4ColumnDefault(Vdbe *v, Table *pTab, int i, int iReg){
   }
 }
 
+/*
+** Walker callback used by exprUsesChangedColumn(). Abort the walk if pExpr
+** refers to a column that is assigned a new value by the UPDATE. Array
+** Walker.u.aiCol is the aXRef[] array of sqlite4Update().
+*/
+static int changedColumnRef(Walker *pWalker, Expr *pExpr){
+  if( pExpr->op==TK_COLUMN && pExpr->iColumn>=0
+   && pWalker->u.aiCol[pExpr->iColumn]>=0
+  ){
+    return WRC_Abort;
+  }
+  return WRC_Continue;
+}
+
+/*
+** Return true if expression pExpr, the WHERE clause of a partial index or
+** an indexed expression, refers to one or more of the columns modified by 
+** the UPDATE.
+*/
+static int exprUsesChangedColumn(Expr *pExpr, int *aXRef){
+  Walker w;
+  memset(&w, 0, sizeof(w));
+  w.xExprCallback = changedColumnRef;
+  w.u.aiCol = aXRef;
+  return sqlite4WalkExpr(&w, pExpr)==WRC_Abort;
+}
+
+/*
+** Return true if the entry for a row in index pIdx may change as a result
+** of an UPDATE that modifies the columns identified by aXRef[]. This is
+** the case if any indexed column or expression uses a modified column, or
+** if pIdx is a partial index and its WHERE clause does (so that the row
+** may be added to or removed from the index).
+*/
+static int indexChanged(Index *pIdx, int *aXRef){
+  int i;
+  for(i=0; i<pIdx->nColumn; i++){
+    int iCol = pIdx->aiColumn[i];
+    if( iCol==XN_EXPR ){
+      if( exprUsesChangedColumn(pIdx->aColExpr->a[i].pExpr, aXRef) ) return 1;
+    }else if( aXRef[iCol]>=0 ){
+      return 1;
+    }
+  }
+  return pIdx->pPartIdxWhere && exprUsesChangedColumn(pIdx->pPartIdxWhere,aXRef);
+}
+
 /*
 ** Process an UPDATE statement.
 **
@@ -274,15 +321,8 @@ void sqlite4Update(
 
   /* Allocate registers for and populate the aRegIdx array. */
   for(j=0, pIdx=pTab->pIndex; pIdx; pIdx=pIdx->pNext, j++){
-    if( pIdx==pPk || hasFK || bChngPk ){
+    if( pIdx==pPk || hasFK || bChngPk || indexChanged(pIdx, aXRef) ){
       aRegIdx[j] = ++pParse->nMem;
-    }else{
-      for(i=0; i<pIdx->nColumn; i++){
-        if( aXRef[pIdx->aiColumn[i]]>=0 ){
-          aRegIdx[j] = ++pParse->nMem;
-          break;
-        }
-      }
     }
   }
 
@@ -490,6 +530,21 @@ void sqlite4Update(
   if( !isView ){
     int j1;                       /* Address of jump instruction */
 
+    /* If there are no BEFORE triggers, affinities have not yet been applied
+    ** to the new row. Apply them now if the table has any partial indexes
+    ** or indexes on expressions, so that their WHERE clauses and indexed
+    ** expressions are evaluated against the values that will actually be
+    ** stored.  */
+    if( (tmask&TRIGGER_BEFORE)==0 ){
+      for(pIdx=pTab->pIndex; pIdx; pIdx=pIdx->pNext){
+        if( pIdx->pPartIdxWhere || pIdx->aColExpr ) break;
+      }
+      if( pIdx ){
+        sqlite4VdbeAddOp2(v, OP_Affinity, regNew, pTab->nCol);
+        sqlite4TableAffinityStr(v, pTab);
+      }
+    }
+
     /* Do constraint checks. */
     assert( bChngPk==0 || bImplicitPk==0 );
     if( bChngPk==0 ) aRegIdx[iPk] = 0;
@@ -175,6 +175,66 @@ void sqlite4VdbeMemStoreType(Mem *pMem){
   }
 }
 
+/*
+** Give each register that refers to the current row of any cursor of
+** VM p a private copy of its value. This is called before the database
+** is written, as a write may invalidate the row buffers of all cursors
+** open on the same store.
+*/
+static void vdbeMaterializeRefs(Vdbe *p){
+  int i;
+  for(i=0; i<p->nCursor; i++){
+    VdbeCursor *pC = p->apCsr[i];
+    if( pC && pC->nRef ) sqlite4VdbeCursorReleaseRefs(pC, 1);
+  }
+}
+
+/*
+** The maximum number of entries OP_SeekGe steps over before giving up
+** and seeking, if the OPFLAG_SEEKNEAR flag is set.
+*/
+#define VDBE_SEEKNEAR_STEPS 8
+
+/*
+** If KV cursor pCur points to an entry smaller than key aProbe[], try to
+** move it to the smallest entry that is greater than or equal to aProbe[]
+** by stepping forward over at most VDBE_SEEKNEAR_STEPS entries. When a
+** series of probes is made in ascending key order the next target is
+** often only a few entries away, and stepping to it is cheaper than a
+** full seek.
+**
+** Return SQLITE4_OK or SQLITE4_INEXACT (as for sqlite4KVCursorSeek()) if
+** the cursor is left pointing to the target entry, or SQLITE4_NOTFOUND
+** if the caller should seek instead.
+*/
+static int vdbeSeekNear(
+  KVCursor *pCur,
+  const KVByteArray *aProbe,
+  KVSize nProbe
+){
+  const KVByteArray *aKey;
+  KVSize nKey;
+  int rc;
+  int i;
+
+  rc = sqlite4KVCursorKey(pCur, &aKey, &nKey);
+  for(i=0; rc==SQLITE4_OK; i++){
+    int c = memcmp(aKey, aProbe, nKey<nProbe ? nKey : nProbe);
+    if( c==0 ) c = nKey - nProbe;
+    if( c>=0 ){
+      /* If the cursor was already at or past aProbe[] to begin with, there
+      ** may be smaller matching entries behind it.  */
+      if( i==0 ) return SQLITE4_NOTFOUND;
+      return (c==0 ? SQLITE4_OK : SQLITE4_INEXACT);
+    }
+    if( i==VDBE_SEEKNEAR_STEPS ) break;
+    rc = sqlite4KVCursorNext(pCur);
+    if( rc==SQLITE4_OK ) rc = sqlite4KVCursorKey(pCur, &aKey, &nKey);
+  }
+  if( rc==SQLITE4_DONE ) rc = SQLITE4_NOTFOUND;
+  return (rc==SQLITE4_OK ? SQLITE4_NOTFOUND : rc);
+}
+
 /*
 ** Allocate VdbeCursor number iCur.  Return a pointer to it.  Return NULL
 ** if we run out of memory.
@@ -210,6 +270,7 @@ static VdbeCursor *allocateCursor(
 
   assert( iCur<p->nCursor );
   if( p->apCsr[iCur] ){
+    sqlite4VdbeCursorReleaseRefs(p->apCsr[iCur], 1);
     sqlite4VdbeFreeCursor(p->apCsr[iCur]);
     p->apCsr[iCur] = 0;
   }
@@ -440,15 +501,47 @@ static int assertFlagsOk(Mem *p){
 #endif
 
 
-#ifdef VDBE_PROFILE
-
 /* 
 ** hwtime.h contains inline assembler code for implementing 
 ** high-performance timing routines.
 */
 #include "hwtime.h"
 
-#endif
+/*
+** Charge the time elapsed since iStart and the KV calls made since the
+** previous call to this function to entry iProf of the profile of VM p.
+*/
+static void vdbeProfileOp(Vdbe *p, int iProf, u64 iStart){
+  VdbeProfile *pProf = &p->aProfile[iProf];
+  pProf->nExec++;
+  pProf->nCycle += sqlite4Hwtime() - iStart;
+  pProf->nSeek += p->aKVCall[KVPROFILE_SEEK];
+  pProf->nStep += p->aKVCall[KVPROFILE_STEP];
+  pProf->nByte += p->aKVCall[KVPROFILE_BYTE];
+  memset(p->aKVCall, 0, sizeof(p->aKVCall));
+}
+
+/*
+** Instruction iOp of the main program, or of a trigger program invoked
+** from it, is about to be executed. Return the index of the entry in
+** p->aProfile[] to charge it to. Instructions in trigger programs are
+** charged to the OP_Program instruction of the main program.
+*/
+static int vdbeProfileIndex(Vdbe *p, int iOp){
+  VdbeFrame *pFrame;
+  for(pFrame=p->pFrame; pFrame; pFrame=pFrame->pParent){
+    iOp = pFrame->pc;
+  }
+  return iOp;
+}
+
+/*
+** If the statement is being profiled, arrange for the KV calls made by
+** KV cursor pKVCur to be counted.
+*/
+static void vdbeProfileCursor(Vdbe *p, KVCursor *pKVCur){
+  if( p->aProfile && pKVCur ) pKVCur->aProfile = p->aKVCall;
+}
 
 /*
 ** The CHECK_FOR_INTERRUPT macro defined here looks to see if the
@@ -463,6 +556,51 @@ static int assertFlagsOk(Mem *p){
 #define CHECK_FOR_INTERRUPT \
    if( db->u1.isInterrupted ) goto abort_due_to_interrupt;
 
+/*
+** If SQLITE4_ENABLE_COMPUTED_GOTO is defined and the compiler supports
+** the "labels as values" extension (gcc and clang), sqlite4VdbeExec()
+** dispatches each instruction with an indirect "goto" through a table of
+** labels instead of through the switch statement. The table is generated
+** by mkopcodeh.awk from the same "case OP_xxx:" lines used to number the
+** opcodes, and each case is preceded by an OPLABEL() line that defines
+** the label. The switch statement is retained, so that builds without
+** the option are unaffected.
+**
+** The instructions that dominate inner loops (OP_Column, OP_Next and
+** friends) end with VDBE_NEXT instead of "break". In computed-goto builds
+** this dispatches the next instruction directly from the end of the
+** current one, so that each has its own indirect branch for the CPU to
+** predict. VDBE_FUSE(OP_xxx) goes one step further for the most common
+** pairs of instructions: if the next instruction is an OP_xxx, it jumps
+** straight to its implementation. Both fall back to "break", and so to
+** the top of the loop, whenever the work done there is needed - for
+** profiling, progress callbacks, or an out2-prerelease instruction.
+*/
+#if defined(SQLITE4_ENABLE_COMPUTED_GOTO) && defined(__GNUC__)
+# define VDBE_COMPUTED_GOTO 1
+#else
+# define VDBE_COMPUTED_GOTO 0
+#endif
+
+#if VDBE_COMPUTED_GOTO
+# ifdef SQLITE4_TEST
+#  define vdbeTestInterrupt() (sqlite4_interrupt_count>0)
+# else
+#  define vdbeTestInterrupt() 0
+# endif
+# define vdbeCanFuse() (bFuse && rc==SQLITE4_OK && !db->mallocFailed \
+    && (aOp[pc+1].opflags & OPFLG_OUT2_PRERELEASE)==0 && !vdbeTestInterrupt())
+# define OPLABEL(X) L_##X:
+# define VDBE_FUSE(X) \
+    if( aOp[pc+1].opcode==X && vdbeCanFuse() ){ pOp = &aOp[++pc]; goto L_##X; }
+# define VDBE_NEXT \
+    if( vdbeCanFuse() ){ pOp = &aOp[++pc]; goto *aLabel[pOp->opcode]; } break
+#else
+# define OPLABEL(X)
+# define VDBE_FUSE(X)
+# define VDBE_NEXT break
+#endif
+
 /*
 ** Transfer error message text from an sqlite4_vtab.zErrMsg (text stored
 ** in memory obtained from sqlite4_malloc) into a Vdbe.zErrMsg (text stored
@@ -541,9 +679,11 @@ int sqlite4VdbeExec(
   Mem *pOut = 0;             /* Output operand */
   int iCompare = 0;          /* Result of last OP_Compare operation */
   int *aPermute = 0;         /* Permutation of columns for OP_Compare */
-#ifdef VDBE_PROFILE
-  u64 start;                 /* CPU clock count at start of opcode */
-  int origPc;                /* Program counter at start of opcode */
+  u64 start = 0;             /* CPU clock count at start of opcode */
+  int iProf = -1;            /* aProfile[] entry for current opcode, or -1 */
+#if VDBE_COMPUTED_GOTO
+  static const void *aLabel[] = OPLABEL_INITIALIZER;
+  int bFuse;                 /* True if VDBE_NEXT may bypass the loop head */
 #endif
   /*** INSERT STACK UNION HERE ***/
 
@@ -562,6 +702,15 @@ int sqlite4VdbeExec(
 #ifndef SQLITE4_OMIT_PROGRESS_CALLBACK
   checkProgress = db->xProgress!=0;
 #endif
+#if VDBE_COMPUTED_GOTO
+  bFuse = (p->aProfile==0);
+#ifndef SQLITE4_OMIT_PROGRESS_CALLBACK
+  if( checkProgress ) bFuse = 0;
+#endif
+#ifdef SQLITE4_DEBUG
+  if( p->trace ) bFuse = 0;
+#endif
+#endif
 #ifdef SQLITE4_DEBUG
   sqlite4BeginBenignMalloc(db->pEnv);
   if( p->pc==0  && (db->flags & SQLITE4_VdbeListing)!=0 ){
@@ -577,10 +726,10 @@ int sqlite4VdbeExec(
   for(pc=p->pc; rc==SQLITE4_OK; pc++){
     assert( pc>=0 && pc<p->nOp );
     if( db->mallocFailed ) goto no_mem;
-#ifdef VDBE_PROFILE
-    origPc = pc;
-    start = sqlite4Hwtime();
-#endif
+    if( p->aProfile ){
+      iProf = vdbeProfileIndex(p, pc);
+      start = sqlite4Hwtime();
+    }
     pOp = &aOp[pc];
 
     /* Only allow tracing if SQLITE4_DEBUG is defined.
@@ -679,6 +828,10 @@ int sqlite4VdbeExec(
     printf("/**\t#p1: %d   #p2: %d   #p3: %d   #p4type: %d   #p5: %d\n",pOp->p1, pOp->p2, pOp->p3, pOp->p4type, pOp->p5);
 
             
+#if VDBE_COMPUTED_GOTO
+    assert( pOp->opcode<ArraySize(aLabel) );
+    goto *aLabel[pOp->opcode];
+#endif
     switch( pOp->opcode ){
 
 /*****************************************************************************
@@ -723,10 +876,11 @@ int sqlite4VdbeExec(
 ** the one at index P2 from the beginning of
 ** the program.
 */
+OPLABEL(OP_Goto)
 case OP_Goto: {             /* jump */
   CHECK_FOR_INTERRUPT;
   pc = pOp->p2 - 1;
-  break;
+  VDBE_NEXT;
 }
 
 /* Opcode:  Gosub P1 P2 * * *
@@ -734,6 +888,7 @@ case OP_Goto: {             /* jump */
 ** Write the current address onto register P1
 ** and then jump to address P2.
 */
+OPLABEL(OP_Gosub)
 case OP_Gosub: {            /* jump */
   assert( pOp->p1>0 && pOp->p1<=p->nMem );
   pIn1 = &aMem[pOp->p1];
@@ -750,6 +905,7 @@ case OP_Gosub: {            /* jump */
 **
 ** Jump to the next instruction after the address in register P1.
 */
+OPLABEL(OP_Return)
 case OP_Return: {           /* in1 */
   pIn1 = &aMem[pOp->p1];
   assert( pIn1->flags & MEM_Int );
@@ -761,6 +917,7 @@ case OP_Return: {           /* in1 */
 **
 ** Swap the program counter with the value in register P1.
 */
+OPLABEL(OP_Yield)
 case OP_Yield: {            /* in1 */
   int pcDest;
   pIn1 = &aMem[pOp->p1];
@@ -779,6 +936,7 @@ case OP_Yield: {            /* in1 */
 ** parameter P1, P2, and P4 as if this were a Halt instruction.  If the
 ** value in register P3 is not NULL, then this routine is a no-op.
 */
+OPLABEL(OP_HaltIfNull)
 case OP_HaltIfNull: {      /* in3 */
   pIn3 = &aMem[pOp->p3];
   if( (pIn3->flags & MEM_Null)==0 ) break;
@@ -804,6 +962,7 @@ case OP_HaltIfNull: {      /* in3 */
 ** every program.  So a jump past the last instruction of the program
 ** is the same as executing Halt.
 */
+OPLABEL(OP_Halt)
 case OP_Halt: {
   if( pOp->p1==SQLITE4_OK && p->pFrame ){
     /* Halt the sub-program. Return control to the parent frame. */
@@ -855,6 +1014,7 @@ case OP_Halt: {
 **
 ** The 32-bit integer value P1 is written into register P2.
 */
+OPLABEL(OP_Integer)
 case OP_Integer: {         /* out2-prerelease */
   pOut->u.num = sqlite4_num_from_int64((i64)pOp->p1);
   MemSetTypeFlag(pOut, MEM_Int);
@@ -867,6 +1027,7 @@ case OP_Integer: {         /* out2-prerelease */
 ** register P2. Set the register flags to MEM_Int if P1 is non-zero,
 ** or MEM_Real otherwise.
 */
+OPLABEL(OP_Num)
 case OP_Num: {            /* out2-prerelease */
   pOut->flags = (pOp->p1 ? MEM_Int : MEM_Real);
   pOut->u.num = *(pOp->p4.pNum);
@@ -878,6 +1039,7 @@ case OP_Num: {            /* out2-prerelease */
 ** P4 points to a nul terminated UTF-8 string. This opcode is transformed 
 ** into an OP_String before it is executed for the first time.
 */
+OPLABEL(OP_String8)
 case OP_String8: {         /* same as TK_STRING, out2-prerelease */
   assert( pOp->p4.z!=0 );
   pOp->opcode = OP_String;
@@ -912,6 +1074,7 @@ case OP_String8: {         /* same as TK_STRING, out2-prerelease */
 **
 ** The string value P4 of length P1 (bytes) is stored in register P2.
 */
+OPLABEL(OP_String)
 case OP_String: {          /* out2-prerelease */
   assert( pOp->p4.z!=0 );
   pOut->flags = MEM_Str|MEM_Static|MEM_Term;
@@ -929,6 +1092,7 @@ case OP_String: {          /* out2-prerelease */
 ** is less than P2 (typically P3 is zero) then only register P2 is
 ** set to NULL
 */
+OPLABEL(OP_Null)
 case OP_Null: {           /* out2-prerelease */
   int cnt;
   cnt = pOp->p3-pOp->p2;
@@ -950,6 +1114,7 @@ case OP_Null: {           /* out2-prerelease */
 ** P4 points to a blob of data P1 bytes long.  Store this
 ** blob in register P2.
 */
+OPLABEL(OP_Blob)
 case OP_Blob: {                /* out2-prerelease */
   assert( pOp->p1 <= SQLITE4_MAX_LENGTH );
   sqlite4VdbeMemSetStr(pOut, pOp->p4.z, pOp->p1, 0, 0, 0);
@@ -965,6 +1130,7 @@ case OP_Blob: {                /* out2-prerelease */
 ** If the parameter is named, then its name appears in P4 and P3==1.
 ** The P4 value is used by sqlite4_bind_parameter_name().
 */
+OPLABEL(OP_Variable)
 case OP_Variable: {            /* out2-prerelease */
   Mem *pVar;       /* Value being transferred */
 
@@ -986,6 +1152,7 @@ case OP_Variable: {            /* out2-prerelease */
 ** left holding a NULL.  It is an error for register ranges
 ** P1..P1+P3-1 and P2..P2+P3-1 to overlap.
 */
+OPLABEL(OP_Move)
 case OP_Move: {
   char *zMalloc;   /* Holding variable for allocated memory */
   int n;           /* Number of registers left to copy */
@@ -1028,6 +1195,7 @@ case OP_Move: {
 ** This instruction makes a deep copy of the value.  A duplicate
 ** is made of any string or blob constant.  See also OP_SCopy.
 */
+OPLABEL(OP_Copy)
 case OP_Copy: {             /* in1, out2 */
   pIn1 = &aMem[pOp->p1];
   pOut = &aMem[pOp->p2];
@@ -1035,7 +1203,7 @@ case OP_Copy: {             /* in1, out2 */
   sqlite4VdbeMemShallowCopy(pOut, pIn1, MEM_Ephem);
   Deephemeralize(pOut);
   REGISTER_TRACE(pOp->p2, pOut);
-  break;
+  VDBE_NEXT;
 }
 
 /* Opcode: SCopy P1 P2 * * *
@@ -1050,6 +1218,7 @@ case OP_Copy: {             /* in1, out2 */
 ** during the lifetime of the copy.  Use OP_Copy to make a complete
 ** copy.
 */
+OPLABEL(OP_SCopy)
 case OP_SCopy: {            /* in1, out2 */
   pIn1 = &aMem[pOp->p1];
   pOut = &aMem[pOp->p2];
@@ -1059,7 +1228,7 @@ case OP_SCopy: {            /* in1, out2 */
   if( pOut->pScopyFrom==0 ) pOut->pScopyFrom = pIn1;
 #endif
   REGISTER_TRACE(pOp->p2, pOut);
-  break;
+  VDBE_NEXT;
 }
 
 /* Opcode: ResultRow P1 P2 * * *
@@ -1070,6 +1239,7 @@ case OP_SCopy: {            /* in1, out2 */
 ** structure to provide access to the top P1 values as the result
 ** row.
 */
+OPLABEL(OP_ResultRow)
 case OP_ResultRow: {
   Mem *pMem;
   int i;
@@ -1136,6 +1306,7 @@ case OP_ResultRow: {
 ** if P3 is the same register as P2, the implementation is able
 ** to avoid a memcpy().
 */
+OPLABEL(OP_Concat)
 case OP_Concat: {           /* same as TK_CONCAT, in1, in2, out3 */
   i64 nByte;
 
@@ -1203,10 +1374,15 @@ case OP_Concat: {           /* same as TK_CONCAT, in1, in2, out3 */
 ** If the value in register P2 is zero the result is NULL.
 ** If either operand is NULL, the result is NULL.
 */
+OPLABEL(OP_Add)
 case OP_Add:                   /* same as TK_PLUS, in1, in2, out3 */
+OPLABEL(OP_Subtract)
 case OP_Subtract:              /* same as TK_MINUS, in1, in2, out3 */
+OPLABEL(OP_Multiply)
 case OP_Multiply:              /* same as TK_STAR, in1, in2, out3 */
+OPLABEL(OP_Divide)
 case OP_Divide:                /* same as TK_SLASH, in1, in2, out3 */
+OPLABEL(OP_Remainder)
 case OP_Remainder: {           /* same as TK_REM, in1, in2, out3 */
   int flags;      /* Combined MEM_* flags from both inputs */
   i64 iA;         /* Integer value of left operand */
@@ -1299,6 +1475,7 @@ arithmetic_result_is_null:
 ** to retrieve the collation sequence set by this opcode is not available
 ** publicly, only to user functions defined in func.c.
 */
+OPLABEL(OP_CollSeq)
 case OP_CollSeq: {
   assert( pOp->p4type==P4_COLLSEQ );
   break;
@@ -1306,6 +1483,7 @@ case OP_CollSeq: {
 
 /* Opcode: Mifunction P1
 */
+OPLABEL(OP_KVMethod)
 case OP_KVMethod: {
   assert( pOp[1].opcode==OP_Function );
   break;
@@ -1313,6 +1491,7 @@ case OP_KVMethod: {
 
 /* Opcode: Mifunction P1
 */
+OPLABEL(OP_Mifunction)
 case OP_Mifunction: {
   pc++;
   pOp++;
@@ -1335,6 +1514,7 @@ case OP_Mifunction: {
 **
 ** See also: AggStep and AggFinal
 */
+OPLABEL(OP_Function)
 case OP_Function: {
   int i;
   Mem *pArg;
@@ -1469,9 +1649,13 @@ case OP_Function: {
 ** Store the result in register P3.
 ** If either input is NULL, the result is NULL.
 */
+OPLABEL(OP_BitAnd)
 case OP_BitAnd:                 /* same as TK_BITAND, in1, in2, out3 */
+OPLABEL(OP_BitOr)
 case OP_BitOr:                  /* same as TK_BITOR, in1, in2, out3 */
+OPLABEL(OP_ShiftLeft)
 case OP_ShiftLeft:              /* same as TK_LSHIFT, in1, in2, out3 */
+OPLABEL(OP_ShiftRight)
 case OP_ShiftRight: {           /* same as TK_RSHIFT, in1, in2, out3 */
   i64 iA;
   u64 uA;
@@ -1529,6 +1713,7 @@ case OP_ShiftRight: {           /* same as TK_RSHIFT, in1, in2, out3 */
 **
 ** To force any register to be an integer, just add 0.
 */
+OPLABEL(OP_AddImm)
 case OP_AddImm: {            /* in1 */
   pIn1 = &aMem[pOp->p1];
   memAboutToChange(p, pIn1);
@@ -1544,6 +1729,7 @@ case OP_AddImm: {            /* in1 */
 ** without data loss, then jump immediately to P2, or if P2==0
 ** raise an SQLITE4_MISMATCH exception.
 */
+OPLABEL(OP_MustBeInt)
 case OP_MustBeInt: {            /* jump, in1 */
   pIn1 = &aMem[pOp->p1];
   applyAffinity(pIn1, SQLITE4_AFF_NUMERIC, encoding);
@@ -1570,6 +1756,7 @@ case OP_MustBeInt: {            /* jump, in1 */
 ** integers, for space efficiency, but after extraction we want them
 ** to have only a real value.
 */
+OPLABEL(OP_RealAffinity)
 case OP_RealAffinity: {                  /* in1 */
   pIn1 = &aMem[pOp->p1];
   if( pIn1->flags & MEM_Int ){
@@ -1589,6 +1776,7 @@ case OP_RealAffinity: {                  /* in1 */
 **
 ** A NULL value is not changed by this routine.  It remains NULL.
 */
+OPLABEL(OP_ToText)
 case OP_ToText: {                  /* same as TK_TO_TEXT, in1 */
   pIn1 = &aMem[pOp->p1];
   memAboutToChange(p, pIn1);
@@ -1611,6 +1799,7 @@ case OP_ToText: {                  /* same as TK_TO_TEXT, in1 */
 **
 ** A NULL value is not changed by this routine.  It remains NULL.
 */
+OPLABEL(OP_ToBlob)
 case OP_ToBlob: {                  /* same as TK_TO_BLOB, in1 */
   pIn1 = &aMem[pOp->p1];
   if( pIn1->flags & MEM_Null ) break;
@@ -1635,6 +1824,7 @@ case OP_ToBlob: {                  /* same as TK_TO_BLOB, in1 */
 **
 ** A NULL value is not changed by this routine.  It remains NULL.
 */
+OPLABEL(OP_ToNumeric)
 case OP_ToNumeric: {                  /* same as TK_TO_NUMERIC, in1 */
   pIn1 = &aMem[pOp->p1];
   sqlite4VdbeMemNumerify(pIn1);
@@ -1651,6 +1841,7 @@ case OP_ToNumeric: {                  /* same as TK_TO_NUMERIC, in1 */
 **
 ** A NULL value is not changed by this routine.  It remains NULL.
 */
+OPLABEL(OP_ToInt)
 case OP_ToInt: {                  /* same as TK_TO_INT, in1 */
   pIn1 = &aMem[pOp->p1];
   if( (pIn1->flags & MEM_Null)==0 ){
@@ -1669,6 +1860,7 @@ case OP_ToInt: {                  /* same as TK_TO_INT, in1 */
 **
 ** A NULL value is not changed by this routine.  It remains NULL.
 */
+OPLABEL(OP_ToReal)
 case OP_ToReal: {                  /* same as TK_TO_REAL, in1 */
   pIn1 = &aMem[pOp->p1];
   memAboutToChange(p, pIn1);
@@ -1751,11 +1943,17 @@ case OP_ToReal: {                  /* same as TK_TO_REAL, in1 */
 ** the content of register P3 is greater than or equal to the content of
 ** register P1.  See the Lt opcode for additional information.
 */
+OPLABEL(OP_Eq)
 case OP_Eq:               /* same as TK_EQ, jump, in1, in3 */
+OPLABEL(OP_Ne)
 case OP_Ne:               /* same as TK_NE, jump, in1, in3 */
+OPLABEL(OP_Lt)
 case OP_Lt:               /* same as TK_LT, jump, in1, in3 */
+OPLABEL(OP_Le)
 case OP_Le:               /* same as TK_LE, jump, in1, in3 */
+OPLABEL(OP_Gt)
 case OP_Gt:               /* same as TK_GT, jump, in1, in3 */
+OPLABEL(OP_Ge)
 case OP_Ge: {             /* same as TK_GE, jump, in1, in3 */
   int res;            /* Result of the comparison of pIn1 against pIn3 */
   char affinity;      /* Affinity to use for comparison */
@@ -1823,7 +2021,7 @@ case OP_Ge: {             /* same as TK_GE, jump, in1, in3 */
   /* Undo any changes made by applyAffinity() to the input registers. */
   pIn1->flags = (pIn1->flags&~MEM_TypeMask) | (flags1&MEM_TypeMask);
   pIn3->flags = (pIn3->flags&~MEM_TypeMask) | (flags3&MEM_TypeMask);
-  break;
+  VDBE_NEXT;
 }
 
 /* Opcode: Permutation P1 * * P4 *
@@ -1836,6 +2034,7 @@ case OP_Ge: {             /* same as TK_GE, jump, in1, in3 */
 ** OP_Halt, or OP_ResultRow.  Typically the OP_Permutation should occur
 ** immediately prior to the OP_Compare.
 */
+OPLABEL(OP_Permutation)
 case OP_Permutation: {
   assert( pOp->p4type==P4_INTARRAY );
   assert( pOp->p4.ai );
@@ -1857,6 +2056,7 @@ case OP_Permutation: {
 ** NULLs are less than numbers, numbers are less than strings,
 ** and strings are less than blobs.
 */
+OPLABEL(OP_Compare)
 case OP_Compare: {
   int n;
   int i;
@@ -1909,6 +2109,7 @@ case OP_Compare: {
 ** in the most recent OP_Compare instruction the P1 vector was less than
 ** equal to, or greater than the P2 vector, respectively.
 */
+OPLABEL(OP_Jump)
 case OP_Jump: {             /* jump */
   if( iCompare<0 ){
     pc = pOp->p1 - 1;
@@ -1938,7 +2139,9 @@ case OP_Jump: {             /* jump */
 ** even if the other input is NULL.  A NULL and false or two NULLs
 ** give a NULL output.
 */
+OPLABEL(OP_And)
 case OP_And:              /* same as TK_AND, in1, in2, out3 */
+OPLABEL(OP_Or)
 case OP_Or: {             /* same as TK_OR, in1, in2, out3 */
   int v1;    /* Left operand:  0==FALSE, 1==TRUE, 2==UNKNOWN or NULL */
   int v2;    /* Right operand: 0==FALSE, 1==TRUE, 2==UNKNOWN or NULL */
@@ -1978,6 +2181,7 @@ case OP_Or: {             /* same as TK_OR, in1, in2, out3 */
 ** boolean complement in register P2.  If the value in register P1 is 
 ** NULL, then a NULL is stored in P2.
 */
+OPLABEL(OP_Not)
 case OP_Not: {                /* same as TK_NOT, in1, out2 */
   pIn1 = &aMem[pOp->p1];
   pOut = &aMem[pOp->p2];
@@ -1995,6 +2199,7 @@ case OP_Not: {                /* same as TK_NOT, in1, out2 */
 ** ones-complement of the P1 value into register P2.  If P1 holds
 ** a NULL then store a NULL in P2.
 */
+OPLABEL(OP_BitNot)
 case OP_BitNot: {             /* same as TK_BITNOT, in1, out2 */
   pIn1 = &aMem[pOp->p1];
   pOut = &aMem[pOp->p2];
@@ -2013,6 +2218,7 @@ case OP_BitNot: {             /* same as TK_BITNOT, in1, out2 */
 **
 ** See also: JumpOnce
 */
+OPLABEL(OP_Once)
 case OP_Once: {             /* jump */
   assert( pOp->p1<p->nOnceFlag );
   if( p->aOnceFlag[pOp->p1] ){
@@ -2035,7 +2241,9 @@ case OP_Once: {             /* jump */
 ** is considered false if it has a numeric value of zero.  If the value
 ** in P1 is NULL then take the jump if P3 is zero.
 */
+OPLABEL(OP_If)
 case OP_If:                 /* jump, in1 */
+OPLABEL(OP_IfNot)
 case OP_IfNot: {            /* jump, in1 */
   int c;
   pIn1 = &aMem[pOp->p1];
@@ -2048,7 +2256,7 @@ case OP_IfNot: {            /* jump, in1 */
   if( c ){
     pc = pOp->p2-1;
   }
-  break;
+  VDBE_NEXT;
 }
 
 /* Opcode: IsNull P1 P2 P3 * *
@@ -2057,6 +2265,7 @@ case OP_IfNot: {            /* jump, in1 */
 ** in an array of a single register. If any registers in the array are
 ** NULL, jump to instruction P2.
 */
+OPLABEL(OP_IsNull)
 case OP_IsNull: {            /* same as TK_ISNULL, jump, in1 */
   Mem *pEnd;
   pIn1 = &aMem[pOp->p1];
@@ -2069,19 +2278,20 @@ case OP_IsNull: {            /* same as TK_ISNULL, jump, in1 */
     }
   }while( (++pIn1)<pEnd );
 
-  break;
+  VDBE_NEXT;
 }
 
 /* Opcode: NotNull P1 P2 * * *
 **
 ** Jump to P2 if the value in register P1 is not NULL.  
 */
+OPLABEL(OP_NotNull)
 case OP_NotNull: {            /* same as TK_NOTNULL, jump, in1 */
   pIn1 = &aMem[pOp->p1];
   if( (pIn1->flags & MEM_Null)==0 ){
     pc = pOp->p2 - 1;
   }
-  break;
+  VDBE_NEXT;
 }
 
 /* Opcode: Column P1 P2 P3 P4 P5
@@ -2102,7 +2312,16 @@ case OP_NotNull: {            /* same as TK_NOTNULL, jump, in1 */
 ** then the cache of the cursor is reset prior to extracting the column.
 ** The first OP_Column against a pseudo-table after the value of the content
 ** register has changed should have this bit set.
+**
+** If the OPFLAG_EPHEM bit is set on P5, a TEXT or BLOB result may be left
+** pointing directly into the row that cursor P1 points to, rather than
+** being copied. The code generator only sets this bit when register P3 is
+** consumed before cursor P1 next advances (a comparison operand, for
+** example). Register P3 is given a copy of its value if cursor P1 is moved
+** in any other way, or if the database is written, while it still refers
+** to the row.
 */
+OPLABEL(OP_Column)
 case OP_Column: {
   int p1;                   /* Index of VdbeCursor to decode */
   int mxField;              /* Maximum column number */
@@ -2129,13 +2348,16 @@ case OP_Column: {
   }
   if( rc==SQLITE4_OK ){
     pDefault = (pOp->p4type==P4_MEM) ? pOp->p4.pMem : 0;
-    rc = sqlite4VdbeDecoderGetColumn(pC->pDecoder, pOp->p2, pDefault, pDest);
+    rc = sqlite4VdbeDecoderGetColumn(pC->pDecoder, pOp->p2, 
+        (pOp->p5 & OPFLAG_EPHEM)!=0, pDefault, pDest
+    );
   }else{
     sqlite4VdbeMemSetNull(pDest);
   }
   UPDATE_MAX_BLOBSIZE(pDest);
   REGISTER_TRACE(pOp->p3, pDest);
-  break;
+  VDBE_FUSE(OP_Column);
+  VDBE_NEXT;
 }
 
 /* Opcode:  MakeKey  P1 P2 P3 P4 P5
@@ -2147,6 +2369,10 @@ case OP_Column: {
 ** If the OPFLAG_SEQCOUNT bit of P5 is set, then a sequence number 
 ** (unique within the cursor) is appended to the record. The sole purpose
 ** of this is to ensure that the key blob is unique within the cursor table.
+**
+** If the OPFLAG_KEYPREFIX bit of P5 is set, then register P1 holds a key
+** prefix stored by OP_SkipScan. The remaining P2-1 values are encoded as
+** the fields that follow it and appended to the prefix.
 */
 /* Opcode:  MakeRecord  P1 P2 P3 P4 P5
 **
@@ -2158,18 +2384,24 @@ case OP_Column: {
 ** an MakeKey opcode, then the data encoding generated may try to refer
 ** to content in the previously generated key in order to make the encoding
 ** smaller.
+**
+** If the OPFLAG_ROWOFFSETS bit of P5 is set, the record is written using
+** the offsets format, in which any column can be located without decoding
+** the columns that precede it.
 */
+OPLABEL(OP_MakeKey)
 case OP_MakeKey:
+OPLABEL(OP_MakeRecord)
 case OP_MakeRecord: {
   VdbeCursor *pC;        /* The cursor for OP_MakeKey */
   Mem *pData0;           /* First field to be combined into the record */
   Mem *pLast;            /* Last field of the record */
   Mem *pMem;             /* For looping over inputs */
   Mem *pOut;             /* Where to store results */
+  Mem *pDest;            /* Where to encode the results */
+  Mem sTmp;              /* Used if register P3 is also an input */
   int nIn;               /* Number of input values to be encoded */
   char *zAffinity;       /* The affinity string */
-  u8 *aRec;              /* The constructed key or value */
-  int nRec;              /* Size of aRec[] in bytes */
   int bRepeat;           /* True to loop to the next opcode */
   u8 aSeq[10];           /* Encoded sequence number */
   int nSeq;              /* Size of sequence number in bytes */
@@ -2186,9 +2418,19 @@ case OP_MakeRecord: {
     assert( pOp->p3>0 && pOp->p3<=p->nMem );
     pOut = &aMem[pOp->p3];
     memAboutToChange(p, pOut);
-    aRec = 0;
     nSeq = 0;
 
+    /* The record is normally encoded directly into the existing allocation
+    ** of register P3, so that no malloc is required once it is large
+    ** enough. This is not possible if P3 is also one of the inputs.  */
+    pDest = pOut;
+    if( pOut>=pData0 && pOut<=pLast ){
+      memset(&sTmp, 0, sizeof(sTmp));
+      sTmp.db = db;
+      sTmp.flags = MEM_Null;
+      pDest = &sTmp;
+    }
+
     /* Apply affinities */
     if( zAffinity ){
       for(pMem=pData0; pMem<=pLast; pMem++){
@@ -2223,10 +2465,20 @@ case OP_MakeRecord: {
         printf("/**        nPK: %d\n", pC->pKeyInfo->nPK);
         printf("/**        nData: %d\n", pC->pKeyInfo->nData);
       /* Generate the key encoding */
-      rc = sqlite4VdbeEncodeKey(
-        db, pData0, nIn, pC->iRoot, pC->pKeyInfo, &aRec, &nRec, nSeq
-      );
-      
+      if( pOp->p5 & OPFLAG_KEYPREFIX ){
+        rc = sqlite4VdbeEncodeKeyWithPrefix(
+          db, pData0, &pData0[1], nIn-1, pC->pKeyInfo, nSeq, pDest
+        );
+      }else{
+        rc = sqlite4VdbeEncodeKeyToMem(
+          db, pData0, nIn, pC->iRoot, pC->pKeyInfo, nSeq, pDest
+        );
+      }
+      if( rc==SQLITE4_OK && nSeq ){
+        memcpy(&pDest->z[pDest->n], &aSeq[sizeof(aSeq)-nSeq], nSeq);
+        pDest->n += nSeq;
+      }
+
       if( pOp[1].opcode==OP_MakeRecord ){
         pc++;
         pOp++;
@@ -2234,17 +2486,22 @@ case OP_MakeRecord: {
       }
     }else{
       assert( pOp->opcode==OP_MakeRecord );
-      rc = sqlite4VdbeEncodeData(db, pData0, aPermute, nIn, &aRec, &nRec);
+      rc = sqlite4VdbeEncodeData(db, pData0, aPermute, nIn,
+          (pOp->p5 & OPFLAG_ROWOFFSETS) ? ROWFORMAT_OFFSETS : ROWFORMAT_VARINT,
+          &p->sScratch, pDest
+      );
       aPermute = 0;
     } 
 
     /* Store the result */
-    if( rc!=SQLITE4_OK ){
-      sqlite4DbFree(db, aRec);
-    }else{
-      if( nSeq ) memcpy(&aRec[nRec], &aSeq[sizeof(aSeq)-nSeq], nSeq);
-      rc = sqlite4VdbeMemSetStr(pOut, (char *)aRec, nRec+nSeq, 0,
-                                SQLITE4_DYNAMIC, 0);
+    if( pDest!=pOut ){
+      if( rc==SQLITE4_OK ){
+        sqlite4VdbeMemMove(pOut, pDest);
+      }else{
+        sqlite4VdbeMemRelease(pDest);
+      }
+    }
+    if( rc==SQLITE4_OK ){
       REGISTER_TRACE(pOp->p3, pOut);
       UPDATE_MAX_BLOBSIZE(pOut);
     }
@@ -2260,6 +2517,7 @@ case OP_MakeRecord: {
 ** string indicates the column affinity that should be used for the nth
 ** memory cell in the range.
 */
+OPLABEL(OP_Affinity)
 case OP_Affinity: {
   const char *zAffinity;   /* The affinity to be applied */
   Mem *pEnd;
@@ -2284,6 +2542,7 @@ case OP_Affinity: {
 ** Store the number of entries (an integer value) in the table or index 
 ** opened by cursor P1 in register P2
 */
+OPLABEL(OP_Count)
 case OP_Count: {         /* out2-prerelease */
   i64 nEntry;
   VdbeCursor *pC;
@@ -2314,6 +2573,7 @@ case OP_Count: {         /* out2-prerelease */
 **     RELEASE          1      <name of savepoint to release>
 **     ROLLBACK TO      2      <name of savepoint to rollback>
 */
+OPLABEL(OP_Savepoint)
 case OP_Savepoint: {
   int iSave;
   Savepoint *pSave;               /* Savepoint object operated upon */
@@ -2423,28 +2683,37 @@ case OP_Savepoint: {
 ** entire transaction. If no error is encountered, the statement transaction
 ** will automatically commit when the VDBE halts.
 */
+OPLABEL(OP_Transaction)
 case OP_Transaction: {
   Db *pDb;
   KVStore *pKV;
   int bStmt;                      /* True to open statement transaction */
   int iLevel;                     /* Savepoint level to open */
+  int iOld;                       /* Transaction level on entry */
 
   assert( pOp->p1>=0 && pOp->p1<db->nDb );
   pDb = &db->aDb[pOp->p1];
   pKV = pDb->pKV;
   if( pKV ){
-    if( pOp->p2==0 ){
-      /* Read transaction needed.  Start if we are not already in one. */
-      if( pKV->iTransLevel==0 ){
-        rc = sqlite4KVStoreBegin(pKV, 1);
-      }
-    }else{
+    iOld = pKV->iTransLevel;
+    if( iOld==0 ){
+      /* Start a read transaction if we are not already in one. This is
+      ** done even if a write transaction is needed, so that the change
+      ** counter is read before the write transaction is opened.  */
+      rc = sqlite4KVStoreBegin(pKV, 1);
+      if( rc==SQLITE4_OK ) sqlite4VdbeRowidHwmValidate(db, pOp->p1);
+    }
+    if( rc==SQLITE4_OK && pOp->p2 ){
       /* A write transaction is needed */
       iLevel = db->nSavepoint + 1;
       if( iLevel<2 ) iLevel = 2;
       bStmt = db->pSavepoint && (p->needSavepoint || db->activeVdbeCnt>1);
       if( pKV->iTransLevel<iLevel ){
         rc = sqlite4KVStoreBegin(pKV, iLevel);
+        if( rc!=SQLITE4_OK && iOld==0 ){
+          /* Do not leave the read transaction opened above open */
+          sqlite4KVStoreRollback(pKV, 0);
+        }
       }
       if( rc==SQLITE4_OK && bStmt ){
         rc = sqlite4KVStoreBegin(pKV, pKV->iTransLevel+1);
@@ -2466,6 +2735,7 @@ case OP_Transaction: {
 ** must be started or there must be an open cursor) before
 ** executing this instruction.
 */
+OPLABEL(OP_ReadCookie)
 case OP_ReadCookie: {               /* out2-prerelease */
   unsigned int iMeta;
   KVStore *pKV;
@@ -2484,10 +2754,13 @@ case OP_ReadCookie: {               /* out2-prerelease */
 ** into cookie number P2 of database P1.  P2==1 is the schema version.  
 ** P2==2 is the database format. P2==3 is the recommended pager cache 
 ** size, and so forth.  P1==0 is the main database file and P1==1 is the 
-** database file used to store temporary tables.
+** database file used to store temporary tables. Since the schema is being
+** changed, all statements in the connection's statement cache are 
+** discarded, and this VM is not added to the cache when it is finalized.
 **
 ** A transaction must be started before executing this opcode.
 */
+OPLABEL(OP_SetCookie)
 case OP_SetCookie: {       /* in3 */
   Db *pDb;
   i64 v;
@@ -2500,6 +2773,8 @@ case OP_SetCookie: {       /* in3 */
   rc = sqlite4KVStorePutSchema(pDb->pKV, (u32)v);
   pDb->pSchema->schema_cookie = (int)v;
   db->flags |= SQLITE4_InternChanges;
+  sqlite4VdbeStmtCacheClear(db);
+  p->noStmtCache = 1;
   if( pOp->p1==1 ){
     /* Invalidate all prepared statements whenever the TEMP database
     ** schema is changed.  Ticket #1644 */
@@ -2521,12 +2796,14 @@ case OP_SetCookie: {       /* in3 */
 **
 ** The cookie changes its value whenever the database schema changes.
 ** This operation is used to detect when that the cookie has changed
-** and that the current process needs to reread the schema.
+** and that the current process needs to reread the schema. If it has,
+** all statements in the connection's statement cache are discarded.
 **
 ** Either a transaction needs to have been started or an OP_Open needs
 ** to be executed (to establish a read lock) before this opcode is
 ** invoked.
 */
+OPLABEL(OP_VerifyCookie)
 case OP_VerifyCookie: {
   unsigned int iMeta;
   int iGen;
@@ -2560,6 +2837,7 @@ case OP_VerifyCookie: {
     if( db->aDb[pOp->p1].pSchema->schema_cookie!=iMeta ){
       sqlite4ResetInternalSchema(db, pOp->p1);
     }
+    sqlite4VdbeStmtCacheClear(db);
 
     p->expired = 1;
     rc = SQLITE4_SCHEMA;
@@ -2616,7 +2894,9 @@ case OP_VerifyCookie: {
 **
 ** See also OpenRead.
 */
+OPLABEL(OP_OpenRead)
 case OP_OpenRead:
+OPLABEL(OP_OpenWrite)
 case OP_OpenWrite: {
   int nField;
   KeyInfo *pKeyInfo;
@@ -2674,11 +2954,12 @@ case OP_OpenWrite: {
   pCur->iRoot = p2;
   printf("pCur->iRoot: %d\n", pCur->iRoot);
   rc = sqlite4KVStoreOpenCursor(pX, &pCur->pKVCur);
+  if( rc==SQLITE4_OK ) vdbeProfileCursor(p, pCur->pKVCur);
   pCur->pKeyInfo = pKeyInfo;
   break;
 }
 
-/* Opcode: OpenEphemeral P1 P2 * P4 P5
+/* Opcode: OpenEphemeral P1 P2 P3 P4 P5
 **
 ** Open a new cursor P1 to a transient table.
 ** The cursor is always opened read/write even if 
@@ -2700,15 +2981,26 @@ case OP_OpenWrite: {
 ** in btree.h.  These flags control aspects of the operation of
 ** the btree.  The BTREE_OMIT_JOURNAL and BTREE_SINGLE flags are
 ** added automatically.
+**
+** If P3 is non-zero, the table is only used to test whether or not keys
+** are present (using OP_Found and OP_NotFound) and whether or not it is
+** empty (using OP_Rewind). In this case it is implemented as a hash set
+** (see vdbeset.c) instead of an ordered table.
 */
-/* Opcode: OpenAutoindex P1 P2 * P4 *
+/* Opcode: OpenAutoindex P1 P2 P3 P4 *
 **
 ** This opcode works the same as OP_OpenEphemeral.  It has a
 ** different name to distinguish its use.  Tables created using
 ** by this opcode will be used for automatically created transient
 ** indices in joins.
+**
+** If P3 is greater than zero, the index is only ever searched for
+** entries whose first P3 fields are equal to a probe key. In this case
+** it is implemented as a hash table on those fields (see vdbejoin.c).
 */
+OPLABEL(OP_OpenAutoindex)
 case OP_OpenAutoindex: 
+OPLABEL(OP_OpenEphemeral)
 case OP_OpenEphemeral: {
   VdbeCursor *pCx;
 
@@ -2717,10 +3009,17 @@ case OP_OpenEphemeral: {
   if( pCx==0 ) goto no_mem;
   pCx->nullRow = 1;
 
-  rc = sqlite4KVStoreOpen(db, "ephm", 0, &pCx->pTmpKV,
-          SQLITE4_KVOPEN_TEMPORARY | SQLITE4_KVOPEN_NO_TRANSACTIONS
-  );
+  if( pOp->opcode==OP_OpenAutoindex && pOp->p3>0 ){
+    rc = sqlite4VdbeHashJoinOpen(db, pOp->p3, &pCx->pTmpKV);
+  }else if( pOp->opcode==OP_OpenEphemeral && pOp->p3 ){
+    rc = sqlite4VdbeHashSetOpen(db, &pCx->pTmpKV);
+  }else{
+    rc = sqlite4KVStoreOpen(db, "ephm", 0, &pCx->pTmpKV,
+            SQLITE4_KVOPEN_TEMPORARY | SQLITE4_KVOPEN_NO_TRANSACTIONS
+    );
+  }
   if( rc==SQLITE4_OK ) rc = sqlite4KVStoreOpenCursor(pCx->pTmpKV, &pCx->pKVCur);
+  if( rc==SQLITE4_OK ) vdbeProfileCursor(p, pCx->pKVCur);
   if( rc==SQLITE4_OK ) rc = sqlite4KVStoreBegin(pCx->pTmpKV, 2);
 
   pCx->pKeyInfo = pOp->p4.pKeyInfo;
@@ -2728,16 +3027,54 @@ case OP_OpenEphemeral: {
   break;
 }
 
-/* Opcode: OpenSorter P1 P2 * P4 *
+/* Opcode: SorterOpen P1 P2 * P4 P5
 **
 ** This opcode works like OP_OpenEphemeral except that it opens
 ** a transient index that is specifically designed to sort large
 ** tables using an external merge-sort algorithm.
+**
+** The index may only be written using OP_Insert until the first call
+** to OP_SorterSort. After that it may only be read, in order.
+**
+** If P5 is non-zero, the keys written to the sorter are encoded for
+** some other table or index (for example by OP_MakeKey using a cursor
+** open on that index). Such keys may be read using OP_RowKey and
+** OP_RowData, but not OP_Column.
 */
+/* Opcode: TopNOpen P1 P2 * P4 *
+**
+** This opcode works like OP_SorterOpen except that it opens a transient
+** index used to sort the rows of an ORDER BY ... LIMIT query. The index
+** is kept in memory as a heap, so that its largest entry can be found
+** using OP_Last and removed using OP_Delete cheaply. The caller is
+** responsible for removing entries to keep the size of the index bounded.
+**
+** Other than OP_Last and OP_Delete, the index may only be written using
+** OP_Insert until it is first read using OP_Sort. After that it may only
+** be read, in order.
+*/
+OPLABEL(OP_TopNOpen)
+case OP_TopNOpen:
+OPLABEL(OP_SorterOpen)
 case OP_SorterOpen: {
-  /* VdbeCursor *pCx; */
-  pOp->opcode = OP_OpenEphemeral;
-  pc--;
+  VdbeCursor *pCx;
+
+  assert( pOp->p1>=0 );
+  pCx = allocateCursor(p, pOp->p1, pOp->p2, -1, 1);
+  if( pCx==0 ) goto no_mem;
+  pCx->nullRow = 1;
+
+  if( pOp->opcode==OP_TopNOpen ){
+    rc = sqlite4VdbeTopNOpen(db, &pCx->pTmpKV);
+  }else{
+    rc = sqlite4VdbeSorterOpen(db, &pCx->pTmpKV);
+    if( pOp->p5 ) pCx->iRoot = KVSTORE_ROOT;
+  }
+  if( rc==SQLITE4_OK ) rc = sqlite4KVStoreOpenCursor(pCx->pTmpKV, &pCx->pKVCur);
+  if( rc==SQLITE4_OK ) vdbeProfileCursor(p, pCx->pKVCur);
+  if( rc==SQLITE4_OK ) rc = sqlite4KVStoreBegin(pCx->pTmpKV, 2);
+
+  pCx->pKeyInfo = pOp->p4.pKeyInfo;
   break;
 }
 
@@ -2746,8 +3083,12 @@ case OP_SorterOpen: {
 ** Close a cursor previously opened as P1.  If P1 is not
 ** currently open, this instruction is a no-op.
 */
+OPLABEL(OP_Close)
 case OP_Close: {
   assert( pOp->p1>=0 && pOp->p1<p->nCursor );
+  if( p->apCsr[pOp->p1] ){
+    sqlite4VdbeCursorReleaseRefs(p->apCsr[pOp->p1], 1);
+  }
   sqlite4VdbeFreeCursor(p->apCsr[pOp->p1]);
   p->apCsr[pOp->p1] = 0;
   break;
@@ -2769,6 +3110,7 @@ case OP_Close: {
 ** row does not exist in the PRIMARY KEY table, then the
 ** sqlite3VdbeCursorMoveto() routine will throw an SQLITE4_CORRUPT error.
 */
+OPLABEL(OP_SeekPk)
 case OP_SeekPk: {
   KVByteArray *aKey;              /* Key data from cursor pIdx */
   KVSize nKey;                    /* Size of aKey[] in bytes */
@@ -2779,6 +3121,7 @@ case OP_SeekPk: {
 
   pPk = p->apCsr[pOp->p1];
   pIdx = p->apCsr[pOp->p3];
+  sqlite4VdbeCursorReleaseRefs(pPk, 1);
 
   if( pIdx->pFts ){
     rc = sqlite4Fts5Pk(pIdx->pFts, pPk->iRoot, &aKey, &nKey);
@@ -2805,7 +3148,7 @@ case OP_SeekPk: {
   break;
 }
 
-/* Opcode: SeekGe P1 P2 P3 P4 *
+/* Opcode: SeekGe P1 P2 P3 P4 P5
 **
 ** P1 identifies an open database cursor. The cursor is repositioned so
 ** that it points to the smallest entry in its index that is greater than
@@ -2815,6 +3158,21 @@ case OP_SeekPk: {
 ** If there are no records greater than or equal to the key and P2 is 
 ** not zero, then jump to P2.
 **
+** If the OPFLAG_SEEKNEAR bit of P5 is set and the cursor already points
+** to an entry smaller than the key, it is first moved forward a few
+** entries at a time in case the target is nearby. This is used when
+** the keys are known to be visited in ascending order.
+**
+** If the OPFLAG_SEEKEQ bit of P5 is set, the key is a complete primary
+** key and the cursor is not stepped afterwards. An exact-match seek is
+** used instead, so that the lookup may be answered by a row cache, and
+** the jump is taken if there is no such entry.
+**
+** If the OPFLAG_KEYPREFIX bit of P5 is set, then register P3 holds a key
+** prefix stored by OP_SkipScan and the key is formed by appending the
+** values in the following P4-1 registers to it. This applies to all four
+** SeekXX opcodes.
+**
 ** See also: Found, NotFound, Distinct, SeekLt, SeekGt, SeekLe
 */
 /* Opcode: SeekGt P1 P2 P3 P4 *
@@ -2853,9 +3211,13 @@ case OP_SeekPk: {
 **
 ** See also: Found, NotFound, Distinct, SeekGt, SeekGe, SeekLt
 */
+OPLABEL(OP_SeekLt)
 case OP_SeekLt:         /* jump, in3 */
+OPLABEL(OP_SeekLe)
 case OP_SeekLe:         /* jump, in3 */
+OPLABEL(OP_SeekGe)
 case OP_SeekGe:         /* jump, in3 */
+OPLABEL(OP_SeekGt)
 case OP_SeekGt: {       /* jump, in3 */
   int op;                         /* Copy of pOp->opcode (the op-code) */
   VdbeCursor *pC;                 /* Cursor P1 */
@@ -2870,6 +3232,7 @@ case OP_SeekGt: {       /* jump, in3 */
   pC->nullRow = 0;
   pC->sSeekKey.n = 0;
   pC->rowChnged = 1;
+  sqlite4VdbeCursorReleaseRefs(pC, 1);
 
   assert( pOp->p1>=0 && pOp->p1<p->nCursor );
   assert( pOp->p2!=0 );
@@ -2888,9 +3251,23 @@ case OP_SeekGt: {       /* jump, in3 */
   nField = pOp->p4.i;
   pIn3 = &aMem[pOp->p3];
   if( pC->iRoot!=KVSTORE_ROOT ){
-    rc = sqlite4VdbeEncodeKey(
-        db, pIn3, nField, pC->iRoot, pC->pKeyInfo, &aProbe, &nProbe, 1
-    );
+    if( pOp->p5 & OPFLAG_KEYPREFIX ){
+      /* The probe is built in a temporary Mem cell. Its buffer is then
+      ** handed over to aProbe, which is freed with sqlite4DbFree() below. */
+      Mem sProbe;
+      memset(&sProbe, 0, sizeof(sProbe));
+      sProbe.db = db;
+      sProbe.flags = MEM_Null;
+      rc = sqlite4VdbeEncodeKeyWithPrefix(
+          db, pIn3, &pIn3[1], nField-1, pC->pKeyInfo, 1, &sProbe
+      );
+      aProbe = (KVByteArray *)sProbe.zMalloc;
+      nProbe = sProbe.n;
+    }else{
+      rc = sqlite4VdbeEncodeKey(
+          db, pIn3, nField, pC->iRoot, pC->pKeyInfo, &aProbe, &nProbe, 1
+      );
+    }
 
     /*   Opcode    search-dir    increment-key
     **  --------------------------------------
@@ -2901,7 +3278,15 @@ case OP_SeekGt: {       /* jump, in3 */
     */
     if( op==OP_SeekLe || op==OP_SeekGt ) aProbe[nProbe++] = 0xFF;
     if( rc==SQLITE4_OK ){
-      rc = sqlite4KVCursorSeek(pC->pKVCur, aProbe, nProbe, dir);
+      assert( op==OP_SeekGe || (pOp->p5 & OPFLAG_SEEKNEAR)==0 );
+      assert( op==OP_SeekGe || (pOp->p5 & OPFLAG_SEEKEQ)==0 );
+      if( pOp->p5 & OPFLAG_SEEKEQ ){
+        rc = sqlite4KVCursorSeek(pC->pKVCur, aProbe, nProbe, 0);
+      }else if( (pOp->p5 & OPFLAG_SEEKNEAR)==0
+       || (rc = vdbeSeekNear(pC->pKVCur, aProbe, nProbe))==SQLITE4_NOTFOUND
+      ){
+        rc = sqlite4KVCursorSeek(pC->pKVCur, aProbe, nProbe, dir);
+      }
     }
   }else{
     Stringify(pIn3, encoding);
@@ -2947,6 +3332,80 @@ case OP_SeekGt: {       /* jump, in3 */
 }
  
 
+/* Opcode: SkipScan P1 P2 P3 P4 P5
+**
+** Cursor P1 is open on an index. If register P3 is NULL, the root page
+** number and first P4 fields of the key that cursor P1 currently points
+** to are stored in register P3 as a blob, and the cursor is not moved.
+**
+** Otherwise, register P3 holds such a key prefix. Cursor P1 is moved past
+** all entries that begin with it - forward to the first entry with a
+** larger prefix or, if P5 is non-zero, backward to the last entry with a
+** smaller prefix. If there is no such entry, jump to P2. Otherwise the
+** prefix of the entry the cursor now points to is stored in register P3.
+**
+** This is used to visit each distinct prefix of an index in turn. The
+** entries within each are then searched for using OP_SeekXX and OP_MakeKey
+** with the OPFLAG_KEYPREFIX flag.
+*/
+OPLABEL(OP_SkipScan)
+case OP_SkipScan: {       /* jump, in3 */
+  VdbeCursor *pC;                 /* Cursor P1 */
+  const KVByteArray *aKey;        /* Key the cursor points to */
+  KVSize nKey;                    /* Size of aKey[] in bytes */
+  int nPrefix;                    /* Size of prefix of aKey[] in bytes */
+
+  pC = p->apCsr[pOp->p1];
+  assert( pC!=0 && pC->iRoot!=KVSTORE_ROOT );
+  pIn3 = &aMem[pOp->p3];
+
+  if( (pIn3->flags & MEM_Null)==0 ){
+    assert( pIn3->flags & MEM_Blob );
+    pC->nullRow = 0;
+    pC->sSeekKey.n = 0;
+    pC->rowChnged = 1;
+    sqlite4VdbeCursorReleaseRefs(pC, 1);
+
+    /* No index key is equal to a prefix of itself, so a backward search
+    ** for the prefix finds the last entry with a smaller prefix. For a
+    ** forward search, a 0xFF byte is appended to the probe so that it
+    ** sorts after every key that begins with the prefix, as for SeekGt. */
+    if( pOp->p5 ){
+      rc = sqlite4KVCursorSeek(pC->pKVCur, (KVByteArray *)pIn3->z, pIn3->n, -1);
+    }else{
+      if( sqlite4VdbeMemGrow(pIn3, pIn3->n+1, 1) ) goto no_mem;
+      pIn3->z[pIn3->n] = (char)0xFF;
+      rc = sqlite4KVCursorSeek(
+          pC->pKVCur, (KVByteArray *)pIn3->z, pIn3->n+1, +1
+      );
+    }
+    if( rc==SQLITE4_OK || rc==SQLITE4_INEXACT ){
+      rc = sqlite4KVCursorKey(pC->pKVCur, &aKey, &nKey);
+      if( rc==SQLITE4_OK
+       && memcmp(aKey, pIn3->z, sqlite4VarintLen(pC->iRoot))
+      ){
+        rc = SQLITE4_NOTFOUND;
+      }
+    }
+    if( rc==SQLITE4_NOTFOUND ){
+      rc = SQLITE4_OK;
+      pc = pOp->p2 - 1;
+      break;
+    }
+  }else{
+    rc = sqlite4KVCursorKey(pC->pKVCur, &aKey, &nKey);
+  }
+
+  if( rc==SQLITE4_OK ){
+    nPrefix = sqlite4VdbeShortKey(aKey, nKey, pOp->p4.i, 0);
+    rc = sqlite4VdbeMemSetStr(
+        pIn3, (const char*)aKey, nPrefix, 0, SQLITE4_TRANSIENT, 0
+    );
+    REGISTER_TRACE(pOp->p3, pIn3);
+  }
+  break;
+}
+
 /* Opcode: Found P1 P2 P3 P4 *
 **
 ** If P4==0 then register P3 holds a blob constructed by MakeKey.  If
@@ -2985,12 +3444,15 @@ case OP_SeekGt: {       /* jump, in3 */
 **
 ** See also: Found, NotFound, IsUnique
 */
+OPLABEL(OP_NotExists)
 case OP_NotExists: {    /* jump, in3 */
   pOp->p4.i = 1;
   pOp->p4type = P4_INT32;
   /* Fall through into OP_NotFound */
 }
+OPLABEL(OP_NotFound)
 case OP_NotFound:       /* jump, in3 */
+OPLABEL(OP_Found)
 case OP_Found: {        /* jump, in3 */
   int alreadyExists;
   VdbeCursor *pC;
@@ -3024,6 +3486,7 @@ case OP_Found: {        /* jump, in3 */
     pFree = 0;
   }
   if( rc==SQLITE4_OK ){
+    sqlite4VdbeCursorReleaseRefs(pC, 1);
     rc = sqlite4KVCursorSeek(pC->pKVCur, pProbe, nProbe, +1);
     if( rc==SQLITE4_INEXACT || rc==SQLITE4_OK ){
       rc = sqlite4KVCursorKey(pC->pKVCur, &pKey, &nKey);
@@ -3060,6 +3523,7 @@ case OP_Found: {        /* jump, in3 */
 ** and the PRIMARY KEY values from the index entry causing the UNIQUE
 ** constraint to fail.
 */
+OPLABEL(OP_IsUnique)
 case OP_IsUnique: {        /* jump, in3 */
   VdbeCursor *pC;
   Mem *pProbe;
@@ -3078,6 +3542,7 @@ case OP_IsUnique: {        /* jump, in3 */
   pProbe = &aMem[pOp->p3];
   pC = p->apCsr[pOp->p1];
   pC->rowChnged = 1;
+  sqlite4VdbeCursorReleaseRefs(pC, 1);
   pOut = (pOp->p4.i==0 ? 0 : &aMem[pOp->p4.i]);
   bPk = (pC->pKeyInfo->nPK==0);
   assert( pOut==0 || (pOut->flags & MEM_Blob) || bPk );
@@ -3128,6 +3593,7 @@ case OP_IsUnique: {        /* jump, in3 */
 ** The sequence number on the cursor is incremented after this
 ** instruction.  
 */
+OPLABEL(OP_Sequence)
 case OP_Sequence: {           /* out2-prerelease */
   assert( pOp->p1>=0 && pOp->p1<p->nCursor );
   assert( p->apCsr[pOp->p1]!=0 );
@@ -3145,6 +3611,7 @@ case OP_Sequence: {           /* out2-prerelease */
 ** frame that holds a lower bound for the new rowid.  In other words, the
 ** new rowid must be no less than reg[P3]+1.
 */
+OPLABEL(OP_NewRowid)
 case OP_NewRowid: {           /* out2-prerelease */
   i64 v;                   /* The new rowid */
   VdbeCursor *pC;          /* Cursor of table to get the new rowid */
@@ -3179,33 +3646,36 @@ case OP_NewRowid: {           /* out2-prerelease */
   ** and try again, up to 100 times.
   */
 
-  rc = sqlite4VdbeSeekEnd(pC, -2);
-  if( rc==SQLITE4_NOTFOUND ){
-    v = 0;
-    rc = SQLITE4_OK;
-  }else if( rc==SQLITE4_OK ){
-    rc = sqlite4KVCursorKey(pC->pKVCur, &aKey, &nKey);
-    if( rc==SQLITE4_OK ){
-      n = sqlite4GetVarint64((u8 *)aKey, nKey, (u64 *)&v);
-      printf("n: %d\n", n);
-      printf("v: %d\n", v);
-      if( n==0 ) rc = SQLITE4_CORRUPT_BKPT;
-      if( v!=pC->iRoot ) rc = SQLITE4_CORRUPT_BKPT;
+  if( sqlite4VdbeRowidHwmGet(pC, &v) ){
+    /* The largest rowid in the table is cached. No need to seek. */
+    if( v==LARGEST_INT64 ){
+      rc = SQLITE4_FULL;
     }
-    if( rc==SQLITE4_OK ){
-      n = sqlite4VdbeDecodeNumericKey(&aKey[n], nKey-n, &vNum);
-      printf("n: %d\n", n);
-      printf("vNum->u.num->approx: %x\n",vNum.approx);
-      printf("vNum->u.num->e: %x\n",vNum.e);
-      printf("vNum->u.num->m: %d\n",vNum.m);
-      printf("vNum->u.num->sign: %x\n",vNum.sign);
-      if( n==0 || (v = sqlite4_num_to_int64(vNum,0))==LARGEST_INT64 ){
-        assert( 0 );
-        rc = SQLITE4_FULL;
+  }else{
+    rc = sqlite4VdbeSeekEnd(pC, -2);
+    if( rc==SQLITE4_NOTFOUND ){
+      v = 0;
+      rc = SQLITE4_OK;
+    }else if( rc==SQLITE4_OK ){
+      rc = sqlite4KVCursorKey(pC->pKVCur, &aKey, &nKey);
+      if( rc==SQLITE4_OK ){
+        n = sqlite4GetVarint64((u8 *)aKey, nKey, (u64 *)&v);
+        if( n==0 ) rc = SQLITE4_CORRUPT_BKPT;
+        if( v!=pC->iRoot ) rc = SQLITE4_CORRUPT_BKPT;
       }
+      if( rc==SQLITE4_OK && sqlite4VdbeDecodeIntKey(&aKey[n], nKey-n, &v) ){
+        if( v==LARGEST_INT64 ) rc = SQLITE4_FULL;
+      }else if( rc==SQLITE4_OK ){
+        n = sqlite4VdbeDecodeNumericKey(&aKey[n], nKey-n, &vNum);
+        if( n==0 || (v = sqlite4_num_to_int64(vNum,0))==LARGEST_INT64 ){
+          assert( 0 );
+          rc = SQLITE4_FULL;
+        }
+      }
+    }else{
+      break;
     }
-  }else{
-    break;
+    if( rc==SQLITE4_OK ) sqlite4VdbeRowidHwmSet(pC, v);
   }
 #ifndef SQLITE_OMIT_AUTOINCREMENT
   if( pOp->p3 && rc==SQLITE4_OK ){
@@ -3226,12 +3696,6 @@ case OP_NewRowid: {           /* out2-prerelease */
   
   pOut->flags = MEM_Int;
   pOut->u.num = sqlite4_num_from_int64(v+1);
-  printf("v: %d\n", v);
-  printf("pOut->u.num->approx: %x\n",pOut->u.num.approx);
-  printf("pOut->u.num->e: %x\n",pOut->u.num.e);
-  printf("pOut->u.num->m: %d\n",pOut->u.num.m);
-  printf("pOut->u.num->sign: %x\n",pOut->u.num.sign);
-  
   break;
 }
 
@@ -3245,6 +3709,7 @@ case OP_NewRowid: {           /* out2-prerelease */
 **   * the largest index number still visible in the database using the 
 **     LEFAST query mode used by OP_NewRowid in database P2.
 */
+OPLABEL(OP_NewIdxid)
 case OP_NewIdxid: {          /* fin1 */
   u64 iMax;
   i64 i1;
@@ -3259,6 +3724,7 @@ case OP_NewIdxid: {          /* fin1 */
   rc = sqlite4KVStoreOpenCursor(pKV, &pCsr);
   if( rc==SQLITE4_OK ){
     const u8 aKey[] = { 0xFF, 0xFF };
+    vdbeProfileCursor(p, pCsr);
     rc = sqlite4KVCursorSeek(pCsr, aKey, sizeof(aKey), -2);
     if( rc==SQLITE4_OK || rc==SQLITE4_INEXACT ){
       const KVByteArray *pKey;
@@ -3298,6 +3764,7 @@ case OP_NewIdxid: {          /* fin1 */
 **
 ** P1 must not be pseudo-table. It has to be a real table.
 */
+OPLABEL(OP_Delete)
 case OP_Delete: {
   VdbeCursor *pC;
   assert( pOp->p1>=0 && pOp->p1<p->nCursor );
@@ -3305,6 +3772,8 @@ case OP_Delete: {
   assert( pC!=0 );
   assert( pC->sSeekKey.n==0 );
   pC->rowChnged = 1;
+  sqlite4VdbeRowidHwmDelete(pC);
+  vdbeMaterializeRefs(p);
   rc = sqlite4KVCursorDelete(pC->pKVCur);
   if( pOp->p2 & OPFLAG_NCHANGE ) p->nChange++;
   break;
@@ -3317,6 +3786,7 @@ case OP_Delete: {
 ** Then the VMs internal change counter resets to 0.
 ** This is used by trigger programs.
 */
+OPLABEL(OP_ResetCount)
 case OP_ResetCount: {
   sqlite4VdbeSetChanges(db, p->nChange);
   p->nChange = 0;
@@ -3337,6 +3807,7 @@ case OP_ResetCount: {
 ** key of P1 (minus the sequence number) and fall through to the next
 ** instruction.
 */
+OPLABEL(OP_GrpCompare)
 case OP_GrpCompare: {
   VdbeCursor *pC;                 /* Cursor P1 */
   KVByteArray const *aKey;        /* Key from cursor P1 */
@@ -3390,8 +3861,11 @@ case OP_GrpCompare: {
 ** the blob copied into register P2 is the first field of the index-key
 ** only.
 */
+OPLABEL(OP_SorterData)
 case OP_SorterData:
+OPLABEL(OP_RowKey)
 case OP_RowKey:
+OPLABEL(OP_RowData)
 case OP_RowData: {
   VdbeCursor *pC;
   KVCursor *pCrsr;
@@ -3448,6 +3922,7 @@ case OP_RowData: {
 ** Finally, the key belonging to the current row of cursor P1 is copied
 ** into register P2.
 */
+OPLABEL(OP_AnalyzeKey)
 case OP_AnalyzeKey: {
   VdbeCursor *pC;
   const KVByteArray *pNew;
@@ -3509,6 +3984,7 @@ case OP_AnalyzeKey: {
 ** be a separate OP_VRowid opcode for use with virtual tables, but this
 ** one opcode now works for both table types.
 */
+OPLABEL(OP_Rowid)
 case OP_Rowid: {                 /* out2-prerelease */
   VdbeCursor *pC;
   i64 v;
@@ -3537,9 +4013,11 @@ case OP_Rowid: {                 /* out2-prerelease */
     rc = sqlite4KVCursorKey(pC->pKVCur, &aKey, &nKey);
     if( rc==SQLITE4_OK ){
       n = sqlite4GetVarint64(aKey, nKey, (sqlite4_uint64*)&v);
-      n = sqlite4VdbeDecodeNumericKey(&aKey[n], nKey-n, &vNum);
-      if( n==0 ) rc = SQLITE4_CORRUPT;
-      v = sqlite4_num_to_int64(vNum,0);
+      if( sqlite4VdbeDecodeIntKey(&aKey[n], nKey-n, &v)==0 ){
+        n = sqlite4VdbeDecodeNumericKey(&aKey[n], nKey-n, &vNum);
+        if( n==0 ) rc = SQLITE4_CORRUPT;
+        v = sqlite4_num_to_int64(vNum,0);
+      }
     }
   }
   pOut->u.num = sqlite4_num_from_int64(v);
@@ -3552,6 +4030,7 @@ case OP_Rowid: {                 /* out2-prerelease */
 ** that occur while the cursor is on the null row will always
 ** write a NULL.
 */
+OPLABEL(OP_NullRow)
 case OP_NullRow: {
   VdbeCursor *pC;
 
@@ -3571,6 +4050,7 @@ case OP_NullRow: {
 ** If P2 is 0 or if the table or index is not empty, fall through
 ** to the following instruction.
 */
+OPLABEL(OP_Last)
 case OP_Last: {        /* jump */
   VdbeCursor *pC;
 
@@ -3600,8 +4080,10 @@ case OP_Last: {        /* jump */
 ** regression tests can determine whether or not the optimizer is
 ** correctly optimizing out sorts.
 */
+OPLABEL(OP_SorterSort)
 case OP_SorterSort:    /* jump */
   pOp->opcode = OP_Sort;
+OPLABEL(OP_Sort)
 case OP_Sort: {        /* jump */
 #ifdef SQLITE4_TEST
   sqlite4_sort_count++;
@@ -3618,6 +4100,7 @@ case OP_Sort: {        /* jump */
 ** If P2 is 0 or if the table or index is not empty, fall through
 ** to the following instruction.
 */
+OPLABEL(OP_Rewind)
 case OP_Rewind: {        /* jump */
   VdbeCursor *pC;
   int doJump;
@@ -3673,9 +4156,12 @@ case OP_Rewind: {        /* jump */
 ** If P5 is positive and the jump is taken, then event counter
 ** number P5-1 in the prepared statement is incremented.
 */
+OPLABEL(OP_SorterNext)
 case OP_SorterNext:    /* jump */
   pOp->opcode = OP_Next;
+OPLABEL(OP_Prev)
 case OP_Prev:          /* jump */
+OPLABEL(OP_Next)
 case OP_Next: {        /* jump */
   VdbeCursor *pC;
 
@@ -3688,6 +4174,11 @@ case OP_Next: {        /* jump */
   }
   assert( pOp->opcode!=OP_Next || pOp->p4.xAdvance==sqlite4VdbeNext );
   assert( pOp->opcode!=OP_Prev || pOp->p4.xAdvance==sqlite4VdbePrevious );
+
+  /* Registers that refer to the current row were loaded by OP_Column
+  ** with OPFLAG_EPHEM set, and are not read once the loop advances. So
+  ** there is no need to copy their values here.  */
+  sqlite4VdbeCursorReleaseRefs(pC, 0);
   rc = pOp->p4.xAdvance(pC);
   if( rc==SQLITE4_OK ){
     pc = pOp->p2 - 1;
@@ -3700,7 +4191,12 @@ case OP_Next: {        /* jump */
     pC->nullRow = 1;
     rc = SQLITE4_OK;
   }
-  break;
+  VDBE_FUSE(OP_Column);
+  VDBE_FUSE(OP_IdxLT);
+  VDBE_FUSE(OP_IdxLE);
+  VDBE_FUSE(OP_IdxGE);
+  VDBE_FUSE(OP_IdxGT);
+  VDBE_NEXT;
 }
 
 
@@ -3717,6 +4213,7 @@ case OP_Next: {        /* jump */
 ** If the OPFLAG_NCHANGE flag of P5 is set, then the row change count is
 ** incremented (otherwise not).
 */
+OPLABEL(OP_Insert)
 case OP_Insert: {
   VdbeCursor *pC;
   Mem *pKey;
@@ -3746,21 +4243,91 @@ case OP_Insert: {
   }
 
 
+  vdbeMaterializeRefs(p);
   rc = sqlite4KVStoreReplace(
      pC->pKVCur->pStore,
      (u8 *)pKVKey, nKVKey,
      (u8 *)(pData ? pData->z : 0), (pData ? pData->n : 0)
   );
+  if( rc==SQLITE4_OK ) sqlite4VdbeRowidHwmInsert(pC, pKVKey, nKVKey);
   pC->rowChnged = 1;
 
   break;
 }
 
+/* Opcode: Transfer P1 P2 P3 * P5
+**
+** Cursor P2 points to an entry in a table or index whose keys and data
+** are encoded in exactly the same way as those of the table or index that
+** cursor P1 is open on. Copy the entry into P1. The key is copied with
+** its leading table number replaced by that of P1. The data is copied
+** unchanged. Register P3 is used as scratch space.
+**
+** If the OPFLAG_NCHANGE flag of P5 is set, then the row change count is
+** incremented (otherwise not).
+**
+** This opcode is used by the INSERT transfer optimization, which copies
+** the contents of one table into an empty table of the same shape.
+*/
+OPLABEL(OP_Transfer)
+case OP_Transfer: {
+  VdbeCursor *pC;                 /* Cursor to write to */
+  VdbeCursor *pSrc;               /* Cursor to read from */
+  KVByteArray const *aKey;        /* Key of entry pSrc points to */
+  KVSize nKey;                    /* Size of aKey[] in bytes */
+  KVByteArray const *aData;       /* Data of entry pSrc points to */
+  KVSize nData;                   /* Size of aData[] in bytes */
+  Mem *pScratch;                  /* Buffer for new key and data */
+  int nPrefix;                    /* Size of table number in aKey[] */
+  int nNew;                       /* Size of table number of pC */
+  u64 dummy;
+
+  assert( pOp->p1>=0 && pOp->p1<p->nCursor );
+  assert( pOp->p2>=0 && pOp->p2<p->nCursor );
+  pC = p->apCsr[pOp->p1];
+  pSrc = p->apCsr[pOp->p2];
+  assert( pC && pC->pKVCur && pC->pKVCur->pStore );
+  assert( pSrc && pSrc->pKVCur );
+  pScratch = &aMem[pOp->p3];
+  memAboutToChange(p, pScratch);
+
+  rc = sqlite4KVCursorKey(pSrc->pKVCur, &aKey, &nKey);
+  if( rc==SQLITE4_OK ){
+    rc = sqlite4KVCursorData(pSrc->pKVCur, 0, -1, &aData, &nData);
+  }
+  if( rc!=SQLITE4_OK ) break;
+
+  /* The key and data are copied out of the source cursor before the
+  ** write, as writing to the database may invalidate them.  */
+  nPrefix = sqlite4GetVarint64(aKey, nKey, &dummy);
+  nNew = sqlite4VarintLen(pC->iRoot);
+  nKey = nKey - nPrefix + nNew;
+  if( nKey+nData>db->aLimit[SQLITE4_LIMIT_LENGTH] ) goto too_big;
+  if( sqlite4VdbeMemGrow(pScratch, nKey+nData, 0) ) goto no_mem;
+  sqlite4PutVarint64((u8 *)pScratch->z, pC->iRoot);
+  memcpy(&pScratch->z[nNew], &aKey[nPrefix], nKey-nNew);
+  memcpy(&pScratch->z[nKey], aData, nData);
+  pScratch->n = nKey+nData;
+  MemSetTypeFlag(pScratch, MEM_Blob);
+
+  if( pOp->p5 & OPFLAG_NCHANGE ) p->nChange++;
+  vdbeMaterializeRefs(p);
+  rc = sqlite4KVStoreReplace(pC->pKVCur->pStore,
+     (u8 *)pScratch->z, nKey, (u8 *)&pScratch->z[nKey], nData
+  );
+  if( rc==SQLITE4_OK ){
+    sqlite4VdbeRowidHwmInsert(pC, (u8 *)pScratch->z, nKey);
+  }
+  pC->rowChnged = 1;
+  break;
+}
+
 /* Opcode: IdxDelete P1 * P3 * *
 **
 ** P1 is a cursor open on a database index. P3 contains a key suitable for
 ** the index. Delete P3 from P1 if it is present.
 */
+OPLABEL(OP_IdxDelete)
 case OP_IdxDelete: {
   VdbeCursor *pC;
   Mem *pKey;
@@ -3772,6 +4339,7 @@ case OP_IdxDelete: {
   assert( pC && pC->pKVCur && pC->pKVCur->pStore );
   assert( pKey->flags & MEM_Blob );
 
+  vdbeMaterializeRefs(p);
   rc = sqlite4KVCursorSeek(pC->pKVCur, (u8 *)pKey->z, pKey->n, 0);
   if( rc==SQLITE4_OK ){
     rc = sqlite4KVCursorDelete(pC->pKVCur);
@@ -3792,6 +4360,7 @@ case OP_IdxDelete: {
 **
 ** See also: Rowkey
 */
+OPLABEL(OP_IdxRowkey)
 case OP_IdxRowkey: {              /* out2-prerelease */
   KVByteArray const *aKey;        /* Key data from cursor pIdx */
   KVSize nKey;                    /* Size of aKey[] in bytes */
@@ -3844,9 +4413,13 @@ case OP_IdxRowkey: {              /* out2-prerelease */
 ** instruction. The comparison is done using memcmp(), except that if P3
 ** is a prefix of the P1 key they are considered equal.
 */
+OPLABEL(OP_IdxLT)
 case OP_IdxLT:          /* jump */
+OPLABEL(OP_IdxLE)
 case OP_IdxLE:          /* jump */
+OPLABEL(OP_IdxGE)
 case OP_IdxGE:          /* jump */
+OPLABEL(OP_IdxGT)
 case OP_IdxGT: {        /* jump */
   VdbeCursor *pC;                 /* Cursor P1 */
   KVByteArray const *aKey;        /* Key from cursor P1 */
@@ -3875,7 +4448,9 @@ case OP_IdxGT: {        /* jump */
 
     if( bJump ) pc = pOp->p2 - 1;
   }
-  break;
+  VDBE_FUSE(OP_Next);
+  VDBE_FUSE(OP_Prev);
+  VDBE_NEXT;
 }
 
 /* Opcode: Clear P1 P2 * * P5
@@ -3892,6 +4467,7 @@ case OP_IdxGT: {        /* jump */
 **
 ** See also: Destroy
 */
+OPLABEL(OP_Clear)
 case OP_Clear: {
   KVCursor *pCur;
   KVByteArray const *aKey;
@@ -3899,9 +4475,12 @@ case OP_Clear: {
   KVSize nProbe;
   KVByteArray aProbe[12];
 
+  sqlite4VdbeRowidHwmDrop(db, pOp->p2, pOp->p1);
+  vdbeMaterializeRefs(p);
   nProbe = sqlite4PutVarint64(aProbe, pOp->p1);
   rc = sqlite4KVStoreOpenCursor(db->aDb[pOp->p2].pKV, &pCur);
   if( rc ) break;
+  vdbeProfileCursor(p, pCur);
   rc = sqlite4KVCursorSeek(pCur, aProbe, nProbe, +1);
   while( rc!=SQLITE4_NOTFOUND ){
     if( pOp->p5 & OPFLAG_NCHANGE ) p->nChange++;
@@ -3927,6 +4506,7 @@ case OP_Clear: {
 ** This opcode invokes the parser to create a new virtual machine,
 ** then runs the new virtual machine.  It is thus a re-entrant opcode.
 */
+OPLABEL(OP_ParseSchema)
 case OP_ParseSchema: {
   int iDb;
   const char *zMaster;
@@ -3970,6 +4550,7 @@ case OP_ParseSchema: {
 ** of that table into the internal index hash table.  This will cause
 ** the analysis to be used when preparing all subsequent queries.
 */
+OPLABEL(OP_LoadAnalysis)
 case OP_LoadAnalysis: {
   assert( pOp->p1>=0 && pOp->p1<db->nDb );
   rc = sqlite4AnalysisLoad(db, pOp->p1);
@@ -3984,6 +4565,7 @@ case OP_LoadAnalysis: {
 ** is dropped in order to keep the internal representation of the
 ** schema consistent with what is on disk.
 */
+OPLABEL(OP_DropTable)
 case OP_DropTable: {
   sqlite4UnlinkAndDeleteTable(db, pOp->p1, pOp->p4.z);
   break;
@@ -3996,6 +4578,7 @@ case OP_DropTable: {
 ** is dropped in order to keep the internal representation of the
 ** schema consistent with what is on disk.
 */
+OPLABEL(OP_DropIndex)
 case OP_DropIndex: {
   sqlite4UnlinkAndDeleteIndex(db, pOp->p1, pOp->p4.z);
   break;
@@ -4008,6 +4591,7 @@ case OP_DropIndex: {
 ** is dropped in order to keep the internal representation of the
 ** schema consistent with what is on disk.
 */
+OPLABEL(OP_DropTrigger)
 case OP_DropTrigger: {
   sqlite4UnlinkAndDeleteTrigger(db, pOp->p1, pOp->p4.z);
   break;
@@ -4022,6 +4606,7 @@ case OP_DropTrigger: {
 **
 ** TODO: Optimization similar to SQLite 3 using P4.
 */
+OPLABEL(OP_RowSetTest)
 case OP_RowSetTest: {        /* in1, in3, jump */
   int iSet;
   pIn1 = &aMem[pOp->p1];
@@ -4042,6 +4627,7 @@ case OP_RowSetTest: {        /* in1, in3, jump */
 **
 ** Read the blob value from register P2 and store it in RowSet object P1.
 */
+OPLABEL(OP_RowSetAdd)
 case OP_RowSetAdd: {         /* in1, in3 */
   pIn1 = &aMem[pOp->p1];
   if( (pIn1->flags & MEM_RowSet)==0 ){
@@ -4060,6 +4646,7 @@ case OP_RowSetAdd: {         /* in1, in3 */
 ** Or, if MemSet P1 is already empty, leave P3 unchanged and jump to 
 ** instruction P2.
 */
+OPLABEL(OP_RowSetRead)
 case OP_RowSetRead: {       /* in1 */
   const u8 *aKey;
   int nKey;
@@ -4097,6 +4684,7 @@ case OP_RowSetRead: {       /* in1 */
 **
 ** P4 is a pointer to the VM containing the trigger program.
 */
+OPLABEL(OP_Program)
 case OP_Program: {        /* jump */
   int nMem;               /* Number of memory registers for sub-program */
   int nByte;              /* Bytes of runtime space required for sub-program */
@@ -4196,6 +4784,7 @@ case OP_Program: {        /* jump */
 ** the value of the P1 argument to the value of the P1 argument to the
 ** calling OP_Program instruction.
 */
+OPLABEL(OP_Param)
 case OP_Param: {           /* out2-prerelease */
   VdbeFrame *pFrame;
   Mem *pIn;
@@ -4216,6 +4805,7 @@ case OP_Param: {           /* out2-prerelease */
 ** (deferred foreign key constraints). Otherwise, if P1 is zero, the 
 ** statement counter is incremented (immediate foreign key constraints).
 */
+OPLABEL(OP_FkCounter)
 case OP_FkCounter: {
   if( pOp->p1 ){
     db->nDeferredCons += pOp->p2;
@@ -4236,6 +4826,7 @@ case OP_FkCounter: {
 ** zero, the jump is taken if the statement constraint-counter is zero
 ** (immediate foreign key constraint violations).
 */
+OPLABEL(OP_FkIfZero)
 case OP_FkIfZero: {         /* jump */
   if( pOp->p1 ){
     if( db->nDeferredCons==0 ) pc = pOp->p2-1;
@@ -4257,6 +4848,7 @@ case OP_FkIfZero: {         /* jump */
 ** This instruction throws an error if the memory cell is not initially
 ** an integer.
 */
+OPLABEL(OP_MemMax)
 case OP_MemMax: {        /* in2 */
   i64 i1;
   i64 i2;
@@ -4284,6 +4876,7 @@ case OP_MemMax: {        /* in2 */
 ** It is illegal to use this instruction on a register that does
 ** not contain an integer.  An assertion fault will result if you try.
 */
+OPLABEL(OP_IfPos)
 case OP_IfPos: {        /* jump, in1 */
   i64 i1;
   pIn1 = &aMem[pOp->p1];
@@ -4302,6 +4895,7 @@ case OP_IfPos: {        /* jump, in1 */
 ** It is illegal to use this instruction on a register that does
 ** not contain an integer.  An assertion fault will result if you try.
 */
+OPLABEL(OP_IfNeg)
 case OP_IfNeg: {        /* jump, in1 */
   i64 i1;
   pIn1 = &aMem[pOp->p1];
@@ -4321,6 +4915,7 @@ case OP_IfNeg: {        /* jump, in1 */
 ** It is illegal to use this instruction on a register that does
 ** not contain an integer.  An assertion fault will result if you try.
 */
+OPLABEL(OP_IfZero)
 case OP_IfZero: {        /* jump, in1 */
   i64 i1;
   pIn1 = &aMem[pOp->p1];
@@ -4344,6 +4939,7 @@ case OP_IfZero: {        /* jump, in1 */
 ** The P5 arguments are taken from register P2 and its
 ** successors.
 */
+OPLABEL(OP_AggStep)
 case OP_AggStep: {
   int n;
   int i;
@@ -4405,6 +5001,7 @@ case OP_AggStep: {
 ** P4 argument is only needed for the degenerate case where
 ** the step function was not previously called.
 */
+OPLABEL(OP_AggFinal)
 case OP_AggFinal: {
   Mem *pMem;
   assert( pOp->p1>0 && pOp->p1<=p->nMem );
@@ -4424,6 +5021,103 @@ case OP_AggFinal: {
   break;
 }
 
+/* Opcode: AggHashOpen P1 P2 P3 * *
+**
+** Open a hash table used to implement GROUP BY without sorting, and
+** store it in cursor P1. Each group in the table has its own copy of
+** the P3 accumulator registers that begin at register P2.
+**
+** See vdbehash.c for details.
+*/
+OPLABEL(OP_AggHashOpen)
+case OP_AggHashOpen: {
+  VdbeCursor *pCx;
+
+  assert( pOp->p1>=0 );
+  assert( pOp->p3==0 || (pOp->p2>0 && pOp->p2+pOp->p3<=p->nMem+1) );
+  pCx = allocateCursor(p, pOp->p1, 0, -1, 0);
+  if( pCx==0 ) goto no_mem;
+  pCx->nullRow = 1;
+  rc = sqlite4VdbeAggHashOpen(db, &aMem[pOp->p2], pOp->p3, &pCx->pAggHash);
+  break;
+}
+
+/* Opcode: AggHashFind P1 P2 P3 * *
+**
+** Register P3 holds a GROUP BY key created by OP_MakeKey. Find the group
+** with that key in the hash table opened by OP_AggHashOpen on cursor P1
+** and load its accumulator registers. If the group does not already
+** exist, add it and set the accumulator registers to NULL.
+**
+** If the group does not exist and cannot be added because the hash
+** table has used all the memory it is allowed, jump to P2 instead.
+*/
+OPLABEL(OP_AggHashFind)
+case OP_AggHashFind: {         /* jump, in3 */
+  VdbeCursor *pC;
+
+  pC = p->apCsr[pOp->p1];
+  assert( pC && pC->pAggHash );
+  pIn3 = &aMem[pOp->p3];
+  assert( pIn3->flags & MEM_Blob );
+  rc = sqlite4VdbeAggHashFind(pC->pAggHash, (const u8*)pIn3->z, pIn3->n);
+  if( rc==SQLITE4_NOTFOUND ){
+    rc = SQLITE4_OK;
+    pc = pOp->p2 - 1;
+  }
+  break;
+}
+
+/* Opcode: AggHashSave P1 * * * *
+**
+** Save the accumulator registers back into the group most recently
+** loaded by OP_AggHashFind on cursor P1.
+*/
+OPLABEL(OP_AggHashSave)
+case OP_AggHashSave: {
+  VdbeCursor *pC;
+
+  pC = p->apCsr[pOp->p1];
+  assert( pC && pC->pAggHash );
+  rc = sqlite4VdbeAggHashSave(pC->pAggHash);
+  break;
+}
+
+/* Opcode: AggHashNext P1 P2 P3 * *
+**
+** Load the accumulator registers of the next group, in key order, of the
+** hash table opened on cursor P1 and fall through. Or, if there are no
+** more groups, or if register P3 holds a key and the key of the next group
+** is not smaller than it, jump to P2.
+**
+** No more groups may be added to the hash table after this opcode has
+** been executed.
+*/
+OPLABEL(OP_AggHashNext)
+case OP_AggHashNext: {         /* jump */
+  VdbeCursor *pC;
+  const u8 *aBound;
+  int nBound;
+
+  pC = p->apCsr[pOp->p1];
+  assert( pC && pC->pAggHash );
+  aBound = 0;
+  nBound = 0;
+  if( pOp->p3 ){
+    pIn3 = &aMem[pOp->p3];
+    if( pIn3->flags & MEM_Blob ){
+      aBound = (const u8*)pIn3->z;
+      nBound = pIn3->n;
+    }
+  }
+  rc = sqlite4VdbeAggHashNext(pC->pAggHash, aBound, nBound);
+  if( rc==SQLITE4_NOTFOUND ){
+    rc = SQLITE4_OK;
+    pc = pOp->p2 - 1;
+  }
+  break;
+}
+
 #ifndef SQLITE4_OMIT_PRAGMA
 /* Opcode: JournalMode P1 P2 P3 * P5
 **
@@ -4436,6 +5130,7 @@ case OP_AggFinal: {
 **
 ** Write a string containing the final journal-mode to register P2.
 */
+OPLABEL(OP_JournalMode)
 case OP_JournalMode: {    /* out2-prerelease */
   break;
 };
@@ -4451,6 +5146,7 @@ case OP_JournalMode: {    /* out2-prerelease */
 ** If P1 is 0, then all SQL statements become expired. If P1 is non-zero,
 ** then only the currently executing statement is affected. 
 */
+OPLABEL(OP_Expire)
 case OP_Expire: {
   if( !pOp->p1 ){
     sqlite4ExpirePreparedStatements(db);
@@ -4471,6 +5167,7 @@ case OP_Expire: {
 ** within a callback to a virtual table xSync() method. If it is, the error
 ** code will be set to SQLITE4_LOCKED.
 */
+OPLABEL(OP_VBegin)
 case OP_VBegin: {
   VTable *pVTab;
   pVTab = pOp->p4.pVtab;
@@ -4486,6 +5183,7 @@ case OP_VBegin: {
 ** P4 is the name of a virtual table in database P1. Call the xCreate method
 ** for that table.
 */
+OPLABEL(OP_VCreate)
 case OP_VCreate: {
   rc = sqlite4VtabCallCreate(db, pOp->p1, pOp->p4.z, &p->zErrMsg);
   break;
@@ -4498,6 +5196,7 @@ case OP_VCreate: {
 ** P4 is the name of a virtual table in database P1.  Call the xDestroy method
 ** of that table.
 */
+OPLABEL(OP_VDestroy)
 case OP_VDestroy: {
   p->inVtabMethod = 2;
   rc = sqlite4VtabCallDestroy(db, pOp->p1, pOp->p4.z);
@@ -4513,6 +5212,7 @@ case OP_VDestroy: {
 ** P1 is a cursor number.  This opcode opens a cursor to the virtual
 ** table and stores that cursor in P1.
 */
+OPLABEL(OP_VOpen)
 case OP_VOpen: {
   VdbeCursor *pCur;
   sqlite4_vtab_cursor *pVtabCursor;
@@ -4563,6 +5263,7 @@ case OP_VOpen: {
 **
 ** A jump is made to P2 if the result set after filtering would be empty.
 */
+OPLABEL(OP_VFilter)
 case OP_VFilter: {   /* jump */
   int nArg;
   int iQuery;
@@ -4625,6 +5326,7 @@ case OP_VFilter: {   /* jump */
 ** the row of the virtual-table that the 
 ** P1 cursor is pointing to into register P3.
 */
+OPLABEL(OP_VColumn)
 case OP_VColumn: {
   sqlite4_vtab *pVtab;
   const sqlite4_module *pModule;
@@ -4682,6 +5384,7 @@ case OP_VColumn: {
 ** jump to instruction P2.  Or, if the virtual table has reached
 ** the end of its result set, then fall through to the next instruction.
 */
+OPLABEL(OP_VNext)
 case OP_VNext: {   /* jump */
   sqlite4_vtab *pVtab;
   const sqlite4_module *pModule;
@@ -4727,6 +5430,7 @@ case OP_VNext: {   /* jump */
 ** This opcode invokes the corresponding xRename method. The value
 ** in register P1 is passed as the zName argument to the xRename method.
 */
+OPLABEL(OP_VRename)
 case OP_VRename: {
   sqlite4_vtab *pVtab;
   Mem *pName;
@@ -4774,6 +5478,7 @@ case OP_VRename: {
 ** is successful, then the value returned by sqlite4_last_insert_rowid() 
 ** is set to the value of the rowid for the row just inserted.
 */
+OPLABEL(OP_VUpdate)
 case OP_VUpdate: {
   sqlite4_vtab *pVtab;
   sqlite4_module *pModule;
@@ -4825,6 +5530,7 @@ case OP_VUpdate: {
 ** If tracing is enabled (by the sqlite4_trace()) interface, then
 ** the UTF-8 string contained in P4 is emitted on the trace callback.
 */
+OPLABEL(OP_Trace)
 case OP_Trace: {
   char *zTrace;
   char *z;
@@ -4866,6 +5572,7 @@ case OP_Trace: {
 ** of the fts index to update. If it is zero, then the root page of the 
 ** index is available as part of the Fts5Info structure.
 */
+OPLABEL(OP_FtsUpdate)
 case OP_FtsUpdate: {
   Fts5Info *pInfo;                /* Description of fts5 index to update */
   Mem *pKey;                      /* Primary key of indexed row */
@@ -4876,6 +5583,7 @@ case OP_FtsUpdate: {
   pInfo = pOp->p4.pFtsInfo;
   aArg = &aMem[pOp->p3];
   pKey = &aMem[pOp->p1];
+  vdbeMaterializeRefs(p);
 
   if( pOp->p2 ){
     iRoot = sqlite4_num_to_int32(aMem[pOp->p2].u.num, 0);
@@ -4893,6 +5601,7 @@ case OP_FtsUpdate: {
 ** This opcode is used by the integrity-check procedure that verifies that
 ** the contents of an fts5 index and its corresponding table match.
 */
+OPLABEL(OP_FtsCksum)
 case OP_FtsCksum: {
   Fts5Info *pInfo;                /* Description of fts5 index to update */
   Mem *pKey;                      /* Primary key of row */
@@ -4931,6 +5640,7 @@ case OP_FtsCksum: {
 ** leave the cursor pointing at the first match and fall through to the
 ** next instruction.
 */
+OPLABEL(OP_FtsOpen)
 case OP_FtsOpen: {          /* jump */
   Fts5Info *pInfo;                /* Description of fts5 index to update */
   VdbeCursor *pCur;
@@ -4959,6 +5669,7 @@ case OP_FtsOpen: {          /* jump */
 ** if there is no next entry, set the cursor to point to EOF and fall through
 ** to the next instruction.
 */
+OPLABEL(OP_FtsNext)
 case OP_FtsNext: {
   VdbeCursor *pCsr;
 
@@ -4974,6 +5685,7 @@ case OP_FtsNext: {
 ** P1 is an FTS cursor that points to a valid entry (not EOF). Copy the PK 
 ** blob for the current entry to register P2.
 */
+OPLABEL(OP_FtsPk)
 case OP_FtsPk: {
   assert( 0 );
   break;
@@ -4990,6 +5702,54 @@ case OP_FtsPk: {
 ** This opcode records information from the optimizer.  It is the
 ** the same as a no-op.  This opcode never appears in a real VM program.
 */
+#if VDBE_COMPUTED_GOTO
+/* Opcodes omitted from this build share the label of the default case,
+** as they would fall through to it in the switch statement.
+*/
+#ifdef SQLITE4_OMIT_FLOATING_POINT
+OPLABEL(OP_RealAffinity)
+#endif
+#ifdef SQLITE4_OMIT_CAST
+OPLABEL(OP_ToText)
+OPLABEL(OP_ToBlob)
+OPLABEL(OP_ToNumeric)
+#endif
+#if defined(SQLITE4_OMIT_CAST) || defined(SQLITE4_OMIT_FLOATING_POINT)
+OPLABEL(OP_ToReal)
+#endif
+#ifdef SQLITE4_OMIT_ANALYZE
+OPLABEL(OP_LoadAnalysis)
+#endif
+#ifdef SQLITE4_OMIT_TRIGGER
+OPLABEL(OP_Program)
+OPLABEL(OP_Param)
+#endif
+#ifdef SQLITE4_OMIT_FOREIGN_KEY
+OPLABEL(OP_FkCounter)
+OPLABEL(OP_FkIfZero)
+#endif
+#ifdef SQLITE4_OMIT_AUTOINCREMENT
+OPLABEL(OP_MemMax)
+#endif
+#ifdef SQLITE4_OMIT_PRAGMA
+OPLABEL(OP_JournalMode)
+#endif
+#ifdef SQLITE4_OMIT_VIRTUALTABLE
+OPLABEL(OP_VBegin)
+OPLABEL(OP_VCreate)
+OPLABEL(OP_VDestroy)
+OPLABEL(OP_VOpen)
+OPLABEL(OP_VFilter)
+OPLABEL(OP_VColumn)
+OPLABEL(OP_VNext)
+OPLABEL(OP_VRename)
+OPLABEL(OP_VUpdate)
+#endif
+#ifdef SQLITE4_OMIT_TRACE
+OPLABEL(OP_Trace)
+#endif
+#endif /* VDBE_COMPUTED_GOTO */
+OPLABEL(OP_Noop)
 default: {          /* This is really OP_Noop and OP_Explain */
   assert( pOp->opcode==OP_Noop || pOp->opcode==OP_Explain );
   break;
@@ -5003,17 +5763,10 @@ default: {          /* This is really OP_Noop and OP_Explain */
 *****************************************************************************/
     }
 
-#ifdef VDBE_PROFILE
-    {
-      u64 elapsed = sqlite4Hwtime() - start;
-      pOp->cycles += elapsed;
-      pOp->cnt++;
-#if 0
-        fprintf(stdout, "%10llu ", elapsed);
-        sqlite4VdbePrintOp(stdout, origPc, &aOp[origPc]);
-#endif
+    if( iProf>=0 ){
+      vdbeProfileOp(p, iProf, start);
+      iProf = -1;
     }
-#endif
 
     /* The following code adds nothing to the actual functionality
     ** of the program.  It is only here for testing and debugging.
@@ -5057,6 +5810,10 @@ vdbe_error_halt:
   ** release the mutexes on btrees that were acquired at the
   ** top. */
 vdbe_return:
+  if( iProf>=0 ){
+    /* OP_ResultRow, OP_Halt and errors exit the loop here */
+    vdbeProfileOp(p, iProf, start);
+  }
   return rc;
 
   /* Jump to here if a string or blob larger than SQLITE4_MAX_LENGTH
@@ -67,10 +67,6 @@ struct VdbeOp {
 #ifdef SQLITE4_DEBUG
   char *zComment;          /* Comment to improve readability */
 #endif
-#ifdef VDBE_PROFILE
-  int cnt;                 /* Number of times this instruction was executed */
-  u64 cycles;              /* Total time spent executing this instruction */
-#endif
 };
 typedef struct VdbeOp VdbeOp;
 
@@ -151,6 +147,14 @@ typedef struct VdbeOpList VdbeOpList;
 # endif
 #endif
 
+/*
+** Allowed values for the 3rd argument to sqlite4VdbeLoopAddr(). Each
+** names one of the addresses recorded for a profiled planner loop.
+*/
+#define VDBE_LOOP_BODY   1       /* First instruction of the loop body */
+#define VDBE_LOOP_CONT   2       /* Code that advances the loop */
+#define VDBE_LOOP_END    3       /* First instruction after the loop */
+
 /*
 ** The following macro converts a relative address in the p2 field
 ** of a VdbeOp structure into a negative number so that 
@@ -189,12 +193,19 @@ void sqlite4VdbeUsesStorage(Vdbe*, int);
 VdbeOp *sqlite4VdbeGetOp(Vdbe*, int);
 int sqlite4VdbeMakeLabel(Vdbe*);
 void sqlite4VdbeRunOnlyOnce(Vdbe*);
+void sqlite4VdbeNoStmtCache(Vdbe*);
 void sqlite4VdbeDelete(Vdbe*);
 void sqlite4VdbeDeleteObject(sqlite4*,Vdbe*);
 void sqlite4VdbeMakeReady(Vdbe*,Parse*);
 int sqlite4VdbeFinalize(Vdbe*);
+int sqlite4VdbeFinalizeToCache(Vdbe*);
+Vdbe *sqlite4VdbeStmtCacheFind(sqlite4*, const char*, int, int*);
+void sqlite4VdbeStmtCacheLimit(sqlite4*, int);
+void sqlite4VdbeStmtCacheClear(sqlite4*);
 void sqlite4VdbeResolveLabel(Vdbe*, int);
 int sqlite4VdbeCurrentAddr(Vdbe*);
+int sqlite4VdbeAddLoop(Vdbe*, int, int, char*);
+void sqlite4VdbeLoopAddr(Vdbe*, int, int);
 #ifdef SQLITE4_DEBUG
   int sqlite4VdbeAssertMayAbort(Vdbe *, int);
   void sqlite4VdbeTrace(Vdbe*,FILE*);
@@ -33,6 +33,9 @@ typedef unsigned char Bool;
 /* Opaque type used by code in vdbesort.c */
 typedef struct VdbeSorter VdbeSorter;
 
+/* Opaque type used by code in vdbehash.c */
+typedef struct VdbeAggHash VdbeAggHash;
+
 /* Opaque type used by the explainer */
 typedef struct Explain Explain;
 
@@ -61,11 +64,15 @@ struct VdbeCursor {
   Bool rowChnged;       /* True if row has changed out from under pDecoder */
   i64 seqCount;         /* Sequence counter */
   VdbeSorter *pSorter;  /* Sorter object for OP_SorterOpen cursors */
+  VdbeAggHash *pAggHash;             /* Hash table for OP_AggHashOpen */
   Fts5Cursor *pFts;     /* Fts5 cursor object (or NULL) */
   RowDecoder *pDecoder;              /* Decoder for row content */
   sqlite4_vtab_cursor *pVtabCursor;  /* The cursor for a virtual table */
   const sqlite4_module *pModule;     /* Module for cursor pVtabCursor */
   sqlite4_buffer sSeekKey;           /* Key for deferred seek */
+  Mem **apRef;          /* Registers that may point into the current row */
+  int nRef;             /* Number of entries in apRef[] */
+  int nRefAlloc;        /* Allocated size of apRef[] */
 };
 
 /* Methods for the VdbeCursor object */
@@ -74,6 +81,36 @@ int sqlite4VdbeSeekEnd(VdbeCursor*, int);
 int sqlite4VdbeNext(VdbeCursor*);
 int sqlite4VdbePrevious(VdbeCursor*);
 int sqlite4VdbeCursorMoveto(VdbeCursor *);
+int sqlite4VdbeCursorAddRef(VdbeCursor*, Mem*);
+void sqlite4VdbeCursorReleaseRefs(VdbeCursor*, int);
+
+/* The external merge sorter used by OP_SorterOpen (see vdbesort.c) */
+int sqlite4VdbeSorterOpen(sqlite4*, KVStore**);
+
+/* The bounded sorter used by OP_TopNOpen (see vdbetopn.c) */
+int sqlite4VdbeTopNOpen(sqlite4*, KVStore**);
+
+/* The GROUP BY hash table used by OP_AggHashOpen (see vdbehash.c) */
+int sqlite4VdbeAggHashOpen(sqlite4*, Mem*, int, VdbeAggHash**);
+void sqlite4VdbeAggHashClose(VdbeAggHash*);
+int sqlite4VdbeAggHashFind(VdbeAggHash*, const u8*, int);
+int sqlite4VdbeAggHashSave(VdbeAggHash*);
+int sqlite4VdbeAggHashNext(VdbeAggHash*, const u8*, int);
+
+/* The hash table used by OP_OpenAutoindex for hash joins (see vdbejoin.c) */
+int sqlite4VdbeHashJoinOpen(sqlite4*, int, KVStore**);
+
+/* The hash set used by OP_OpenEphemeral for membership tests (vdbeset.c) */
+int sqlite4VdbeHashSetOpen(sqlite4*, KVStore**);
+
+/* Cache of the largest rowid in each table (see struct RowidHwm) */
+int sqlite4VdbeRowidHwmGet(VdbeCursor*, i64*);
+void sqlite4VdbeRowidHwmSet(VdbeCursor*, i64);
+void sqlite4VdbeRowidHwmInsert(VdbeCursor*, const KVByteArray*, KVSize);
+void sqlite4VdbeRowidHwmDelete(VdbeCursor*);
+void sqlite4VdbeRowidHwmDrop(sqlite4*, int, int);
+void sqlite4VdbeRowidHwmValidate(sqlite4*, int);
+void sqlite4VdbeRowidHwmCommit(sqlite4*, int);
 
 
 /*
@@ -176,12 +213,17 @@ struct Mem {
 ** the following flags must be set to determine the memory management
 ** policy for Mem.z.  The MEM_Term flag tells us whether or not the
 ** string is \000 or \u0000 terminated
+**
+** MEM_KVRef is set along with MEM_Ephem when Mem.z points directly into
+** the row that a VdbeCursor is positioned on. Such a value is only valid
+** until the cursor moves. Copying it to another Mem makes a private copy.
 */
 #define MEM_Term      0x0200   /* String rep is nul terminated */
 #define MEM_Dyn       0x0400   /* Need to call sqliteFree() on Mem.z */
 #define MEM_Static    0x0800   /* Mem.z points to a static string */
 #define MEM_Ephem     0x1000   /* Mem.z points to an ephemeral string */
 #define MEM_Agg       0x2000   /* Mem.z points to an agg function context */
+#define MEM_KVRef     0x4000   /* Mem.z points into the row of a VdbeCursor */
 
 /*
 ** Clear any existing type flags from a Mem and replace them with f
@@ -252,6 +294,52 @@ struct Explain {
   char zBase[100];   /* Initial space */
 };
 
+/*
+** Profile counters for a single VM instruction. When a statement is being
+** profiled, Vdbe.aProfile[] holds one of these for each entry in Vdbe.aOp[].
+** See sqlite4_stmt_profile().
+*/
+typedef struct VdbeProfile VdbeProfile;
+struct VdbeProfile {
+  i64 nExec;            /* Number of times the instruction was executed */
+  i64 nCycle;           /* Total CPU cycles spent in the instruction */
+  i64 nSeek;            /* KV cursor seeks made by the instruction */
+  i64 nStep;            /* KV cursor next and prev calls */
+  i64 nByte;            /* Bytes returned by KV cursor key and data calls */
+};
+
+/*
+** Each nested loop generated by sqlite4WhereBegin() for a statement
+** compiled with profiling enabled is described by one of the following.
+** Instructions in the range [addrStart, addrBody) position the loop on
+** its next row, those in [addrBody, addrCont) are the body of the loop
+** (including any inner loops) and those in [addrCont, addrEnd) advance
+** the loop and close it.
+*/
+typedef struct VdbeLoop VdbeLoop;
+struct VdbeLoop {
+  int iSelectId;        /* Id of the SELECT, as in EXPLAIN QUERY PLAN */
+  int iLevel;           /* Loop nesting level within the SELECT */
+  char *zDesc;          /* Description of the loop */
+  int addrStart;        /* First instruction of the loop */
+  int addrBody;         /* First instruction of the loop body */
+  int addrCont;         /* Jump here to continue with the next row */
+  int addrEnd;          /* First instruction past the end of the loop */
+};
+
+/*
+** An array of values bound to a host parameter by sqlite4_bind_array().
+** Vdbe.aArray[] has one entry for each host parameter. Entries with eType
+** set to zero have no array bound.
+*/
+typedef struct VdbeArray VdbeArray;
+struct VdbeArray {
+  int eType;            /* SQLITE4_INTEGER, FLOAT, TEXT or BLOB */
+  int nRow;             /* Number of values in aData[] */
+  const void *aData;    /* Array of values */
+  const int *anByte;    /* Array of sizes or NULL indicators, or NULL */
+};
+
 /*
 ** An instance of the virtual machine.  This structure contains the complete
 ** state of the virtual machine.
@@ -290,6 +378,7 @@ struct Vdbe {
   char **azVar;           /* Name of variables */
   ynVar nVar;             /* Number of entries in aVar[] */
   ynVar nzVar;            /* Number of entries in azVar[] */
+  VdbeArray *aArray;      /* Array bindings for aVar[], or NULL */
   u32 cacheCtr;           /* VdbeCursor row cache generation counter */
   int pc;                 /* The program counter */
   int rc;                 /* Value to return */
@@ -302,6 +391,7 @@ struct Vdbe {
   u8 inVtabMethod;        /* See comments above */
   u8 needSavepoint;       /* True if a change might abort and needs savepoint */
   u8 readOnly;            /* True for read-only statements */
+  u8 noStmtCache;         /* Do not add to db->pStmtCache when finalized */
   int nChange;            /* Number of db changes made since last reset */
   yDbMask stmtTransMask;  /* db->aDb[] entries that have a subtransaction */
   int aCounter[3];        /* Counters used by sqlite4_stmt_status() */
@@ -311,6 +401,9 @@ struct Vdbe {
   i64 nFkConstraint;      /* Number of imm. FK constraints this VM */
   i64 nStmtDefCons;       /* Number of def. constraints when stmt started */
   char *zSql;             /* Text of the SQL statement that generated this */
+  int nSql;               /* Length of zSql. Set while in db->pStmtCache */
+  u32 iSqlHash;           /* Hash of zSql. Set while in db->pStmtCache */
+  int dbFlags;            /* Value of db->flags when VM was compiled */
   void *pFree;            /* Free this when deleting the vdbe */
 #ifdef SQLITE4_DEBUG
   FILE *trace;            /* Write an execution trace here, if not NULL */
@@ -326,6 +419,12 @@ struct Vdbe {
   SubProgram *pProgram;   /* Linked list of all sub-programs used by VM */
   int nOnceFlag;          /* Size of array aOnceFlag[] */
   u8 *aOnceFlag;          /* Flags for OP_Once */
+  Mem sScratch;           /* Buffer reused by sqlite4VdbeEncodeData() */
+  VdbeProfile *aProfile;  /* Per-instruction profile, or NULL */
+  VdbeLoop *aLoop;        /* Loops generated by the query planner */
+  int nLoop;              /* Number of entries in aLoop[] */
+  u8 bProfiled;           /* True once EXPLAIN ANALYZE has run the program */
+  sqlite4_uint64 aKVCall[KVPROFILE_N];  /* KV calls by current instruction */
 };
 
 /*
@@ -336,6 +435,16 @@ struct Vdbe {
 #define VDBE_MAGIC_HALT     0x519c2973    /* VDBE has completed execution */
 #define VDBE_MAGIC_DEAD     0xb606c3c8    /* The VDBE has been deallocated */
 
+/*
+** Record formats that may be generated by sqlite4VdbeEncodeData(). Both
+** may be read by the RowDecoder object. A record in the offsets format
+** begins with the ROWFORMAT_MARKER byte, which can never be the first
+** byte of the header-size varint that begins a varint format record.
+*/
+#define ROWFORMAT_VARINT    0     /* Varint header followed by payload */
+#define ROWFORMAT_OFFSETS   1     /* Fixed-width table of column offsets */
+#define ROWFORMAT_MARKER    0xFF  /* First byte of an offsets format record */
+
 /*
 ** Function prototypes
 */
@@ -356,6 +465,7 @@ int sqlite4VdbeDecoderDestroy(RowDecoder *pDecoder);
 int sqlite4VdbeDecoderGetColumn(
   RowDecoder *pDecoder,        /* The decoder for the whole string */
   int iVal,                    /* Index of the value to decode.  First is 0 */
+  int bRef,                    /* True to return text and blobs by reference */
   Mem *pDefault,               /* The default value.  Often NULL */
   Mem *pOut                    /* Write the result here */
 );
@@ -364,11 +474,32 @@ int sqlite4VdbeEncodeData(
   Mem *aIn,                   /* Array of values to encode */
   int *aPermute,              /* Permutation (or NULL) */
   int nIn,                    /* Number of entries in aIn[] */
-  u8 **pzOut,                 /* The output data record */
-  int *pnOut                  /* Bytes of content in pzOut */
+  int eFormat,                /* ROWFORMAT_VARINT or ROWFORMAT_OFFSETS */
+  Mem *pScratch,              /* Scratch buffer reused across calls */
+  Mem *pOut                   /* Write the output data record here */
+);
+int sqlite4VdbeEncodeKeyToMem(
+  sqlite4 *db,                /* The database connection */
+  Mem *aIn,                   /* Values to be encoded */
+  int nIn,                    /* Number of entries in aIn[] */
+  int iTabno,                 /* The table this key applies to */
+  KeyInfo *pKeyInfo,          /* Collating sequence information */
+  int nExtra,                 /* Extra bytes to reserve after the key */
+  Mem *pOut                   /* Write the key here */
+);
+int sqlite4VdbeEncodeKeyWithPrefix(
+  sqlite4 *db,                /* The database connection */
+  Mem *pPrefix,               /* Key prefix to start the key with */
+  Mem *aIn,                   /* Values to be encoded after the prefix */
+  int nIn,                    /* Number of entries in aIn[] */
+  KeyInfo *pKeyInfo,          /* Collating sequence information */
+  int nExtra,                 /* Extra bytes to reserve after the key */
+  Mem *pOut                   /* Write the key here */
 );
 int sqlite4VdbeEncodeIntKey(u8 *aBuf,sqlite4_int64 v);
+int sqlite4VdbeEncodeNumKey(u8 *aBuf, sqlite4_num num);
 int sqlite4VdbeDecodeNumericKey(const KVByteArray*, KVSize, sqlite4_num*);
+int sqlite4VdbeDecodeIntKey(const KVByteArray*, KVSize, sqlite4_int64*);
 int sqlite4VdbeShortKey(const u8 *, int, int, int *);
 int sqlite4MemCompare(Mem*, Mem*, const CollSeq*,int*);
 int sqlite4VdbeExec(Vdbe*);
@@ -382,6 +513,7 @@ void sqlite4VdbeMemMove(Mem*, Mem*);
 int sqlite4VdbeMemNulTerminate(Mem*);
 int sqlite4VdbeMemSetStr(Mem*, const char*, int, u8,
                          void(*)(void*,void*),void*);
+void sqlite4VdbeMemSetRef(Mem*, const char*, int, u8);
 void sqlite4VdbeMemSetInt64(Mem*, i64);
 #ifdef SQLITE4_OMIT_FLOATING_POINT
 # define sqlite4VdbeMemSetDouble sqlite4VdbeMemSetInt64
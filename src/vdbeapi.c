@@ -64,7 +64,7 @@ int sqlite4_finalize(sqlite4_stmt *pStmt){
     mutex = v->db->mutex;
 #endif
     sqlite4_mutex_enter(mutex);
-    rc = sqlite4VdbeFinalize(v);
+    rc = sqlite4VdbeFinalizeToCache(v);
     rc = sqlite4ApiExit(db, rc);
     sqlite4_mutex_leave(mutex);
   }
@@ -109,6 +109,8 @@ int sqlite4_clear_bindings(sqlite4_stmt *pStmt){
     sqlite4VdbeMemRelease(&p->aVar[i]);
     p->aVar[i].flags = MEM_Null;
   }
+  sqlite4DbFree(p->db, p->aArray);
+  p->aArray = 0;
   if( p->expmask ){
     p->expired = 1;
   }
@@ -311,6 +313,18 @@ void sqlite4_result_error_nomem(sqlite4_context *pCtx){
   pCtx->s.db->mallocFailed = 1;
 }
 
+/*
+** Return true if the next run of VM p should collect the per-instruction
+** profile reported by sqlite4_stmt_profile() and EXPLAIN ANALYZE. If
+** SQLite is compiled with VDBE_PROFILE, every run is profiled.
+*/
+#ifdef VDBE_PROFILE
+# define vdbeWantProfile(p) 1
+#else
+# define vdbeWantProfile(p) \
+    ((p)->explain==3 || ((p)->db->flags & SQLITE4_StmtProfile)!=0)
+#endif
+
 /*
 ** Execute the statement pStmt, either until a row of data is ready, the
 ** statement is completely executed or an error occurs.
@@ -382,6 +396,22 @@ static int sqlite4Step(Vdbe *p){
     }
 #endif
 
+    /* Allocate or free the per-instruction profile counters, depending on
+    ** whether or not this run is to be profiled. */
+    if( vdbeWantProfile(p) ){
+      if( p->aProfile==0 ){
+        p->aProfile = sqlite4DbMallocZero(db, p->nOp*sizeof(VdbeProfile));
+        if( p->aProfile==0 ){
+          p->rc = SQLITE4_NOMEM;
+          return SQLITE4_NOMEM;
+        }
+      }
+      memset(p->aKVCall, 0, sizeof(p->aKVCall));
+    }else if( p->aProfile ){
+      sqlite4DbFree(db, p->aProfile);
+      p->aProfile = 0;
+    }
+
     db->activeVdbeCnt++;
     if( p->readOnly==0 ) db->writeVdbeCnt++;
     p->pc = 0;
@@ -438,26 +468,20 @@ end_of_step:
 #endif
 
 /*
-** This is the top-level implementation of sqlite4_step().  Call
-** sqlite4Step() to do most of the work.  If a schema error occurs,
-** call sqlite4Reprepare() and try again.
+** Call sqlite4Step() to run statement v.  If a schema error occurs,
+** call sqlite4Reprepare() and try again. The caller must hold the
+** database mutex.
 */
-int sqlite4_step(sqlite4_stmt *pStmt){
+static int vdbeStepWithRetry(Vdbe *v){
   int rc = SQLITE4_OK;      /* Result from sqlite4Step() */
   int rc2 = SQLITE4_OK;     /* Result from sqlite4Reprepare() */
-  Vdbe *v = (Vdbe*)pStmt;  /* the prepared statement */
   int cnt = 0;             /* Counter to prevent infinite loop of reprepares */
-  sqlite4 *db;             /* The database connection */
+  sqlite4 *db = v->db;     /* The database connection */
 
-  if( vdbeSafetyNotNull(v) ){
-    return SQLITE4_MISUSE_BKPT;
-  }
-  db = v->db;
-  sqlite4_mutex_enter(db->mutex);
   while( (rc = sqlite4Step(v))==SQLITE4_SCHEMA
          && cnt++ < SQLITE4_MAX_SCHEMA_RETRY
          && (rc2 = rc = sqlite4Reprepare(v))==SQLITE4_OK ){
-    sqlite4_reset(pStmt);
+    sqlite4_reset((sqlite4_stmt*)v);
     assert( v->expired==0 );
   }
   if( rc2!=SQLITE4_OK && ALWAYS(db->pErr) ){
@@ -479,6 +503,23 @@ int sqlite4_step(sqlite4_stmt *pStmt){
       v->rc = rc = SQLITE4_NOMEM;
     }
   }
+  return rc;
+}
+
+/*
+** This is the top-level implementation of sqlite4_step().
+*/
+int sqlite4_step(sqlite4_stmt *pStmt){
+  int rc;
+  Vdbe *v = (Vdbe*)pStmt;
+  sqlite4 *db;
+
+  if( vdbeSafetyNotNull(v) ){
+    return SQLITE4_MISUSE_BKPT;
+  }
+  db = v->db;
+  sqlite4_mutex_enter(db->mutex);
+  rc = vdbeStepWithRetry(v);
   rc = sqlite4ApiExit(db, rc);
   sqlite4_mutex_leave(db->mutex);
   return rc;
@@ -942,6 +983,7 @@ static int vdbeUnbind(Vdbe *p, int i){
   pVar = &p->aVar[i];
   sqlite4VdbeMemRelease(pVar);
   pVar->flags = MEM_Null;
+  if( p->aArray ) memset(&p->aArray[i], 0, sizeof(VdbeArray));
   sqlite4Error(p->db, SQLITE4_OK, 0);
 
   /* If the bit corresponding to this variable in Vdbe.expmask is set, then 
@@ -1094,6 +1136,192 @@ int sqlite4_bind_value(sqlite4_stmt *pStmt, int i, const sqlite4_value *pValue){
   return rc;
 }
 
+/*
+** Bind an array of nRow values to host parameter i. See the comments
+** above sqlite4_step_array() in sqlite.h.in for details.
+*/
+int sqlite4_bind_array(
+  sqlite4_stmt *pStmt,
+  int i,
+  int eType,
+  const void *aData,
+  const int *anByte,
+  int nRow
+){
+  Vdbe *p = (Vdbe*)pStmt;
+  int rc;
+
+  if( nRow<0 || aData==0
+   || (eType!=SQLITE4_INTEGER && eType!=SQLITE4_FLOAT
+    && eType!=SQLITE4_TEXT && eType!=SQLITE4_BLOB)
+   || (eType==SQLITE4_BLOB && anByte==0)
+  ){
+    return SQLITE4_MISUSE_BKPT;
+  }
+  rc = vdbeUnbind(p, i);
+  if( rc==SQLITE4_OK ){
+    if( p->aArray==0 ){
+      p->aArray = sqlite4DbMallocZero(p->db, sizeof(VdbeArray)*p->nVar);
+    }
+    if( p->aArray ){
+      VdbeArray *pArray = &p->aArray[i-1];
+      pArray->eType = eType;
+      pArray->nRow = nRow;
+      pArray->aData = aData;
+      pArray->anByte = anByte;
+    }else{
+      rc = SQLITE4_NOMEM;
+    }
+    sqlite4Error(p->db, rc, 0);
+    rc = sqlite4ApiExit(p->db, rc);
+    sqlite4_mutex_leave(p->db->mutex);
+  }
+  return rc;
+}
+
+/*
+** Load the values for row iRow of the array bindings of statement p
+** into p->aVar[]. The values are not copied.
+*/
+static int vdbeLoadArrayRow(Vdbe *p, int iRow){
+  int rc = SQLITE4_OK;
+  int i;
+
+  for(i=0; rc==SQLITE4_OK && i<p->nVar; i++){
+    VdbeArray *pArray = &p->aArray[i];
+    Mem *pVar = &p->aVar[i];
+    int bNull;
+
+    if( pArray->eType==0 ) continue;
+    bNull = (pArray->anByte && pArray->anByte[iRow]<0);
+    sqlite4VdbeMemRelease(pVar);
+    pVar->flags = MEM_Null;
+    switch( pArray->eType ){
+      case SQLITE4_INTEGER:
+        if( !bNull ){
+          sqlite4VdbeMemSetInt64(pVar, ((const i64*)pArray->aData)[iRow]);
+        }
+        break;
+      case SQLITE4_FLOAT:
+        if( !bNull ){
+          sqlite4VdbeMemSetDouble(pVar, ((const double*)pArray->aData)[iRow]);
+        }
+        break;
+      default: {
+        const char *z = ((const char *const*)pArray->aData)[iRow];
+        if( z ){
+          int n = (pArray->anByte ? pArray->anByte[iRow] : -1);
+          u8 enc = (pArray->eType==SQLITE4_TEXT ? SQLITE4_UTF8 : 0);
+          rc = sqlite4VdbeMemSetStr(pVar, z, n, enc, SQLITE4_STATIC, 0);
+          if( rc==SQLITE4_OK && enc!=0 ){
+            rc = sqlite4VdbeChangeEncoding(pVar, ENC(p->db));
+          }
+        }
+        break;
+      }
+    }
+
+    /* As for vdbeUnbind(), a new value for a parameter that the query
+    ** plan depends on invalidates the plan.  */
+    if( (i<32 && p->expmask & ((u32)1 << i)) || p->expmask==0xffffffff ){
+      p->expired = 1;
+    }
+  }
+  return rc;
+}
+
+/*
+** Run statement pStmt once for each of the first nRow rows of its array
+** bindings. Store the result of each row in aRc[], if it is not NULL.
+*/
+int sqlite4_step_array(sqlite4_stmt *pStmt, int nRow, int *aRc){
+  Vdbe *v = (Vdbe*)pStmt;
+  sqlite4 *db;
+  int rc = SQLITE4_OK;            /* Return code */
+  char *zErr = 0;                 /* Error message for rc */
+  int bTrans = 0;                 /* True if a transaction was opened */
+  int bLost = 0;                  /* True if the transaction was rolled back */
+  int iRow;
+  int i;
+
+  if( vdbeSafetyNotNull(v) || nRow<0 ){
+    return SQLITE4_MISUSE_BKPT;
+  }
+  db = v->db;
+  sqlite4_mutex_enter(db->mutex);
+  if( v->magic!=VDBE_MAGIC_RUN || v->pc>=0 ){
+    sqlite4_reset(pStmt);
+  }
+  for(i=0; v->aArray && i<v->nVar; i++){
+    if( v->aArray[i].eType && v->aArray[i].nRow<nRow ){
+      sqlite4Error(db, SQLITE4_RANGE, 0);
+      sqlite4_mutex_leave(db->mutex);
+      return SQLITE4_RANGE;
+    }
+  }
+
+  /* In autocommit mode, run all rows in a single transaction so that
+  ** the KV store commits once per batch instead of once per row.  */
+  if( nRow>1 && v->readOnly==0 && db->pSavepoint==0 ){
+    rc = sqlite4_exec(db, "BEGIN", 0, 0);
+    if( rc!=SQLITE4_OK ) goto step_array_out;
+    bTrans = 1;
+  }
+
+  for(iRow=0; iRow<nRow; ){
+    int rcRow = SQLITE4_OK;
+    if( v->aArray ) rcRow = vdbeLoadArrayRow(v, iRow);
+    if( rcRow==SQLITE4_OK ){
+      while( (rcRow = vdbeStepWithRetry(v))==SQLITE4_ROW );
+    }
+    sqlite4_reset(pStmt);
+    if( aRc ) aRc[iRow] = rcRow;
+    if( rcRow!=SQLITE4_DONE && rc==SQLITE4_OK ){
+      rc = rcRow;
+      zErr = sqlite4DbStrDup(db, sqlite4_errmsg(db));
+    }
+    iRow++;
+    if( bTrans && db->pSavepoint==0 ){
+      /* The error rolled back the transaction, and the changes made by
+      ** the rows before this one with it.  */
+      bTrans = 0;
+      bLost = 1;
+    }
+    if( bLost || db->mallocFailed ) break;
+  }
+
+  if( bTrans ){
+    int rc2 = sqlite4_exec(db, "COMMIT", 0, 0);
+    if( rc2!=SQLITE4_OK ){
+      if( rc==SQLITE4_OK ){
+        rc = rc2;
+        zErr = sqlite4DbStrDup(db, sqlite4_errmsg(db));
+      }
+      if( db->pSavepoint ) sqlite4_exec(db, "ROLLBACK", 0, 0);
+      bLost = 1;
+    }
+  }
+
+  if( aRc ){
+    for(i=0; i<nRow; i++){
+      if( i>=iRow || (bLost && aRc[i]==SQLITE4_DONE) ){
+        aRc[i] = SQLITE4_ABORT;
+      }
+    }
+  }
+
+ step_array_out:
+  if( zErr ){
+    sqlite4Error(db, rc, "%s", zErr);
+    sqlite4DbFree(db, zErr);
+  }else{
+    sqlite4Error(db, rc, 0);
+  }
+  rc = sqlite4ApiExit(db, rc);
+  sqlite4_mutex_leave(db->mutex);
+  return rc;
+}
+
 /*
 ** Return the number of wildcards that can be potentially bound to.
 ** This routine is added to support DBD::SQLite.  
@@ -1154,6 +1382,9 @@ int sqlite4TransferBindings(sqlite4_stmt *pFromStmt, sqlite4_stmt *pToStmt){
   for(i=0; i<pFrom->nVar; i++){
     sqlite4VdbeMemMove(&pTo->aVar[i], &pFrom->aVar[i]);
   }
+  sqlite4DbFree(pTo->db, pTo->aArray);
+  pTo->aArray = pFrom->aArray;
+  pFrom->aArray = 0;
   sqlite4_mutex_leave(pTo->db->mutex);
   return SQLITE4_OK;
 }
@@ -1211,3 +1442,76 @@ int sqlite4_stmt_status(sqlite4_stmt *pStmt, int op, int resetFlag){
   if( resetFlag ) pVdbe->aCounter[op-1] = 0;
   return v;
 }
+
+/*
+** Add the cycle and KV counters for instructions iFirst to iLast-1 of
+** VM p to *pOut.
+*/
+static void vdbeProfileSum(
+  Vdbe *p,                        /* Profiled VM */
+  int iFirst, int iLast,          /* Range of instructions to add */
+  sqlite4_profile_info *pOut      /* Accumulate totals here */
+){
+  int i;
+  for(i=iFirst; i<iLast && i<p->nOp; i++){
+    VdbeProfile *pProf = &p->aProfile[i];
+    pOut->nCycle += pProf->nCycle;
+    pOut->nSeek += pProf->nSeek;
+    pOut->nStep += pProf->nStep;
+    pOut->nByte += pProf->nByte;
+  }
+}
+
+/*
+** Return the profile of a VM instruction or planner loop.
+*/
+int sqlite4_stmt_profile(
+  sqlite4_stmt *pStmt,            /* Statement to query */
+  int eType,                      /* SQLITE4_PROFILE_OP, LOOP or RESET */
+  int iIdx,                       /* Instruction or loop number */
+  sqlite4_profile_info *pOut      /* OUT: Profile counters */
+){
+  Vdbe *p = (Vdbe*)pStmt;
+  if( p->aProfile==0 ) return SQLITE4_ERROR;
+
+  switch( eType ){
+    case SQLITE4_PROFILE_OP: {
+      VdbeProfile *pProf;
+      if( iIdx<0 || iIdx>=p->nOp ) return SQLITE4_RANGE;
+      pProf = &p->aProfile[iIdx];
+      pOut->nExec = pProf->nExec;
+      pOut->nRow = (p->aOp[iIdx].opcode==OP_ResultRow ? pProf->nExec : 0);
+      pOut->nCycle = pProf->nCycle;
+      pOut->nSeek = pProf->nSeek;
+      pOut->nStep = pProf->nStep;
+      pOut->nByte = pProf->nByte;
+      pOut->zDesc = sqlite4OpcodeName(p->aOp[iIdx].opcode);
+      break;
+    }
+
+    case SQLITE4_PROFILE_LOOP: {
+      VdbeLoop *pLoop;
+      if( iIdx<0 || iIdx>=p->nLoop ) return SQLITE4_RANGE;
+      pLoop = &p->aLoop[iIdx];
+      memset(pOut, 0, sizeof(*pOut));
+      if( pLoop->addrStart<p->nOp ){
+        pOut->nExec = p->aProfile[pLoop->addrStart].nExec;
+      }
+      if( pLoop->addrBody<p->nOp ){
+        pOut->nRow = p->aProfile[pLoop->addrBody].nExec;
+      }
+      vdbeProfileSum(p, pLoop->addrStart, pLoop->addrBody, pOut);
+      vdbeProfileSum(p, pLoop->addrCont, pLoop->addrEnd, pOut);
+      pOut->zDesc = pLoop->zDesc;
+      break;
+    }
+
+    case SQLITE4_PROFILE_RESET:
+      memset(p->aProfile, 0, p->nOp*sizeof(VdbeProfile));
+      break;
+
+    default:
+      return SQLITE4_MISUSE_BKPT;
+  }
+  return SQLITE4_OK;
+}
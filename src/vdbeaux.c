@@ -26,6 +26,8 @@ Vdbe *sqlite4VdbeCreate(sqlite4 *db){
   p = sqlite4DbMallocZero(db, sizeof(Vdbe) );
   if( p==0 ) return 0;
   p->db = db;
+  p->sScratch.db = db;
+  p->sScratch.flags = MEM_Null;
   if( db->pVdbe ){
     db->pVdbe->pPrev = p;
   }
@@ -144,10 +146,6 @@ int sqlite4VdbeAddOp3(Vdbe *p, int op, int p1, int p2, int p3){
   if( p->db->flags & SQLITE4_VdbeAddopTrace ){
     sqlite4VdbePrintOp(0, i, &p->aOp[i]);
   }
-#endif
-#ifdef VDBE_PROFILE
-  pOp->cycles = 0;
-  pOp->cnt = 0;
 #endif
   return i;
 }
@@ -261,6 +259,15 @@ void sqlite4VdbeRunOnlyOnce(Vdbe *p){
   p->runOnlyOnce = 1;
 }
 
+/*
+** Mark the VDBE as one that may not be added to the statement cache when
+** it is finalized. This is used for statements that have side-effects
+** at compile time, such as most PRAGMA statements.
+*/
+void sqlite4VdbeNoStmtCache(Vdbe *p){
+  p->noStmtCache = 1;
+}
+
 #ifdef SQLITE4_DEBUG /* sqlite4AssertMayAbort() logic */
 
 /*
@@ -445,6 +452,55 @@ int sqlite4VdbeCurrentAddr(Vdbe *p){
   return p->nOp;
 }
 
+/*
+** Record the start of a new planner loop at the current address, for
+** reporting by sqlite4_stmt_profile(). The Vdbe takes ownership of zDesc,
+** which must have been obtained from sqlite4DbMalloc(). Return an index
+** to pass to sqlite4VdbeLoopAddr(), or -1 if a malloc fails.
+*/
+int sqlite4VdbeAddLoop(Vdbe *p, int iSelectId, int iLevel, char *zDesc){
+  sqlite4 *db = p->db;
+  VdbeLoop *aNew;
+  VdbeLoop *pLoop;
+
+  assert( p->magic==VDBE_MAGIC_INIT );
+  aNew = sqlite4DbRealloc(db, p->aLoop, (p->nLoop+1)*sizeof(VdbeLoop));
+  if( aNew==0 ){
+    sqlite4DbFree(db, zDesc);
+    return -1;
+  }
+  p->aLoop = aNew;
+  pLoop = &aNew[p->nLoop];
+  pLoop->iSelectId = iSelectId;
+  pLoop->iLevel = iLevel;
+  pLoop->zDesc = zDesc;
+  pLoop->addrStart = p->nOp;
+  pLoop->addrBody = p->nOp;
+  pLoop->addrCont = p->nOp;
+  pLoop->addrEnd = p->nOp;
+  return p->nLoop++;
+}
+
+/*
+** Set the VDBE_LOOP_BODY, VDBE_LOOP_CONT or VDBE_LOOP_END address of
+** loop iLoop to the current address. A negative iLoop is a no-op.
+*/
+void sqlite4VdbeLoopAddr(Vdbe *p, int iLoop, int eAddr){
+  VdbeLoop *pLoop;
+  assert( p->magic==VDBE_MAGIC_INIT );
+  if( iLoop<0 ) return;
+  assert( iLoop<p->nLoop );
+  pLoop = &p->aLoop[iLoop];
+  switch( eAddr ){
+    case VDBE_LOOP_BODY: pLoop->addrBody = p->nOp; break;
+    case VDBE_LOOP_CONT: pLoop->addrCont = p->nOp; break;
+    default:
+      assert( eAddr==VDBE_LOOP_END );
+      pLoop->addrEnd = p->nOp;
+      break;
+  }
+}
+
 /*
 ** This function returns a pointer to the array of opcodes associated with
 ** the Vdbe passed as the first argument. It is the callers responsibility
@@ -1045,6 +1101,52 @@ void sqlite4VdbeFrameDelete(VdbeFrame *p){
 }
 
 #ifndef SQLITE4_OMIT_EXPLAIN
+/*
+** Run the program of an EXPLAIN ANALYZE statement to completion so that
+** the profile of this run may be listed. Result rows are discarded. If
+** successful, the VM is left ready to list the program, as if
+** sqlite4_step() had just been called for the first time. Otherwise the
+** VM has already been halted and an error code is returned.
+**
+** While the program runs, p->nResColumn is set to the number of columns
+** returned by its OP_ResultRow instructions, instead of the width of the
+** EXPLAIN ANALYZE listing.
+*/
+static int vdbeProfileRun(Vdbe *p){
+  sqlite4 *db = p->db;
+  int nListCol = p->nResColumn;   /* Columns in the listing */
+  int rc;
+  int i;
+
+  assert( p->explain==3 && p->aProfile && p->pc==0 );
+  memset(p->aProfile, 0, p->nOp*sizeof(VdbeProfile));
+  p->nResColumn = 0;
+  for(i=0; i<p->nOp; i++){
+    if( p->aOp[i].opcode==OP_ResultRow ){
+      p->nResColumn = (u16)p->aOp[i].p2;
+      break;
+    }
+  }
+  p->explain = 0;
+  db->vdbeExecCnt++;
+  do{
+    rc = sqlite4VdbeExec(p);
+  }while( rc==SQLITE4_ROW );
+  db->vdbeExecCnt--;
+  p->explain = 3;
+  p->nResColumn = (u16)nListCol;
+  if( rc!=SQLITE4_DONE ) return rc;
+
+  /* The OP_Halt has halted the VM. Restart it for the listing. */
+  p->bProfiled = 1;
+  p->magic = VDBE_MAGIC_RUN;
+  db->activeVdbeCnt++;
+  if( p->readOnly==0 ) db->writeVdbeCnt++;
+  p->pc = 0;
+  p->rc = SQLITE4_OK;
+  return SQLITE4_OK;
+}
+
 /*
 ** Give a listing of the program in the virtual machine.
 **
@@ -1059,6 +1161,11 @@ void sqlite4VdbeFrameDelete(VdbeFrame *p){
 **
 ** When p->explain==1, first the main program is listed, then each of
 ** the trigger subprograms are listed one by one.
+**
+** When p->explain==3 (EXPLAIN ANALYZE), the first call runs the program
+** to completion with profiling enabled, discarding any result rows. The
+** main program is then listed as for p->explain==1, with five extra
+** columns holding the profile counters of each instruction.
 */
 int sqlite4VdbeList(
   Vdbe *p                   /* The VDBE */
@@ -1080,7 +1187,7 @@ int sqlite4VdbeList(
   ** the result, result columns may become dynamic if the user calls
   ** sqlite4_column_text16(), causing a translation to UTF-16 encoding.
   */
-  releaseMemArray(pMem, 8);
+  releaseMemArray(pMem, p->explain==3 ? 13 : 8);
   p->pResultSet = 0;
 
   if( p->rc==SQLITE4_NOMEM ){
@@ -1089,6 +1196,10 @@ int sqlite4VdbeList(
     db->mallocFailed = 1;
     return SQLITE4_ERROR;
   }
+  if( p->explain==3 && p->bProfiled==0 ){
+    rc = vdbeProfileRun(p);
+    if( rc!=SQLITE4_OK ) return rc;
+  }
 
   /* When the number of output rows reaches nRow, that means the
   ** listing has finished and sqlite4_step() should return SQLITE4_DONE.
@@ -1143,7 +1254,7 @@ int sqlite4VdbeList(
       }
       pOp = &apSub[j]->aOp[i];
     }
-    if( p->explain==1 ){
+    if( p->explain!=2 ){
       pMem->flags = MEM_Int;
       pMem->type = SQLITE4_INTEGER;
       pMem->u.num = sqlite4_num_from_int64(i);             /* Program counter */
@@ -1162,7 +1273,7 @@ int sqlite4VdbeList(
       ** kept in p->aMem[9].z to hold the new program - assuming this subprogram
       ** has not already been seen.
       */
-      if( pOp->p4type==P4_SUBPROGRAM ){
+      if( pSub && pOp->p4type==P4_SUBPROGRAM ){
         int nByte = (nSub+1)*sizeof(SubProgram*);
         int j;
         for(j=0; j<nSub; j++){
@@ -1208,7 +1319,7 @@ int sqlite4VdbeList(
     pMem->type = SQLITE4_TEXT;
     pMem++;
 
-    if( p->explain==1 ){
+    if( p->explain!=2 ){
       if( sqlite4VdbeMemGrow(pMem, 4, 0) ){
         assert( p->db->mallocFailed );
         return SQLITE4_ERROR;
@@ -1235,7 +1346,24 @@ int sqlite4VdbeList(
       }
     }
 
-    p->nResColumn = 8 - 4*(p->explain-1);
+    if( p->explain==3 ){
+      VdbeProfile *pProf = &p->aProfile[i];
+      i64 aVal[5];
+      int j;
+      aVal[0] = pProf->nExec;
+      aVal[1] = pProf->nCycle;
+      aVal[2] = pProf->nSeek;
+      aVal[3] = pProf->nStep;
+      aVal[4] = pProf->nByte;
+      for(j=0; j<5; j++){
+        pMem++;
+        pMem->flags = MEM_Int;
+        pMem->u.num = sqlite4_num_from_int64(aVal[j]);
+        pMem->type = SQLITE4_INTEGER;
+      }
+    }
+
+    p->nResColumn = (p->explain==2 ? 4 : (p->explain==3 ? 13 : 8));
     p->pResultSet = &p->aMem[1];
     p->rc = SQLITE4_OK;
     rc = SQLITE4_ROW;
@@ -1336,7 +1464,7 @@ static void *allocSpace(
 ** running it.
 */
 void sqlite4VdbeRewind(Vdbe *p){
-#if defined(SQLITE4_DEBUG) || defined(VDBE_PROFILE)
+#if defined(SQLITE4_DEBUG)
   int i;
 #endif
   assert( p!=0 );
@@ -1363,12 +1491,7 @@ void sqlite4VdbeRewind(Vdbe *p){
   p->minWriteFileFormat = 255;
   p->stmtTransMask = 0;
   p->nFkConstraint = 0;
-#ifdef VDBE_PROFILE
-  for(i=0; i<p->nOp; i++){
-    p->aOp[i].cnt = 0;
-    p->aOp[i].cycles = 0;
-  }
-#endif
+  p->bProfiled = 0;
 }
 
 /*
@@ -1436,9 +1559,13 @@ void sqlite4VdbeMakeReady(
 
   resolveP2Values(p, &nArg);
   p->needSavepoint = (u8)(pParse->isMultiWrite && pParse->mayAbort);
+  p->dbFlags = db->flags;
   if( pParse->explain && nMem<10 ){
     nMem = 10;
   }
+  if( pParse->explain==3 && nMem<13 ){
+    nMem = 13;                      /* EXPLAIN ANALYZE returns 13 columns */
+  }
   memset(zCsr, 0, zEnd-zCsr);
   zCsr += (zCsr - (u8*)0)&7;
   assert( EIGHT_BYTE_ALIGNMENT(zCsr) );
@@ -1688,7 +1815,14 @@ int sqlite4VdbeRollback(sqlite4 *db, int iLevel){
   for(i=0; i<db->nDb; i++){
     KVStore *pKV = db->aDb[i].pKV;
     if( pKV && pKV->iTransLevel>=iLevel ){
+      /* Closing a read transaction does not undo any writes, so the
+      ** cached largest rowids need only be discarded if a write
+      ** transaction is being rolled back.  */
+      int bWrite = (pKV->iTransLevel>=2);
       sqlite4KVStoreRollback(pKV, iLevel);
+      if( bWrite && db->aDb[i].pSchema ){
+        sqlite4VdbeRowidHwmClear(db->pEnv, db->aDb[i].pSchema);
+      }
     }
   }
   sqlite4EndBenignMalloc(db->pEnv);
@@ -1726,6 +1860,9 @@ int sqlite4VdbeCommit(sqlite4 *db, int iLevel){
   for(i=0; rc==SQLITE4_OK && i<db->nDb; i++){
     KVStore *pKV = db->aDb[i].pKV;
     if( pKV && pKV->iTransLevel>iLevel ){
+      if( iLevel<2 && pKV->iTransLevel>=2 ){
+        sqlite4VdbeRowidHwmCommit(db, i);
+      }
       rc = sqlite4KVStoreCommit(pKV, iLevel);
     }
   }
@@ -1750,6 +1887,7 @@ static int vdbeCloseStatement(Vdbe *p, int bRollback){
       assert( pKV->iTransLevel>2 );
       if( bRollback ){
         rc = sqlite4KVStoreRollback(pKV, pKV->iTransLevel);
+        sqlite4VdbeRowidHwmClear(db->pEnv, db->aDb[i].pSchema);
       }
       if( rc==SQLITE4_OK ){
         rc = sqlite4KVStoreCommit(pKV, pKV->iTransLevel-1);
@@ -2016,7 +2154,7 @@ int sqlite4VdbeReset(Vdbe *p){
   /* Save profiling information from this VDBE run.
   */
 #ifdef VDBE_PROFILE
-  {
+  if( p->aProfile ){
     FILE *out = fopen("vdbe_profile.out", "a");
     if( out ){
       int i;
@@ -2026,15 +2164,17 @@ int sqlite4VdbeReset(Vdbe *p){
       }
       fprintf(out, "\n");
       for(i=0; i<p->nOp; i++){
-        fprintf(out, "%6d %10lld %8lld ",
-           p->aOp[i].cnt,
-           p->aOp[i].cycles,
-           p->aOp[i].cnt>0 ? p->aOp[i].cycles/p->aOp[i].cnt : 0
+        VdbeProfile *pProf = &p->aProfile[i];
+        fprintf(out, "%6lld %10lld %8lld ",
+           pProf->nExec,
+           pProf->nCycle,
+           pProf->nExec>0 ? pProf->nCycle/pProf->nExec : 0
         );
         sqlite4VdbePrintOp(out, i, &p->aOp[i]);
       }
       fclose(out);
     }
+    memset(p->aProfile, 0, p->nOp*sizeof(VdbeProfile));
   }
 #endif
   p->magic = VDBE_MAGIC_INIT;
@@ -2054,6 +2194,199 @@ int sqlite4VdbeFinalize(Vdbe *p){
   return rc;
 }
 
+/*
+** The statement cache.
+**
+** When a statement compiled from SQL text is finalized, it may be reset
+** and moved from the db->pVdbe list to the db->pStmtCache list instead of
+** being deleted. A later call to sqlite4_prepare() with exactly the same
+** SQL text removes it from the cache and returns it, so that the parser,
+** query planner and code generator do not have to be run again. The
+** cache is kept in most-recently-used order and holds no more than
+** db->mxStmtCache entries. It is emptied whenever the prepared statements
+** belonging to the connection are expired, a schema cookie changes or a
+** pragma is run. Statements that are in use when this happens are not
+** added to the cache when they are finalized, as they were compiled under
+** the same conditions as those discarded.
+**
+** Statements that expire themselves, that depend on the values bound to
+** their parameters (Vdbe.expmask) or that have side-effects at compile
+** time (Vdbe.noStmtCache) are never cached. Neither are statements
+** compiled while the schema is being loaded. A cached statement is only
+** reused if the connection flags that affect code generation (pragmas,
+** disabled optimizations) are the same as when it was compiled.
+*/
+
+/*
+** Bits of sqlite4.flags that do not affect the code generated for a
+** statement.
+*/
+#define STMTCACHE_IGNORE_FLAGS (SQLITE4_InternChanges)
+
+/*
+** Return a hash of the n bytes of SQL text at z.
+*/
+static u32 vdbeSqlHash(const char *z, int n){
+  u32 h = 0;
+  int i;
+  for(i=0; i<n; i++){
+    h = (h<<3) ^ h ^ (u8)z[i];
+  }
+  return h;
+}
+
+/*
+** Delete VM p, which is not linked into the db->pVdbe list.
+*/
+static void vdbeDeleteCached(sqlite4 *db, Vdbe *p){
+  p->magic = VDBE_MAGIC_DEAD;
+  p->db = 0;
+  sqlite4VdbeDeleteObject(db, p);
+}
+
+/*
+** This routine is called by sqlite4_finalize(). If VM p may be reused, 
+** reset it and add it to the head of the statement cache. Otherwise,
+** delete it. Either way, the return value is the same as that of
+** sqlite4VdbeFinalize().
+*/
+int sqlite4VdbeFinalizeToCache(Vdbe *p){
+  sqlite4 *db = p->db;
+  int rc;
+  int i;
+
+  if( db->mxStmtCache<=0 || db->init.busy || db->mallocFailed
+   || p->zSql==0 || p->expired || p->expmask || p->noStmtCache
+   || (p->magic!=VDBE_MAGIC_RUN && p->magic!=VDBE_MAGIC_HALT)
+  ){
+    return sqlite4VdbeFinalize(p);
+  }
+  rc = sqlite4VdbeReset(p);
+  if( rc!=SQLITE4_OK || p->expired || db->mallocFailed ){
+    sqlite4VdbeDelete(p);
+    return rc;
+  }
+  for(i=0; i<p->nVar; i++){
+    sqlite4VdbeMemRelease(&p->aVar[i]);
+    p->aVar[i].flags = MEM_Null;
+  }
+  sqlite4DbFree(db, p->aArray);
+  p->aArray = 0;
+  memset(p->aCounter, 0, sizeof(p->aCounter));
+
+  /* Move p from the db->pVdbe list to the head of db->pStmtCache */
+  if( p->pPrev ){
+    p->pPrev->pNext = p->pNext;
+  }else{
+    assert( db->pVdbe==p );
+    db->pVdbe = p->pNext;
+  }
+  if( p->pNext ){
+    p->pNext->pPrev = p->pPrev;
+  }
+  p->nSql = sqlite4Strlen30(p->zSql);
+  p->iSqlHash = vdbeSqlHash(p->zSql, p->nSql);
+  p->pPrev = 0;
+  p->pNext = db->pStmtCache;
+  if( p->pNext ) p->pNext->pPrev = p;
+  db->pStmtCache = p;
+  db->nStmtCache++;
+
+  sqlite4VdbeStmtCacheLimit(db, db->mxStmtCache);
+  return rc;
+}
+
+/*
+** Search the statement cache for a VM compiled from SQL text identical to
+** the first nBytes bytes of zSql, or to the text up to the first nul
+** byte if that comes first or nBytes is negative. If one is found, remove
+** it from the cache, link it back into the db->pVdbe list and return it,
+** ready to run. Set *pnUsed to the number of bytes of zSql that were
+** used. If there is no such VM, return NULL.
+*/
+Vdbe *sqlite4VdbeStmtCacheFind(
+  sqlite4 *db,                    /* Database connection */
+  const char *zSql,               /* SQL text to search for */
+  int nBytes,                     /* Length of zSql in bytes, or -1 */
+  int *pnUsed                     /* OUT: Bytes of zSql used */
+){
+  Vdbe *p;
+  u32 h;
+  int n;
+
+  assert( sqlite4_mutex_held(db->mutex) );
+  if( db->mxStmtCache<=0 || db->init.busy ) return 0;
+  for(n=0; (nBytes<0 || n<nBytes) && zSql[n]; n++);
+  h = vdbeSqlHash(zSql, n);
+  for(p=db->pStmtCache; p; p=p->pNext){
+    if( p->iSqlHash==h && p->nSql==n && memcmp(p->zSql, zSql, n)==0
+     && ((p->dbFlags ^ db->flags) & ~STMTCACHE_IGNORE_FLAGS)==0
+    ){
+      break;
+    }
+  }
+  if( p==0 ){
+    db->nStmtCacheMiss++;
+    return 0;
+  }
+  db->nStmtCacheHit++;
+
+  if( p->pPrev ){
+    p->pPrev->pNext = p->pNext;
+  }else{
+    db->pStmtCache = p->pNext;
+  }
+  if( p->pNext ){
+    p->pNext->pPrev = p->pPrev;
+  }
+  db->nStmtCache--;
+  p->pPrev = 0;
+  p->pNext = db->pVdbe;
+  if( p->pNext ) p->pNext->pPrev = p;
+  db->pVdbe = p;
+
+  if( p->aProfile ) memset(p->aProfile, 0, p->nOp*sizeof(VdbeProfile));
+  sqlite4VdbeRewind(p);
+  if( pnUsed ) *pnUsed = n;
+  return p;
+}
+
+/*
+** Delete VMs from the tail of the statement cache until it contains no
+** more than nMax entries.
+*/
+void sqlite4VdbeStmtCacheLimit(sqlite4 *db, int nMax){
+  while( db->nStmtCache>nMax ){
+    Vdbe *p;
+    for(p=db->pStmtCache; p->pNext; p=p->pNext);
+    if( p->pPrev ){
+      p->pPrev->pNext = 0;
+    }else{
+      db->pStmtCache = 0;
+    }
+    db->nStmtCache--;
+    vdbeDeleteCached(db, p);
+  }
+}
+
+/*
+** Delete all VMs in the statement cache.
+*/
+void sqlite4VdbeStmtCacheClear(sqlite4 *db){
+  Vdbe *p;
+  for(p=db->pVdbe; p; p=p->pNext){
+    p->noStmtCache = 1;
+  }
+  p = db->pStmtCache;
+  db->pStmtCache = 0;
+  db->nStmtCache = 0;
+  while( p ){
+    Vdbe *pNext = p->pNext;
+    vdbeDeleteCached(db, p);
+    p = pNext;
+  }
+}
+
 /*
 ** Call the destructor for each auxdata entry in pVdbeFunc for which
 ** the corresponding bit in mask is clear.  Auxdata entries beyond 31
@@ -2084,6 +2417,7 @@ void sqlite4VdbeDeleteObject(sqlite4 *db, Vdbe *p){
   int i;
   assert( p->db==0 || p->db==db );
   releaseMemArray(p->aVar, p->nVar);
+  sqlite4DbFree(db, p->aArray);
   releaseMemArray(p->aColName, p->nResColumn*COLNAME_N);
   for(pSub=p->pProgram; pSub; pSub=pNext){
     pNext = pSub->pNext;
@@ -2094,8 +2428,12 @@ void sqlite4VdbeDeleteObject(sqlite4 *db, Vdbe *p){
   vdbeFreeOpArray(db, p->aOp, p->nOp);
   sqlite4DbFree(db, p->aLabel);
   sqlite4DbFree(db, p->aColName);
+  for(i=0; i<p->nLoop; i++) sqlite4DbFree(db, p->aLoop[i].zDesc);
+  sqlite4DbFree(db, p->aLoop);
+  sqlite4DbFree(db, p->aProfile);
   sqlite4DbFree(db, p->zSql);
   sqlite4DbFree(db, p->pFree);
+  sqlite4VdbeMemRelease(&p->sScratch);
 #if defined(SQLITE4_ENABLE_TREE_EXPLAIN)
   sqlite4DbFree(db, p->zExplain);
   sqlite4DbFree(db, p->pExplain);
@@ -2212,6 +2550,7 @@ void sqlite4ExpirePreparedStatements(sqlite4 *db){
   for(p = db->pVdbe; p; p=p->pNext){
     p->expired = 1;
   }
+  sqlite4VdbeStmtCacheClear(db);
 }
 
 /*
@@ -37,6 +37,23 @@ struct RowDecoder {
     KVSize n; /* Bytes of content in a[] */
     KVSize nKey; /* Bytes of key content */
     int mxCol; /* Maximum number of columns */
+
+    /* The header of the current row is parsed lazily, only as far as the
+     ** highest column requested so far. The results are cached in aType[]
+     ** and aOfst[] so that each column is only parsed once per row. */
+    int nCol; /* Number of valid entries in aType[] and aOfst[] */
+    int nColAlloc; /* Allocated size of aType[] and aOfst[] */
+    int iHdr; /* Offset of next unparsed header byte, or 0 */
+    int endHdr; /* First byte past the end of the header */
+    KVSize iPayload; /* Payload offset of the next unparsed column */
+    sqlite4_uint64 *aType; /* Header code for each column */
+    KVSize *aOfst; /* Payload offset for each column */
+
+    /* If the current row uses the ROWFORMAT_OFFSETS format, nOfstWidth is
+     ** the width of each entry in its offset table, iHdr is the offset of
+     ** the table and nCol the number of columns. aType[] and aOfst[] are
+     ** not used in this case. */
+    int nOfstWidth; /* Offset width, or 0 for ROWFORMAT_VARINT rows */
 };
 
 /*
@@ -71,11 +88,22 @@ int sqlite4VdbeDecoderCreate(
  */
 int sqlite4VdbeDecoderDestroy(RowDecoder *p) {
     if (p) {
+        sqlite4DbFree(p->db, p->aType);
+        sqlite4DbFree(p->db, p->aOfst);
         sqlite4DbFree(p->db, p);
     }
     return SQLITE4_OK;
 }
 
+/*
+ ** Discard the cached header of the current row.
+ */
+static void decoderResetHeader(RowDecoder *p) {
+    p->nCol = 0;
+    p->iHdr = 0;
+    p->nOfstWidth = 0;
+}
+
 /*
  ** Make sure the p->a and p->n fields are valid and current.
  */
@@ -83,6 +111,9 @@ static int decoderFetchData(RowDecoder *p) {
     VdbeCursor *pCur = p->pCur;
     int rc;
     if (pCur == 0) {
+        /* There is no way to tell whether or not a bare KVCursor has moved
+         ** since the last call, so the cached header cannot be trusted. */
+        decoderResetHeader(p);
         rc = sqlite4KVCursorData(p->pKVCur, 0, -1, &p->a, &p->n);
         return rc;
     }
@@ -92,6 +123,7 @@ static int decoderFetchData(RowDecoder *p) {
         pCur->rowChnged = 0;
     }
     if (p->a) return SQLITE4_OK;
+    decoderResetHeader(p);
     rc = sqlite4VdbeCursorMoveto(pCur);
     if (rc) return rc;
     if (pCur->nullRow) {
@@ -310,6 +342,101 @@ int sqlite4VdbeDecodeNumericKey(
     return i;
 }
 
+/*
+ ** Decode a numeric key encoding that holds an integer value which fits
+ ** in a signed 64-bit integer, writing the value to *piVal.  Return the
+ ** number of bytes in the encoding on success, or 0 if the encoding is
+ ** not of such a value (in which case the caller should fall back to
+ ** sqlite4VdbeDecodeNumericKey()).
+ **
+ ** This is equivalent to sqlite4VdbeDecodeNumericKey() followed by
+ ** sqlite4_num_to_int64(), but avoids the decimal intermediate form.
+ */
+int sqlite4VdbeDecodeIntKey(
+        const KVByteArray *aKey, /* Input encoding */
+        KVSize nKey, /* Number of bytes in aKey[] */
+        sqlite4_int64 *piVal /* Write the result here */
+        ) {
+    unsigned int xorMask;
+    int bNeg;
+    int e; /* Base-100 exponent */
+    int i;
+    u64 m = 0;
+    u8 y;
+
+    if (nKey < 1) return 0;
+    y = aKey[0];
+    if (y == 0x15 || y == 0xea) { /* zero */
+        *piVal = 0;
+        return 1;
+    } else if (y >= 0x17 && y <= 0x21) { /* +medium ascending */
+        e = y - 0x17;
+        bNeg = 0;
+        xorMask = 0x00;
+    } else if (y >= 0x09 && y <= 0x13) { /* -medium ascending */
+        e = 0x13 - y;
+        bNeg = 1;
+        xorMask = 0xff;
+    } else if (y >= 0xde && y <= 0xe8) { /* +medium descending */
+        e = 0xe8 - y;
+        bNeg = 0;
+        xorMask = 0xff;
+    } else if (y >= 0xec && y <= 0xf6) { /* -medium descending */
+        e = y - 0xec;
+        bNeg = 1;
+        xorMask = 0x00;
+    } else {
+        return 0;
+    }
+
+    /* Read at most e digits. A further digit means a fractional part. */
+    i = 1;
+    do {
+        if (i > e || i >= nKey) return 0;
+        y = aKey[i++] ^ xorMask;
+        if (m > (LARGEST_UINT64 - 99) / 100) return 0;
+        m = m * 100 + (y >> 1);
+    } while (y & 1);
+    if (m == 0) return 0;
+    for (e = e - (i - 1); e > 0; e--) {
+        if (m > LARGEST_UINT64 / 100) return 0;
+        m = m * 100;
+    }
+
+    if (bNeg) {
+        if (m > (u64) LARGEST_INT64 + 1) return 0;
+        *piVal = (sqlite4_int64) (0 - m);
+    } else {
+        if (m > (u64) LARGEST_INT64) return 0;
+        *piVal = (sqlite4_int64) m;
+    }
+    return i;
+}
+
+/*
+ ** This is a private method for the RowDecoder object.
+ **
+ ** Set pOut to the n byte string (if enc is non-zero) or blob at z, which
+ ** lies within the current row. If bRef is true and the decoder belongs
+ ** to a VdbeCursor, pOut is left pointing at the row and registered with
+ ** the cursor (see MEM_KVRef). Otherwise the value is copied.
+ */
+static int decoderMemSetRef(
+        RowDecoder *p, /* The current key/value pair */
+        int bRef, /* True to refer to the row without copying */
+        const KVByteArray *z, /* Start of value */
+        int n, /* Size of value in bytes */
+        u8 enc, /* Text encoding, or 0 for a blob */
+        Mem *pOut /* Write the results here */
+        ) {
+    if (bRef && p->pCur) {
+        sqlite4VdbeMemSetRef(pOut, (const char*) z, n, enc);
+        return sqlite4VdbeCursorAddRef(p->pCur, pOut);
+    }
+    return sqlite4VdbeMemSetStr(pOut, (const char*) z, n, enc,
+            SQLITE4_TRANSIENT, 0);
+}
+
 /*
  ** This is a private method for the RowDecoder object.
  **
@@ -317,12 +444,14 @@ int sqlite4VdbeDecodeNumericKey(
  ** key/value pair.  If beginning of the value is iOfst bytes from the beginning
  ** of the key.  If affReal is true, then force numeric values to be floating
  ** point.  Write the result in pOut.  Or return non-zero if there is an
- ** error.
+ ** error.  If bRef is true, ascending text and blob values may refer to
+ ** the key instead of being copied (see decoderMemSetRef()).
  */
 static int decoderFromKey(
         RowDecoder *p, /* The current key/value pair */
         int affReal, /* True to coerce numbers to floating point */
         sqlite4_int64 iOfst, /* Offset of value in the key */
+        int bRef, /* True to refer to the key if possible */
         Mem *pOut /* Write the results here */
         ) {
     int rc;
@@ -353,8 +482,8 @@ static int decoderFromKey(
         { /* Text (ascending index) */
             for (i = iOfst; i < n && a[i] != 0; i++) {
             }
-            rc = sqlite4VdbeMemSetStr(pOut, &a[iOfst], i - iOfst,
-                    SQLITE4_UTF8, SQLITE4_TRANSIENT, 0);
+            rc = decoderMemSetRef(p, bRef, &a[iOfst], i - iOfst,
+                    SQLITE4_UTF8, pOut);
             break;
         }
         case 0xDB:
@@ -387,8 +516,7 @@ static int decoderFromKey(
 
         case 0x26:
         { /* Blob-final (ascending) */
-            rc = sqlite4VdbeMemSetStr(pOut, &a[iOfst], n - iOfst, 0,
-                    SQLITE4_TRANSIENT, 0);
+            rc = decoderMemSetRef(p, bRef, &a[iOfst], n - iOfst, 0, pOut);
             break;
         }
         case 0xD9:
@@ -404,6 +532,15 @@ static int decoderFromKey(
         default:
         {
             sqlite4_num v;
+            sqlite4_int64 iVal;
+            if (!affReal) {
+                i = sqlite4VdbeDecodeIntKey(a + iOfst - 1, n - iOfst + 1, &iVal);
+                if (i) {
+                    sqlite4VdbeMemSetInt64(pOut, iVal);
+                    rc = SQLITE4_OK;
+                    break;
+                }
+            }
             i = sqlite4VdbeDecodeNumericKey(a + iOfst - 1, n - iOfst + 1, &v);
             if (i == 0) {
                 rc = SQLITE4_CORRUPT_BKPT;
@@ -417,6 +554,119 @@ static int decoderFromKey(
     return rc;
 }
 
+/*
+ ** Return the number of payload bytes used by a column with header code
+ ** type. Set *pCclass to the content class (type-22)%4 if type>=22.
+ */
+static u32 decoderPayloadSize(sqlite4_uint64 type, int *pCclass) {
+    if (type >= 22) { /* STRING, BLOB, KEY, and TYPED */
+        *pCclass = (type - 22) % 4;
+        if (*pCclass == 2) return 0; /* KEY */
+        return (type - 22) / 4;
+    }
+    *pCclass = -1;
+    if (type <= 2) return 0; /* NULL, ZERO, and ONE */
+    if (type <= 10) return type - 2; /* INT */
+    assert(type >= 11 && type <= 21); /* NUM */
+    return type - 9;
+}
+
+/*
+ ** Parse the header of the current row, if necessary, until either
+ ** column iVal has been parsed or the end of the header is reached.
+ ** For a ROWFORMAT_OFFSETS row, only the fixed-size prefix that precedes
+ ** the offset table is parsed.
+ */
+static int decoderParseHeader(RowDecoder *p, int iVal) {
+    sqlite4_uint64 x;
+    int sz;
+    int cclass;
+
+    if (p->iHdr == 0 && p->n > 0 && p->a[0] == ROWFORMAT_MARKER) {
+        int w = (p->n > 1 ? p->a[1] : 0);
+        if (w != 1 && w != 2 && w != 4) return SQLITE4_CORRUPT;
+        sz = sqlite4GetVarint64(p->a + 2, p->n - 2, &x);
+        if (sz == 0) return SQLITE4_CORRUPT;
+        p->iHdr = 2 + sz;
+        if (x > (p->n - p->iHdr) / w) return SQLITE4_CORRUPT;
+        p->endHdr = p->iHdr + (int) x * w;
+        p->nCol = (int) x;
+        p->nOfstWidth = w;
+    }
+    if (p->nOfstWidth) return SQLITE4_OK;
+    if (p->iHdr == 0) {
+        sz = sqlite4GetVarint64(p->a, p->n, &x);
+        if (sz == 0) return SQLITE4_CORRUPT;
+        if (x + sz > p->n) return SQLITE4_CORRUPT;
+        p->iHdr = sz;
+        p->endHdr = (int) (x + sz);
+        p->iPayload = p->endHdr;
+    }
+    if (iVal >= p->nColAlloc && p->nCol <= iVal && p->iHdr < p->endHdr) {
+        int nNew = (iVal > p->mxCol ? iVal : p->mxCol) + 1;
+        sqlite4_uint64 *aType;
+        KVSize *aOfst;
+        aType = sqlite4DbRealloc(p->db, p->aType, nNew * sizeof (aType[0]));
+        if (aType == 0) return SQLITE4_NOMEM;
+        p->aType = aType;
+        aOfst = sqlite4DbRealloc(p->db, p->aOfst, nNew * sizeof (aOfst[0]));
+        if (aOfst == 0) return SQLITE4_NOMEM;
+        p->aOfst = aOfst;
+        p->nColAlloc = nNew;
+    }
+    while (p->nCol <= iVal && p->iHdr < p->endHdr) {
+        sz = sqlite4GetVarint64(p->a + p->iHdr, p->n - p->iHdr, &x);
+        if (sz == 0) return SQLITE4_CORRUPT;
+        p->iHdr += sz;
+        p->aType[p->nCol] = x;
+        p->aOfst[p->nCol] = p->iPayload;
+        p->iPayload += decoderPayloadSize(x, &cclass);
+        if (cclass == 3) { /* The TYPED header code is followed by a subtype */
+            sz = sqlite4GetVarint64(p->a + p->iHdr, p->n - p->iHdr, &x);
+            if (sz == 0) return SQLITE4_CORRUPT;
+            p->iHdr += sz;
+        }
+        p->nCol++;
+    }
+    return SQLITE4_OK;
+}
+
+/*
+ ** Locate column iVal of a ROWFORMAT_OFFSETS row. Its offset is read
+ ** directly from the offset table, and the cell found there holds the
+ ** header code followed by the payload. Set *pType to the header code
+ ** and *pOfst to the offset of the payload.
+ */
+static int decoderLocateCell(
+        RowDecoder *p, /* The decoder */
+        int iVal, /* Column to locate. Less than p->nCol */
+        sqlite4_uint64 *pType, /* OUT: Header code */
+        KVSize *pOfst /* OUT: Payload offset */
+        ) {
+    const KVByteArray *aEntry;
+    KVSize iCell = 0;
+    sqlite4_uint64 x;
+    int cclass;
+    int sz;
+    int i;
+
+    assert(p->nOfstWidth && iVal < p->nCol);
+    aEntry = &p->a[p->iHdr + iVal * p->nOfstWidth];
+    for (i = 0; i < p->nOfstWidth; i++) iCell = (iCell << 8) + aEntry[i];
+    if (iCell < p->endHdr || iCell >= p->n) return SQLITE4_CORRUPT;
+    sz = sqlite4GetVarint64(p->a + iCell, p->n - iCell, pType);
+    if (sz == 0) return SQLITE4_CORRUPT;
+    iCell += sz;
+    decoderPayloadSize(*pType, &cclass);
+    if (cclass == 3) { /* The TYPED header code is followed by a subtype */
+        sz = sqlite4GetVarint64(p->a + iCell, p->n - iCell, &x);
+        if (sz == 0) return SQLITE4_CORRUPT;
+        iCell += sz;
+    }
+    *pOfst = iCell;
+    return SQLITE4_OK;
+}
+
 /*
  ** Decode a single column from a key/value pair taken from the storage
  ** engine.  The key/value pair to be decoded is the one that the VdbeCursor
@@ -430,126 +680,99 @@ static int decoderFromKey(
  ** The key is referenced only if the iVal-th column in the value is either
  ** the 22 or 23 header code which indicates that the value is stored in the
  ** key instead.
+ **
+ ** The type and offset of each column are cached as the header is parsed,
+ ** so extracting several columns from the same row only parses the
+ ** header once. Rows written in the ROWFORMAT_OFFSETS format need no
+ ** such cache, as each column is located using the offset table.
+ **
+ ** If bRef is true, a TEXT or BLOB result may point directly into the
+ ** current row instead of being copied. See MEM_KVRef.
  */
 int sqlite4VdbeDecoderGetColumn(
         RowDecoder *p, /* The decoder for the whole string */
         int iVal, /* Index of the value to decode.  First is 0 */
+        int bRef, /* True to refer to the row instead of copying */
         Mem *pDefault, /* The default value.  Often NULL */
         Mem *pOut /* Write the result here */
         ) {
     u32 size; /* Size of a field */
-    sqlite4_uint64 ofst; /* Offset to the payload */
+    KVSize ofst; /* Offset to the payload */
     sqlite4_uint64 type; /* Datatype */
-    sqlite4_uint64 subtype; /* Subtype for a typed blob */
     int cclass; /* class of content */
-    int n; /* Offset into the header */
-    int i; /* Loop counter */
-    int sz; /* Size of a varint */
-    int endHdr; /* First byte past header */
+    int n; /* Bytes of numeric payload decoded */
     int rc; /* Return code */
-    
-    printf("iVal: %d\n", iVal);
+
     sqlite4VdbeMemSetNull(pOut);
     assert(iVal <= p->mxCol);
     rc = decoderFetchData(p);
     if (rc) return rc;
     if (p->a == 0) return SQLITE4_OK;
-    n = sqlite4GetVarint64(p->a, p->n, &ofst);
-    printf("sizeofheader: %d\n",ofst);
-    printf("varintsize of sizeofheader: %d\n",n);
-    if (n == 0) return SQLITE4_CORRUPT;
-    ofst += n;
-    endHdr = ofst;
-    printf("endHdr: %d\n",endHdr);
-    if (endHdr > p->n) return SQLITE4_CORRUPT;
-    for (i = 0; i <= iVal && n < endHdr; i++) {
-        printf("n: %d\n",n);
-        sz = sqlite4GetVarint64(p->a + n, p->n - n, &type);
-        printf("type: %d\n",type);
-        if (sz == 0) return SQLITE4_CORRUPT;
-        n += sz;
-        
-        if (type >= 22) { /* STRING, BLOB, KEY, and TYPED */
-            cclass = (type - 22) % 4;
-            if (cclass == 2) {
-                size = 0; /* KEY */
-            } else {
-                size = (type - 22) / 4;
-                if (cclass == 3) { /* The TYPED header code */
-                    sz = sqlite4GetVarint64(p->a + n, p->n - n, &subtype);
-                    if (sz == 0) return SQLITE4_CORRUPT;
-                    n += sz;
-                }
-            }
-        } else if (type <= 2) { /* NULL, ZERO, and ONE */
-            size = 0;
-        } else if (type <= 10) { /* INT */
-            size = type - 2;
-        } else {
-            assert(type >= 11 && type <= 21); /* NUM */
-            size = type - 9;
-        }
-        printf ("Bytes of Payload: %d\n", size);
-        printf ("offset: %d\n", ofst);
-        if (i < iVal) {
-            ofst += size;
-        } else if (type == 0) {
-            /* no-op */
-        } else if (type <= 2) {
-            sqlite4VdbeMemSetInt64(pOut, type - 1);
-        } else if (type <= 10) {
-            int iByte;
-            sqlite4_int64 v = ((char*) p->a)[ofst];
-            for (iByte = 1; iByte < size; iByte++) {
-                v = v * 256 + p->a[ofst + iByte];
-            }
-            sqlite4VdbeMemSetInt64(pOut, v);
-        } else if (type <= 21) {
-            sqlite4_num num = {0, 0, 0, 0};
-            sqlite4_uint64 x;
-            int e;
+    rc = decoderParseHeader(p, iVal);
+    if (rc) return rc;
 
-            n = sqlite4GetVarint64(p->a + ofst, p->n - ofst, &x);
-            e = (int) x;
-            n += sqlite4GetVarint64(p->a + ofst + n, p->n - (ofst + n), &x);
-            if (n != size) return SQLITE4_CORRUPT;
-
-            num.m = x;
-            num.e = (e >> 2);
-            if (e & 0x02) num.e = -1 * num.e;
-            if (e & 0x01) num.sign = 1;
-            pOut->u.num = num;
-            MemSetTypeFlag(pOut, MEM_Real);
-        } else if (cclass == 0) {
-            if (size == 0) {
-                sqlite4VdbeMemSetStr(pOut, "", 0, SQLITE4_UTF8, SQLITE4_TRANSIENT, 0);
-            } else if (p->a[ofst] > 0x02) {
-                sqlite4VdbeMemSetStr(pOut, (char*) (p->a + ofst), size,
-                        SQLITE4_UTF8, SQLITE4_TRANSIENT, 0);
-            } else {
-                static const u8 enc[] = {SQLITE4_UTF8, SQLITE4_UTF16LE, SQLITE4_UTF16BE};
-                sqlite4VdbeMemSetStr(pOut, (char*) (p->a + ofst + 1), size - 1,
-                        enc[p->a[ofst]], SQLITE4_TRANSIENT, 0);
-            }
-        } else if (cclass == 2) {
-            unsigned int k = (type - 24) / 4;
-            return decoderFromKey(p, (k & 1) != 0, k / 2, pOut);
-        } else {
-            sqlite4VdbeMemSetStr(pOut, (char*) (p->a + ofst), size, 0,
-                    SQLITE4_TRANSIENT, 0);
-            pOut->enc = ENC(p->db);
-        }
-    }
-    testcase(i == iVal);
-    testcase(i == iVal + 1);
-    if (i <= iVal) {
+    if (iVal >= p->nCol) {
         if (pDefault) {
             sqlite4VdbeMemShallowCopy(pOut, pDefault, MEM_Static);
+        }
+        return SQLITE4_OK;
+    }
+
+    if (p->nOfstWidth) {
+        rc = decoderLocateCell(p, iVal, &type, &ofst);
+        if (rc) return rc;
+    } else {
+        type = p->aType[iVal];
+        ofst = p->aOfst[iVal];
+    }
+    size = decoderPayloadSize(type, &cclass);
+    if (ofst + size > p->n) return SQLITE4_CORRUPT;
+
+    if (type == 0) {
+        /* no-op */
+    } else if (type <= 2) {
+        sqlite4VdbeMemSetInt64(pOut, type - 1);
+    } else if (type <= 10) {
+        int iByte;
+        sqlite4_int64 v = ((char*) p->a)[ofst];
+        for (iByte = 1; iByte < size; iByte++) {
+            v = v * 256 + p->a[ofst + iByte];
+        }
+        sqlite4VdbeMemSetInt64(pOut, v);
+    } else if (type <= 21) {
+        sqlite4_num num = {0, 0, 0, 0};
+        sqlite4_uint64 x;
+        int e;
+
+        n = sqlite4GetVarint64(p->a + ofst, p->n - ofst, &x);
+        e = (int) x;
+        n += sqlite4GetVarint64(p->a + ofst + n, p->n - (ofst + n), &x);
+        if (n != size) return SQLITE4_CORRUPT;
+
+        num.m = x;
+        num.e = (e >> 2);
+        if (e & 0x02) num.e = -1 * num.e;
+        if (e & 0x01) num.sign = 1;
+        pOut->u.num = num;
+        MemSetTypeFlag(pOut, MEM_Real);
+    } else if (cclass == 0) {
+        if (size == 0) {
+            sqlite4VdbeMemSetStr(pOut, "", 0, SQLITE4_UTF8, SQLITE4_TRANSIENT, 0);
+        } else if (p->a[ofst] > 0x02) {
+            rc = decoderMemSetRef(p, bRef, p->a + ofst, size, SQLITE4_UTF8, pOut);
         } else {
-            sqlite4VdbeMemSetNull(pOut);
+            static const u8 enc[] = {SQLITE4_UTF8, SQLITE4_UTF16LE, SQLITE4_UTF16BE};
+            sqlite4VdbeMemSetStr(pOut, (char*) (p->a + ofst + 1), size - 1,
+                    enc[p->a[ofst]], SQLITE4_TRANSIENT, 0);
         }
+    } else if (cclass == 2) {
+        unsigned int k = (type - 24) / 4;
+        return decoderFromKey(p, (k & 1) != 0, k / 2, bRef, pOut);
+    } else {
+        rc = decoderMemSetRef(p, bRef, p->a + ofst, size, 0, pOut);
+        pOut->enc = ENC(p->db);
     }
-    return SQLITE4_OK;
+    return rc;
 }
 
 /*
@@ -574,6 +797,70 @@ static int significantBytes(sqlite4_int64 v) {
     return n;
 }
 
+/*
+ ** Per-value information gathered by sqlite4VdbeEncodeData() while it
+ ** builds the record header.
+ */
+struct dencAux {
+    int n; /* Size of payload at this position */
+    int iCode; /* Offset of header code for this position */
+    u8 z[12]; /* Encoding for number at this position */
+};
+
+/*
+ ** Write the payload for value pIn to aOut[]. Return the number of bytes
+ ** written, which is always equal to pAux->n.
+ */
+static int encodeDataPayload(
+        u8 *aOut, /* Write the payload here */
+        Mem *pIn, /* Value to encode */
+        struct dencAux *pAux, /* Information gathered for pIn */
+        int encoding /* Text encoding */
+        ) {
+    int flags = pIn->flags;
+    int n;
+    if (flags & MEM_Null) {
+        /* No content */
+    } else if (flags & MEM_Int) {
+        sqlite4_int64 v;
+        v = sqlite4_num_to_int64(pIn->u.num, 0);
+        n = pAux->n;
+        aOut[--n] = v & 0xff;
+        while (n) {
+            v >>= 8;
+            aOut[--n] = v & 0xff;
+        }
+    } else if (flags & MEM_Real) {
+        memcpy(aOut, pAux->z, pAux->n);
+    } else if (flags & MEM_Str) {
+        n = 0;
+        if (pIn->n) {
+            if (encoding == SQLITE4_UTF16LE) aOut[n++] = 1;
+            else if (encoding == SQLITE4_UTF16BE) aOut[n++] = 2;
+            else if (pIn->z[0] < 3) aOut[n++] = 0;
+            memcpy(aOut + n, pIn->z, pIn->n);
+        }
+    } else {
+        assert(flags & MEM_Blob);
+        memcpy(aOut, pIn->z, pIn->n);
+    }
+    return pAux->n;
+}
+
+/*
+ ** Make sure the allocation belonging to Mem cell pMem (pMem->zMalloc) is
+ ** at least n bytes in size, and point pMem->z at it. Any existing content
+ ** is discarded. The allocation grows geometrically, so that a cell that
+ ** is reused for a series of similar values soon stops needing mallocs.
+ */
+static int encoderReserveMem(Mem *pMem, int n) {
+    int nAlloc;
+    VdbeMemRelease(pMem);
+    nAlloc = sqlite4DbMallocSize(pMem->db, pMem->zMalloc);
+    if (nAlloc < n && n < 2 * nAlloc) n = 2 * nAlloc;
+    return sqlite4VdbeMemGrow(pMem, n, 0);
+}
+
 /*
  ** Encode nIn values from array aIn[] using the data encoding. If argument
  ** aPermute[] is NULL, then the nIn elements are elements 0, 1 ... (nIn-1)
@@ -582,49 +869,61 @@ static int significantBytes(sqlite4_int64 v) {
  ** Assume that affinity has already been applied to all elements of the
  ** input array aIn[].
  **
- ** Space to hold the record is obtained from sqlite4DbMalloc() and should
- ** be freed by the caller using sqlite4DbFree() to avoid a memory leak.
+ ** If eFormat is ROWFORMAT_VARINT, the record consists of a varint header
+ ** size, the header codes of all values, then the payloads of all values.
+ ** If it is ROWFORMAT_OFFSETS, the record is:
+ **
+ **     ROWFORMAT_MARKER
+ **     W              (1 byte: width of each offset, 1, 2 or 4)
+ **     N              (varint: number of values)
+ **     N offsets      (W bytes each, big-endian, from the start of record)
+ **     N cells        (header code, then payload, for each value)
+ **
+ ** W is the smallest width able to address the whole record.
+ **
+ ** The record is written into the existing allocation of Mem cell pOut
+ ** if it is large enough, and pOut is left holding it as a blob. Cell
+ ** pScratch is used for working space. Neither may be one of the input
+ ** values. When the same two cells are used to encode a series of rows,
+ ** no mallocs are required once their allocations are large enough.
  */
 int sqlite4VdbeEncodeData(
         sqlite4 *db, /* The database connection */
         Mem *aIn, /* Array of values to encode */
         int *aPermute, /* Permutation or NULL (see above) */
         int nIn, /* Number of entries in aIn[] */
-        u8 **pzOut, /* The output data record */
-        int *pnOut /* Bytes of content in pzOut */
+        int eFormat, /* ROWFORMAT_VARINT or ROWFORMAT_OFFSETS */
+        Mem *pScratch, /* Scratch buffer reused across calls */
+        Mem *pOut /* Write the output data record here */
         ) {
     int i, j;
-    int rc = SQLITE4_OK;
-    int nHdr;
+    int nHdr; /* Bytes of header codes in aCodes[] */
     int n;
-    u8 *aOut = 0; /* The result */
+    u8 *aOut; /* The result */
     int nOut; /* Bytes of aOut used */
     int nPayload = 0; /* Payload space required */
     int encoding = ENC(db); /* Text encoding */
+    int nAux = ROUND8(sizeof (struct dencAux) * (nIn + 1));
+    struct dencAux *aAux; /* For each input value of aIn[] */
+    u8 *aCodes; /* Header codes for all values */
 
-    struct dencAux { /* For each input value of aIn[] */
-        int n; /* Size of encoding at this position */
-        u8 z[12]; /* Encoding for number at this position */
-    } *aAux;
-
-    aAux = sqlite4StackAllocZero(db, sizeof (*aAux) * nIn);
-    if (aAux == 0) return SQLITE4_NOMEM;
-    aOut = sqlite4DbMallocZero(db, (nIn + 1)*9);
-    if (aOut == 0) {
-        rc = SQLITE4_NOMEM;
-        goto vdbeEncodeData_error;
-    }
-    nOut = 9;
+    if (encoderReserveMem(pScratch, nAux + nIn * 9)) return SQLITE4_NOMEM;
+    aAux = (struct dencAux *) pScratch->z;
+    aCodes = (u8 *) & pScratch->z[nAux];
+    memset(aAux, 0, nAux);
+
+    nHdr = 0;
     for (i = 0; i < nIn; i++) {
         Mem *pIn = &aIn[ aPermute ? aPermute[i] : i ];
         int flags = pIn->flags;
+        aAux[i].iCode = nHdr;
         if (flags & MEM_Null) {
-            aOut[nOut++] = 0;
+            aCodes[nHdr++] = 0;
         } else if (flags & MEM_Int) {
             i64 i1;
             i1 = sqlite4_num_to_int64(pIn->u.num, 0);
             n = significantBytes(i1);
-            aOut[nOut++] = n + 2;
+            aCodes[nHdr++] = n + 2;
             nPayload += n;
             aAux[i].n = n;
         } else if (flags & MEM_Real) {
@@ -639,72 +938,68 @@ int sqlite4VdbeEncodeData(
             n = sqlite4PutVarint64(aAux[i].z, (sqlite4_uint64) e);
             n += sqlite4PutVarint64(aAux[i].z + n, p->m);
             aAux[i].n = n;
-            aOut[nOut++] = n + 9;
+            aCodes[nHdr++] = n + 9;
             nPayload += n;
         } else if (flags & MEM_Str) {
             n = pIn->n;
             if (n && (encoding != SQLITE4_UTF8 || pIn->z[0] < 3)) n++;
             nPayload += n;
-            nOut += sqlite4PutVarint64(aOut + nOut, 22 + 4 * (sqlite4_int64) n);
+            aAux[i].n = n;
+            nHdr += sqlite4PutVarint64(aCodes + nHdr, 22 + 4 * (sqlite4_int64) n);
         } else {
             n = pIn->n;
             assert(flags & MEM_Blob);
             nPayload += n;
-            nOut += sqlite4PutVarint64(aOut + nOut, 23 + 4 * (sqlite4_int64) n);
+            aAux[i].n = n;
+            nHdr += sqlite4PutVarint64(aCodes + nHdr, 23 + 4 * (sqlite4_int64) n);
         }
     }
-    nHdr = nOut - 9;
-    n = sqlite4PutVarint64(aOut, nHdr);
-    for (i = n, j = 9; j < nOut; j++) aOut[i++] = aOut[j];
-    nOut = i;
-    aOut = sqlite4DbReallocOrFree(db, aOut, nOut + nPayload);
-    if (aOut == 0) {
-        rc = SQLITE4_NOMEM;
-        goto vdbeEncodeData_error;
-    }
-    for (i = 0; i < nIn; i++) {
-        Mem *pIn = &aIn[ aPermute ? aPermute[i] : i ];
-        int flags = pIn->flags;
-        if (flags & MEM_Null) {
-            /* No content */
-        } else if (flags & MEM_Int) {
-            sqlite4_int64 v;
-            v = sqlite4_num_to_int64(pIn->u.num, 0);
-            n = aAux[i].n;
-            aOut[nOut + (--n)] = v & 0xff;
-            while (n) {
-                v >>= 8;
-                aOut[nOut + (--n)] = v & 0xff;
-            }
-            nOut += aAux[i].n;
-        } else if (flags & MEM_Real) {
-            memcpy(aOut + nOut, aAux[i].z, aAux[i].n);
-            nOut += aAux[i].n;
-        } else if (flags & MEM_Str) {
-            n = pIn->n;
-            if (n) {
-                if (encoding == SQLITE4_UTF16LE) aOut[nOut++] = 1;
-                else if (encoding == SQLITE4_UTF16BE) aOut[nOut++] = 2;
-                else if (pIn->z[0] < 3) aOut[nOut++] = 0;
-                memcpy(aOut + nOut, pIn->z, n);
-                nOut += n;
-            }
-        } else {
-            assert(flags & MEM_Blob);
-            memcpy(aOut + nOut, pIn->z, pIn->n);
-            nOut += pIn->n;
+    aAux[nIn].iCode = nHdr;
+
+    if (eFormat == ROWFORMAT_OFFSETS) {
+        int nVarint = sqlite4VarintLen(nIn);
+        int nBody = nHdr + nPayload; /* Total size of all cells */
+        int w; /* Width of each offset in bytes */
+        int iCell; /* Offset of next cell to write */
+
+        for (w = 1; w < 4; w *= 2) {
+            if (2 + nVarint + nIn * w + nBody <= (1 << (8 * w))) break;
+        }
+        nOut = 2 + nVarint + nIn*w;
+        if (encoderReserveMem(pOut, nOut + nBody)) return SQLITE4_NOMEM;
+        aOut = (u8 *) pOut->z;
+        aOut[0] = ROWFORMAT_MARKER;
+        aOut[1] = (u8) w;
+        sqlite4PutVarint64(aOut + 2, nIn);
+        iCell = nOut;
+        for (i = 0; i < nIn; i++) {
+            u8 *aEntry = &aOut[2 + nVarint + i * w];
+            for (j = w - 1; j >= 0; j--) aEntry[w - 1 - j] = (iCell >> (8 * j)) & 0xff;
+            n = aAux[i + 1].iCode - aAux[i].iCode;
+            memcpy(aOut + iCell, aCodes + aAux[i].iCode, n);
+            iCell += n;
+            iCell += encodeDataPayload(aOut + iCell,
+                    &aIn[ aPermute ? aPermute[i] : i ], &aAux[i], encoding);
+        }
+        assert(iCell == nOut + nBody);
+        nOut = iCell;
+    } else {
+        n = sqlite4VarintLen(nHdr);
+        if (encoderReserveMem(pOut, n + nHdr + nPayload)) return SQLITE4_NOMEM;
+        aOut = (u8 *) pOut->z;
+        sqlite4PutVarint64(aOut, nHdr);
+        memcpy(aOut + n, aCodes, nHdr);
+        nOut = n + nHdr;
+        for (i = 0; i < nIn; i++) {
+            nOut += encodeDataPayload(aOut + nOut,
+                    &aIn[ aPermute ? aPermute[i] : i ], &aAux[i], encoding);
         }
     }
 
-    *pzOut = aOut;
-    *pnOut = nOut;
-    sqlite4StackFree(db, aAux);
+    pOut->n = nOut;
+    pOut->flags = MEM_Blob;
+    pOut->type = SQLITE4_BLOB;
     return SQLITE4_OK;
-
-vdbeEncodeData_error:
-    sqlite4StackFree(db, aAux);
-    sqlite4DbFree(db, aOut);
-    return rc;
 }
 
 /*
@@ -726,7 +1021,8 @@ static int enlargeEncoderAllocation(KeyEncoder *p, int needed) {
     assert(p->nOut <= p->nAlloc);
     if (p->nOut + needed > p->nAlloc) {
         u8 *aNew;
-        p->nAlloc = p->nAlloc + needed + 10;
+        p->nAlloc = p->nAlloc * 2;
+        if (p->nAlloc < p->nOut + needed + 10) p->nAlloc = p->nOut + needed + 10;
         aNew = sqlite4DbRealloc(p->db, p->aOut, p->nAlloc);
         if (aNew == 0) {
             sqlite4DbFree(p->db, p->aOut);
@@ -834,16 +1130,68 @@ static void encodeNumericKey(KeyEncoder *p, sqlite4_num num) {
     }
 }
 
+/*
+ ** Write the key encoding of the integer with magnitude m and sign bNeg
+ ** to a[], which must have space for at least 12 bytes.  Return the number
+ ** of bytes written.
+ **
+ ** The output is identical to that of encodeNumericKey() for a value with
+ ** an exponent of zero, but is computed directly from the base-100 digits
+ ** of m. An integer of up to 20 decimal digits always has a base-100
+ ** exponent between 1 and 10, so it is always a "medium" value: a single
+ ** header byte followed by the significant base-100 digits, each stored
+ ** as (2*digit+1), except the last which is stored as (2*digit).
+ */
+static int encodeIntKeyDigits(u8 *a, u64 m, int bNeg) {
+    u8 aDigit[10]; /* Base-100 digits of m, least significant first */
+    int nDigit = 0; /* Number of entries in aDigit[] */
+    int iLast = 0; /* Index of least significant non-zero digit */
+    u8 xorMask = (bNeg ? 0xFF : 0x00);
+    int n = 1;
+
+    if (m == 0) {
+        a[0] = 0x15; /* Numeric zero */
+        return 1;
+    }
+    do {
+        aDigit[nDigit++] = (u8) (m % 100);
+        m = m / 100;
+    } while (m);
+    while (aDigit[iLast] == 0) iLast++;
+
+    a[0] = bNeg ? (0x13 - nDigit) : (0x17 + nDigit);
+    while (nDigit-- > iLast) {
+        a[n++] = ((aDigit[nDigit] << 1) | (nDigit != iLast)) ^ xorMask;
+    }
+    return n;
+}
+
 /*
  ** Encode a single integer using the key encoding.  The caller must 
  ** ensure that sufficient space exits in a[] (at least 12 bytes).  
  ** The return value is the number of bytes of a[] used.  
  */
 int sqlite4VdbeEncodeIntKey(u8 *a, sqlite4_int64 v) {
+    u64 m;
+    if (v >= 0) {
+        m = (u64) v;
+    } else if (v != SMALLEST_INT64) {
+        m = (u64) - v;
+    } else {
+        m = 1 + (u64) LARGEST_INT64;
+    }
+    return encodeIntKeyDigits(a, m, v < 0);
+}
+
+/*
+ ** Encode a single number using the key encoding, without the integer
+ ** fast path used by sqlite4VdbeEncodeIntKey().  The caller must ensure
+ ** that sufficient space exists in a[] (at least 16 bytes).  The return
+ ** value is the number of bytes of a[] used.
+ */
+int sqlite4VdbeEncodeNumKey(u8 *a, sqlite4_num num) {
     KeyEncoder s;
-    sqlite4_num num;
 
-    num = sqlite4_num_from_int64(v);
     memset(&s, 0, sizeof (s));
     s.aOut = a;
     encodeNumericKey(&s, num);
@@ -873,8 +1221,13 @@ static int encodeOneKeyValue(
         if (flags & (MEM_Real | MEM_Int)) {
         printf("flags & (MEM_Real|MEM_Int)\n");
 
+        sqlite4_num num = pMem->u.num;
         if (enlargeEncoderAllocation(p, 16)) return SQLITE4_NOMEM;
-        encodeNumericKey(p, pMem->u.num);
+        if ((flags & MEM_Int) && num.e == 0 && num.approx == 0) {
+            p->nOut += encodeIntKeyDigits(&p->aOut[p->nOut], num.m, num.sign);
+        } else {
+            encodeNumericKey(p, num);
+        }
     } else if (flags & MEM_Str) {
         printf("flags & MEM_Str\n");
         int enc; /* Initial encoding o (string)key:    
@@ -1049,43 +1402,35 @@ int sqlite4VdbeShortKey(
 }
 
 /*
- ** Generate a database key from one or more data values.
- **
- ** Space to hold the key is obtained from sqlite4DbMalloc() and should
- ** be freed by the caller using sqlite4DbFree() to avoid a memory leak.
+ ** Append the key encoding of nIn values from aIn[] to the buffer of
+ ** encoder x. If iTabno is not negative, it is encoded as a varint at the
+ ** start of the key. Value aIn[0] is encoded as field iField of the key
+ ** described by pKeyInfo, aIn[1] as field iField+1, and so on. On failure,
+ ** the buffer of x is freed.
  */
-int sqlite4VdbeEncodeKey(
-        sqlite4 *db, /* The database connection */
+static int encodeKey(
+        KeyEncoder *x, /* Encoder to write to */
         Mem *aIn, /* Values to be encoded */
         int nIn, /* Number of entries in aIn[] */
         int iTabno, /* The table this key applies to, or negative */
         KeyInfo *pKeyInfo, /* Collating sequence and sort-order info */
-        u8 **paOut, /* Write the resulting key here */
-        int *pnOut, /* Number of bytes in the key */
+        int iField, /* Key field that aIn[0] is encoded as */
         int nExtra /* extra bytes of space appended to the key */
         ) {
     int i;
     int rc = SQLITE4_OK;
-    KeyEncoder x;
     u8 *so;
     CollSeq **aColl;
 
     assert(pKeyInfo);
-    assert(nIn <= pKeyInfo->nField);
-
-    x.db = db;
-    x.aOut = 0;
-    x.nOut = 0;
-    x.nAlloc = 0;
-    *paOut = 0;
-    *pnOut = 0;
+    assert(iField + nIn <= pKeyInfo->nField);
 
-    if (enlargeEncoderAllocation(&x, (nIn + 1)*10)) return SQLITE4_NOMEM;
+    if (enlargeEncoderAllocation(x, (nIn + 1)*10)) return SQLITE4_NOMEM;
     if (iTabno >= 0) {
-        x.nOut = sqlite4PutVarint64(x.aOut, iTabno);
+        x->nOut = sqlite4PutVarint64(x->aOut, iTabno);
     }
-    aColl = pKeyInfo->aColl;
-    so = pKeyInfo->aSortOrder;
+    aColl = &pKeyInfo->aColl[iField];
+    so = pKeyInfo->aSortOrder ? &pKeyInfo->aSortOrder[iField] : 0;
     for (i = 0; i < nIn && rc == SQLITE4_OK; i++) {
         printf("Mem info:\n");
         printf("         flags: %x\n", aIn->flags);
@@ -1093,18 +1438,141 @@ int sqlite4VdbeEncodeKey(
         printf("         n: %d\n", aIn->n);
 
 
-        rc = encodeOneKeyValue(&x, aIn + i, so ? so[i] : SQLITE4_SO_ASC,
-                i == pKeyInfo->nField - 1, aColl[i]);
+        rc = encodeOneKeyValue(x, aIn + i, so ? so[i] : SQLITE4_SO_ASC,
+                iField + i == pKeyInfo->nField - 1, aColl[i]);
     }
 
     if (rc == SQLITE4_OK && nExtra) {
-        rc = enlargeEncoderAllocation(&x, nExtra);
+        rc = enlargeEncoderAllocation(x, nExtra);
     }
     if (rc) {
-        sqlite4DbFree(db, x.aOut);
-    } else {
+        sqlite4DbFree(x->db, x->aOut);
+        x->aOut = 0;
+    }
+    return rc;
+}
+
+/*
+ ** Generate a database key from one or more data values.
+ **
+ ** Space to hold the key is obtained from sqlite4DbMalloc() and should
+ ** be freed by the caller using sqlite4DbFree() to avoid a memory leak.
+ */
+int sqlite4VdbeEncodeKey(
+        sqlite4 *db, /* The database connection */
+        Mem *aIn, /* Values to be encoded */
+        int nIn, /* Number of entries in aIn[] */
+        int iTabno, /* The table this key applies to, or negative */
+        KeyInfo *pKeyInfo, /* Collating sequence and sort-order info */
+        u8 **paOut, /* Write the resulting key here */
+        int *pnOut, /* Number of bytes in the key */
+        int nExtra /* extra bytes of space appended to the key */
+        ) {
+    int rc;
+    KeyEncoder x;
+
+    x.db = db;
+    x.aOut = 0;
+    x.nOut = 0;
+    x.nAlloc = 0;
+    *paOut = 0;
+    *pnOut = 0;
+
+    rc = encodeKey(&x, aIn, nIn, iTabno, pKeyInfo, 0, nExtra);
+    if (rc == SQLITE4_OK) {
         *paOut = x.aOut;
         *pnOut = x.nOut;
     }
     return rc;
 }
+
+/*
+ ** Generate a database key from one or more data values, as for
+ ** sqlite4VdbeEncodeKey(), and store it in Mem cell pOut as a blob.
+ ** The key is written into the existing allocation of pOut if it is
+ ** large enough, so that a cell reused for the keys of a series of rows
+ ** needs no further mallocs. At least nExtra bytes of space are available
+ ** at pOut->z[pOut->n] for the caller to append to the key.
+ **
+ ** pOut may not be one of the values being encoded.
+ */
+int sqlite4VdbeEncodeKeyToMem(
+        sqlite4 *db, /* The database connection */
+        Mem *aIn, /* Values to be encoded */
+        int nIn, /* Number of entries in aIn[] */
+        int iTabno, /* The table this key applies to */
+        KeyInfo *pKeyInfo, /* Collating sequence and sort-order info */
+        int nExtra, /* extra bytes of space appended to the key */
+        Mem *pOut /* Write the key here */
+        ) {
+    int rc;
+    KeyEncoder x;
+
+    /* Take the allocation belonging to pOut and use it as the output buffer
+     ** of the encoder. The buffer is given back to pOut afterwards. */
+    VdbeMemRelease(pOut);
+    x.db = db;
+    x.aOut = (u8 *) pOut->zMalloc;
+    x.nOut = 0;
+    x.nAlloc = sqlite4DbMallocSize(db, x.aOut);
+    pOut->zMalloc = 0;
+    sqlite4VdbeMemSetNull(pOut);
+
+    rc = encodeKey(&x, aIn, nIn, iTabno, pKeyInfo, 0, nExtra);
+    if (rc == SQLITE4_OK) {
+        pOut->z = pOut->zMalloc = (char *) x.aOut;
+        pOut->n = x.nOut;
+        pOut->flags = MEM_Blob;
+        pOut->type = SQLITE4_BLOB;
+    }
+    return rc;
+}
+
+/*
+ ** Register pPrefix holds a blob containing the root page number and the
+ ** first N complete fields of a key belonging to the index described by
+ ** pKeyInfo, as stored by the OP_SkipScan opcode. Append the key encoding
+ ** of the nIn values in aIn[] to that prefix, encoding them as fields N,
+ ** N+1 and so on of the key, and store the result in Mem cell pOut as a
+ ** blob. At least nExtra bytes of space are available at pOut->z[pOut->n]
+ ** for the caller to append to the key.
+ **
+ ** pOut may not be pPrefix or one of the values being encoded.
+ */
+int sqlite4VdbeEncodeKeyWithPrefix(
+        sqlite4 *db, /* The database connection */
+        Mem *pPrefix, /* Key prefix to start the key with */
+        Mem *aIn, /* Values to be encoded after the prefix */
+        int nIn, /* Number of entries in aIn[] */
+        KeyInfo *pKeyInfo, /* Collating sequence and sort-order info */
+        int nExtra, /* Extra bytes to reserve after the key */
+        Mem *pOut /* Write the key here */
+        ) {
+    int rc;
+    int nPrefixField; /* Number of fields in the prefix */
+    KeyEncoder x;
+
+    assert(pPrefix->flags & MEM_Blob);
+    sqlite4VdbeShortKey((const u8 *) pPrefix->z, pPrefix->n,
+            pKeyInfo->nField, &nPrefixField);
+
+    VdbeMemRelease(pOut);
+    x.db = db;
+    x.aOut = (u8 *) pOut->zMalloc;
+    x.nOut = 0;
+    x.nAlloc = sqlite4DbMallocSize(db, x.aOut);
+    pOut->zMalloc = 0;
+    sqlite4VdbeMemSetNull(pOut);
+
+    if (enlargeEncoderAllocation(&x, pPrefix->n)) return SQLITE4_NOMEM;
+    memcpy(x.aOut, pPrefix->z, pPrefix->n);
+    x.nOut = pPrefix->n;
+    rc = encodeKey(&x, aIn, nIn, -1, pKeyInfo, nPrefixField, nExtra);
+    if (rc == SQLITE4_OK) {
+        pOut->z = pOut->zMalloc = (char *) x.aOut;
+        pOut->n = x.nOut;
+        pOut->flags = MEM_Blob;
+        pOut->type = SQLITE4_BLOB;
+    }
+    return rc;
+}
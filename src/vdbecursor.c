@@ -38,6 +38,7 @@ int sqlite4VdbeSeekEnd(VdbeCursor *pC, int iEnd){
   KVByteArray aProbe[16];
 
   assert( iEnd==(+1) || iEnd==(-1) || iEnd==(-2) );  
+  sqlite4VdbeCursorReleaseRefs(pC, 1);
   if( pC->iRoot==KVSTORE_ROOT ){
     if( iEnd>0 ){
       rc = sqlite4KVCursorSeek(pCur, (const KVByteArray *)"\00", 1, iEnd);
@@ -126,6 +127,8 @@ void sqlite4VdbeFreeCursor(VdbeCursor *pCx){
     return;
   }
   sqlite4Fts5Close(pCx->pFts);
+  sqlite4VdbeAggHashClose(pCx->pAggHash);
+  pCx->pAggHash = 0;
   if( pCx->pKVCur ){
     sqlite4KVCursorClose(pCx->pKVCur);
   }
@@ -136,6 +139,9 @@ void sqlite4VdbeFreeCursor(VdbeCursor *pCx){
     sqlite4VdbeDecoderDestroy(pCx->pDecoder);
     pCx->pDecoder = 0;
   }
+  sqlite4DbFree(pCx->db, pCx->apRef);
+  pCx->apRef = 0;
+  pCx->nRef = pCx->nRefAlloc = 0;
   sqlite4_buffer_clear(&pCx->sSeekKey);
 #ifndef SQLITE4_OMIT_VIRTUALTABLE
   if( pCx->pVtabCursor ){
@@ -161,6 +167,7 @@ int sqlite4VdbeCursorMoveto(VdbeCursor *pPk){
   int rc = SQLITE4_OK;            /* Return code */
   if( pPk->sSeekKey.n!=0 ){
     assert( pPk->pKeyInfo->nPK==0 );
+    sqlite4VdbeCursorReleaseRefs(pPk, 1);
     rc = sqlite4KVCursorSeek(pPk->pKVCur, pPk->sSeekKey.p, pPk->sSeekKey.n, 0);
     if( rc==SQLITE4_NOTFOUND ){
       rc = SQLITE4_CORRUPT_BKPT;
@@ -171,3 +178,253 @@ int sqlite4VdbeCursorMoveto(VdbeCursor *pPk){
   }
   return rc;
 }
+
+/*
+** Register Mem cell pMem as referring to the row that cursor pC is
+** currently positioned on (see MEM_KVRef). If the cursor cannot track the
+** cell because a malloc fails, a private copy of the value is made
+** instead. Return SQLITE4_OK on success or SQLITE4_NOMEM.
+*/
+int sqlite4VdbeCursorAddRef(VdbeCursor *pC, Mem *pMem){
+  int i;
+  assert( pMem->flags & MEM_KVRef );
+  for(i=0; i<pC->nRef; i++){
+    if( pC->apRef[i]==pMem ) return SQLITE4_OK;
+  }
+  if( pC->nRef>=pC->nRefAlloc ){
+    int nNew = pC->nRefAlloc ? pC->nRefAlloc*2 : 8;
+    Mem **apNew;
+    apNew = sqlite4DbRealloc(pC->db, pC->apRef, nNew*sizeof(Mem*));
+    if( apNew==0 ){
+      return sqlite4VdbeMemMakeWriteable(pMem);
+    }
+    pC->apRef = apNew;
+    pC->nRefAlloc = nNew;
+  }
+  pC->apRef[pC->nRef++] = pMem;
+  return SQLITE4_OK;
+}
+
+/*
+** Forget all Mem cells registered with cursor pC by CursorAddRef(). If
+** bCopy is true, each cell that still refers to the current row is first
+** given a private copy of its value, so that it remains valid after the
+** cursor moves. Otherwise the caller guarantees that the registered
+** cells will not be read again before they are overwritten, and they
+** are simply unmarked.
+*/
+void sqlite4VdbeCursorReleaseRefs(VdbeCursor *pC, int bCopy){
+  int i;
+  for(i=0; i<pC->nRef; i++){
+    Mem *pMem = pC->apRef[i];
+    if( pMem->flags & MEM_KVRef ){
+      if( bCopy ){
+        sqlite4VdbeMemMakeWriteable(pMem);
+      }else{
+        pMem->flags &= ~MEM_KVRef;
+      }
+    }
+  }
+  pC->nRef = 0;
+}
+
+/*
+** Return the schema that holds the cached largest rowid for the table
+** that cursor pC is open on, or NULL if the value may not be cached for
+** this cursor (because it is open on an ephemeral table, for example).
+*/
+static Schema *vdbeRowidHwmSchema(VdbeCursor *pC){
+  if( pC->pTmpKV || pC->iDb<0 || pC->iRoot==KVSTORE_ROOT ) return 0;
+  return pC->db->aDb[pC->iDb].pSchema;
+}
+
+/*
+** Return a pointer to the pointer to the RowidHwm entry for table iRoot
+** in the list belonging to pSchema. If there is no such entry, the
+** returned pointer points to the NULL pointer at the end of the list.
+*/
+static RowidHwm **vdbeRowidHwmFind(Schema *pSchema, int iRoot){
+  RowidHwm **pp;
+  for(pp=&pSchema->pRowidHwm; *pp && (*pp)->iRoot!=iRoot; pp=&(*pp)->pNext);
+  return pp;
+}
+
+/*
+** Decode the rowid from the key of a row of the table that cursor pC is
+** open on. Return SQLITE4_OK if successful, or SQLITE4_NOTFOUND if the
+** key is not a simple integer rowid.
+*/
+static int vdbeRowidFromKey(
+  VdbeCursor *pC,                 /* Cursor the key belongs to */
+  const KVByteArray *aKey,        /* Key to decode */
+  KVSize nKey,                    /* Size of aKey[] in bytes */
+  i64 *piRowid                    /* OUT: The decoded rowid */
+){
+  u64 iRoot;
+  sqlite4_num num;
+  int bLossy = 0;
+  int n;
+  int m;
+
+  n = sqlite4GetVarint64((u8 *)aKey, nKey, &iRoot);
+  if( n==0 || iRoot!=(u64)pC->iRoot ) return SQLITE4_NOTFOUND;
+  m = sqlite4VdbeDecodeIntKey(&aKey[n], nKey-n, piRowid);
+  if( m ){
+    return (n+m==nKey) ? SQLITE4_OK : SQLITE4_NOTFOUND;
+  }
+  m = sqlite4VdbeDecodeNumericKey(&aKey[n], nKey-n, &num);
+  if( m==0 || n+m!=nKey ) return SQLITE4_NOTFOUND;
+  *piRowid = sqlite4_num_to_int64(num, &bLossy);
+  return bLossy ? SQLITE4_NOTFOUND : SQLITE4_OK;
+}
+
+/*
+** If the largest rowid in the table that cursor pC is open on is cached,
+** set *piMax to it and return non-zero. Otherwise, return zero.
+*/
+int sqlite4VdbeRowidHwmGet(VdbeCursor *pC, i64 *piMax){
+  Schema *pSchema = vdbeRowidHwmSchema(pC);
+  if( pSchema && pSchema->pRowidHwm ){
+    RowidHwm *pHwm = *vdbeRowidHwmFind(pSchema, pC->iRoot);
+    if( pHwm ){
+      *piMax = pHwm->iMax;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+** Record iMax as the largest rowid currently in the table that cursor pC
+** is open on. If a malloc fails, the value is simply not cached.
+*/
+void sqlite4VdbeRowidHwmSet(VdbeCursor *pC, i64 iMax){
+  Schema *pSchema = vdbeRowidHwmSchema(pC);
+  if( pSchema ){
+    RowidHwm **pp = vdbeRowidHwmFind(pSchema, pC->iRoot);
+    RowidHwm *pHwm = *pp;
+    if( pHwm==0 ){
+      pHwm = (RowidHwm*)sqlite4_malloc(pC->db->pEnv, sizeof(RowidHwm));
+      if( pHwm==0 ) return;
+      pHwm->iRoot = pC->iRoot;
+      pHwm->pNext = 0;
+      *pp = pHwm;
+    }
+    pHwm->iMax = iMax;
+  }
+}
+
+/*
+** This is called after the row with key aKey/nKey has been written via
+** cursor pC. Update the cached largest rowid for the table, if any.
+*/
+void sqlite4VdbeRowidHwmInsert(
+  VdbeCursor *pC, 
+  const KVByteArray *aKey, 
+  KVSize nKey
+){
+  Schema *pSchema = vdbeRowidHwmSchema(pC);
+  if( pSchema && pSchema->pRowidHwm ){
+    RowidHwm **pp = vdbeRowidHwmFind(pSchema, pC->iRoot);
+    RowidHwm *pHwm = *pp;
+    if( pHwm ){
+      i64 iRowid;
+      if( vdbeRowidFromKey(pC, aKey, nKey, &iRowid)!=SQLITE4_OK ){
+        *pp = pHwm->pNext;
+        sqlite4_free(pC->db->pEnv, pHwm);
+      }else if( iRowid>pHwm->iMax ){
+        pHwm->iMax = iRowid;
+      }
+    }
+  }
+}
+
+/*
+** This is called before the row that cursor pC currently points to is
+** deleted. If it is the row with the largest rowid in the table, discard
+** the cached value, as the new largest rowid is not known.
+*/
+void sqlite4VdbeRowidHwmDelete(VdbeCursor *pC){
+  Schema *pSchema = vdbeRowidHwmSchema(pC);
+  if( pSchema && pSchema->pRowidHwm ){
+    RowidHwm **pp = vdbeRowidHwmFind(pSchema, pC->iRoot);
+    RowidHwm *pHwm = *pp;
+    if( pHwm ){
+      const KVByteArray *aKey;
+      KVSize nKey;
+      i64 iRowid;
+      if( sqlite4KVCursorKey(pC->pKVCur, &aKey, &nKey)!=SQLITE4_OK
+       || vdbeRowidFromKey(pC, aKey, nKey, &iRowid)!=SQLITE4_OK
+       || iRowid>=pHwm->iMax
+      ){
+        *pp = pHwm->pNext;
+        sqlite4_free(pC->db->pEnv, pHwm);
+      }
+    }
+  }
+}
+
+/*
+** Discard the cached largest rowid for table iRoot of database iDb.
+*/
+void sqlite4VdbeRowidHwmDrop(sqlite4 *db, int iDb, int iRoot){
+  Schema *pSchema = db->aDb[iDb].pSchema;
+  if( pSchema && pSchema->pRowidHwm ){
+    RowidHwm **pp = vdbeRowidHwmFind(pSchema, iRoot);
+    RowidHwm *pHwm = *pp;
+    if( pHwm ){
+      *pp = pHwm->pNext;
+      sqlite4_free(db->pEnv, pHwm);
+    }
+  }
+}
+
+/*
+** Discard all cached largest rowid values belonging to schema pSchema.
+*/
+void sqlite4VdbeRowidHwmClear(sqlite4_env *pEnv, Schema *pSchema){
+  RowidHwm *pHwm;
+  RowidHwm *pNext;
+  for(pHwm=pSchema->pRowidHwm; pHwm; pHwm=pNext){
+    pNext = pHwm->pNext;
+    sqlite4_free(pEnv, pHwm);
+  }
+  pSchema->pRowidHwm = 0;
+}
+
+/*
+** This is called just after a read transaction is opened on database
+** iDb.  If some other connection may have written to the database since
+** the cached largest rowid values were loaded, discard them.  The values
+** are also discarded if the storage engine does not supply a change
+** counter, or did not supply one when the values were loaded.
+*/
+void sqlite4VdbeRowidHwmValidate(sqlite4 *db, int iDb){
+  Schema *pSchema = db->aDb[iDb].pSchema;
+  unsigned int iChng = 0;
+  int rc;
+  if( pSchema==0 ) return;
+  rc = sqlite4KVStoreChangeCounter(db->aDb[iDb].pKV, &iChng);
+  if( rc!=SQLITE4_OK || pSchema->bRowidChng==0 || iChng!=pSchema->iRowidChng ){
+    sqlite4VdbeRowidHwmClear(db->pEnv, pSchema);
+  }
+  pSchema->bRowidChng = (rc==SQLITE4_OK);
+  pSchema->iRowidChng = iChng;
+}
+
+/*
+** This is called just before the write transaction open on database iDb
+** is committed. The cached values already reflect this connection's
+** own writes, so record the change counter that the transaction will
+** be committed with. Then the next read transaction only discards them
+** if some other connection writes to the database in the meantime.
+*/
+void sqlite4VdbeRowidHwmCommit(sqlite4 *db, int iDb){
+  Schema *pSchema = db->aDb[iDb].pSchema;
+  unsigned int iChng = 0;
+  int rc;
+  if( pSchema==0 ) return;
+  rc = sqlite4KVStoreChangeCounter(db->aDb[iDb].pKV, &iChng);
+  pSchema->bRowidChng = (rc==SQLITE4_OK);
+  pSchema->iRowidChng = iChng;
+}
@@ -0,0 +1,389 @@
+/*
+** 2016 May 2
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains the hash table used by OP_AggHashOpen cursors to
+** implement GROUP BY without sorting the input.
+**
+** A GROUP BY query accumulates each group using a contiguous range of
+** registers (the accumulator registers - see struct AggInfo). The hash
+** table stores a copy of these registers for every group seen so far,
+** keyed by the encoded GROUP BY key. For each input row:
+**
+**   1. OP_AggHashFind looks up the group key. The registers saved for
+**      the group (or NULL values, for a new group) are moved into the
+**      accumulator registers.
+**
+**   2. The usual OP_AggStep and OP_Column code updates the accumulators.
+**
+**   3. OP_AggHashSave moves the accumulator registers back into the
+**      hash table.
+**
+** Moving a register copies the Mem structure only, so aggregate contexts
+** and other dynamic allocations are never copied.
+**
+** Once the input is finished, OP_AggHashNext sorts the groups by key and
+** loads them into the accumulator registers one at a time, so that the
+** groups are returned in the same order as if the input had been sorted.
+**
+** The table uses open addressing with linear probing. Entries, their keys
+** and their saved registers are allocated from an arena that is freed all
+** at once when the cursor is closed.
+**
+** If the memory used by the table exceeds the budget set by PRAGMA
+** sorter_memory, no new groups are added. OP_AggHashFind jumps instead,
+** and the caller passes the row to the sort-based implementation. Each
+** group is then handled entirely by one of the two methods, and the
+** output of the two is merged in key order (see OP_AggHashNext).
+*/
+#include "sqliteInt.h"
+#include "vdbeInt.h"
+
+/*
+** Size of each chunk of memory that entries are allocated from.
+*/
+#define AGGHASH_CHUNK_SIZE (32*1024)
+
+typedef struct AggHashChunk AggHashChunk;
+typedef struct AggHashEntry AggHashEntry;
+
+/*
+** A chunk of memory that entries are allocated from. The usable space
+** follows this header.
+*/
+struct AggHashChunk {
+  AggHashChunk *pNext;            /* Next (older) chunk */
+  int nAlloc;                     /* Bytes of usable space */
+  int nUsed;                      /* Bytes used so far */
+};
+
+/*
+** One group. The saved registers (aReg[]) and the key follow this header
+** in memory.
+*/
+struct AggHashEntry {
+  u32 iHash;                      /* Hash of key */
+  int nKey;                       /* Size of key in bytes */
+  int nDyn;                       /* Dynamic memory used by aReg[] */
+  Mem *aReg;                      /* Saved accumulator registers */
+  u8 *aKey;                       /* Encoded GROUP BY key */
+};
+
+/*
+** The hash table object.
+**
+** While input is being accumulated, aSlot[] is an open-addressing hash
+** table of nSlot slots (a power of two). Once bSorted is set, the first
+** nEntry elements of aSlot[] are the entries sorted by key and iNext is
+** the index of the next entry to return.
+*/
+struct VdbeAggHash {
+  sqlite4 *db;                    /* Database connection */
+  Mem *aReg;                      /* First accumulator register */
+  int nReg;                       /* Number of accumulator registers */
+  i64 mxMem;                      /* Memory budget, or 0 for no limit */
+  i64 nMem;                       /* Memory currently used */
+  int bFull;                      /* True once the budget is exceeded */
+  AggHashEntry **aSlot;           /* Hash table slots */
+  int nSlot;                      /* Number of slots in aSlot[] */
+  int nEntry;                     /* Number of entries */
+  AggHashChunk *pChunk;           /* List of chunks, most recent first */
+  AggHashEntry *pCurrent;         /* Entry loaded by the last Find */
+  int bSorted;                    /* True once input is finished */
+  int iNext;                      /* Next entry to return once bSorted */
+};
+
+/*
+** Return a hash of the nKey byte key aKey.
+*/
+static u32 aggHashKey(const u8 *aKey, int nKey){
+  u32 h = 0x811C9DC5;
+  int i;
+  for(i=0; i<nKey; i++){
+    h = (h ^ aKey[i]) * 0x01000193;
+  }
+  return h;
+}
+
+/*
+** Compare two entries by key, using memcmp() order.
+*/
+static int aggHashCompare(const AggHashEntry *p1, const AggHashEntry *p2){
+  int c = memcmp(p1->aKey, p2->aKey, p1->nKey<p2->nKey ? p1->nKey : p2->nKey);
+  if( c==0 ) c = p1->nKey - p2->nKey;
+  return c;
+}
+
+/*
+** Allocate nByte bytes (a multiple of 8) from the arena. Return NULL if
+** a malloc fails.
+*/
+static void *aggHashAlloc(VdbeAggHash *p, int nByte){
+  AggHashChunk *pChunk = p->pChunk;
+  void *pRet;
+  assert( nByte==ROUND8(nByte) );
+  if( pChunk==0 || pChunk->nUsed+nByte>pChunk->nAlloc ){
+    int nAlloc = MAX(AGGHASH_CHUNK_SIZE, nByte);
+    pChunk = (AggHashChunk*)sqlite4DbMallocRaw(
+        p->db, ROUND8(sizeof(AggHashChunk)) + nAlloc
+    );
+    if( pChunk==0 ) return 0;
+    pChunk->nAlloc = nAlloc;
+    pChunk->nUsed = 0;
+    pChunk->pNext = p->pChunk;
+    p->pChunk = pChunk;
+    p->nMem += ROUND8(sizeof(AggHashChunk)) + nAlloc;
+  }
+  pRet = &((u8*)pChunk)[ROUND8(sizeof(AggHashChunk)) + pChunk->nUsed];
+  pChunk->nUsed += nByte;
+  return pRet;
+}
+
+/*
+** Double the size of the hash table (or allocate the initial table).
+*/
+static int aggHashGrow(VdbeAggHash *p){
+  int nNew = p->nSlot ? p->nSlot*2 : 64;
+  AggHashEntry **aNew;
+  int i;
+
+  aNew = (AggHashEntry**)sqlite4DbMallocZero(
+      p->db, nNew*sizeof(AggHashEntry*)
+  );
+  if( aNew==0 ) return SQLITE4_NOMEM;
+  for(i=0; i<p->nSlot; i++){
+    AggHashEntry *pEntry = p->aSlot[i];
+    if( pEntry ){
+      int iSlot = pEntry->iHash & (nNew-1);
+      while( aNew[iSlot] ) iSlot = (iSlot+1) & (nNew-1);
+      aNew[iSlot] = pEntry;
+    }
+  }
+  sqlite4DbFree(p->db, p->aSlot);
+  p->nMem += (nNew - p->nSlot) * sizeof(AggHashEntry*);
+  p->aSlot = aNew;
+  p->nSlot = nNew;
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new hash table for database connection db. The nReg
+** accumulator registers begin at aReg[0].
+*/
+int sqlite4VdbeAggHashOpen(
+  sqlite4 *db,
+  Mem *aReg,
+  int nReg,
+  VdbeAggHash **pp
+){
+  VdbeAggHash *pNew;
+  *pp = pNew = (VdbeAggHash*)sqlite4DbMallocZero(db, sizeof(VdbeAggHash));
+  if( pNew==0 ) return SQLITE4_NOMEM;
+  pNew->db = db;
+  pNew->aReg = aReg;
+  pNew->nReg = nReg;
+  pNew->mxMem = db->mxSorterMem>0 ? db->mxSorterMem : 0;
+  return SQLITE4_OK;
+}
+
+/*
+** Free a hash table and all groups it contains.
+*/
+void sqlite4VdbeAggHashClose(VdbeAggHash *p){
+  if( p ){
+    sqlite4 *db = p->db;
+    AggHashChunk *pChunk;
+    AggHashChunk *pNext;
+    int i;
+    int nEntry = (p->bSorted ? p->nEntry : p->nSlot);
+    for(i=0; i<nEntry; i++){
+      AggHashEntry *pEntry = p->aSlot[i];
+      if( pEntry ){
+        int j;
+        for(j=0; j<p->nReg; j++) sqlite4VdbeMemRelease(&pEntry->aReg[j]);
+      }
+    }
+    for(pChunk=p->pChunk; pChunk; pChunk=pNext){
+      pNext = pChunk->pNext;
+      sqlite4DbFree(db, pChunk);
+    }
+    sqlite4DbFree(db, p->aSlot);
+    sqlite4DbFree(db, p);
+  }
+}
+
+/*
+** Look up the group with key aKey/nKey. If it exists, move its saved
+** registers into the accumulator registers. If it does not, add it,
+** and set the accumulator registers to NULL.
+**
+** Return SQLITE4_OK if successful, or SQLITE4_NOTFOUND if the group
+** does not exist and cannot be added because the memory budget has
+** been exceeded. Or an error code if a malloc fails.
+*/
+int sqlite4VdbeAggHashFind(VdbeAggHash *p, const u8 *aKey, int nKey){
+  u32 iHash = aggHashKey(aKey, nKey);
+  AggHashEntry *pEntry;
+  int iSlot;
+  int i;
+
+  assert( p->bSorted==0 );
+  p->pCurrent = 0;
+  if( p->nSlot>0 ){
+    iSlot = iHash & (p->nSlot-1);
+    while( (pEntry = p->aSlot[iSlot])!=0 ){
+      if( pEntry->iHash==iHash && pEntry->nKey==nKey
+       && memcmp(pEntry->aKey, aKey, nKey)==0
+      ){
+        for(i=0; i<p->nReg; i++){
+          sqlite4VdbeMemMove(&p->aReg[i], &pEntry->aReg[i]);
+        }
+        p->pCurrent = pEntry;
+        return SQLITE4_OK;
+      }
+      iSlot = (iSlot+1) & (p->nSlot-1);
+    }
+  }
+
+  /* The group does not exist. Add it, unless the budget is exhausted. */
+  if( p->bFull ) return SQLITE4_NOTFOUND;
+  if( p->mxMem>0 && p->nMem>=p->mxMem ){
+    p->bFull = 1;
+    return SQLITE4_NOTFOUND;
+  }
+  if( (p->nEntry+1)*2>p->nSlot ){
+    if( aggHashGrow(p) ) return SQLITE4_NOMEM;
+  }
+  pEntry = (AggHashEntry*)aggHashAlloc(p,
+      ROUND8(sizeof(AggHashEntry)) + p->nReg*sizeof(Mem) + ROUND8(nKey)
+  );
+  if( pEntry==0 ) return SQLITE4_NOMEM;
+  pEntry->iHash = iHash;
+  pEntry->nKey = nKey;
+  pEntry->nDyn = 0;
+  pEntry->aReg = (Mem*)&((u8*)pEntry)[ROUND8(sizeof(AggHashEntry))];
+  pEntry->aKey = (u8*)&pEntry->aReg[p->nReg];
+  memcpy(pEntry->aKey, aKey, nKey);
+  memset(pEntry->aReg, 0, p->nReg*sizeof(Mem));
+  for(i=0; i<p->nReg; i++){
+    pEntry->aReg[i].flags = MEM_Null;
+    pEntry->aReg[i].db = p->db;
+    sqlite4VdbeMemSetNull(&p->aReg[i]);
+  }
+
+  iSlot = iHash & (p->nSlot-1);
+  while( p->aSlot[iSlot] ) iSlot = (iSlot+1) & (p->nSlot-1);
+  p->aSlot[iSlot] = pEntry;
+  p->nEntry++;
+  p->pCurrent = pEntry;
+  return SQLITE4_OK;
+}
+
+/*
+** Move the accumulator registers back into the group loaded by the
+** most recent successful call to sqlite4VdbeAggHashFind().
+*/
+int sqlite4VdbeAggHashSave(VdbeAggHash *p){
+  AggHashEntry *pEntry = p->pCurrent;
+  int nDyn = 0;
+  int i;
+
+  assert( pEntry );
+  for(i=0; i<p->nReg; i++){
+    Mem *pReg = &p->aReg[i];
+    if( pReg->flags & MEM_Ephem ){
+      if( sqlite4VdbeMemMakeWriteable(pReg) ) return SQLITE4_NOMEM;
+    }
+    if( pReg->zMalloc ) nDyn += sqlite4DbMallocSize(p->db, pReg->zMalloc);
+    sqlite4VdbeMemMove(&pEntry->aReg[i], pReg);
+  }
+  p->nMem += (nDyn - pEntry->nDyn);
+  pEntry->nDyn = nDyn;
+  p->pCurrent = 0;
+  return SQLITE4_OK;
+}
+
+/*
+** Sort the n entries in array a[] by key, using aTmp[] (also of size n)
+** as temporary storage.
+*/
+static void aggHashSort(AggHashEntry **a, AggHashEntry **aTmp, int n){
+  int nRun;
+  for(nRun=1; nRun<n; nRun=nRun*2){
+    int i;
+    for(i=0; i<n; i+=nRun*2){
+      int i1 = i;
+      int i2 = MIN(i+nRun, n);
+      int iEnd1 = i2;
+      int iEnd2 = MIN(i+nRun*2, n);
+      int iOut = i;
+      while( i1<iEnd1 || i2<iEnd2 ){
+        if( i2>=iEnd2 || (i1<iEnd1 && aggHashCompare(a[i1], a[i2])<=0) ){
+          aTmp[iOut++] = a[i1++];
+        }else{
+          aTmp[iOut++] = a[i2++];
+        }
+      }
+    }
+    memcpy(a, aTmp, n*sizeof(AggHashEntry*));
+  }
+}
+
+/*
+** End the input phase. Sort the groups by key.
+*/
+static int aggHashFinish(VdbeAggHash *p){
+  int i;
+  int n = 0;
+  for(i=0; i<p->nSlot; i++){
+    if( p->aSlot[i] ) p->aSlot[n++] = p->aSlot[i];
+  }
+  assert( n==p->nEntry );
+  if( n>1 ){
+    AggHashEntry **aTmp;
+    aTmp = (AggHashEntry**)sqlite4DbMallocRaw(p->db, n*sizeof(AggHashEntry*));
+    if( aTmp==0 ) return SQLITE4_NOMEM;
+    aggHashSort(p->aSlot, aTmp, n);
+    sqlite4DbFree(p->db, aTmp);
+  }
+  p->bSorted = 1;
+  p->iNext = 0;
+  return SQLITE4_OK;
+}
+
+/*
+** If the smallest group not yet returned has a key smaller than aBound,
+** move its registers into the accumulator registers and return
+** SQLITE4_OK. Otherwise, return SQLITE4_NOTFOUND. If aBound is NULL,
+** every group is smaller than it.
+**
+** The first call ends the input phase.
+*/
+int sqlite4VdbeAggHashNext(VdbeAggHash *p, const u8 *aBound, int nBound){
+  AggHashEntry *pEntry;
+  int i;
+
+  if( p->bSorted==0 ){
+    int rc = aggHashFinish(p);
+    if( rc!=SQLITE4_OK ) return rc;
+  }
+  if( p->iNext>=p->nEntry ) return SQLITE4_NOTFOUND;
+  pEntry = p->aSlot[p->iNext];
+  if( aBound ){
+    int c = memcmp(pEntry->aKey, aBound, MIN(pEntry->nKey, nBound));
+    if( c>0 || (c==0 && pEntry->nKey>=nBound) ) return SQLITE4_NOTFOUND;
+  }
+  for(i=0; i<p->nReg; i++){
+    sqlite4VdbeMemMove(&p->aReg[i], &pEntry->aReg[i]);
+  }
+  p->iNext++;
+  return SQLITE4_OK;
+}
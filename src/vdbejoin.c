@@ -0,0 +1,562 @@
+/*
+** 2016 May 9
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains the hash table used to implement hash joins.
+**
+** When the query planner decides to build an automatic index on the inner
+** table of a join (see constructAutomaticIndex() in where.c), and the
+** index is only ever used for equality lookups on its first N columns,
+** OP_OpenAutoindex opens one of these objects instead of an ordered
+** ephemeral table. Like the sorters in vdbesort.c and vdbetopn.c, it
+** presents itself to the VDBE as a key/value store. It is used as follows:
+**
+**   1. The index is filled using xReplace. Each entry is appended to a
+**      list. A hash of the first N fields of the key is computed and
+**      stored with the entry.
+**
+**   2. The first xSeek ends the input phase. The entries are distributed
+**      between an array of hash buckets, in the order they were added.
+**
+**   3. Each lookup is an xSeek with a probe key containing exactly N
+**      fields. The cursor is left pointing to the first entry with the
+**      same N fields. xNext and xPrev then visit the other entries with
+**      the same N fields, and return SQLITE4_NOTFOUND after the last.
+**
+** So building the index costs O(1) per row instead of O(log N), and so
+** does each lookup. Entries are allocated from large chunks of memory
+** that are freed all at once when the store is closed.
+**
+** Entries with equal prefixes are returned in the order in which they were
+** added, not in key order. Seeks that are not equality lookups, adding
+** entries after reading has begun and deleting entries are not supported
+** and return SQLITE4_MISUSE.
+**
+** The probes are made by the outer loop of the join, in whatever order it
+** visits its rows, so the table cannot be partitioned to disk and probed
+** one partition at a time. Instead, if the memory used by the table
+** exceeds the budget set by PRAGMA sorter_memory during the input phase,
+** its entries are moved to an ordered ephemeral store, and the object
+** behaves exactly like the automatic index it replaced from then on.
+*/
+#include "sqliteInt.h"
+#include "vdbeInt.h"
+
+/*
+** Size of each chunk of memory that entries are allocated from.
+*/
+#define HASHJOIN_CHUNK_SIZE (64*1024)
+
+typedef struct HashJoinChunk HashJoinChunk;
+typedef struct HashJoinCsr HashJoinCsr;
+typedef struct HashJoinEntry HashJoinEntry;
+typedef struct VdbeHashJoin VdbeHashJoin;
+
+/*
+** A chunk of memory that entries are allocated from. The usable space
+** follows this header.
+*/
+struct HashJoinChunk {
+  HashJoinChunk *pNext;           /* Next (older) chunk */
+  int nAlloc;                     /* Bytes of usable space */
+  int nUsed;                      /* Bytes used so far */
+};
+
+/*
+** A single key/value pair. The key immediately follows this header, and
+** the value immediately follows the key.
+**
+** During the input phase, pNext links all entries in the order they were
+** added. Afterwards it links the entries in the same hash bucket.
+*/
+struct HashJoinEntry {
+  HashJoinEntry *pNext;           /* Next entry in list */
+  u32 iHash;                      /* Hash of first nPrefix bytes of key */
+  int nPrefix;                    /* Size of the hashed key prefix */
+  KVSize nKey;                    /* Size of key in bytes */
+  KVSize nData;                   /* Size of value in bytes */
+};
+
+/*
+** The hash join object. This is a subclass of KVStore.
+**
+** The cursor points to pCurrent, or to no entry if pCurrent is NULL.
+*/
+struct VdbeHashJoin {
+  KVStore base;                   /* Base class, must be first */
+  sqlite4 *db;                    /* Database connection */
+  int nField;                     /* Number of key fields hashed */
+  i64 mxMem;                      /* Memory budget, or 0 for no limit */
+  i64 nMem;                       /* Memory used by entries so far */
+  HashJoinChunk *pChunk;          /* List of chunks, most recent first */
+  HashJoinEntry *pFirst;          /* First entry added (input phase only) */
+  HashJoinEntry *pLast;           /* Last entry added (input phase only) */
+  int nEntry;                     /* Number of entries */
+  HashJoinEntry **aBucket;        /* Hash buckets, once input is finished */
+  int nBucket;                    /* Size of aBucket[] (a power of two) */
+  HashJoinEntry *pCurrent;        /* Entry the cursor points to */
+  KVStore *pOrdered;              /* Ordered store, if budget exceeded */
+  KVCursor *pOrderedCsr;          /* Cursor open on pOrdered */
+};
+
+/*
+** A cursor open on a hash join object. The iteration state is held by the
+** object itself.
+*/
+struct HashJoinCsr {
+  KVCursor base;                  /* Base class, must be first */
+};
+
+#define hashJoinEntryKey(p) ((const u8*)&(p)[1])
+
+/*
+** Return a hash of the nKey byte buffer aKey.
+*/
+static u32 hashJoinHash(const u8 *aKey, int nKey){
+  u32 h = 0x811C9DC5;
+  int i;
+  for(i=0; i<nKey; i++){
+    h = (h ^ aKey[i]) * 0x01000193;
+  }
+  return h;
+}
+
+/*
+** Return true if the hashed prefix of the key belonging to entry pEntry
+** is the nPrefix byte buffer aPrefix, which has hash value iHash.
+*/
+static int hashJoinMatch(
+  const HashJoinEntry *pEntry,
+  u32 iHash,
+  const u8 *aPrefix,
+  int nPrefix
+){
+  return pEntry->iHash==iHash
+      && pEntry->nPrefix==nPrefix
+      && memcmp(hashJoinEntryKey(pEntry), aPrefix, nPrefix)==0;
+}
+
+/*
+** Allocate nByte bytes (a multiple of 8) from the current chunk, allocating
+** a new chunk if required. Return NULL if a malloc fails.
+*/
+static void *hashJoinAlloc(VdbeHashJoin *p, int nByte){
+  HashJoinChunk *pChunk = p->pChunk;
+  void *pRet;
+  assert( nByte==ROUND8(nByte) );
+  if( pChunk==0 || pChunk->nUsed+nByte>pChunk->nAlloc ){
+    int nAlloc = MAX(HASHJOIN_CHUNK_SIZE, nByte);
+    pChunk = (HashJoinChunk*)sqlite4_malloc(
+        p->base.pEnv, ROUND8(sizeof(HashJoinChunk)) + nAlloc
+    );
+    if( pChunk==0 ) return 0;
+    pChunk->nAlloc = nAlloc;
+    pChunk->nUsed = 0;
+    pChunk->pNext = p->pChunk;
+    p->pChunk = pChunk;
+  }
+  pRet = &((u8*)pChunk)[ROUND8(sizeof(HashJoinChunk)) + pChunk->nUsed];
+  pChunk->nUsed += nByte;
+  return pRet;
+}
+
+/*
+** End the input phase. Distribute the entries between the hash buckets,
+** preserving the order in which they were added within each bucket.
+*/
+static int hashJoinBuild(VdbeHashJoin *p){
+  HashJoinEntry *pEntry;
+  HashJoinEntry *pNext;
+  int nBucket = 16;
+  int i;
+
+  while( nBucket<p->nEntry ) nBucket = nBucket*2;
+  p->aBucket = (HashJoinEntry**)sqlite4_malloc(
+      p->base.pEnv, nBucket*sizeof(HashJoinEntry*)
+  );
+  if( p->aBucket==0 ) return SQLITE4_NOMEM;
+  memset(p->aBucket, 0, nBucket*sizeof(HashJoinEntry*));
+  p->nBucket = nBucket;
+
+  /* Add each entry to the start of its bucket, then reverse each bucket. */
+  for(pEntry=p->pFirst; pEntry; pEntry=pNext){
+    int iBucket = pEntry->iHash & (nBucket-1);
+    pNext = pEntry->pNext;
+    pEntry->pNext = p->aBucket[iBucket];
+    p->aBucket[iBucket] = pEntry;
+  }
+  for(i=0; i<nBucket; i++){
+    HashJoinEntry *pList = 0;
+    for(pEntry=p->aBucket[i]; pEntry; pEntry=pNext){
+      pNext = pEntry->pNext;
+      pEntry->pNext = pList;
+      pList = pEntry;
+    }
+    p->aBucket[i] = pList;
+  }
+  p->pFirst = p->pLast = 0;
+  return SQLITE4_OK;
+}
+
+/*
+** Free all chunks of memory that entries were allocated from.
+*/
+static void hashJoinFreeChunks(VdbeHashJoin *p){
+  HashJoinChunk *pChunk;
+  HashJoinChunk *pNext;
+  for(pChunk=p->pChunk; pChunk; pChunk=pNext){
+    pNext = pChunk->pNext;
+    sqlite4_free(p->base.pEnv, pChunk);
+  }
+  p->pChunk = 0;
+}
+
+/*
+** The memory budget has been exceeded during the input phase. Open an
+** ordered ephemeral store, move all entries added so far into it and
+** free the memory they used. All subsequent operations are passed
+** through to the new store.
+*/
+static int hashJoinConvert(VdbeHashJoin *p){
+  HashJoinEntry *pEntry;
+  int rc;
+
+  assert( p->pOrdered==0 && p->aBucket==0 );
+  rc = sqlite4KVStoreOpen(p->db, "ephm", 0, &p->pOrdered,
+      SQLITE4_KVOPEN_TEMPORARY | SQLITE4_KVOPEN_NO_TRANSACTIONS
+  );
+  if( rc==SQLITE4_OK ){
+    rc = sqlite4KVStoreOpenCursor(p->pOrdered, &p->pOrderedCsr);
+  }
+  if( rc==SQLITE4_OK ){
+    rc = sqlite4KVStoreBegin(p->pOrdered, 2);
+  }
+  for(pEntry=p->pFirst; rc==SQLITE4_OK && pEntry; pEntry=pEntry->pNext){
+    const KVByteArray *aKey = (const KVByteArray*)&pEntry[1];
+    rc = sqlite4KVStoreReplace(p->pOrdered,
+        aKey, pEntry->nKey, &aKey[pEntry->nKey], pEntry->nData
+    );
+  }
+  hashJoinFreeChunks(p);
+  p->pFirst = p->pLast = 0;
+  p->nMem = 0;
+  return rc;
+}
+
+/*
+** Add a new entry to the hash table.
+*/
+static int hashJoinReplace(
+  KVStore *pKVStore,
+  const KVByteArray *aKey, KVSize nKey,
+  const KVByteArray *aData, KVSize nData
+){
+  VdbeHashJoin *p = (VdbeHashJoin*)pKVStore;
+  HashJoinEntry *pEntry;
+  int nByte;
+
+  if( p->aBucket ) return SQLITE4_MISUSE;
+  nByte = ROUND8(sizeof(HashJoinEntry) + nKey + nData);
+  if( p->pOrdered==0 && p->mxMem>0
+   && p->nMem + nByte + (int)sizeof(HashJoinEntry*) > p->mxMem
+  ){
+    int rc = hashJoinConvert(p);
+    if( rc!=SQLITE4_OK ) return rc;
+  }
+  if( p->pOrdered ){
+    return sqlite4KVStoreReplace(p->pOrdered, aKey, nKey, aData, nData);
+  }
+
+  /* Each entry also uses one slot of the bucket array. */
+  p->nMem += nByte + sizeof(HashJoinEntry*);
+  pEntry = (HashJoinEntry*)hashJoinAlloc(p, nByte);
+  if( pEntry==0 ) return SQLITE4_NOMEM;
+  pEntry->pNext = 0;
+  pEntry->nKey = nKey;
+  pEntry->nData = nData;
+  pEntry->nPrefix = sqlite4VdbeShortKey(aKey, nKey, p->nField, 0);
+  pEntry->iHash = hashJoinHash(aKey, pEntry->nPrefix);
+  memcpy(&pEntry[1], aKey, nKey);
+  if( nData ) memcpy(&((u8*)&pEntry[1])[nKey], aData, nData);
+
+  if( p->pLast ){
+    p->pLast->pNext = pEntry;
+  }else{
+    p->pFirst = pEntry;
+  }
+  p->pLast = pEntry;
+  p->nEntry++;
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new cursor on the hash table.
+*/
+static int hashJoinOpenCursor(KVStore *pKVStore, KVCursor **ppKVCursor){
+  HashJoinCsr *pCsr;
+  pCsr = (HashJoinCsr*)sqlite4_malloc(pKVStore->pEnv, sizeof(HashJoinCsr));
+  if( pCsr==0 ){
+    *ppKVCursor = 0;
+    return SQLITE4_NOMEM;
+  }
+  memset(pCsr, 0, sizeof(HashJoinCsr));
+  pCsr->base.pStore = pKVStore;
+  pCsr->base.pStoreVfunc = pKVStore->pStoreVfunc;
+  pCsr->base.pEnv = pKVStore->pEnv;
+  *ppKVCursor = (KVCursor*)pCsr;
+  return SQLITE4_OK;
+}
+
+/*
+** Seek the cursor.
+**
+** The probe key must consist of exactly nField fields, optionally followed
+** by a single 0xFF byte (as added by OP_SeekLe). If the direction is zero,
+** the cursor is moved to the entry with a key equal to the probe. Otherwise,
+** it is moved to the first entry whose key begins with the probe fields.
+*/
+static int hashJoinSeek(
+  KVCursor *pKVCursor,
+  const KVByteArray *aProbe,
+  KVSize nProbe,
+  int direction
+){
+  VdbeHashJoin *p = (VdbeHashJoin*)pKVCursor->pStore;
+  HashJoinEntry *pEntry;
+  int nPrefix;
+  int nPrefixField;
+  u32 iHash;
+
+  if( p->pOrdered ){
+    return sqlite4KVCursorSeek(p->pOrderedCsr, aProbe, nProbe, direction);
+  }
+  p->pCurrent = 0;
+  if( p->aBucket==0 ){
+    int rc = hashJoinBuild(p);
+    if( rc!=SQLITE4_OK ) return rc;
+  }
+
+  nPrefix = sqlite4VdbeShortKey(aProbe, nProbe, p->nField, &nPrefixField);
+  if( nPrefixField<p->nField ) return SQLITE4_MISUSE;
+  if( direction!=0
+   && nPrefix!=nProbe
+   && (nPrefix+1!=nProbe || aProbe[nPrefix]!=0xFF)
+  ){
+    return SQLITE4_MISUSE;
+  }
+
+  iHash = hashJoinHash(aProbe, nPrefix);
+  for(pEntry=p->aBucket[iHash & (p->nBucket-1)]; pEntry; pEntry=pEntry->pNext){
+    if( hashJoinMatch(pEntry, iHash, aProbe, nPrefix) ){
+      if( direction!=0 ) break;
+      if( pEntry->nKey==nProbe
+       && memcmp(hashJoinEntryKey(pEntry), aProbe, nProbe)==0
+      ){
+        break;
+      }
+    }
+  }
+  if( pEntry==0 ) return SQLITE4_NOTFOUND;
+  p->pCurrent = pEntry;
+  return (pEntry->nKey==nProbe ? SQLITE4_OK : SQLITE4_INEXACT);
+}
+
+/*
+** Move the cursor to the next entry with the same key prefix as the
+** current entry. Entries with the same prefix have no particular order,
+** so this is used for both xNext and xPrev.
+*/
+static int hashJoinNextEntry(KVCursor *pKVCursor){
+  VdbeHashJoin *p = (VdbeHashJoin*)pKVCursor->pStore;
+  HashJoinEntry *pCurrent = p->pCurrent;
+  HashJoinEntry *pEntry;
+
+  if( pCurrent==0 ) return SQLITE4_NOTFOUND;
+  assert( p->pOrdered==0 );
+  for(pEntry=pCurrent->pNext; pEntry; pEntry=pEntry->pNext){
+    if( hashJoinMatch(pEntry, pCurrent->iHash,
+          hashJoinEntryKey(pCurrent), pCurrent->nPrefix)
+    ){
+      break;
+    }
+  }
+  p->pCurrent = pEntry;
+  return (pEntry ? SQLITE4_OK : SQLITE4_NOTFOUND);
+}
+
+/*
+** Once the entries have been moved to an ordered store, the usual xNext
+** and xPrev are used. The VDBE stops at the end of the equal prefix by
+** comparing keys, as it does for any other automatic index.
+*/
+static int hashJoinNext(KVCursor *pKVCursor){
+  VdbeHashJoin *p = (VdbeHashJoin*)pKVCursor->pStore;
+  if( p->pOrdered ) return sqlite4KVCursorNext(p->pOrderedCsr);
+  return hashJoinNextEntry(pKVCursor);
+}
+static int hashJoinPrev(KVCursor *pKVCursor){
+  VdbeHashJoin *p = (VdbeHashJoin*)pKVCursor->pStore;
+  if( p->pOrdered ) return sqlite4KVCursorPrev(p->pOrderedCsr);
+  return hashJoinNextEntry(pKVCursor);
+}
+
+static int hashJoinDelete(KVCursor *pKVCursor){
+  return SQLITE4_MISUSE;
+}
+
+static int hashJoinKey(
+  KVCursor *pKVCursor,
+  const KVByteArray **paKey,
+  KVSize *pnKey
+){
+  VdbeHashJoin *p = (VdbeHashJoin*)pKVCursor->pStore;
+  HashJoinEntry *pEntry = p->pCurrent;
+  if( p->pOrdered ){
+    return sqlite4KVCursorKey(p->pOrderedCsr, paKey, pnKey);
+  }
+  if( pEntry==0 ) return SQLITE4_NOTFOUND;
+  *paKey = (const KVByteArray*)&pEntry[1];
+  *pnKey = pEntry->nKey;
+  return SQLITE4_OK;
+}
+
+static int hashJoinData(
+  KVCursor *pKVCursor,
+  KVSize ofst,
+  KVSize n,
+  const KVByteArray **paData,
+  KVSize *pnData
+){
+  VdbeHashJoin *p = (VdbeHashJoin*)pKVCursor->pStore;
+  HashJoinEntry *pEntry = p->pCurrent;
+  KVSize nData;
+  if( p->pOrdered ){
+    return sqlite4KVCursorData(p->pOrderedCsr, ofst, n, paData, pnData);
+  }
+  if( pEntry==0 ) return SQLITE4_NOTFOUND;
+  nData = pEntry->nData;
+  if( ofst>nData ) ofst = nData;
+  if( n<0 || ofst+n>nData ) n = nData - ofst;
+  *paData = &((const KVByteArray*)&pEntry[1])[pEntry->nKey + ofst];
+  *pnData = n;
+  return SQLITE4_OK;
+}
+
+static int hashJoinReset(KVCursor *pKVCursor){
+  return SQLITE4_OK;
+}
+
+static int hashJoinCloseCursor(KVCursor *pKVCursor){
+  if( pKVCursor ) sqlite4_free(pKVCursor->pEnv, pKVCursor);
+  return SQLITE4_OK;
+}
+
+/*
+** The hash table does not support transactions. These methods only
+** track the transaction level as required by kv.c.
+*/
+static int hashJoinBegin(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int hashJoinCommitPhaseOne(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+static int hashJoinCommitPhaseTwo(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int hashJoinRollback(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int hashJoinRevert(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+
+/*
+** Close the hash table and free all resources.
+*/
+static int hashJoinClose(KVStore *pKVStore){
+  VdbeHashJoin *p = (VdbeHashJoin*)pKVStore;
+  if( p ){
+    sqlite4_env *pEnv = p->base.pEnv;
+    sqlite4KVCursorClose(p->pOrderedCsr);
+    sqlite4KVStoreClose(p->pOrdered);
+    hashJoinFreeChunks(p);
+    sqlite4_free(pEnv, p->aBucket);
+    sqlite4_free(pEnv, p);
+  }
+  return SQLITE4_OK;
+}
+
+static int hashJoinControl(KVStore *pKVStore, int op, void *pArg){
+  return SQLITE4_NOTFOUND;
+}
+
+static int hashJoinGetMeta(KVStore *pKVStore, unsigned int *piVal){
+  *piVal = 0;
+  return SQLITE4_OK;
+}
+
+static int hashJoinPutMeta(KVStore *pKVStore, unsigned int iVal){
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new hash table for database connection db. Entries are hashed
+** and looked up using the first nField fields of their keys. The table
+** is limited to db->mxSorterMem bytes, or is unlimited if that is zero
+** or less.
+*/
+int sqlite4VdbeHashJoinOpen(sqlite4 *db, int nField, KVStore **ppKVStore){
+  static const KVStoreMethods hashJoinMethods = {
+    1,                            /* iVersion */
+    sizeof(KVStoreMethods),       /* szSelf */
+    hashJoinReplace,              /* xReplace */
+    hashJoinOpenCursor,           /* xOpenCursor */
+    hashJoinSeek,                 /* xSeek */
+    hashJoinNext,                 /* xNext */
+    hashJoinPrev,                 /* xPrev */
+    hashJoinDelete,               /* xDelete */
+    hashJoinKey,                  /* xKey */
+    hashJoinData,                 /* xData */
+    hashJoinReset,                /* xReset */
+    hashJoinCloseCursor,          /* xCloseCursor */
+    hashJoinBegin,                /* xBegin */
+    hashJoinCommitPhaseOne,       /* xCommitPhaseOne */
+    hashJoinCommitPhaseTwo,       /* xCommitPhaseTwo */
+    hashJoinRollback,             /* xRollback */
+    hashJoinRevert,               /* xRevert */
+    hashJoinClose,                /* xClose */
+    hashJoinControl,              /* xControl */
+    hashJoinGetMeta,              /* xGetMeta */
+    hashJoinPutMeta,              /* xPutMeta */
+    0                             /* xGetMethod */
+  };
+  VdbeHashJoin *pNew;
+
+  assert( nField>0 );
+  *ppKVStore = 0;
+  pNew = (VdbeHashJoin*)sqlite4_malloc(db->pEnv, sizeof(VdbeHashJoin));
+  if( pNew==0 ) return SQLITE4_NOMEM;
+  memset(pNew, 0, sizeof(VdbeHashJoin));
+  pNew->base.pStoreVfunc = &hashJoinMethods;
+  pNew->base.pEnv = db->pEnv;
+  pNew->base.fTrace = (db->flags & SQLITE4_KvTrace)!=0;
+  pNew->db = db;
+  pNew->nField = nField;
+  pNew->mxMem = db->mxSorterMem>0 ? db->mxSorterMem : 0;
+  sqlite4_snprintf(pNew->base.zKVName, sizeof(pNew->base.zKVName), "hashjoin");
+
+  *ppKVStore = (KVStore*)pNew;
+  return SQLITE4_OK;
+}
@@ -100,7 +100,7 @@ int sqlite4VdbeMemGrow(Mem *pMem, int n, int preserve){
   if( pMem->z==0 ){
     pMem->flags = MEM_Null;
   }else{
-    pMem->flags &= ~(MEM_Ephem|MEM_Static);
+    pMem->flags &= ~(MEM_Ephem|MEM_Static|MEM_KVRef);
   }
   pMem->xDel = 0;
   return (pMem->z ? SQLITE4_OK : SQLITE4_NOMEM);
@@ -497,6 +497,11 @@ void sqlite4VdbeMemShallowCopy(Mem *pTo, const Mem *pFrom, int srcType){
     assert( srcType==MEM_Ephem || srcType==MEM_Static );
     pTo->flags |= srcType;
   }
+  if( pFrom->flags&MEM_KVRef ){
+    /* Only pFrom is tracked by the cursor, so pTo needs its own copy */
+    pTo->flags |= MEM_Ephem;
+    sqlite4VdbeMemMakeWriteable(pTo);
+  }
 }
 
 /*
@@ -509,7 +514,7 @@ int sqlite4VdbeMemCopy(Mem *pTo, const Mem *pFrom){
   assert( (pFrom->flags & MEM_RowSet)==0 );
   VdbeMemRelease(pTo);
   memcpy(pTo, pFrom, MEMCELLSIZE);
-  pTo->flags &= ~MEM_Dyn;
+  pTo->flags &= ~(MEM_Dyn|MEM_KVRef);
 
   if( pTo->flags&(MEM_Str|MEM_Blob) ){
     if( 0==(pFrom->flags&MEM_Static) ){
@@ -537,6 +542,27 @@ void sqlite4VdbeMemMove(Mem *pTo, Mem *pFrom){
   pFrom->flags = MEM_Null;
   pFrom->xDel = 0;
   pFrom->zMalloc = 0;
+  if( pTo->flags&MEM_KVRef ){
+    sqlite4VdbeMemMakeWriteable(pTo);
+  }
+}
+
+/*
+** Change the value of a Mem to be a string (if enc is non-zero) or a BLOB
+** that refers to the n bytes at z without copying them. z must point
+** into the row that a VdbeCursor is positioned on, and the caller must
+** register pMem with that cursor using sqlite4VdbeCursorAddRef(). The
+** existing Mem.zMalloc buffer, if any, is kept for later reuse.
+*/
+void sqlite4VdbeMemSetRef(Mem *pMem, const char *z, int n, u8 enc){
+  assert( (pMem->flags & MEM_RowSet)==0 );
+  VdbeMemRelease(pMem);
+  pMem->z = (char *)z;
+  pMem->n = n;
+  pMem->xDel = 0;
+  pMem->flags = (enc==0 ? MEM_Blob : MEM_Str) | MEM_Ephem | MEM_KVRef;
+  pMem->enc = (enc==0 ? SQLITE4_UTF8 : enc);
+  pMem->type = (enc==0 ? SQLITE4_BLOB : SQLITE4_TEXT);
 }
 
 /*
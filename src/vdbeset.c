@@ -0,0 +1,475 @@
+/*
+** 2016 May 13
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains the hash set used by ephemeral tables that are only
+** used to test whether or not a key has been seen before. For example,
+** the tables used to implement DISTINCT, DISTINCT aggregates and "x IN
+** (...)" membership tests. It is opened by OP_OpenEphemeral when its P3
+** parameter is non-zero and, like the sorters in vdbesort.c and
+** vdbetopn.c, presents itself to the VDBE as a key/value store.
+**
+** Entries are stored in a hash table that grows as required, so that
+** adding an entry and looking up a key are both O(1) operations. Before
+** a hash bucket is searched, the key is tested against a bloom filter
+** with one byte for each bucket. Since most probes of a large IN(...)
+** set or a DISTINCT table are for keys that are not present, this usually
+** avoids touching the buckets and entries at all.
+**
+** Only seeks for an exact key are supported, plus the seek used by
+** OP_Rewind to test whether or not the table is empty. xNext visits the
+** entries in the order they were added. Any other operation returns
+** SQLITE4_MISUSE.
+*/
+#include "sqliteInt.h"
+#include "vdbeInt.h"
+
+/*
+** Size of each chunk of memory that entries are allocated from.
+*/
+#define HASHSET_CHUNK_SIZE (64*1024)
+
+/*
+** Initial number of hash buckets. Must be a power of two.
+*/
+#define HASHSET_MIN_BUCKET 64
+
+typedef struct HashSetChunk HashSetChunk;
+typedef struct HashSetCsr HashSetCsr;
+typedef struct HashSetEntry HashSetEntry;
+typedef struct VdbeHashSet VdbeHashSet;
+
+/*
+** A chunk of memory that entries are allocated from. The usable space
+** follows this header.
+*/
+struct HashSetChunk {
+  HashSetChunk *pNext;            /* Next (older) chunk */
+  int nAlloc;                     /* Bytes of usable space */
+  int nUsed;                      /* Bytes used so far */
+};
+
+/*
+** A single key/value pair. The key immediately follows this header. The
+** value is stored separately so that it may be replaced by a larger one.
+*/
+struct HashSetEntry {
+  HashSetEntry *pHashNext;        /* Next entry in same hash bucket */
+  HashSetEntry *pList;            /* Next entry in the order added */
+  u32 iHash;                      /* Hash of key */
+  KVSize nKey;                    /* Size of key in bytes */
+  KVSize nData;                   /* Size of value in bytes */
+  u8 *aData;                      /* Value */
+};
+
+/*
+** The hash set object. This is a subclass of KVStore.
+**
+** aBloom[] contains nBucket*8 bits. Each entry sets two of them. The
+** cursor points to pCurrent, or to no entry if pCurrent is NULL.
+*/
+struct VdbeHashSet {
+  KVStore base;                   /* Base class, must be first */
+  HashSetChunk *pChunk;           /* List of chunks, most recent first */
+  HashSetEntry *pFirst;           /* First entry added */
+  HashSetEntry *pLast;            /* Last entry added */
+  int nEntry;                     /* Number of entries */
+  HashSetEntry **aBucket;         /* Hash buckets */
+  int nBucket;                    /* Size of aBucket[] (a power of two) */
+  u8 *aBloom;                     /* Bloom filter (nBucket bytes) */
+  HashSetEntry *pCurrent;         /* Entry the cursor points to */
+};
+
+/*
+** A cursor open on a hash set. The iteration state is held by the object
+** itself.
+*/
+struct HashSetCsr {
+  KVCursor base;                  /* Base class, must be first */
+};
+
+#define hashSetEntryKey(p) ((const u8*)&(p)[1])
+
+/*
+** Return a hash of the nKey byte buffer aKey.
+*/
+static u32 hashSetHash(const u8 *aKey, int nKey){
+  u32 h = 0x811C9DC5;
+  int i;
+  for(i=0; i<nKey; i++){
+    h = (h ^ aKey[i]) * 0x01000193;
+  }
+  return h;
+}
+
+/*
+** Return the two bits of the bloom filter that correspond to hash value
+** iHash in *piBit1 and *piBit2. The bucket index is taken from the least
+** significant bits of the hash, so the bloom filter uses the others.
+*/
+static void hashSetBloomBits(
+  VdbeHashSet *p,
+  u32 iHash,
+  int *piBit1,
+  int *piBit2
+){
+  u32 nBit = (u32)p->nBucket * 8;
+  u32 h2 = (iHash >> 16) | (iHash << 16);
+  *piBit1 = (int)((iHash * 0x9E3779B1) >> 7) & (nBit-1);
+  *piBit2 = (int)(h2 * 0x85EBCA6B) & (nBit-1);
+}
+
+static void hashSetBloomAdd(VdbeHashSet *p, u32 iHash){
+  int i1, i2;
+  hashSetBloomBits(p, iHash, &i1, &i2);
+  p->aBloom[i1/8] |= (1 << (i1 & 7));
+  p->aBloom[i2/8] |= (1 << (i2 & 7));
+}
+
+static int hashSetBloomTest(VdbeHashSet *p, u32 iHash){
+  int i1, i2;
+  hashSetBloomBits(p, iHash, &i1, &i2);
+  return (p->aBloom[i1/8] & (1 << (i1 & 7)))
+      && (p->aBloom[i2/8] & (1 << (i2 & 7)));
+}
+
+/*
+** Allocate nByte bytes (a multiple of 8) from the current chunk, allocating
+** a new chunk if required. Return NULL if a malloc fails.
+*/
+static void *hashSetAlloc(VdbeHashSet *p, int nByte){
+  HashSetChunk *pChunk = p->pChunk;
+  void *pRet;
+  assert( nByte==ROUND8(nByte) );
+  if( pChunk==0 || pChunk->nUsed+nByte>pChunk->nAlloc ){
+    int nAlloc = MAX(HASHSET_CHUNK_SIZE, nByte);
+    pChunk = (HashSetChunk*)sqlite4_malloc(
+        p->base.pEnv, ROUND8(sizeof(HashSetChunk)) + nAlloc
+    );
+    if( pChunk==0 ) return 0;
+    pChunk->nAlloc = nAlloc;
+    pChunk->nUsed = 0;
+    pChunk->pNext = p->pChunk;
+    p->pChunk = pChunk;
+  }
+  pRet = &((u8*)pChunk)[ROUND8(sizeof(HashSetChunk)) + pChunk->nUsed];
+  pChunk->nUsed += nByte;
+  return pRet;
+}
+
+/*
+** Resize the hash table so that it has nBucket buckets, and rebuild the
+** bloom filter to match.
+*/
+static int hashSetResize(VdbeHashSet *p, int nBucket){
+  HashSetEntry **aNew;
+  u8 *aBloom;
+  HashSetEntry *pEntry;
+
+  aNew = (HashSetEntry**)sqlite4_malloc(p->base.pEnv,
+      nBucket*(sizeof(HashSetEntry*) + 1)
+  );
+  if( aNew==0 ) return SQLITE4_NOMEM;
+  aBloom = (u8*)&aNew[nBucket];
+  memset(aNew, 0, nBucket*(sizeof(HashSetEntry*) + 1));
+
+  sqlite4_free(p->base.pEnv, p->aBucket);
+  p->aBucket = aNew;
+  p->aBloom = aBloom;
+  p->nBucket = nBucket;
+  for(pEntry=p->pFirst; pEntry; pEntry=pEntry->pList){
+    int iBucket = pEntry->iHash & (nBucket-1);
+    pEntry->pHashNext = aNew[iBucket];
+    aNew[iBucket] = pEntry;
+    hashSetBloomAdd(p, pEntry->iHash);
+  }
+  return SQLITE4_OK;
+}
+
+/*
+** Return the entry with key aKey/nKey, which has hash value iHash, or
+** NULL if there is no such entry.
+*/
+static HashSetEntry *hashSetFind(
+  VdbeHashSet *p,
+  u32 iHash,
+  const u8 *aKey,
+  KVSize nKey
+){
+  HashSetEntry *pEntry = 0;
+  if( p->nEntry>0 && hashSetBloomTest(p, iHash) ){
+    pEntry = p->aBucket[iHash & (p->nBucket-1)];
+    while( pEntry && (pEntry->iHash!=iHash
+        || pEntry->nKey!=nKey
+        || memcmp(hashSetEntryKey(pEntry), aKey, nKey)
+    )){
+      pEntry = pEntry->pHashNext;
+    }
+  }
+  return pEntry;
+}
+
+/*
+** Add a new entry to the hash set, or replace the value of an existing
+** entry with the same key.
+*/
+static int hashSetReplace(
+  KVStore *pKVStore,
+  const KVByteArray *aKey, KVSize nKey,
+  const KVByteArray *aData, KVSize nData
+){
+  VdbeHashSet *p = (VdbeHashSet*)pKVStore;
+  HashSetEntry *pEntry;
+  u32 iHash = hashSetHash(aKey, nKey);
+
+  pEntry = hashSetFind(p, iHash, aKey, nKey);
+  if( pEntry ){
+    if( nData>pEntry->nData ){
+      pEntry->aData = (u8*)hashSetAlloc(p, ROUND8(nData));
+      if( pEntry->aData==0 ){
+        pEntry->nData = 0;
+        return SQLITE4_NOMEM;
+      }
+    }
+    pEntry->nData = nData;
+    if( nData ) memcpy(pEntry->aData, aData, nData);
+    return SQLITE4_OK;
+  }
+
+  if( p->nEntry>=p->nBucket ){
+    int rc = hashSetResize(p, p->nBucket ? p->nBucket*2 : HASHSET_MIN_BUCKET);
+    if( rc!=SQLITE4_OK ) return rc;
+  }
+  pEntry = (HashSetEntry*)hashSetAlloc(p,
+      ROUND8(sizeof(HashSetEntry) + nKey) + ROUND8(nData)
+  );
+  if( pEntry==0 ) return SQLITE4_NOMEM;
+  pEntry->iHash = iHash;
+  pEntry->nKey = nKey;
+  pEntry->nData = nData;
+  pEntry->aData = &((u8*)pEntry)[ROUND8(sizeof(HashSetEntry) + nKey)];
+  memcpy(&pEntry[1], aKey, nKey);
+  if( nData ) memcpy(pEntry->aData, aData, nData);
+
+  pEntry->pHashNext = p->aBucket[iHash & (p->nBucket-1)];
+  p->aBucket[iHash & (p->nBucket-1)] = pEntry;
+  hashSetBloomAdd(p, iHash);
+  pEntry->pList = 0;
+  if( p->pLast ){
+    p->pLast->pList = pEntry;
+  }else{
+    p->pFirst = pEntry;
+  }
+  p->pLast = pEntry;
+  p->nEntry++;
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new cursor on the hash set.
+*/
+static int hashSetOpenCursor(KVStore *pKVStore, KVCursor **ppKVCursor){
+  HashSetCsr *pCsr;
+  pCsr = (HashSetCsr*)sqlite4_malloc(pKVStore->pEnv, sizeof(HashSetCsr));
+  if( pCsr==0 ){
+    *ppKVCursor = 0;
+    return SQLITE4_NOMEM;
+  }
+  memset(pCsr, 0, sizeof(HashSetCsr));
+  pCsr->base.pStore = pKVStore;
+  pCsr->base.pStoreVfunc = pKVStore->pStoreVfunc;
+  pCsr->base.pEnv = pKVStore->pEnv;
+  *ppKVCursor = (KVCursor*)pCsr;
+  return SQLITE4_OK;
+}
+
+/*
+** Seek the cursor.
+**
+** If the probe key contains no fields (only the table number, as used by
+** OP_Rewind) and the direction is positive, the cursor is moved to the
+** first entry added. Otherwise, the cursor is moved to the entry with a
+** key equal to the probe, if any. Since the keys of all entries contain
+** the same number of fields, this is also the only entry that might have
+** the probe as a prefix.
+*/
+static int hashSetSeek(
+  KVCursor *pKVCursor,
+  const KVByteArray *aProbe,
+  KVSize nProbe,
+  int direction
+){
+  VdbeHashSet *p = (VdbeHashSet*)pKVCursor->pStore;
+  int nField = 0;
+
+  sqlite4VdbeShortKey(aProbe, nProbe, 1, &nField);
+  if( nField==0 ){
+    if( direction<=0 ) return SQLITE4_MISUSE;
+    p->pCurrent = p->pFirst;
+    return (p->pCurrent ? SQLITE4_INEXACT : SQLITE4_NOTFOUND);
+  }
+  p->pCurrent = hashSetFind(p, hashSetHash(aProbe, nProbe), aProbe, nProbe);
+  return (p->pCurrent ? SQLITE4_OK : SQLITE4_NOTFOUND);
+}
+
+/*
+** Move the cursor to the entry added after the current entry.
+*/
+static int hashSetNext(KVCursor *pKVCursor){
+  VdbeHashSet *p = (VdbeHashSet*)pKVCursor->pStore;
+  if( p->pCurrent ) p->pCurrent = p->pCurrent->pList;
+  return (p->pCurrent ? SQLITE4_OK : SQLITE4_NOTFOUND);
+}
+
+static int hashSetPrev(KVCursor *pKVCursor){
+  return SQLITE4_MISUSE;
+}
+
+static int hashSetDelete(KVCursor *pKVCursor){
+  return SQLITE4_MISUSE;
+}
+
+static int hashSetKey(
+  KVCursor *pKVCursor,
+  const KVByteArray **paKey,
+  KVSize *pnKey
+){
+  HashSetEntry *pEntry = ((VdbeHashSet*)pKVCursor->pStore)->pCurrent;
+  if( pEntry==0 ) return SQLITE4_NOTFOUND;
+  *paKey = (const KVByteArray*)&pEntry[1];
+  *pnKey = pEntry->nKey;
+  return SQLITE4_OK;
+}
+
+static int hashSetData(
+  KVCursor *pKVCursor,
+  KVSize ofst,
+  KVSize n,
+  const KVByteArray **paData,
+  KVSize *pnData
+){
+  HashSetEntry *pEntry = ((VdbeHashSet*)pKVCursor->pStore)->pCurrent;
+  KVSize nData;
+  if( pEntry==0 ) return SQLITE4_NOTFOUND;
+  nData = pEntry->nData;
+  if( ofst>nData ) ofst = nData;
+  if( n<0 || ofst+n>nData ) n = nData - ofst;
+  *paData = &((const KVByteArray*)pEntry->aData)[ofst];
+  *pnData = n;
+  return SQLITE4_OK;
+}
+
+static int hashSetReset(KVCursor *pKVCursor){
+  return SQLITE4_OK;
+}
+
+static int hashSetCloseCursor(KVCursor *pKVCursor){
+  if( pKVCursor ) sqlite4_free(pKVCursor->pEnv, pKVCursor);
+  return SQLITE4_OK;
+}
+
+/*
+** The hash set does not support transactions. These methods only track
+** the transaction level as required by kv.c.
+*/
+static int hashSetBegin(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int hashSetCommitPhaseOne(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+static int hashSetCommitPhaseTwo(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int hashSetRollback(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int hashSetRevert(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+
+/*
+** Close the hash set and free all resources.
+*/
+static int hashSetClose(KVStore *pKVStore){
+  VdbeHashSet *p = (VdbeHashSet*)pKVStore;
+  if( p ){
+    sqlite4_env *pEnv = p->base.pEnv;
+    HashSetChunk *pChunk;
+    HashSetChunk *pNext;
+    for(pChunk=p->pChunk; pChunk; pChunk=pNext){
+      pNext = pChunk->pNext;
+      sqlite4_free(pEnv, pChunk);
+    }
+    sqlite4_free(pEnv, p->aBucket);
+    sqlite4_free(pEnv, p);
+  }
+  return SQLITE4_OK;
+}
+
+static int hashSetControl(KVStore *pKVStore, int op, void *pArg){
+  return SQLITE4_NOTFOUND;
+}
+
+static int hashSetGetMeta(KVStore *pKVStore, unsigned int *piVal){
+  *piVal = 0;
+  return SQLITE4_OK;
+}
+
+static int hashSetPutMeta(KVStore *pKVStore, unsigned int iVal){
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new hash set for database connection db.
+*/
+int sqlite4VdbeHashSetOpen(sqlite4 *db, KVStore **ppKVStore){
+  static const KVStoreMethods hashSetMethods = {
+    1,                            /* iVersion */
+    sizeof(KVStoreMethods),       /* szSelf */
+    hashSetReplace,               /* xReplace */
+    hashSetOpenCursor,            /* xOpenCursor */
+    hashSetSeek,                  /* xSeek */
+    hashSetNext,                  /* xNext */
+    hashSetPrev,                  /* xPrev */
+    hashSetDelete,                /* xDelete */
+    hashSetKey,                   /* xKey */
+    hashSetData,                  /* xData */
+    hashSetReset,                 /* xReset */
+    hashSetCloseCursor,           /* xCloseCursor */
+    hashSetBegin,                 /* xBegin */
+    hashSetCommitPhaseOne,        /* xCommitPhaseOne */
+    hashSetCommitPhaseTwo,        /* xCommitPhaseTwo */
+    hashSetRollback,              /* xRollback */
+    hashSetRevert,                /* xRevert */
+    hashSetClose,                 /* xClose */
+    hashSetControl,               /* xControl */
+    hashSetGetMeta,               /* xGetMeta */
+    hashSetPutMeta,               /* xPutMeta */
+    0                             /* xGetMethod */
+  };
+  VdbeHashSet *pNew;
+
+  *ppKVStore = 0;
+  pNew = (VdbeHashSet*)sqlite4_malloc(db->pEnv, sizeof(VdbeHashSet));
+  if( pNew==0 ) return SQLITE4_NOMEM;
+  memset(pNew, 0, sizeof(VdbeHashSet));
+  pNew->base.pStoreVfunc = &hashSetMethods;
+  pNew->base.pEnv = db->pEnv;
+  pNew->base.fTrace = (db->flags & SQLITE4_KvTrace)!=0;
+  sqlite4_snprintf(pNew->base.zKVName, sizeof(pNew->base.zKVName), "hashset");
+
+  *ppKVStore = (KVStore*)pNew;
+  return SQLITE4_OK;
+}
@@ -0,0 +1,1291 @@
+/*
+** 2016 March 10
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains the external merge sorter used by OP_SorterOpen
+** cursors.
+**
+** The sorter presents itself to the VDBE as a write-once key/value store,
+** so that the usual cursor opcodes (OP_Column, OP_RowData, OP_GrpCompare,
+** OP_Next and so on) work on it unchanged. It is used as follows:
+**
+**   1. Keys and values are appended using xReplace. Each key/value pair
+**      is copied into a large memory arena and a pointer to it added to
+**      the aEntry[] array. No ordering work is done at this point.
+**
+**   2. If the number of bytes buffered exceeds the memory budget (see
+**      PRAGMA sorter_memory), the buffered entries are sorted and written
+**      to a temporary file as a single sorted "run". The arenas are
+**      then reused for the next run.
+**
+**   3. The first xSeek call marks the end of the input. If no run was
+**      ever written to disk, the buffered entries are sorted in memory
+**      and returned directly. Otherwise, any buffered entries are written
+**      out as a final run and the runs are merged using a loser tree.
+**
+** If "PRAGMA threads" is set to N>0, step 2 hands each full buffer to one
+** of N tasks, each of which runs in a worker thread and writes its runs
+** to its own temp file, while the VDBE continues to fill a new buffer.
+** The memory budget is shared between the buffers. In step 3, once all
+** runs have been written, each task merges the runs in its own file in
+** parallel, leaving at most N runs for the final merge.
+**
+** Entries are sorted using memcmp() on the encoded keys, which is the
+** order used by all other key/value stores. The first eight bytes of
+** each key are cached in aEntry[] as an integer so that most comparisons
+** do not need to dereference the entry itself. Keys are not required to
+** be unique (although they always are in practice, as OP_MakeKey appends
+** a sequence number). Unless worker threads are in use, entries with
+** equal keys are returned in the order in which they were inserted.
+**
+** Adding entries after reading has begun is not supported.
+*/
+#include "sqliteInt.h"
+#include "vdbeInt.h"
+#include "lsm.h"
+
+/*
+** Size of each memory arena used to buffer sorter input, and of the
+** buffers used to read and write temporary files.
+*/
+#define SORTER_ARENA_SIZE  (256*1024)
+#define SORTER_BUFFER_SIZE (64*1024)
+
+/* Forward declarations of objects */
+typedef struct SorterArena SorterArena;
+typedef struct SorterCsr SorterCsr;
+typedef struct SorterEntry SorterEntry;
+typedef struct SorterFile SorterFile;
+typedef struct SorterMerger SorterMerger;
+typedef struct SorterReader SorterReader;
+typedef struct SorterRecord SorterRecord;
+typedef struct SorterRun SorterRun;
+typedef struct SorterTask SorterTask;
+
+/*
+** A block of memory that buffered records are allocated from.
+*/
+struct SorterArena {
+  SorterArena *pNext;             /* Next (older) arena */
+  int nAlloc;                     /* Size of aData[] in bytes */
+  int nUsed;                      /* Bytes of aData[] used so far */
+  u8 *aData;                      /* Pointer to arena memory */
+};
+
+/*
+** A single buffered key/value pair. The key immediately follows this
+** header, and the value immediately follows the key.
+*/
+struct SorterRecord {
+  KVSize nKey;                    /* Size of key in bytes */
+  KVSize nData;                   /* Size of value in bytes */
+};
+
+/*
+** An element of the VdbeSorter.aEntry[] array. iPrefix contains the first
+** eight bytes of the key as a big-endian integer (padded with zeroes).
+*/
+struct SorterEntry {
+  u64 iPrefix;                    /* First 8 bytes of key */
+  SorterRecord *pRec;             /* Record itself */
+};
+
+/*
+** A temporary file that sorted runs are appended to, and its write
+** buffer. A file is only ever accessed by one thread at a time.
+*/
+struct SorterFile {
+  lsm_env *pEnv;                  /* Environment used to access file */
+  lsm_file *pFile;                /* Open file handle, or NULL */
+  char *zName;                    /* Name of temp file */
+  i64 iWriteOff;                  /* Size of temp file */
+  u8 *aWrite;                     /* Write buffer */
+  int nWrite;                     /* Bytes of data in aWrite[] */
+};
+
+/*
+** A sorted run occupies the bytes between offsets iStart and iEnd of
+** temporary file pFile.
+*/
+struct SorterRun {
+  SorterFile *pFile;              /* File containing the run */
+  i64 iStart;                     /* Offset of first byte of run */
+  i64 iEnd;                       /* Offset of first byte past end of run */
+};
+
+/*
+** An object used to read records from a single run. The current record
+** is aKey/nKey and aData/nData. These point either into aBuf[] or into
+** aAlloc[].
+*/
+struct SorterReader {
+  SorterFile *pFile;              /* File to read from */
+  i64 iReadOff;                   /* Offset of next byte to load into aBuf */
+  i64 iEnd;                       /* End of the run */
+  u8 *aBuf;                       /* Read buffer */
+  int nBufAlloc;                  /* Allocated size of aBuf[] */
+  int nBuf;                       /* Number of valid bytes in aBuf[] */
+  int iBuf;                       /* Current offset in aBuf[] */
+  u8 *aAlloc;                     /* Space for records that span buffers */
+  int nAlloc;                     /* Size of aAlloc[] in bytes */
+  int bEof;                       /* True once the run is exhausted */
+  const u8 *aKey;                 /* Key of current record */
+  KVSize nKey;                    /* Size of aKey[] in bytes */
+  const u8 *aData;                /* Value of current record */
+  KVSize nData;                   /* Size of aData[] in bytes */
+};
+
+/*
+** An object used to merge the nRun runs in aRun[] (which is owned by the
+** caller). The current record is that of reader aReader[aTree[0]].
+**
+** aTree[] is a loser tree with nTree leaves. Leaf i corresponds to
+** aReader[i] (leaves with i>=nRun are permanently at EOF). For each
+** internal node 1..nTree-1, aTree[] holds the index of the reader that
+** lost the comparison at that node. aTree[0] holds the overall winner.
+*/
+struct SorterMerger {
+  SorterRun *aRun;                /* Runs to merge */
+  int nRun;                       /* Number of entries in aRun[] */
+  SorterReader *aReader;          /* One reader for each run */
+  int nTree;                      /* Number of leaves in loser tree */
+  int *aTree;                     /* Loser tree */
+};
+
+/*
+** A unit of work that may be run by a worker thread: either sorting a
+** full buffer of entries and writing it to a run in the task's temp
+** file, or merging all runs in the task's temp file into a single run.
+**
+** While the task is running (pThread is not NULL) it owns everything
+** except the pSorter pointer, which it must not use. The results are
+** collected by sorterTaskJoin().
+*/
+struct SorterTask {
+  sqlite4_env *pEnv;              /* Environment to allocate from */
+  SQLiteThread *pThread;          /* Thread running the task, or NULL */
+  SorterFile file;                /* Temp file written by this task */
+  SorterArena *pArena;            /* Arenas holding the records in aEntry[] */
+  SorterEntry *aEntry;            /* Entries to sort */
+  int nEntry;                     /* Number of valid entries in aEntry[] */
+  int nEntryAlloc;                /* Allocated size of aEntry[] */
+  SorterRun *aMerge;              /* Runs to merge */
+  int nMerge;                     /* Number of valid entries in aMerge[] */
+  int iRun;                       /* Slot in VdbeSorter.aRun[] for result */
+  SorterRun run;                  /* OUT: Run written by the task */
+  int rc;                         /* OUT: Error code */
+};
+
+/*
+** The sorter object. This is a subclass of KVStore.
+**
+** Once reading has begun (bSorted is set), the current entry is either
+** aEntry[iEntry] (if nRun==0) or the current record of the merger.
+**
+** Runs are written by the nTask tasks in aTask[], in round-robin order.
+** If bThreads is true, each task runs in its own worker thread while
+** the VDBE continues to add entries. Otherwise, tasks are run
+** synchronously.
+*/
+struct VdbeSorter {
+  KVStore base;                   /* Base class, must be first */
+  i64 mxMem;                      /* Spill to disk after this many bytes */
+  i64 nMem;                       /* Bytes of records currently buffered */
+  SorterArena *pArena;            /* List of arenas, most recent first */
+  SorterArena *pFree;             /* Arenas available for reuse */
+  SorterEntry *aEntry;            /* Buffered entries */
+  int nEntry;                     /* Number of valid entries in aEntry[] */
+  int nEntryAlloc;                /* Allocated size of aEntry[] */
+  int bSorted;                    /* True once input is finished */
+  int iEntry;                     /* Current entry (in-memory sort only) */
+
+  SorterRun *aRun;                /* Runs written to temp files */
+  int nRun;                       /* Number of valid entries in aRun[] */
+  int nRunAlloc;                  /* Allocated size of aRun[] */
+  SorterMerger merger;            /* Used to merge aRun[] */
+
+  int bThreads;                   /* True to run tasks in worker threads */
+  int nTask;                      /* Number of entries in aTask[] */
+  int iNextTask;                  /* Task to use for the next run */
+  SorterTask *aTask;              /* Array of tasks */
+};
+
+/*
+** A cursor open on a sorter. The iteration state is held by the sorter
+** object itself.
+*/
+struct SorterCsr {
+  KVCursor base;                  /* Base class, must be first */
+};
+
+/*
+** Map an error code returned by an lsm_env method to an SQLite4 code.
+*/
+static int sorterFileError(int rc){
+  return rc==LSM_OK ? SQLITE4_OK : SQLITE4_IOERR;
+}
+
+/*
+** Return the first eight bytes of key aKey as a big-endian integer.
+*/
+static u64 sorterKeyPrefix(const u8 *aKey, KVSize nKey){
+  u64 iPrefix = 0;
+  int i;
+  for(i=0; i<8; i++){
+    iPrefix = (iPrefix<<8) | (i<nKey ? aKey[i] : 0);
+  }
+  return iPrefix;
+}
+
+/*
+** Compare two keys using memcmp() order.
+*/
+static int sorterKeyCompare(
+  const u8 *aKey1, KVSize nKey1,
+  const u8 *aKey2, KVSize nKey2
+){
+  int c = memcmp(aKey1, aKey2, nKey1<nKey2 ? nKey1 : nKey2);
+  if( c==0 ) c = (nKey1>nKey2) - (nKey1<nKey2);
+  return c;
+}
+
+/*
+** Compare two buffered entries.
+*/
+static int sorterEntryCompare(const SorterEntry *p1, const SorterEntry *p2){
+  if( p1->iPrefix!=p2->iPrefix ){
+    return p1->iPrefix<p2->iPrefix ? -1 : +1;
+  }
+  return sorterKeyCompare(
+      (u8*)&p1->pRec[1], p1->pRec->nKey, (u8*)&p2->pRec[1], p2->pRec->nKey
+  );
+}
+
+/*
+** Sort the nEntry elements of aEntry[] using a stable merge sort. Runs of
+** up to 8 entries are first sorted using insertion sort, then merged
+** bottom-up using the aTmp[] buffer, which must be as large as aEntry[].
+*/
+static void sorterSortEntries(
+  SorterEntry *aEntry,            /* Array to sort */
+  SorterEntry *aTmp,              /* Temporary buffer */
+  int nEntry                      /* Number of entries in aEntry[] */
+){
+  SorterEntry *aIn = aEntry;
+  SorterEntry *aOut = aTmp;
+  int nWidth;
+  int i, j;
+
+  for(i=0; i<nEntry; i+=8){
+    int iEnd = (i+8<nEntry) ? i+8 : nEntry;
+    for(j=i+1; j<iEnd; j++){
+      SorterEntry x = aIn[j];
+      int k;
+      for(k=j; k>i && sorterEntryCompare(&aIn[k-1], &x)>0; k--){
+        aIn[k] = aIn[k-1];
+      }
+      aIn[k] = x;
+    }
+  }
+
+  for(nWidth=8; nWidth<nEntry; nWidth=nWidth*2){
+    SorterEntry *aSwap;
+    for(i=0; i<nEntry; i+=nWidth*2){
+      int iMid = (i+nWidth<nEntry) ? i+nWidth : nEntry;
+      int iEnd = (i+nWidth*2<nEntry) ? i+nWidth*2 : nEntry;
+      int i1 = i;
+      int i2 = iMid;
+      int iOut = i;
+      while( i1<iMid && i2<iEnd ){
+        if( sorterEntryCompare(&aIn[i2], &aIn[i1])<0 ){
+          aOut[iOut++] = aIn[i2++];
+        }else{
+          aOut[iOut++] = aIn[i1++];
+        }
+      }
+      while( i1<iMid ) aOut[iOut++] = aIn[i1++];
+      while( i2<iEnd ) aOut[iOut++] = aIn[i2++];
+    }
+    aSwap = aIn;
+    aIn = aOut;
+    aOut = aSwap;
+  }
+
+  if( aIn!=aEntry ){
+    memcpy(aEntry, aIn, nEntry*sizeof(SorterEntry));
+  }
+}
+
+/*
+** Sort the nEntry elements of array aEntry[]. Return SQLITE4_OK if
+** successful, or SQLITE4_NOMEM if the temporary buffer cannot be
+** allocated.
+*/
+static int sorterSortBuffered(
+  sqlite4_env *pEnv,
+  SorterEntry *aEntry,
+  int nEntry
+){
+  SorterEntry *aTmp;
+  if( nEntry<=8 ){
+    sorterSortEntries(aEntry, 0, nEntry);
+    return SQLITE4_OK;
+  }
+  aTmp = (SorterEntry*)sqlite4_malloc(pEnv, nEntry*sizeof(SorterEntry));
+  if( aTmp==0 ) return SQLITE4_NOMEM;
+  sorterSortEntries(aEntry, aTmp, nEntry);
+  sqlite4_free(pEnv, aTmp);
+  return SQLITE4_OK;
+}
+
+/*
+** Add the arenas in list pList to the sorter's free list. Oversized
+** arenas, allocated for a single large record, are freed instead.
+*/
+static void sorterRecycleArenas(VdbeSorter *p, SorterArena *pList){
+  while( pList ){
+    SorterArena *pArena = pList;
+    pList = pArena->pNext;
+    if( pArena->nAlloc==SORTER_ARENA_SIZE ){
+      pArena->nUsed = 0;
+      pArena->pNext = p->pFree;
+      p->pFree = pArena;
+    }else{
+      sqlite4_free(p->base.pEnv, pArena);
+    }
+  }
+}
+
+/*
+** Free a list of arenas.
+*/
+static void sorterFreeArenas(sqlite4_env *pEnv, SorterArena *pArena){
+  while( pArena ){
+    SorterArena *pNext = pArena->pNext;
+    sqlite4_free(pEnv, pArena);
+    pArena = pNext;
+  }
+}
+
+/*
+** Allocate nByte bytes of space for a new record from the arenas.
+*/
+static SorterRecord *sorterAllocRecord(VdbeSorter *p, int nByte){
+  SorterArena *pArena = p->pArena;
+  SorterRecord *pRec;
+
+  nByte = ROUND8(nByte);
+  if( pArena==0 || pArena->nUsed+nByte>pArena->nAlloc ){
+    if( nByte<=SORTER_ARENA_SIZE && p->pFree ){
+      pArena = p->pFree;
+      p->pFree = pArena->pNext;
+    }else{
+      int nAlloc = nByte>SORTER_ARENA_SIZE ? nByte : SORTER_ARENA_SIZE;
+      int nHdr = ROUND8(sizeof(SorterArena));
+      pArena = (SorterArena*)sqlite4_malloc(p->base.pEnv, nHdr+nAlloc);
+      if( pArena==0 ) return 0;
+      pArena->nAlloc = nAlloc;
+      pArena->aData = &((u8*)pArena)[nHdr];
+    }
+    pArena->nUsed = 0;
+    pArena->pNext = p->pArena;
+    p->pArena = pArena;
+  }
+
+  pRec = (SorterRecord*)&pArena->aData[pArena->nUsed];
+  pArena->nUsed += nByte;
+  p->nMem += nByte;
+  return pRec;
+}
+
+/*
+** Open temporary file pFile, if it is not already open.
+*/
+static int sorterOpenTempFile(sqlite4_env *pEnv, SorterFile *pFile){
+  if( pFile->pFile==0 ){
+    const char *zDir = getenv("TMPDIR");
+    u64 iRand;
+    int rc;
+
+    if( zDir==0 || zDir[0]=='\0' ) zDir = "/tmp";
+    sqlite4_randomness(pEnv, sizeof(iRand), &iRand);
+    sqlite4_free(pEnv, pFile->zName);
+    pFile->zName = sqlite4_mprintf(pEnv, "%s/sqlite4_sort_%llx", zDir, iRand);
+    if( pFile->aWrite==0 ){
+      pFile->aWrite = (u8*)sqlite4_malloc(pEnv, SORTER_BUFFER_SIZE);
+    }
+    if( pFile->zName==0 || pFile->aWrite==0 ) return SQLITE4_NOMEM;
+
+    pFile->pEnv = lsm_default_env();
+    rc = pFile->pEnv->xOpen(pFile->pEnv, pFile->zName, 0, &pFile->pFile);
+    if( rc!=LSM_OK ){
+      pFile->pFile = 0;
+      return sorterFileError(rc);
+    }
+
+    /* Unlink the file straight away. It is deleted automatically when it
+    ** is closed, even if the process crashes first. */
+    pFile->pEnv->xUnlink(pFile->pEnv, pFile->zName);
+  }
+  return SQLITE4_OK;
+}
+
+/*
+** Close temporary file pFile, if it is open, and free its buffers.
+*/
+static void sorterCloseTempFile(sqlite4_env *pEnv, SorterFile *pFile){
+  if( pFile->pFile ) pFile->pEnv->xClose(pFile->pFile);
+  sqlite4_free(pEnv, pFile->zName);
+  sqlite4_free(pEnv, pFile->aWrite);
+  memset(pFile, 0, sizeof(SorterFile));
+}
+
+/*
+** Flush the contents of the write buffer to the temp file.
+*/
+static int sorterFlushWrite(SorterFile *pFile){
+  int rc = LSM_OK;
+  if( pFile->nWrite>0 ){
+    rc = pFile->pEnv->xWrite(
+        pFile->pFile, pFile->iWriteOff, pFile->aWrite, pFile->nWrite
+    );
+    pFile->iWriteOff += pFile->nWrite;
+    pFile->nWrite = 0;
+  }
+  return sorterFileError(rc);
+}
+
+/*
+** Append nByte bytes from buffer a[] to the temp file.
+*/
+static int sorterWrite(SorterFile *pFile, const u8 *a, int nByte){
+  int rc = SQLITE4_OK;
+  while( rc==SQLITE4_OK && nByte>0 ){
+    int nCopy = SORTER_BUFFER_SIZE - pFile->nWrite;
+    if( nCopy>nByte ) nCopy = nByte;
+    memcpy(&pFile->aWrite[pFile->nWrite], a, nCopy);
+    pFile->nWrite += nCopy;
+    a += nCopy;
+    nByte -= nCopy;
+    if( pFile->nWrite==SORTER_BUFFER_SIZE ) rc = sorterFlushWrite(pFile);
+  }
+  return rc;
+}
+
+/*
+** Append a record to the temp file. Each record is written as a 4-byte
+** big-endian key size, a 4-byte big-endian value size, the key and then
+** the value.
+*/
+static int sorterWriteRecord(
+  SorterFile *pFile,
+  const u8 *aKey, KVSize nKey,
+  const u8 *aData, KVSize nData
+){
+  u8 aHdr[8];
+  int rc;
+  sqlite4Put4byte(&aHdr[0], nKey);
+  sqlite4Put4byte(&aHdr[4], nData);
+  rc = sorterWrite(pFile, aHdr, 8);
+  if( rc==SQLITE4_OK ) rc = sorterWrite(pFile, aKey, nKey);
+  if( rc==SQLITE4_OK ) rc = sorterWrite(pFile, aData, nData);
+  return rc;
+}
+
+/*
+** Read nByte bytes from the run that reader pReader is reading. Set *pa
+** to point to a buffer containing the data. The buffer remains valid
+** until the next call to this function on the same reader.
+*/
+static int sorterReadBytes(
+  sqlite4_env *pEnv,              /* Environment to allocate from */
+  SorterReader *pReader,          /* Reader to read from */
+  int nByte,                      /* Number of bytes to read */
+  const u8 **pa                   /* OUT: Pointer to data */
+){
+  int nCopy = 0;
+
+  if( pReader->iBuf+nByte<=pReader->nBuf ){
+    *pa = &pReader->aBuf[pReader->iBuf];
+    pReader->iBuf += nByte;
+    return SQLITE4_OK;
+  }
+
+  /* The requested data spans two or more buffers. Assemble it in
+  ** aAlloc[].  */
+  if( pReader->nAlloc<nByte ){
+    int nNew = nByte>256 ? nByte : 256;
+    u8 *aNew = (u8*)sqlite4_realloc(pEnv, pReader->aAlloc, nNew);
+    if( aNew==0 ) return SQLITE4_NOMEM;
+    pReader->aAlloc = aNew;
+    pReader->nAlloc = nNew;
+  }
+  while( nCopy<nByte ){
+    int nAvail = pReader->nBuf - pReader->iBuf;
+    if( nAvail==0 ){
+      SorterFile *pFile = pReader->pFile;
+      int rc;
+      i64 nLeft = pReader->iEnd - pReader->iReadOff;
+      if( nLeft<=0 ) return SQLITE4_CORRUPT_BKPT;
+      pReader->nBuf = pReader->nBufAlloc;
+      if( nLeft<pReader->nBuf ) pReader->nBuf = (int)nLeft;
+      pReader->iBuf = 0;
+      rc = pFile->pEnv->xRead(
+          pFile->pFile, pReader->iReadOff, pReader->aBuf, pReader->nBuf
+      );
+      if( rc!=LSM_OK ) return sorterFileError(rc);
+      pReader->iReadOff += pReader->nBuf;
+      nAvail = pReader->nBuf;
+    }
+    if( nAvail>nByte-nCopy ) nAvail = nByte-nCopy;
+    memcpy(&pReader->aAlloc[nCopy], &pReader->aBuf[pReader->iBuf], nAvail);
+    pReader->iBuf += nAvail;
+    nCopy += nAvail;
+  }
+  *pa = pReader->aAlloc;
+  return SQLITE4_OK;
+}
+
+/*
+** Advance reader pReader to the next record in its run.
+*/
+static int sorterReaderNext(sqlite4_env *pEnv, SorterReader *pReader){
+  const u8 *aHdr;
+  const u8 *aRec;
+  KVSize nKey;
+  KVSize nData;
+  int rc;
+
+  if( pReader->iBuf>=pReader->nBuf && pReader->iReadOff>=pReader->iEnd ){
+    pReader->bEof = 1;
+    return SQLITE4_OK;
+  }
+  rc = sorterReadBytes(pEnv, pReader, 8, &aHdr);
+  if( rc==SQLITE4_OK ){
+    nKey = sqlite4Get4byte(&aHdr[0]);
+    nData = sqlite4Get4byte(&aHdr[4]);
+    rc = sorterReadBytes(pEnv, pReader, nKey+nData, &aRec);
+  }
+  if( rc==SQLITE4_OK ){
+    pReader->aKey = aRec;
+    pReader->nKey = nKey;
+    pReader->aData = &aRec[nKey];
+    pReader->nData = nData;
+  }
+  return rc;
+}
+
+/*
+** Return true if the current record of reader i1 should be returned
+** before that of reader i2. Readers at EOF sort after all others, and
+** ties are broken in favour of the earlier run.
+*/
+static int sorterReaderLess(SorterMerger *pMerger, int i1, int i2){
+  SorterReader *p1 = &pMerger->aReader[i1];
+  SorterReader *p2 = &pMerger->aReader[i2];
+  int c;
+  if( i1>=pMerger->nRun || p1->bEof ) return 0;
+  if( i2>=pMerger->nRun || p2->bEof ) return 1;
+  c = sorterKeyCompare(p1->aKey, p1->nKey, p2->aKey, p2->nKey);
+  return c<0 || (c==0 && i1<i2);
+}
+
+/*
+** Populate the subtree of the loser tree rooted at node iNode. Return
+** the index of the reader that wins the subtree.
+*/
+static int sorterTreeBuild(SorterMerger *pMerger, int iNode){
+  int i1, i2;
+  if( iNode>=pMerger->nTree ) return iNode - pMerger->nTree;
+  i1 = sorterTreeBuild(pMerger, iNode*2);
+  i2 = sorterTreeBuild(pMerger, iNode*2+1);
+  if( sorterReaderLess(pMerger, i2, i1) ){
+    pMerger->aTree[iNode] = i1;
+    return i2;
+  }
+  pMerger->aTree[iNode] = i2;
+  return i1;
+}
+
+/*
+** Advance the reader that won the last comparison, then replay the
+** matches on the path from its leaf to the root of the loser tree.
+*/
+static int sorterTreeNext(sqlite4_env *pEnv, SorterMerger *pMerger){
+  int iWinner = pMerger->aTree[0];
+  int iNode;
+  int rc;
+
+  rc = sorterReaderNext(pEnv, &pMerger->aReader[iWinner]);
+  if( rc!=SQLITE4_OK ) return rc;
+  for(iNode=(iWinner+pMerger->nTree)/2; iNode>0; iNode=iNode/2){
+    if( sorterReaderLess(pMerger, pMerger->aTree[iNode], iWinner) ){
+      int iSwap = pMerger->aTree[iNode];
+      pMerger->aTree[iNode] = iWinner;
+      iWinner = iSwap;
+    }
+  }
+  pMerger->aTree[0] = iWinner;
+  return SQLITE4_OK;
+}
+
+/*
+** Return a pointer to the reader holding the current record of the
+** merger, or NULL if the merger is at EOF.
+*/
+static SorterReader *sorterMergerCurrent(SorterMerger *pMerger){
+  int iWinner;
+  if( pMerger->aTree==0 ) return 0;
+  iWinner = pMerger->aTree[0];
+  if( iWinner>=pMerger->nRun || pMerger->aReader[iWinner].bEof ) return 0;
+  return &pMerger->aReader[iWinner];
+}
+
+/*
+** Free all readers and the loser tree of a merger.
+*/
+static void sorterMergerFree(sqlite4_env *pEnv, SorterMerger *pMerger){
+  if( pMerger->aReader ){
+    int i;
+    for(i=0; i<pMerger->nRun; i++){
+      sqlite4_free(pEnv, pMerger->aReader[i].aBuf);
+      sqlite4_free(pEnv, pMerger->aReader[i].aAlloc);
+    }
+    sqlite4_free(pEnv, pMerger->aReader);
+  }
+  sqlite4_free(pEnv, pMerger->aTree);
+  memset(pMerger, 0, sizeof(SorterMerger));
+}
+
+/*
+** Initialize a merger to merge the nRun runs in aRun[]. Array aRun[]
+** must remain valid until the merger is freed.
+*/
+static int sorterMergerInit(
+  sqlite4_env *pEnv,
+  SorterMerger *pMerger,
+  SorterRun *aRun,
+  int nRun
+){
+  int nByte = nRun*sizeof(SorterReader);
+  int i;
+
+  memset(pMerger, 0, sizeof(SorterMerger));
+  pMerger->aRun = aRun;
+  pMerger->aReader = (SorterReader*)sqlite4_malloc(pEnv, nByte);
+  if( pMerger->aReader==0 ) return SQLITE4_NOMEM;
+  memset(pMerger->aReader, 0, nByte);
+  pMerger->nRun = nRun;
+  for(pMerger->nTree=1; pMerger->nTree<nRun; pMerger->nTree*=2);
+  pMerger->aTree = (int*)sqlite4_malloc(pEnv, pMerger->nTree*sizeof(int));
+  if( pMerger->aTree==0 ) return SQLITE4_NOMEM;
+  for(i=0; i<nRun; i++){
+    SorterReader *pReader = &pMerger->aReader[i];
+    i64 nSize = aRun[i].iEnd - aRun[i].iStart;
+    pReader->pFile = aRun[i].pFile;
+    pReader->nBufAlloc = SORTER_BUFFER_SIZE;
+    if( nSize<SORTER_BUFFER_SIZE ) pReader->nBufAlloc = (int)nSize;
+    pReader->aBuf = sqlite4_malloc(pEnv, pReader->nBufAlloc);
+    if( pReader->aBuf==0 ) return SQLITE4_NOMEM;
+  }
+  return SQLITE4_OK;
+}
+
+/*
+** Position a merger on its first record.
+*/
+static int sorterMergerRewind(sqlite4_env *pEnv, SorterMerger *pMerger){
+  int rc = SQLITE4_OK;
+  int i;
+  for(i=0; rc==SQLITE4_OK && i<pMerger->nRun; i++){
+    SorterReader *pReader = &pMerger->aReader[i];
+    pReader->iReadOff = pMerger->aRun[i].iStart;
+    pReader->iEnd = pMerger->aRun[i].iEnd;
+    pReader->nBuf = 0;
+    pReader->iBuf = 0;
+    pReader->bEof = 0;
+    rc = sorterReaderNext(pEnv, pReader);
+  }
+  if( rc==SQLITE4_OK ) pMerger->aTree[0] = sorterTreeBuild(pMerger, 1);
+  return rc;
+}
+
+/*
+** Task procedure: sort the entries handed to the task and write them to
+** the task's temp file as a single run.
+*/
+static void *sorterTaskSpill(void *pCtx){
+  SorterTask *pTask = (SorterTask*)pCtx;
+  SorterFile *pFile = &pTask->file;
+  int rc;
+  int i;
+
+  rc = sorterSortBuffered(pTask->pEnv, pTask->aEntry, pTask->nEntry);
+  pTask->run.pFile = pFile;
+  pTask->run.iStart = pFile->iWriteOff;
+  for(i=0; rc==SQLITE4_OK && i<pTask->nEntry; i++){
+    SorterRecord *pRec = pTask->aEntry[i].pRec;
+    const u8 *aKey = (const u8*)&pRec[1];
+    rc = sorterWriteRecord(pFile, aKey, pRec->nKey,
+                           &aKey[pRec->nKey], pRec->nData);
+  }
+  if( rc==SQLITE4_OK ) rc = sorterFlushWrite(pFile);
+  pTask->run.iEnd = pFile->iWriteOff;
+  pTask->rc = rc;
+  return 0;
+}
+
+/*
+** Task procedure: merge the runs in pTask->aMerge[], all of which are
+** stored in the task's own temp file, into a single new run appended to
+** the same file.
+*/
+static void *sorterTaskMerge(void *pCtx){
+  SorterTask *pTask = (SorterTask*)pCtx;
+  SorterFile *pFile = &pTask->file;
+  SorterMerger merger;
+  SorterReader *pReader;
+  int rc;
+
+  rc = sorterMergerInit(pTask->pEnv, &merger, pTask->aMerge, pTask->nMerge);
+  if( rc==SQLITE4_OK ) rc = sorterMergerRewind(pTask->pEnv, &merger);
+  pTask->run.pFile = pFile;
+  pTask->run.iStart = pFile->iWriteOff;
+  while( rc==SQLITE4_OK && (pReader = sorterMergerCurrent(&merger))!=0 ){
+    rc = sorterWriteRecord(pFile, pReader->aKey, pReader->nKey,
+                           pReader->aData, pReader->nData);
+    if( rc==SQLITE4_OK ) rc = sorterTreeNext(pTask->pEnv, &merger);
+  }
+  if( rc==SQLITE4_OK ) rc = sorterFlushWrite(pFile);
+  pTask->run.iEnd = pFile->iWriteOff;
+  sorterMergerFree(pTask->pEnv, &merger);
+  pTask->rc = rc;
+  return 0;
+}
+
+/*
+** Wait for task pTask to finish, if it is running, and collect its
+** results. The run written by the task, if any, is stored in slot
+** pTask->iRun of the sorter's aRun[] array, and the arenas that held its
+** input are returned to the sorter's free list. Return the task's error
+** code.
+*/
+static int sorterTaskJoin(VdbeSorter *p, SorterTask *pTask){
+  int rc;
+  if( pTask->pThread ){
+    rc = sqlite4ThreadJoin(p->base.pEnv, pTask->pThread, 0);
+    pTask->pThread = 0;
+    if( rc!=SQLITE4_OK ) return rc;
+  }
+  if( pTask->iRun>=0 ){
+    p->aRun[pTask->iRun] = pTask->run;
+    pTask->iRun = -1;
+  }
+  sorterRecycleArenas(p, pTask->pArena);
+  pTask->pArena = 0;
+  pTask->nEntry = 0;
+  rc = pTask->rc;
+  pTask->rc = SQLITE4_OK;
+  return rc;
+}
+
+/*
+** Start task pTask running xTask. If worker threads are not in use, the
+** task is run to completion and its results collected before returning.
+*/
+static int sorterTaskStart(
+  VdbeSorter *p,
+  SorterTask *pTask,
+  void *(*xTask)(void*)
+){
+  int rc;
+  assert( pTask->pThread==0 );
+  if( p->bThreads ){
+    rc = sqlite4ThreadCreate(p->base.pEnv, &pTask->pThread, xTask, pTask);
+  }else{
+    xTask((void*)pTask);
+    rc = sorterTaskJoin(p, pTask);
+  }
+  return rc;
+}
+
+/*
+** Wait for all running tasks to finish. Return the first error code
+** encountered, if any.
+*/
+static int sorterJoinAll(VdbeSorter *p){
+  int rc = SQLITE4_OK;
+  int i;
+  for(i=0; i<p->nTask; i++){
+    int rc2 = sorterTaskJoin(p, &p->aTask[i]);
+    if( rc==SQLITE4_OK ) rc = rc2;
+  }
+  return rc;
+}
+
+/*
+** Hand the buffered entries to the next task, to be sorted and written
+** to a temp file as a new run. If that task is still busy with an
+** earlier run, wait for it to finish first.
+*/
+static int sorterSpill(VdbeSorter *p){
+  sqlite4_env *pEnv = p->base.pEnv;
+  SorterTask *pTask;
+  SorterEntry *aSwap;
+  int nSwap;
+  int rc;
+
+  if( p->nRun>=p->nRunAlloc ){
+    int nNew = p->nRunAlloc ? p->nRunAlloc*2 : 16;
+    SorterRun *aNew = (SorterRun*)sqlite4_realloc(pEnv, p->aRun,
+                                                  nNew*sizeof(SorterRun));
+    if( aNew==0 ) return SQLITE4_NOMEM;
+    p->aRun = aNew;
+    p->nRunAlloc = nNew;
+  }
+
+  pTask = &p->aTask[p->iNextTask];
+  p->iNextTask = (p->iNextTask+1) % p->nTask;
+  rc = sorterTaskJoin(p, pTask);
+  if( rc==SQLITE4_OK ) rc = sorterOpenTempFile(pEnv, &pTask->file);
+  if( rc!=SQLITE4_OK ) return rc;
+
+  /* Swap entry arrays with the task, so that the array used by its
+  ** previous run is reused for the next buffer. */
+  aSwap = pTask->aEntry;
+  nSwap = pTask->nEntryAlloc;
+  pTask->aEntry = p->aEntry;
+  pTask->nEntry = p->nEntry;
+  pTask->nEntryAlloc = p->nEntryAlloc;
+  p->aEntry = aSwap;
+  p->nEntryAlloc = nSwap;
+  p->nEntry = 0;
+
+  pTask->pArena = p->pArena;
+  p->pArena = 0;
+  p->nMem = 0;
+  pTask->iRun = p->nRun++;
+  return sorterTaskStart(p, pTask, sorterTaskSpill);
+}
+
+/*
+** This is called once all runs have been written when worker threads
+** are in use. If any task wrote more than one run to its temp file,
+** merge them into a single run, with all tasks working in parallel.
+** This leaves at most nTask runs for the final merge performed by the
+** consumer.
+*/
+static int sorterMergeParallel(VdbeSorter *p){
+  sqlite4_env *pEnv = p->base.pEnv;
+  int rc = SQLITE4_OK;
+  int nRun = 0;
+  int i, j;
+
+  if( p->nRun<=p->nTask ) return SQLITE4_OK;
+
+  /* Give each task a copy of the list of runs in its temp file. */
+  for(i=0; i<p->nTask; i++){
+    SorterTask *pTask = &p->aTask[i];
+    pTask->nMerge = 0;
+    for(j=0; j<p->nRun; j++){
+      if( p->aRun[j].pFile!=&pTask->file ) continue;
+      if( (pTask->nMerge % 16)==0 ){
+        int nNew = pTask->nMerge + 16;
+        SorterRun *aNew = (SorterRun*)sqlite4_realloc(
+            pEnv, pTask->aMerge, nNew*sizeof(SorterRun)
+        );
+        if( aNew==0 ) return SQLITE4_NOMEM;
+        pTask->aMerge = aNew;
+      }
+      pTask->aMerge[pTask->nMerge++] = p->aRun[j];
+    }
+  }
+
+  /* Start a merge for each task with more than one run, and rebuild the
+  ** aRun[] array with one run per task. */
+  for(i=0; rc==SQLITE4_OK && i<p->nTask; i++){
+    SorterTask *pTask = &p->aTask[i];
+    if( pTask->nMerge==1 ){
+      p->aRun[nRun++] = pTask->aMerge[0];
+    }else if( pTask->nMerge>1 ){
+      pTask->iRun = nRun++;
+      rc = sorterTaskStart(p, pTask, sorterTaskMerge);
+    }
+  }
+  p->nRun = nRun;
+  if( rc==SQLITE4_OK ){
+    rc = sorterJoinAll(p);
+  }else{
+    sorterJoinAll(p);
+  }
+  return rc;
+}
+
+/*
+** Mark the end of the input, if this has not already been done. Then
+** position the sorter on its first entry.
+*/
+static int sorterRewind(VdbeSorter *p){
+  sqlite4_env *pEnv = p->base.pEnv;
+  int rc = SQLITE4_OK;
+
+  if( p->bSorted==0 ){
+    p->bSorted = 1;
+    if( p->nRun==0 ){
+      rc = sorterSortBuffered(pEnv, p->aEntry, p->nEntry);
+    }else{
+      int rc2;
+      if( p->nEntry>0 ) rc = sorterSpill(p);
+      rc2 = sorterJoinAll(p);
+      if( rc==SQLITE4_OK ) rc = rc2;
+      if( rc==SQLITE4_OK && p->bThreads ) rc = sorterMergeParallel(p);
+      if( rc==SQLITE4_OK ){
+        rc = sorterMergerInit(pEnv, &p->merger, p->aRun, p->nRun);
+      }
+    }
+    if( rc!=SQLITE4_OK ) return rc;
+  }
+
+  if( p->nRun==0 ){
+    p->iEntry = 0;
+  }else{
+    rc = sorterMergerRewind(pEnv, &p->merger);
+  }
+  return rc;
+}
+
+/*
+** Set *paKey, *pnKey, *paData and *pnData to the current entry. Return
+** SQLITE4_OK if successful, or SQLITE4_NOTFOUND if the sorter is at EOF.
+*/
+static int sorterCurrent(
+  VdbeSorter *p,
+  const u8 **paKey, KVSize *pnKey,
+  const u8 **paData, KVSize *pnData
+){
+  if( p->bSorted==0 ) return SQLITE4_MISUSE;
+  if( p->nRun==0 ){
+    SorterRecord *pRec;
+    if( p->iEntry>=p->nEntry ) return SQLITE4_NOTFOUND;
+    pRec = p->aEntry[p->iEntry].pRec;
+    *paKey = (u8*)&pRec[1];
+    *pnKey = pRec->nKey;
+    *paData = &(*paKey)[pRec->nKey];
+    *pnData = pRec->nData;
+  }else{
+    SorterReader *pReader = sorterMergerCurrent(&p->merger);
+    if( pReader==0 ) return SQLITE4_NOTFOUND;
+    *paKey = pReader->aKey;
+    *pnKey = pReader->nKey;
+    *paData = pReader->aData;
+    *pnData = pReader->nData;
+  }
+  return SQLITE4_OK;
+}
+
+/*
+** Advance the sorter to its next entry.
+*/
+static int sorterAdvance(VdbeSorter *p){
+  const u8 *aKey, *aData;
+  KVSize nKey, nData;
+  int rc = sorterCurrent(p, &aKey, &nKey, &aData, &nData);
+  if( rc==SQLITE4_OK ){
+    if( p->nRun==0 ){
+      p->iEntry++;
+    }else{
+      rc = sorterTreeNext(p->base.pEnv, &p->merger);
+    }
+    if( rc==SQLITE4_OK ){
+      rc = sorterCurrent(p, &aKey, &nKey, &aData, &nData);
+    }
+  }
+  return rc;
+}
+
+/*
+** Append a new entry to the sorter.
+*/
+static int sorterReplace(
+  KVStore *pKVStore,
+  const KVByteArray *aKey, KVSize nKey,
+  const KVByteArray *aData, KVSize nData
+){
+  VdbeSorter *p = (VdbeSorter*)pKVStore;
+  SorterRecord *pRec;
+  SorterEntry *pEntry;
+  int rc;
+
+  if( p->bSorted ) return SQLITE4_MISUSE;
+  if( p->nEntry>=p->nEntryAlloc ){
+    int nNew = p->nEntryAlloc ? p->nEntryAlloc*2 : 256;
+    SorterEntry *aNew = (SorterEntry*)sqlite4_realloc(
+        p->base.pEnv, p->aEntry, nNew*sizeof(SorterEntry)
+    );
+    if( aNew==0 ) return SQLITE4_NOMEM;
+    p->aEntry = aNew;
+    p->nEntryAlloc = nNew;
+  }
+
+  pRec = sorterAllocRecord(p, sizeof(SorterRecord) + nKey + nData);
+  if( pRec==0 ) return SQLITE4_NOMEM;
+  pRec->nKey = nKey;
+  pRec->nData = nData;
+  memcpy(&pRec[1], aKey, nKey);
+  if( nData ) memcpy(&((u8*)&pRec[1])[nKey], aData, nData);
+
+  pEntry = &p->aEntry[p->nEntry++];
+  pEntry->pRec = pRec;
+  pEntry->iPrefix = sorterKeyPrefix(aKey, nKey);
+
+  rc = SQLITE4_OK;
+  if( p->mxMem>0 && p->nMem+p->nEntryAlloc*sizeof(SorterEntry)>p->mxMem ){
+    rc = sorterSpill(p);
+  }
+  return rc;
+}
+
+/*
+** Create a new cursor on the sorter.
+*/
+static int sorterOpenCursor(KVStore *pKVStore, KVCursor **ppKVCursor){
+  SorterCsr *pCsr;
+  pCsr = (SorterCsr*)sqlite4_malloc(pKVStore->pEnv, sizeof(SorterCsr));
+  if( pCsr==0 ){
+    *ppKVCursor = 0;
+    return SQLITE4_NOMEM;
+  }
+  memset(pCsr, 0, sizeof(SorterCsr));
+  pCsr->base.pStore = pKVStore;
+  pCsr->base.pStoreVfunc = pKVStore->pStoreVfunc;
+  pCsr->base.pEnv = pKVStore->pEnv;
+  *ppKVCursor = (KVCursor*)pCsr;
+  return SQLITE4_OK;
+}
+
+/*
+** Seek the cursor. The first seek ends the input phase. Only seeks with
+** direction>=0 are supported, as the sorter may only be read forwards.
+*/
+static int sorterSeek(
+  KVCursor *pKVCursor,
+  const KVByteArray *aProbe,
+  KVSize nProbe,
+  int direction
+){
+  VdbeSorter *p = (VdbeSorter*)pKVCursor->pStore;
+  const u8 *aKey, *aData;
+  KVSize nKey, nData;
+  int rc;
+  int c = -1;
+
+  if( direction<0 ) return SQLITE4_MISUSE;
+  rc = sorterRewind(p);
+  if( rc==SQLITE4_OK ) rc = sorterCurrent(p, &aKey, &nKey, &aData, &nData);
+  while( rc==SQLITE4_OK
+      && (c = sorterKeyCompare(aKey, nKey, aProbe, nProbe))<0
+  ){
+    rc = sorterAdvance(p);
+    if( rc==SQLITE4_OK ) rc = sorterCurrent(p, &aKey, &nKey, &aData, &nData);
+  }
+  if( rc==SQLITE4_OK && c!=0 ){
+    rc = (direction==0 ? SQLITE4_NOTFOUND : SQLITE4_INEXACT);
+  }
+  return rc;
+}
+
+static int sorterNextEntry(KVCursor *pKVCursor){
+  return sorterAdvance((VdbeSorter*)pKVCursor->pStore);
+}
+
+static int sorterPrevEntry(KVCursor *pKVCursor){
+  return SQLITE4_MISUSE;
+}
+
+static int sorterDelete(KVCursor *pKVCursor){
+  return SQLITE4_MISUSE;
+}
+
+static int sorterKey(
+  KVCursor *pKVCursor,
+  const KVByteArray **paKey,
+  KVSize *pnKey
+){
+  const u8 *aData;
+  KVSize nData;
+  return sorterCurrent(
+      (VdbeSorter*)pKVCursor->pStore, paKey, pnKey, &aData, &nData
+  );
+}
+
+static int sorterData(
+  KVCursor *pKVCursor,
+  KVSize ofst,
+  KVSize n,
+  const KVByteArray **paData,
+  KVSize *pnData
+){
+  const u8 *aKey, *aData;
+  KVSize nKey, nData;
+  int rc;
+  rc = sorterCurrent(
+      (VdbeSorter*)pKVCursor->pStore, &aKey, &nKey, &aData, &nData
+  );
+  if( rc==SQLITE4_OK ){
+    if( ofst>nData ) ofst = nData;
+    if( n<0 || ofst+n>nData ) n = nData - ofst;
+    *paData = &aData[ofst];
+    *pnData = n;
+  }
+  return rc;
+}
+
+static int sorterReset(KVCursor *pKVCursor){
+  return SQLITE4_OK;
+}
+
+static int sorterCloseCursor(KVCursor *pKVCursor){
+  if( pKVCursor ) sqlite4_free(pKVCursor->pEnv, pKVCursor);
+  return SQLITE4_OK;
+}
+
+/*
+** The sorter does not support transactions. These methods only track
+** the transaction level as required by kv.c.
+*/
+static int sorterBegin(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int sorterCommitPhaseOne(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+static int sorterCommitPhaseTwo(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int sorterRollback(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int sorterRevert(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+
+/*
+** Close the sorter and free all resources, including the temp file.
+*/
+static int sorterClose(KVStore *pKVStore){
+  VdbeSorter *p = (VdbeSorter*)pKVStore;
+  if( p ){
+    sqlite4_env *pEnv = p->base.pEnv;
+    int i;
+    sorterJoinAll(p);
+    for(i=0; i<p->nTask; i++){
+      SorterTask *pTask = &p->aTask[i];
+      sorterCloseTempFile(pEnv, &pTask->file);
+      sqlite4_free(pEnv, pTask->aEntry);
+      sqlite4_free(pEnv, pTask->aMerge);
+    }
+    sqlite4_free(pEnv, p->aTask);
+    sorterMergerFree(pEnv, &p->merger);
+    sorterFreeArenas(pEnv, p->pArena);
+    sorterFreeArenas(pEnv, p->pFree);
+    sqlite4_free(pEnv, p->aEntry);
+    sqlite4_free(pEnv, p->aRun);
+    sqlite4_free(pEnv, p);
+  }
+  return SQLITE4_OK;
+}
+
+static int sorterControl(KVStore *pKVStore, int op, void *pArg){
+  return SQLITE4_NOTFOUND;
+}
+
+static int sorterGetMeta(KVStore *pKVStore, unsigned int *piVal){
+  *piVal = 0;
+  return SQLITE4_OK;
+}
+
+static int sorterPutMeta(KVStore *pKVStore, unsigned int iVal){
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new sorter for database connection db. The sorter buffers up
+** to db->mxSorterMem bytes of data in memory before spilling to a
+** temporary file. If db->mxSorterMem is zero or less, the sorter never
+** uses a temporary file. Up to db->nWorker worker threads are used to
+** sort and merge runs.
+*/
+int sqlite4VdbeSorterOpen(sqlite4 *db, KVStore **ppKVStore){
+  static const KVStoreMethods sorterMethods = {
+    1,                            /* iVersion */
+    sizeof(KVStoreMethods),       /* szSelf */
+    sorterReplace,                /* xReplace */
+    sorterOpenCursor,             /* xOpenCursor */
+    sorterSeek,                   /* xSeek */
+    sorterNextEntry,              /* xNext */
+    sorterPrevEntry,              /* xPrev */
+    sorterDelete,                 /* xDelete */
+    sorterKey,                    /* xKey */
+    sorterData,                   /* xData */
+    sorterReset,                  /* xReset */
+    sorterCloseCursor,            /* xCloseCursor */
+    sorterBegin,                  /* xBegin */
+    sorterCommitPhaseOne,         /* xCommitPhaseOne */
+    sorterCommitPhaseTwo,         /* xCommitPhaseTwo */
+    sorterRollback,               /* xRollback */
+    sorterRevert,                 /* xRevert */
+    sorterClose,                  /* xClose */
+    sorterControl,                /* xControl */
+    sorterGetMeta,                /* xGetMeta */
+    sorterPutMeta,                /* xPutMeta */
+    0                             /* xGetMethod */
+  };
+  VdbeSorter *pNew;
+  int i;
+
+  *ppKVStore = 0;
+  pNew = (VdbeSorter*)sqlite4_malloc(db->pEnv, sizeof(VdbeSorter));
+  if( pNew==0 ) return SQLITE4_NOMEM;
+  memset(pNew, 0, sizeof(VdbeSorter));
+  pNew->base.pStoreVfunc = &sorterMethods;
+  pNew->base.pEnv = db->pEnv;
+  pNew->base.fTrace = (db->flags & SQLITE4_KvTrace)!=0;
+  sqlite4_snprintf(pNew->base.zKVName, sizeof(pNew->base.zKVName), "sorter");
+  pNew->mxMem = db->mxSorterMem;
+
+  /* If worker threads are in use, up to nTask full buffers may be
+  ** waiting to be sorted in addition to the one being filled, so divide
+  ** the memory budget between them. */
+  pNew->bThreads = (db->nWorker>0);
+  pNew->nTask = pNew->bThreads ? db->nWorker : 1;
+  if( pNew->bThreads && pNew->mxMem>0 ){
+    pNew->mxMem = pNew->mxMem / (pNew->nTask+1);
+    if( pNew->mxMem==0 ) pNew->mxMem = 1;
+  }
+  pNew->aTask = (SorterTask*)sqlite4_malloc(
+      db->pEnv, pNew->nTask*sizeof(SorterTask)
+  );
+  if( pNew->aTask==0 ){
+    sqlite4_free(db->pEnv, pNew);
+    return SQLITE4_NOMEM;
+  }
+  memset(pNew->aTask, 0, pNew->nTask*sizeof(SorterTask));
+  for(i=0; i<pNew->nTask; i++){
+    pNew->aTask[i].pEnv = db->pEnv;
+    pNew->aTask[i].iRun = -1;
+  }
+
+  *ppKVStore = (KVStore*)pNew;
+  return SQLITE4_OK;
+}
@@ -0,0 +1,438 @@
+/*
+** 2016 April 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains the bounded "top-N" sorter used by OP_TopNOpen
+** cursors to implement ORDER BY clauses that have a LIMIT.
+**
+** Like the external merge sorter in vdbesort.c, the top-N sorter presents
+** itself to the VDBE as a key/value store. Entries are held in a binary
+** max-heap ordered by key, so that the largest key is always at the root.
+** The code generated by pushOntoSorter() in select.c uses the store as
+** follows:
+**
+**   1. While fewer than N entries have been added, each new entry is
+**      added using xReplace.
+**
+**   2. Once N entries are present, OP_Last moves the cursor to the root
+**      of the heap, which is the largest (worst) key in the store. If the
+**      new key is larger than this, the row is discarded without being
+**      copied. Otherwise the root is removed with xDelete and the new
+**      entry added with xReplace.
+**
+**   3. The first xSeek with a direction of 0 or greater marks the end of
+**      the input. The heap is sorted in place and the entries returned
+**      in ascending order.
+**
+** So at most N entries are ever held in memory and each row costs
+** O(log N) comparisons, regardless of the number of rows sorted. The
+** record removed from the root is kept and reused for the next entry
+** whenever it is large enough, so once the heap is full rows that make
+** it into the result do not usually require a malloc() either.
+**
+** Only the operations listed above are supported. Any other seek,
+** deleting any entry other than the root, adding entries after reading
+** has begun, and reading in reverse order all return SQLITE4_MISUSE.
+*/
+#include "sqliteInt.h"
+#include "vdbeInt.h"
+
+typedef struct TopNCsr TopNCsr;
+typedef struct TopNRecord TopNRecord;
+typedef struct VdbeTopN VdbeTopN;
+
+/*
+** A single key/value pair. The key immediately follows this header, and
+** the value immediately follows the key.
+*/
+struct TopNRecord {
+  int nAlloc;                     /* Total bytes allocated for record */
+  KVSize nKey;                    /* Size of key in bytes */
+  KVSize nData;                   /* Size of value in bytes */
+};
+
+/*
+** The top-N sorter object. This is a subclass of KVStore.
+**
+** Until bSorted is set, aHeap[0..nHeap-1] is a max-heap. The cursor
+** points to the root of the heap if bOnRoot is true, or to no entry
+** otherwise. Once bSorted is set, aHeap[] is in ascending order and the
+** cursor points to aHeap[iEntry].
+*/
+struct VdbeTopN {
+  KVStore base;                   /* Base class, must be first */
+  TopNRecord **aHeap;             /* Heap of records */
+  int nHeap;                      /* Number of valid entries in aHeap[] */
+  int nHeapAlloc;                 /* Allocated size of aHeap[] */
+  TopNRecord *pSpare;             /* Record removed by xDelete, or NULL */
+  int bOnRoot;                    /* True if cursor points to aHeap[0] */
+  int bSorted;                    /* True once input is finished */
+  int iEntry;                     /* Current entry once bSorted is set */
+};
+
+/*
+** A cursor open on a top-N sorter. The iteration state is held by the
+** sorter object itself.
+*/
+struct TopNCsr {
+  KVCursor base;                  /* Base class, must be first */
+};
+
+#define topnRecordKey(pRec) ((const u8*)&(pRec)[1])
+
+/*
+** Compare a record with a key using memcmp() order.
+*/
+static int topnKeyCompare(
+  const TopNRecord *pRec,
+  const u8 *aKey, KVSize nKey
+){
+  KVSize nCmp = pRec->nKey<nKey ? pRec->nKey : nKey;
+  int c = memcmp(topnRecordKey(pRec), aKey, nCmp);
+  if( c==0 ) c = (pRec->nKey>nKey) - (pRec->nKey<nKey);
+  return c;
+}
+
+/*
+** Compare the keys of two records.
+*/
+static int topnCompare(const TopNRecord *p1, const TopNRecord *p2){
+  return topnKeyCompare(p1, topnRecordKey(p2), p2->nKey);
+}
+
+/*
+** Restore the heap property for the subtree rooted at aHeap[i], where
+** only the first nHeap entries of aHeap[] are considered part of the heap.
+*/
+static void topnSiftDown(TopNRecord **aHeap, int nHeap, int i){
+  TopNRecord *pRec = aHeap[i];
+  while( 1 ){
+    int iChild = i*2 + 1;
+    if( iChild>=nHeap ) break;
+    if( iChild+1<nHeap && topnCompare(aHeap[iChild+1], aHeap[iChild])>0 ){
+      iChild++;
+    }
+    if( topnCompare(aHeap[iChild], pRec)<=0 ) break;
+    aHeap[i] = aHeap[iChild];
+    i = iChild;
+  }
+  aHeap[i] = pRec;
+}
+
+/*
+** Move entry aHeap[i] towards the root until the heap property holds.
+*/
+static void topnSiftUp(TopNRecord **aHeap, int i){
+  TopNRecord *pRec = aHeap[i];
+  while( i>0 ){
+    int iParent = (i-1) / 2;
+    if( topnCompare(aHeap[iParent], pRec)>=0 ) break;
+    aHeap[i] = aHeap[iParent];
+    i = iParent;
+  }
+  aHeap[i] = pRec;
+}
+
+/*
+** End the input phase. Sort the contents of the heap into ascending
+** order in place.
+*/
+static void topnSort(VdbeTopN *p){
+  int i;
+  assert( p->bSorted==0 );
+  for(i=p->nHeap-1; i>0; i--){
+    TopNRecord *pMax = p->aHeap[0];
+    p->aHeap[0] = p->aHeap[i];
+    p->aHeap[i] = pMax;
+    topnSiftDown(p->aHeap, i, 0);
+  }
+  p->bSorted = 1;
+  p->bOnRoot = 0;
+}
+
+/*
+** Return the record the cursor currently points to, or NULL if it does
+** not point to any record.
+*/
+static TopNRecord *topnCurrent(VdbeTopN *p){
+  if( p->bSorted ){
+    return p->iEntry<p->nHeap ? p->aHeap[p->iEntry] : 0;
+  }
+  return (p->bOnRoot && p->nHeap>0) ? p->aHeap[0] : 0;
+}
+
+/*
+** Add a new entry to the heap.
+*/
+static int topnReplace(
+  KVStore *pKVStore,
+  const KVByteArray *aKey, KVSize nKey,
+  const KVByteArray *aData, KVSize nData
+){
+  VdbeTopN *p = (VdbeTopN*)pKVStore;
+  sqlite4_env *pEnv = p->base.pEnv;
+  TopNRecord *pRec;
+  int nByte;
+
+  if( p->bSorted ) return SQLITE4_MISUSE;
+  if( p->nHeap>=p->nHeapAlloc ){
+    int nNew = p->nHeapAlloc ? p->nHeapAlloc*2 : 64;
+    TopNRecord **aNew = (TopNRecord**)sqlite4_realloc(
+        pEnv, p->aHeap, nNew*sizeof(TopNRecord*)
+    );
+    if( aNew==0 ) return SQLITE4_NOMEM;
+    p->aHeap = aNew;
+    p->nHeapAlloc = nNew;
+  }
+
+  nByte = sizeof(TopNRecord) + nKey + nData;
+  pRec = p->pSpare;
+  p->pSpare = 0;
+  if( pRec==0 || pRec->nAlloc<nByte ){
+    sqlite4_free(pEnv, pRec);
+    pRec = (TopNRecord*)sqlite4_malloc(pEnv, nByte);
+    if( pRec==0 ) return SQLITE4_NOMEM;
+    pRec->nAlloc = nByte;
+  }
+  pRec->nKey = nKey;
+  pRec->nData = nData;
+  memcpy(&pRec[1], aKey, nKey);
+  if( nData ) memcpy(&((u8*)&pRec[1])[nKey], aData, nData);
+
+  p->aHeap[p->nHeap] = pRec;
+  topnSiftUp(p->aHeap, p->nHeap);
+  p->nHeap++;
+  p->bOnRoot = 0;
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new cursor on the top-N sorter.
+*/
+static int topnOpenCursor(KVStore *pKVStore, KVCursor **ppKVCursor){
+  TopNCsr *pCsr;
+  pCsr = (TopNCsr*)sqlite4_malloc(pKVStore->pEnv, sizeof(TopNCsr));
+  if( pCsr==0 ){
+    *ppKVCursor = 0;
+    return SQLITE4_NOMEM;
+  }
+  memset(pCsr, 0, sizeof(TopNCsr));
+  pCsr->base.pStore = pKVStore;
+  pCsr->base.pStoreVfunc = pKVStore->pStoreVfunc;
+  pCsr->base.pEnv = pKVStore->pEnv;
+  *ppKVCursor = (KVCursor*)pCsr;
+  return SQLITE4_OK;
+}
+
+/*
+** Seek the cursor.
+**
+** During the input phase, a seek with a negative direction moves the
+** cursor to the root of the heap. This is only supported if the probe
+** key is greater than or equal to every key in the store, as it is for
+** the seek done by OP_Last.
+**
+** Otherwise, the first seek ends the input phase. Seeks with direction>=0
+** move the cursor to the smallest key that is greater than or equal to
+** the probe key.
+*/
+static int topnSeek(
+  KVCursor *pKVCursor,
+  const KVByteArray *aProbe,
+  KVSize nProbe,
+  int direction
+){
+  VdbeTopN *p = (VdbeTopN*)pKVCursor->pStore;
+  int c = -1;
+
+  if( direction<0 ){
+    if( p->bSorted ) return SQLITE4_MISUSE;
+    if( p->nHeap==0 ) return SQLITE4_NOTFOUND;
+    c = topnKeyCompare(p->aHeap[0], aProbe, nProbe);
+    if( c>0 ) return SQLITE4_MISUSE;
+    p->bOnRoot = 1;
+    return (c==0 ? SQLITE4_OK : SQLITE4_INEXACT);
+  }
+
+  if( p->bSorted==0 ) topnSort(p);
+  for(p->iEntry=0; p->iEntry<p->nHeap; p->iEntry++){
+    c = topnKeyCompare(p->aHeap[p->iEntry], aProbe, nProbe);
+    if( c>=0 ) break;
+  }
+  if( p->iEntry>=p->nHeap ) return SQLITE4_NOTFOUND;
+  if( c!=0 ) return (direction==0 ? SQLITE4_NOTFOUND : SQLITE4_INEXACT);
+  return SQLITE4_OK;
+}
+
+static int topnNextEntry(KVCursor *pKVCursor){
+  VdbeTopN *p = (VdbeTopN*)pKVCursor->pStore;
+  if( p->bSorted==0 ) return SQLITE4_MISUSE;
+  if( p->iEntry<p->nHeap ) p->iEntry++;
+  return (p->iEntry<p->nHeap ? SQLITE4_OK : SQLITE4_NOTFOUND);
+}
+
+static int topnPrevEntry(KVCursor *pKVCursor){
+  return SQLITE4_MISUSE;
+}
+
+/*
+** Remove the root of the heap. The record is kept for reuse by the next
+** call to xReplace.
+*/
+static int topnDelete(KVCursor *pKVCursor){
+  VdbeTopN *p = (VdbeTopN*)pKVCursor->pStore;
+  if( p->bSorted || p->bOnRoot==0 || p->nHeap==0 ) return SQLITE4_MISUSE;
+  sqlite4_free(p->base.pEnv, p->pSpare);
+  p->pSpare = p->aHeap[0];
+  p->nHeap--;
+  if( p->nHeap>0 ){
+    p->aHeap[0] = p->aHeap[p->nHeap];
+    topnSiftDown(p->aHeap, p->nHeap, 0);
+  }
+  p->bOnRoot = 0;
+  return SQLITE4_OK;
+}
+
+static int topnKey(
+  KVCursor *pKVCursor,
+  const KVByteArray **paKey,
+  KVSize *pnKey
+){
+  TopNRecord *pRec = topnCurrent((VdbeTopN*)pKVCursor->pStore);
+  if( pRec==0 ) return SQLITE4_NOTFOUND;
+  *paKey = (const KVByteArray*)&pRec[1];
+  *pnKey = pRec->nKey;
+  return SQLITE4_OK;
+}
+
+static int topnData(
+  KVCursor *pKVCursor,
+  KVSize ofst,
+  KVSize n,
+  const KVByteArray **paData,
+  KVSize *pnData
+){
+  TopNRecord *pRec = topnCurrent((VdbeTopN*)pKVCursor->pStore);
+  KVSize nData;
+  if( pRec==0 ) return SQLITE4_NOTFOUND;
+  nData = pRec->nData;
+  if( ofst>nData ) ofst = nData;
+  if( n<0 || ofst+n>nData ) n = nData - ofst;
+  *paData = &((const KVByteArray*)&pRec[1])[pRec->nKey + ofst];
+  *pnData = n;
+  return SQLITE4_OK;
+}
+
+static int topnReset(KVCursor *pKVCursor){
+  return SQLITE4_OK;
+}
+
+static int topnCloseCursor(KVCursor *pKVCursor){
+  if( pKVCursor ) sqlite4_free(pKVCursor->pEnv, pKVCursor);
+  return SQLITE4_OK;
+}
+
+/*
+** The top-N sorter does not support transactions. These methods only
+** track the transaction level as required by kv.c.
+*/
+static int topnBegin(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int topnCommitPhaseOne(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+static int topnCommitPhaseTwo(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int topnRollback(KVStore *pKVStore, int iLevel){
+  pKVStore->iTransLevel = iLevel;
+  return SQLITE4_OK;
+}
+static int topnRevert(KVStore *pKVStore, int iLevel){
+  return SQLITE4_OK;
+}
+
+/*
+** Close the top-N sorter and free all resources.
+*/
+static int topnClose(KVStore *pKVStore){
+  VdbeTopN *p = (VdbeTopN*)pKVStore;
+  if( p ){
+    sqlite4_env *pEnv = p->base.pEnv;
+    int i;
+    for(i=0; i<p->nHeap; i++){
+      sqlite4_free(pEnv, p->aHeap[i]);
+    }
+    sqlite4_free(pEnv, p->pSpare);
+    sqlite4_free(pEnv, p->aHeap);
+    sqlite4_free(pEnv, p);
+  }
+  return SQLITE4_OK;
+}
+
+static int topnControl(KVStore *pKVStore, int op, void *pArg){
+  return SQLITE4_NOTFOUND;
+}
+
+static int topnGetMeta(KVStore *pKVStore, unsigned int *piVal){
+  *piVal = 0;
+  return SQLITE4_OK;
+}
+
+static int topnPutMeta(KVStore *pKVStore, unsigned int iVal){
+  return SQLITE4_OK;
+}
+
+/*
+** Create a new top-N sorter for database connection db.
+*/
+int sqlite4VdbeTopNOpen(sqlite4 *db, KVStore **ppKVStore){
+  static const KVStoreMethods topnMethods = {
+    1,                            /* iVersion */
+    sizeof(KVStoreMethods),       /* szSelf */
+    topnReplace,                  /* xReplace */
+    topnOpenCursor,               /* xOpenCursor */
+    topnSeek,                     /* xSeek */
+    topnNextEntry,                /* xNext */
+    topnPrevEntry,                /* xPrev */
+    topnDelete,                   /* xDelete */
+    topnKey,                      /* xKey */
+    topnData,                     /* xData */
+    topnReset,                    /* xReset */
+    topnCloseCursor,              /* xCloseCursor */
+    topnBegin,                    /* xBegin */
+    topnCommitPhaseOne,           /* xCommitPhaseOne */
+    topnCommitPhaseTwo,           /* xCommitPhaseTwo */
+    topnRollback,                 /* xRollback */
+    topnRevert,                   /* xRevert */
+    topnClose,                    /* xClose */
+    topnControl,                  /* xControl */
+    topnGetMeta,                  /* xGetMeta */
+    topnPutMeta,                  /* xPutMeta */
+    0                             /* xGetMethod */
+  };
+  VdbeTopN *pNew;
+
+  *ppKVStore = 0;
+  pNew = (VdbeTopN*)sqlite4_malloc(db->pEnv, sizeof(VdbeTopN));
+  if( pNew==0 ) return SQLITE4_NOMEM;
+  memset(pNew, 0, sizeof(VdbeTopN));
+  pNew->base.pStoreVfunc = &topnMethods;
+  pNew->base.pEnv = db->pEnv;
+  pNew->base.fTrace = (db->flags & SQLITE4_KvTrace)!=0;
+  sqlite4_snprintf(pNew->base.zKVName, sizeof(pNew->base.zKVName), "topn");
+
+  *ppKVStore = (KVStore*)pNew;
+  return SQLITE4_OK;
+}
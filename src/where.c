@@ -91,6 +91,9 @@ struct WhereLevel {
   u8 iFrom;             /* Which entry in the FROM clause */
   u8 op, p5;            /* Opcode and P5 of the opcode that ends the loop */
   int p1, p2;           /* Operands of the opcode used to ends the loop */
+  int regBatchEof;      /* True once a WHERE_BATCHED scan is finished */
+  int addrBatch;        /* Start of code to fill the next batch */
+  int iProfLoop;        /* Index passed to sqlite4VdbeLoopAddr(), or -1 */
   union {               /* Information that depends on pWLoop->wsFlags */
     struct {
       int nIn;              /* Number of entries in aInLoop[] */
@@ -127,6 +130,7 @@ struct WhereLoop {
 #endif
   u8 iTab;              /* Position in FROM clause of table for this loop */
   u8 iSortIdx;          /* Sorting index number.  0==None */
+                        /* (or WHERE_SORTIDX_HASH for a hash join) */
   WhereCost rSetup;     /* One-time setup cost (ex: create transient index) */
   WhereCost rRun;       /* Cost of running each loop */
   WhereCost nOut;       /* Estimated number of output rows */
@@ -298,6 +302,7 @@ struct WhereScan {
   WhereClause *pWC;          /* WhereClause currently being scanned */
   char *zCollName;           /* Required collating sequence, if not NULL */
   char idxaff;               /* Must match this affinity, if zCollName!=NULL */
+  Expr *pIdxExpr;            /* Indexed expression, if column is XN_EXPR */
   unsigned char nEquiv;      /* Number of entries in aEquiv[] */
   unsigned char iEquiv;      /* Next unused slot in aEquiv[] */
   u32 opMask;                /* Acceptable operators */
@@ -467,6 +472,28 @@ struct WhereInfo {
 #define WHERE_ONEROW       0x00001000  /* Selects no more than one row */
 #define WHERE_MULTI_OR     0x00002000  /* OR using multiple indices */
 #define WHERE_AUTO_INDEX   0x00004000  /* Uses an ephemeral index */
+#define WHERE_HASH_JOIN    0x00008000  /* Ephemeral index is a hash table */
+
+/*
+** Value of WhereLoop.iSortIdx used for hash join loops. Loops with
+** different iSortIdx values are never compared with one another by
+** whereLoopInsert(), so hash join loops may have a smaller rSetup than
+** the ordered automatic index loops for the same table without breaking
+** the SETUP-INVARIANT.
+*/
+#define WHERE_SORTIDX_HASH 0xFF
+#define WHERE_BATCHED      0x00010000  /* Rows are sorted in batches */
+#define WHERE_BATCH_PROBE  0x00020000  /* Lookups are made in key order */
+#define WHERE_SKIPSCAN     0x00040000  /* First index column is skipped */
+
+/*
+** The number of rows sorted at a time by a WHERE_BATCHED loop. A full
+** scan is only done in batches if sqlite_stat1 shows that the table
+** has at least this many rows.
+*/
+#ifndef SQLITE4_WHERE_BATCH_SIZE
+# define SQLITE4_WHERE_BATCH_SIZE 1024
+#endif
 
 
 /* Convert a WhereCost value (10 times log2(X)) into its integer value X.
@@ -931,7 +958,10 @@ static WhereTerm *whereScanNext(WhereScan *pScan){
     iColumn = pScan->aEquiv[pScan->iEquiv-1];
     while( (pWC = pScan->pWC)!=0 ){
       for(pTerm=pWC->a+k; k<pWC->nTerm; k++, pTerm++){
-        if( pTerm->leftCursor==iCur && pTerm->u.leftColumn==iColumn ){
+        if( pTerm->leftCursor==iCur && pTerm->u.leftColumn==iColumn
+         && (iColumn!=XN_EXPR
+          || sqlite4ExprCompare(pTerm->pExpr->pLeft,pScan->pIdxExpr,iCur)==0)
+        ){
           if( (pTerm->eOperator & WO_EQUIV)!=0
            && pScan->nEquiv<ArraySize(pScan->aEquiv)
           ){
@@ -1041,6 +1071,20 @@ static int idxColumnSortOrder(Index *pIdx, Index *pPk, int iIdxCol){
   return iRet;
 }
 
+/*
+** Return the affinity of the iIdxCol'th column of index pIdx. This is
+** the affinity of the table column or, for an indexed expression, the
+** affinity of the expression (which may be 0).
+*/
+static char idxColumnAffinity(Index *pIdx, int iIdxCol){
+  int iCol = pIdx->aiColumn[iIdxCol];
+  if( iCol==XN_EXPR ){
+    return sqlite4ExprAffinity(pIdx->aColExpr->a[iIdxCol].pExpr);
+  }
+  assert( iCol>=0 );
+  return pIdx->pTable->aCol[iCol].affinity;
+}
+
 /*
 ** Return the total number of fields in the index pIdx, including any
 ** trailing primary key fields.
@@ -1057,13 +1101,16 @@ static int idxColumnCount(Index *pIdx, Index *pPk){
 ** for terms of the form "X <op> <expr>" where X is column iColumn of table
 ** iCur.  The <op> must be one of the operators described by opMask.
 **
+** If pIdx is not NULL, then iColumn is not a table column number, but
+** the index of a field in the keys of pIdx, including any appended
+** PRIMARY KEY fields. X is the table column or expression indexed by
+** that field, and must be compatible with its affinity and collation
+** sequence (unless it is the INTEGER PRIMARY KEY).
+**
 ** If the search is for X and the WHERE clause contains terms of the
 ** form X=Y then this routine might also return terms of the form
 ** "Y <op> <expr>".  The number of levels of transitivity is limited,
 ** but is enough to handle most commonly occurring SQL statements.
-**
-** If X is not the INTEGER PRIMARY KEY then X must be compatible with
-** index pIdx.
 */
 static WhereTerm *whereScanInit(
   WhereScan *pScan,       /* The WhereScan object being initialized */
@@ -1073,21 +1120,25 @@ static WhereTerm *whereScanInit(
   u32 opMask,             /* Operator(s) to scan for */
   Index *pIdx             /* Must be compatible with this index */
 ){
-  int j;
-
   /* memset(pScan, 0, sizeof(*pScan)); */
   pScan->pOrigWC = pWC;
   pScan->pWC = pWC;
-  if( pIdx && iColumn>=0 ){
+  pScan->pIdxExpr = 0;
+  pScan->idxaff = 0;
+  pScan->zCollName = 0;
+  if( pIdx ){
     Index *pPk = sqlite4FindPrimaryKey(pIdx->pTable, 0);
-    pScan->idxaff = pIdx->pTable->aCol[iColumn].affinity;
-    for(j=0; idxColumnNumber(pIdx, pPk, j)!=iColumn; j++){
-      if( NEVER(j>=idxColumnCount(pIdx, pPk)) ) return 0;
+    int iIdxCol = iColumn;
+    iColumn = idxColumnNumber(pIdx, pPk, iIdxCol);
+    if( NEVER(iColumn==-2) ) return 0;
+    if( iColumn==XN_EXPR ){
+      pScan->pIdxExpr = pIdx->aColExpr->a[iIdxCol].pExpr;
+      pScan->idxaff = idxColumnAffinity(pIdx, iIdxCol);
+      pScan->zCollName = pIdx->azColl[iIdxCol];
+    }else if( iColumn>=0 ){
+      pScan->idxaff = pIdx->pTable->aCol[iColumn].affinity;
+      pScan->zCollName = idxColumnCollation(pIdx, pPk, iIdxCol);
     }
-    pScan->zCollName = idxColumnCollation(pIdx, pPk, j);
-  }else{
-    pScan->idxaff = 0;
-    pScan->zCollName = 0;
   }
   pScan->opMask = opMask;
   pScan->k = 0;
@@ -1547,7 +1598,9 @@ static void exprAnalyzeOrTerm(
         assert( pOrTerm->eOperator & WO_EQ );
         if( pOrTerm->leftCursor!=iCursor ){
           pOrTerm->wtFlags &= ~TERM_OR_OK;
-        }else if( pOrTerm->u.leftColumn!=iColumn ){
+        }else if( pOrTerm->u.leftColumn!=iColumn || iColumn==XN_EXPR ){
+          /* Terms on indexed expressions are not converted, as the same
+          ** leftColumn value is used for all such expressions */
           okToChngToIN = 0;
         }else{
           int affLeft, affRight;
@@ -1610,6 +1663,46 @@ static void exprAnalyzeOrTerm(
 }
 #endif /* !SQLITE4_OMIT_OR_OPTIMIZATION && !SQLITE4_OMIT_SUBQUERY */
 
+/*
+** Expression pExpr is the left-hand side of a comparison. Its value
+** depends only on the FROM clause table identified by mask prereqLeft.
+** If pExpr matches an expression indexed by an index on that table, set
+** *piCur to the cursor number for the table and return true. Otherwise
+** return false.
+*/
+static int exprIsIndexed(
+  SrcList *pSrc,                  /* The FROM clause */
+  WhereMaskSet *pMaskSet,         /* Mapping from cursors to mask bits */
+  Bitmask prereqLeft,             /* Tables used by pExpr */
+  Expr *pExpr,                    /* Expression to search for */
+  int *piCur                      /* OUT: Cursor number of table */
+){
+  int i;
+  if( prereqLeft==0 || !IsPowerOfTwo(prereqLeft) ) return 0;
+  for(i=0; i<pSrc->nSrc; i++){
+    int iCur = pSrc->a[i].iCursor;
+    if( getMask(pMaskSet, iCur)==prereqLeft ){
+      Index *pIdx;
+      Table *pTab = pSrc->a[i].pTab;
+      if( pTab==0 || IsVirtual(pTab) ) return 0;
+      for(pIdx=pTab->pIndex; pIdx; pIdx=pIdx->pNext){
+        int j;
+        if( pIdx->aColExpr==0 ) continue;
+        for(j=0; j<pIdx->nColumn; j++){
+          if( pIdx->aiColumn[j]==XN_EXPR
+           && sqlite4ExprCompare(pExpr, pIdx->aColExpr->a[j].pExpr, iCur)==0
+          ){
+            *piCur = iCur;
+            return 1;
+          }
+        }
+      }
+      return 0;
+    }
+  }
+  return 0;
+}
+
 /*
 ** The input to this routine is an WhereTerm structure with only the
 ** "pExpr" field filled in.  The job of this routine is to analyze the
@@ -1683,10 +1776,19 @@ static void exprAnalyze(
     Expr *pLeft = sqlite4ExprSkipCollate(pExpr->pLeft);
     Expr *pRight = sqlite4ExprSkipCollate(pExpr->pRight);
     u16 opMask = (pTerm->prereqRight & prereqLeft)==0 ? WO_ALL : WO_EQUIV;
+    int iCur;
     if( pLeft->op==TK_COLUMN ){
       pTerm->leftCursor = pLeft->iTable;
       pTerm->u.leftColumn = pLeft->iColumn;
       pTerm->eOperator = operatorMask(op) & opMask;
+    }else if( opMask==WO_ALL
+           && exprIsIndexed(pSrc, pMaskSet, prereqLeft, pLeft, &iCur)
+    ){
+      /* The LHS is an indexed expression. Such terms never take part in
+      ** transitive (WO_EQUIV) constraints.  */
+      pTerm->leftCursor = iCur;
+      pTerm->u.leftColumn = XN_EXPR;
+      pTerm->eOperator = operatorMask(op);
     }
     if( pRight && pRight->op==TK_COLUMN ){
       WhereTerm *pNew;
@@ -1708,6 +1810,7 @@ static void exprAnalyze(
         pTerm->wtFlags |= TERM_COPIED;
         if( pExpr->op==TK_EQ
          && !ExprHasProperty(pExpr, EP_FromJoin)
+         && pTerm->u.leftColumn!=XN_EXPR
          && OptimizationEnabled(db, SQLITE4_Transitive)
         ){
           pTerm->eOperator |= WO_EQUIV;
@@ -1997,7 +2100,7 @@ static int isDistinctRedundant(
   /* Loop through all indices on the table, checking each to see if it makes
   ** the DISTINCT qualifier redundant. It does so if:
   **
-  **   1. The index is itself UNIQUE, and
+  **   1. The index is itself UNIQUE and is not a partial index, and
   **
   **   2. All of the columns in the index are either part of the pDistinct
   **      list, or else the WHERE clause contains a term of the form "col=X",
@@ -2008,10 +2111,9 @@ static int isDistinctRedundant(
   **      contain a "col=X" term are subject to a NOT NULL constraint.
   */
   for(pIdx=pTab->pIndex; pIdx; pIdx=pIdx->pNext){
-    if( pIdx->onError==OE_None ) continue;
+    if( pIdx->onError==OE_None || pIdx->pPartIdxWhere ) continue;
     for(i=0; i<pIdx->nColumn; i++){
-      int iCol = pIdx->aiColumn[i];
-      if( 0==findTerm(pWC, iBase, iCol, ~(Bitmask)0, WO_EQ, pIdx) ){
+      if( 0==findTerm(pWC, iBase, i, ~(Bitmask)0, WO_EQ, pIdx) ){
         int iIdxCol = findIndexCol(pParse, pDistinct, iBase, pIdx, i);
         if( iIdxCol<0 || pTab->aCol[pIdx->aiColumn[i]].notNull==0 ){
           break;
@@ -2163,6 +2265,18 @@ static int termCanDriveIndex(
   if( !sqlite4IndexAffinityOk(pTerm->pExpr, aff) ) return 0;
   return 1;
 }
+
+/*
+** Return TRUE if table pTab has an index (including its primary key)
+** whose leftmost column is column iCol.
+*/
+static int tableHasIndexOn(Table *pTab, int iCol){
+  Index *pIdx;
+  for(pIdx=pTab->pIndex; pIdx; pIdx=pIdx->pNext){
+    if( pIdx->nColumn>0 && pIdx->aiColumn[0]==iCol ) return 1;
+  }
+  return 0;
+}
 #endif
 
 
@@ -2236,7 +2350,7 @@ static void constructAutomaticIndex(
   assert( nColumn>0 );
   pLoop->u.btree.nEq = pLoop->nLTerm = nColumn;
   pLoop->wsFlags = WHERE_COLUMN_EQ | WHERE_IDX_ONLY | WHERE_INDEXED
-                     | WHERE_AUTO_INDEX;
+                     | WHERE_AUTO_INDEX | (pLoop->wsFlags & WHERE_HASH_JOIN);
 
   /* Count the number of additional columns needed to create a
   ** covering index.  A "covering index" is an index that contains all
@@ -2313,12 +2427,15 @@ static void constructAutomaticIndex(
   }
   assert( n==nColumn );
 
-  /* Create the automatic index */
+  /* Create the automatic index. If it is to be a hash table, pass the
+  ** number of equality columns as P3. */
   pKeyinfo = sqlite4IndexKeyinfo(pParse, pIdx);
   assert( pLevel->iIdxCur>=0 );
   pLevel->iIdxCur = pParse->nTab++;
-  sqlite4VdbeAddOp4(v, OP_OpenAutoindex, pLevel->iIdxCur, nColumn+1, 0,
-                    (char*)pKeyinfo, P4_KEYINFO_HANDOFF);
+  sqlite4VdbeAddOp4(v, OP_OpenAutoindex, pLevel->iIdxCur, nColumn+1,
+      (pLoop->wsFlags & WHERE_HASH_JOIN) ? pLoop->u.btree.nEq : 0,
+      (char*)pKeyinfo, P4_KEYINFO_HANDOFF
+  );
   VdbeComment((v, "for %s", pTable->zName));
 
   /* Fill the automatic index with content */
@@ -2702,7 +2819,7 @@ static int whereRangeScanEst(
     tRowcnt iLower = 0;
     tRowcnt iUpper = p->aiRowEst[0];
     tRowcnt a[2];
-    u8 aff = p->pTable->aCol[p->aiColumn[0]].affinity;
+    u8 aff = idxColumnAffinity(p, 0);
 
     sqlite4_buffer_init(&buf, db->pEnv->pMM);
     rc = whereSampleKeyinfo(pParse, p, &keyinfo);
@@ -2792,7 +2909,7 @@ static int whereEqualScanEst(
   assert( p->aSample!=0 );
   assert( p->nSample>0 );
   sqlite4_buffer_init(&buf, pParse->db->pEnv->pMM);
-  aff = p->pTable->aCol[p->aiColumn[0]].affinity;
+  aff = idxColumnAffinity(p, 0);
   if( pExpr ){
     KeyInfo keyinfo;
     rc = whereSampleKeyinfo(pParse, p, &keyinfo);
@@ -3106,7 +3223,13 @@ static int codeAllEqualityTerms(
   for(j=0; j<nEq; j++){
     int r1;
     pTerm = pLoop->aLTerm[j];
-    assert( pTerm!=0 );
+    if( pTerm==0 ){
+      /* A column skipped by a skip-scan. Its register is loaded with the
+      ** key prefix by OP_SkipScan, to which no affinity applies. */
+      assert( pLoop->wsFlags & WHERE_SKIPSCAN );
+      if( zAff ) zAff[j] = SQLITE4_AFF_NONE;
+      continue;
+    }
     /* The following true for indices with redundant columns. 
     ** Ex: CREATE INDEX i1 ON t1(a,b,a); SELECT * FROM t1 WHERE a=0 AND b=0; */
     testcase( (pTerm->wtFlags & TERM_CODED)!=0 );
@@ -3160,6 +3283,20 @@ static void explainAppendTerm(
   sqlite4StrAccumAppend(pStr, "?", 1);
 }
 
+/*
+** Return the name of the iCol'th column of index pIdx on table pTab, for
+** use in EXPLAIN QUERY PLAN output. Indexed expressions are shown as
+** "<expr>".
+*/
+static const char *explainIndexColumnName(Table *pTab, Index *pIdx, int iCol){
+  int iTblCol;
+  if( iCol>=pIdx->nColumn ) return "rowid";
+  iTblCol = pIdx->aiColumn[iCol];
+  if( iTblCol==XN_EXPR ) return "<expr>";
+  if( iTblCol<0 ) return "rowid";
+  return pTab->aCol[iTblCol].zName;
+}
+
 /*
 ** Argument pLevel describes a strategy for scanning table pTab. This 
 ** function returns a pointer to a string buffer containing a description
@@ -3183,8 +3320,6 @@ static char *explainIndexRange(sqlite4 *db, WhereLoop *pLoop, Table *pTab){
   Index *pIndex = pLoop->u.btree.pIndex;
   int nEq = pLoop->u.btree.nEq;
   int i, j;
-  Column *aCol = pTab->aCol;
-  int *aiColumn = pIndex->aiColumn;
   StrAccum txt;
 
   if( nEq==0 && (pLoop->wsFlags & (WHERE_BTM_LIMIT|WHERE_TOP_LIMIT))==0 ){
@@ -3194,16 +3329,22 @@ static char *explainIndexRange(sqlite4 *db, WhereLoop *pLoop, Table *pTab){
   txt.db = db;
   sqlite4StrAccumAppend(&txt, " (", 2);
   for(i=0; i<nEq; i++){
-    explainAppendTerm(&txt, i, aCol[aiColumn[i]].zName, "=");
+    const char *z = explainIndexColumnName(pTab, pIndex, i);
+    if( pLoop->aLTerm[i]==0 ){
+      if( i ) sqlite4StrAccumAppend(&txt, " AND ", 5);
+      sqlite4XPrintf(&txt, "ANY(%s)", z);
+    }else{
+      explainAppendTerm(&txt, i, z, "=");
+    }
   }
 
   j = i;
   if( pLoop->wsFlags&WHERE_BTM_LIMIT ){
-    char *z = (j==pIndex->nColumn ) ? "rowid" : aCol[aiColumn[j]].zName;
+    const char *z = explainIndexColumnName(pTab, pIndex, j);
     explainAppendTerm(&txt, i++, z, ">");
   }
   if( pLoop->wsFlags&WHERE_TOP_LIMIT ){
-    char *z = (j==pIndex->nColumn ) ? "rowid" : aCol[aiColumn[j]].zName;
+    const char *z = explainIndexColumnName(pTab, pIndex, j);
     explainAppendTerm(&txt, i, z, "<");
   }
   sqlite4StrAccumAppend(&txt, ")", 1);
@@ -3212,9 +3353,11 @@ static char *explainIndexRange(sqlite4 *db, WhereLoop *pLoop, Table *pTab){
 
 /*
 ** This function is a no-op unless currently processing an EXPLAIN QUERY PLAN
-** command. If the query being compiled is an EXPLAIN QUERY PLAN, a single
-** record is added to the output to describe the table scan strategy in 
-** pLevel.
+** command or compiling a statement to be profiled. If the query being
+** compiled is an EXPLAIN QUERY PLAN, a single record is added to the output
+** to describe the table scan strategy in pLevel. If it is being profiled,
+** the same description is recorded with the start address of the loop
+** for sqlite4_stmt_profile().
 */
 static void explainOneScan(
   Parse *pParse,                  /* Parse context */
@@ -3224,7 +3367,10 @@ static void explainOneScan(
   int iFrom,                      /* Value for "from" column of output */
   u16 wctrlFlags                  /* Flags passed to sqlite4WhereBegin() */
 ){
-  if( pParse->explain==2 ){
+  int bProfile;                   /* True if the statement is profiled */
+  bProfile = pParse->explain==3
+    || (pParse->explain==0 && (pParse->db->flags & SQLITE4_StmtProfile));
+  if( pParse->explain==2 || bProfile ){
     struct SrcListItem *pItem = &pTabList->a[pLevel->iFrom];
     Vdbe *v = pParse->pVdbe;      /* VM being constructed */
     sqlite4 *db = pParse->db;     /* Database handle */
@@ -3274,6 +3420,9 @@ static void explainOneScan(
         );
       }
       sqlite4DbFree(db, zWhere);
+      if( flags & WHERE_BATCHED ){
+        zMsg = sqlite4MAppendf(db, zMsg, "%s IN SORTED BATCHES", zMsg);
+      }
     }
 #ifndef SQLITE4_OMIT_VIRTUALTABLE
     else if( (flags & WHERE_VIRTUALTABLE)!=0 ){
@@ -3282,7 +3431,11 @@ static void explainOneScan(
     }
 #endif
     zMsg = sqlite4MAppendf(db, zMsg, "%s", zMsg);
-    sqlite4VdbeAddOp4(v, OP_Explain, iId, iLevel, iFrom, zMsg, P4_DYNAMIC);
+    if( bProfile ){
+      pLevel->iProfLoop = sqlite4VdbeAddLoop(v, iId, iLevel, zMsg);
+    }else{
+      sqlite4VdbeAddOp4(v, OP_Explain, iId, iLevel, iFrom, zMsg, P4_DYNAMIC);
+    }
   }
 }
 #else
@@ -3313,6 +3466,88 @@ static int findMatchExpr(
   return 1;
 }
 
+/*
+** Generate code for the start of the WHERE_BATCHED loop at level iLevel
+** of pWInfo (see whereCheckBatched()). The code is as follows:
+**
+**          Integer    0 regEof
+**          Rewind     iScan addrBrk
+**    A:    SorterOpen iCur
+**          Integer    SQLITE4_WHERE_BATCH_SIZE regCnt
+**    B:    <key for inner index from current row of iScan>
+**          Insert     iCur <current row of iScan> <key>
+**          IfZero     regCnt C -1
+**          Next       iScan B
+**          Integer    1 regEof
+**    C:    SorterSort iCur addrBrk
+**          <loop body>
+**          SorterNext iCur
+**          If         regEof addrBrk
+**          Next       iScan A
+**
+** The last three instructions are added by sqlite4WhereEnd().
+*/
+static void codeBatchedScan(WhereInfo *pWInfo, int iLevel){
+  Parse *pParse = pWInfo->pParse;
+  Vdbe *v = pParse->pVdbe;
+  WhereLevel *pLevel = &pWInfo->a[iLevel];
+  WhereLoop *pInner = pWInfo->a[iLevel+1].pWLoop;
+  Table *pTab = pWInfo->pTabList->a[pLevel->iFrom].pTab;
+  int iCur = pLevel->iTabCur;     /* Sorter cursor */
+  int iScan = pLevel->iIdxCur;    /* Cursor used to scan the table */
+  int nEq = pInner->u.btree.nEq;  /* Number of key fields */
+  KeyInfo *pKeyInfo;              /* Key format for the sorter */
+  int regCnt;                     /* Rows left in the current batch */
+  int regKey;                     /* Sorter key */
+  int regData;                    /* Sorter data (a row of pTab) */
+  int regBase;                    /* Values of key fields */
+  int addrRow;                    /* Address B in the header comment */
+  int addrFull;                   /* The OP_IfZero instruction */
+  int i;
+
+  /* The sorter keys use the same encoding as the inner index, so that
+  ** the batch is sorted in the order of the inner index. The sorter data
+  ** is a row of pTab, so that OP_Column on cursor iCur works as if iCur
+  ** were still open on pTab.  */
+  pKeyInfo = sqlite4IndexKeyinfo(pParse, pInner->u.btree.pIndex);
+  if( pKeyInfo ) pKeyInfo->nData = pTab->nCol;
+
+  pLevel->regBatchEof = ++pParse->nMem;
+  regCnt = ++pParse->nMem;
+  regKey = ++pParse->nMem;
+  regData = ++pParse->nMem;
+  regBase = pParse->nMem+1;
+  pParse->nMem += nEq;
+
+  sqlite4VdbeAddOp2(v, OP_Integer, 0, pLevel->regBatchEof);
+  sqlite4VdbeAddOp2(v, OP_Rewind, iScan, pLevel->addrBrk);
+  pLevel->addrBatch = sqlite4VdbeAddOp4(v, OP_SorterOpen, iCur, pTab->nCol, 0,
+      (char*)pKeyInfo, P4_KEYINFO_HANDOFF
+  );
+  VdbeComment((v, "batch of %s", pTab->zName));
+  sqlite4VdbeAddOp2(v, OP_Integer, SQLITE4_WHERE_BATCH_SIZE, regCnt);
+  addrRow = sqlite4VdbeCurrentAddr(v);
+  for(i=0; i<nEq; i++){
+    Expr *pRight = sqlite4ExprSkipCollate(pInner->aLTerm[i]->pExpr->pRight);
+    assert( pRight->op==TK_COLUMN && pRight->iTable==iCur );
+    sqlite4ExprCodeGetColumnOfTable(v, pTab, iScan, pRight->iColumn, regBase+i);
+  }
+  sqlite4VdbeAddOp4Int(v, OP_MakeKey, regBase, nEq, regKey, iCur);
+  sqlite4VdbeChangeP5(v, OPFLAG_SEQCOUNT);
+  sqlite4VdbeAddOp2(v, OP_RowData, iScan, regData);
+  sqlite4VdbeAddOp3(v, OP_Insert, iCur, regData, regKey);
+  addrFull = sqlite4VdbeAddOp3(v, OP_IfZero, regCnt, 0, -1);
+  sqlite4VdbeAddOp2(v, OP_Next, iScan, addrRow);
+  sqlite4VdbeChangeP5(v, SQLITE4_STMTSTATUS_FULLSCAN_STEP);
+  sqlite4VdbeAddOp2(v, OP_Integer, 1, pLevel->regBatchEof);
+  sqlite4VdbeJumpHere(v, addrFull);
+  sqlite4VdbeAddOp2(v, OP_SorterSort, iCur, pLevel->addrBrk);
+  sqlite4ExprCacheClear(pParse);
+
+  pLevel->op = OP_SorterNext;
+  pLevel->p1 = iCur;
+  pLevel->p2 = sqlite4VdbeCurrentAddr(v);
+}
 
 /*
 ** Generate code for the start of the iLevel-th loop in the WHERE clause
@@ -3453,6 +3688,13 @@ static Bitmask codeOneLoopStart(
   }else
 #endif /* SQLITE4_OMIT_VIRTUALTABLE */
 
+  if( pLoop->wsFlags & WHERE_BATCHED ){
+    /* Case 3: A full table scan that sorts the rows in batches before
+    **         passing them to the inner loops.
+    */
+    codeBatchedScan(pWInfo, iLevel);
+  }else
+
   if( pLoop->wsFlags & WHERE_INDEXED ){
     /* Case 4: A scan using an index.
     **
@@ -3484,6 +3726,15 @@ static Bitmask codeOneLoopStart(
     **         This case is also used when there are no WHERE clause
     **         constraints but an index is selected anyway, in order
     **         to force the output order to conform to an ORDER BY.
+    **
+    **         If the loop is a skip-scan, the first column of the index
+    **         is not constrained. Instead, the search described above is
+    **         repeated once for each distinct value of the first column,
+    **         which OP_SkipScan finds by seeking past the key prefix of
+    **         the previous one. For example, with an index on (x,y):
+    **
+    **            y=5
+    **            y>5 AND y<10
     */  
     static const u8 aStartOp[] = {
       0,
@@ -3504,6 +3755,7 @@ static Bitmask codeOneLoopStart(
     };
 
     int nEq = pLoop->u.btree.nEq;  /* Number of == or IN terms */
+    int nSkip;                     /* Number of columns skipped (0 or 1) */
     int isMinQuery = 0;            /* If this is an optimized SELECT min(x).. */
     int regBase;                 /* Base register holding constraint values */
     int r1;                      /* Temp register */
@@ -3520,12 +3772,13 @@ static Bitmask codeOneLoopStart(
     char *zStartAff;             /* Affinity for start of range constraint */
     char *zEndAff;               /* Affinity for end of range constraint */
     int regEndKey;               /* Register for end-key */
-    int iIneq;                   /* The table column subject to inequality */
+    int iIneq;                   /* Table column (or XN_EXPR) in inequality */
     Index *pPk;                  /* Primary key index on same table as pIdx */
 
     pIdx = pLoop->u.btree.pIndex;
     pPk = sqlite4FindPrimaryKey(pIdx->pTable, 0);
     iIneq = idxColumnNumber(pIdx, pPk, nEq);
+    nSkip = (pLoop->wsFlags & WHERE_SKIPSCAN) ? 1 : 0;
     iIdxCur = pLevel->iIdxCur;
     assert( iCur==pLevel->iTabCur );
 
@@ -3569,6 +3822,22 @@ static Bitmask codeOneLoopStart(
     zEndAff = sqlite4DbStrDup(pParse->db, zStartAff);
     addrNxt = pLevel->addrNxt;
 
+    /* For a skip-scan, point the cursor at the first entry of the index
+    ** (or the last, for a reverse scan) and load the prefix of its key
+    ** into the register of the skipped column. Each search for the
+    ** remaining constraints jumps back to the OP_SkipScan when it is
+    ** done, to move on to the next prefix. Because the range start and
+    ** end values share a register, they are loaded again each time.  */
+    if( nSkip ){
+      assert( nSkip==1 && pLoop->aLTerm[0]==0 );
+      sqlite4VdbeAddOp2(v, OP_Null, 0, regBase);
+      sqlite4VdbeAddOp2(v, bRev ? OP_Last : OP_Rewind, iIdxCur, addrBrk);
+      addrNxt = pLevel->addrNxt = sqlite4VdbeAddOp4Int(
+          v, OP_SkipScan, iIdxCur, addrBrk, regBase, nSkip
+      );
+      sqlite4VdbeChangeP5(v, (u8)bRev);
+    }
+
     /* If we are doing a reverse order scan on an ascending index, or
     ** a forward order scan on a descending index, interchange the 
     ** start and end terms (pRangeStart and pRangeEnd).
@@ -3624,6 +3893,18 @@ static Bitmask codeOneLoopStart(
     testcase( op==OP_SeekLe );
     testcase( op==OP_SeekLt );
     sqlite4VdbeAddOp4Int(v, op, iIdxCur, addrNxt, regBase, nConstraint);
+    if( op==OP_SeekGe && (pLoop->wsFlags & WHERE_BATCH_PROBE) ){
+      sqlite4VdbeChangeP5(v, OPFLAG_SEEKNEAR | (nSkip ? OPFLAG_KEYPREFIX : 0));
+    }else if( op==OP_SeekGe && (pLoop->wsFlags & WHERE_ONEROW)
+           && nSkip==0 && pRangeStart==0 && nEq==pIdx->nColumn
+           && pIdx->eIndexType==SQLITE4_INDEX_PRIMARYKEY
+    ){
+      /* A one-row lookup on a complete primary key. Use an exact-match
+      ** seek so that the row may be served from a row cache.  */
+      sqlite4VdbeChangeP5(v, OPFLAG_SEEKEQ);
+    }else if( nSkip ){
+      sqlite4VdbeChangeP5(v, OPFLAG_KEYPREFIX);
+    }
 
     /* Set variable op to the instruction required to determine if the
     ** cursor is passed the end of the range. If the range is unbounded,
@@ -3672,6 +3953,7 @@ static Bitmask codeOneLoopStart(
       }else{
         sqlite4VdbeAddOp4Int(v, OP_MakeKey, regBase, nConstraint, regEndKey,
                                 iIdxCur);
+        if( nSkip ) sqlite4VdbeChangeP5(v, OPFLAG_KEYPREFIX);
       }
     }
 
@@ -3703,7 +3985,11 @@ static Bitmask codeOneLoopStart(
     testcase( pLoop->wsFlags & WHERE_BTM_LIMIT );
     testcase( pLoop->wsFlags & WHERE_TOP_LIMIT );
     if( (pLoop->wsFlags & (WHERE_BTM_LIMIT|WHERE_TOP_LIMIT))!=0 ){
-      sqlite4ExprCodeGetColumnOfTable(v, pIdx->pTable, iCur, iIneq, r1);
+      if( iIneq==XN_EXPR ){
+        sqlite4CodeIndexColumn(pParse, pIdx, nEq, iCur, 0, r1);
+      }else{
+        sqlite4ExprCodeGetColumnOfTable(v, pIdx->pTable, iCur, iIneq, r1);
+      }
       sqlite4VdbeAddOp2(v, OP_IsNull, r1, addrCont);
     }
     sqlite4ReleaseTempReg(pParse, r1);
@@ -4385,9 +4671,9 @@ static int whereLoopAddBtreeIndex(
   }else{
     return SQLITE4_OK;
   }
-  assert( iCol>=-1 );
-  pTerm = whereScanInit(&scan, pBuilder->pWC, pSrc->iCursor, iCol,
-                        opMask, pProbe);
+  assert( iCol>=-1 || iCol==XN_EXPR );
+  pTerm = whereScanInit(&scan, pBuilder->pWC, pSrc->iCursor,
+                        pNew->u.btree.nEq, opMask, pProbe);
   saved_nEq = pNew->u.btree.nEq;
   saved_nLTerm = pNew->nLTerm;
   saved_wsFlags = pNew->wsFlags;
@@ -4395,11 +4681,45 @@ static int whereLoopAddBtreeIndex(
   saved_nOut = pNew->nOut;
   pNew->rSetup = 0;
   rLogSize = estLog(whereCost(pProbe->aiRowEst[0]));
+
+  /* If there is no constraint on the first column of the index, but the
+  ** sqlite_stat1 data shows that it has few distinct values, consider a
+  ** skip-scan. This searches the rest of the index once for each distinct
+  ** value of the first column. The skipped column has no entry in
+  ** aLTerm[], and IN operators may not be used by the remaining terms.
+  */
+  if( pTerm==0
+   && saved_nEq==0
+   && (saved_wsFlags & WHERE_BTM_LIMIT)==0
+   && pProbe->nColumn>1
+   && pProbe->bUnordered==0
+   && pProbe->tnum!=KVSTORE_ROOT
+   && pProbe->aiRowEst[1]>=18  /* TUNING: Minimum rows per value to skip */
+   && (db->flags & SQLITE4_SkipScan)!=0
+   && whereLoopResize(db, pNew, 1)==SQLITE4_OK
+  ){
+    WhereCost nIter;    /* log(Number of distinct values in first column) */
+    nIter = whereCost(pProbe->aiRowEst[0]/pProbe->aiRowEst[1]);
+    pNew->u.btree.nEq = 1;
+    pNew->aLTerm[0] = 0;
+    pNew->nLTerm = 1;
+    pNew->wsFlags |= WHERE_SKIPSCAN;
+    rc = whereLoopAddBtreeIndex(pBuilder, pSrc, pProbe, nIter);
+    pNew->u.btree.nEq = saved_nEq;
+    pNew->nLTerm = saved_nLTerm;
+    pNew->wsFlags = saved_wsFlags;
+  }
+
   for(; rc==SQLITE4_OK && pTerm!=0; pTerm = whereScanNext(&scan)){
     int nIn = 0;
     if( pTerm->prereqRight & pNew->maskSelf ) continue;
+    if( (saved_wsFlags & WHERE_SKIPSCAN) && (pTerm->eOperator & WO_IN) ){
+      continue;  /* IN operators may not be used by a skip-scan */
+    }
 #ifdef SQLITE4_ENABLE_STAT3
-    if( (pTerm->wtFlags & TERM_VNULL)!=0 && pSrc->pTab->aCol[iCol].notNull ){
+    if( (pTerm->wtFlags & TERM_VNULL)!=0
+     && iCol>=0 && pSrc->pTab->aCol[iCol].notNull
+    ){
       continue; /* skip IS NOT NULL constraints on a NOT NULL column */
     }
 #endif
@@ -4410,6 +4730,11 @@ static int whereLoopAddBtreeIndex(
     pNew->aLTerm[pNew->nLTerm++] = pTerm;
     pNew->prereq = (saved_prereq | pTerm->prereqRight) & ~pNew->maskSelf;
     pNew->rRun = rLogSize; /* Baseline cost is log2(N).  Adjustments below */
+    if( saved_wsFlags & WHERE_SKIPSCAN ){
+      /* A skip-scan does one search for each distinct value of the skipped
+      ** column. There are no IN operators, so nInMul is that number. */
+      pNew->rRun += nInMul;
+    }
     if( pTerm->eOperator & WO_IN ){
       Expr *pExpr = pTerm->pExpr;
       pNew->wsFlags |= WHERE_COLUMN_IN;
@@ -4425,13 +4750,15 @@ static int whereLoopAddBtreeIndex(
       pNew->nOut = nRowEst + nInMul + nIn;
     }else if( pTerm->eOperator & (WO_EQ) ){
       assert( (pNew->wsFlags & (WHERE_COLUMN_NULL|WHERE_COLUMN_IN))!=0
+                  || (pNew->wsFlags & WHERE_SKIPSCAN)!=0
                   || nInMul==0 );
       pNew->wsFlags |= WHERE_COLUMN_EQ;
-      if( iCol<0  
-       || (pProbe->onError!=OE_None && nInMul==0
-           && pNew->u.btree.nEq==pProbe->nColumn-1)
+      if( (pNew->wsFlags & WHERE_SKIPSCAN)==0
+       && (iCol==-1
+        || (pProbe->onError!=OE_None && nInMul==0
+            && pNew->u.btree.nEq==pProbe->nColumn-1))
       ){
-        assert( (pNew->wsFlags & WHERE_COLUMN_IN)==0 || iCol<0 );
+        assert( (pNew->wsFlags & WHERE_COLUMN_IN)==0 || iCol==-1 );
         pNew->wsFlags |= WHERE_ONEROW;
       }
       pNew->u.btree.nEq++;
@@ -4522,11 +4849,22 @@ static int indexMightHelpWithOrderBy(
   if( (pOB = pBuilder->pWInfo->pOrderBy)==0 ) return 0;
   for(ii=0; ii<pOB->nExpr; ii++){
     Expr *pExpr = sqlite4ExprSkipCollate(pOB->a[ii].pExpr);
-    if( pExpr->op!=TK_COLUMN ) return 0;
-    if( pExpr->iTable==iCursor ){
+    if( pExpr->op==TK_COLUMN ){
+      if( pExpr->iTable==iCursor ){
+        for(jj=0; jj<pIndex->nColumn; jj++){
+          if( pExpr->iColumn==pIndex->aiColumn[jj] ) return 1;
+        }
+      }
+    }else if( pIndex->aColExpr ){
       for(jj=0; jj<pIndex->nColumn; jj++){
-        if( pExpr->iColumn==pIndex->aiColumn[jj] ) return 1;
+        if( pIndex->aiColumn[jj]==XN_EXPR
+         && sqlite4ExprCompare(pExpr, pIndex->aColExpr->a[jj].pExpr, iCursor)==0
+        ){
+          return 1;
+        }
       }
+    }else{
+      return 0;
     }
   }
   return 0;
@@ -4578,6 +4916,36 @@ static int whereLoopAddMatch(
   return rc;
 }
 
+/*
+** Return true if partial index pIdx, which has WHERE clause pWhere, may be
+** used to scan table iTab for a query with WHERE clause pWC. This is the
+** case if each AND-connected term of pWhere is implied by a term of pWC
+** (or of the conjunctions that contain it). Terms of the ON clause of
+** a LEFT JOIN do not restrict the rows of any table other than the one on
+** the right-hand side of the join, so they are only considered for that
+** table.
+*/
+static int whereUsablePartialIndex(int iTab, WhereClause *pWC, Expr *pWhere){
+  int i;
+  WhereTerm *pTerm;
+  while( pWhere->op==TK_AND ){
+    if( !whereUsablePartialIndex(iTab, pWC, pWhere->pLeft) ) return 0;
+    pWhere = pWhere->pRight;
+  }
+  for(; pWC; pWC=pWC->pOuter){
+    for(i=0, pTerm=pWC->a; i<pWC->nTerm; i++, pTerm++){
+      Expr *pExpr = pTerm->pExpr;
+      if( (!ExprHasProperty(pExpr, EP_FromJoin) 
+            || pExpr->iRightJoinTable==iTab)
+       && sqlite4ExprImpliesExpr(pExpr, pWhere, iTab) 
+      ){
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
 /*
 ** Add all WhereLoop objects for a single table of the join where the table
 ** is idenfied by pBuilder->pNew->iTab.  That table is guaranteed to be
@@ -4639,6 +5007,24 @@ static int whereLoopAddBtree(
     WhereClause *pWC = pBuilder->pWC;
     WhereTerm *pTerm;
     WhereTerm *pWCEnd = pWC->a + pWC->nTerm;
+    sqlite4 *db = pWInfo->pParse->db;
+    int bHash;                    /* True to consider a hash join */
+
+    /* TUNING: If sqlite_stat1 shows that a hash table on this table would
+    ** not fit within the sorter_memory budget, assuming 64 bytes per
+    ** entry, do not consider a hash join. At runtime such a hash table
+    ** is converted to an ordered automatic index (see vdbejoin.c), so
+    ** it would cost more than an ordered automatic index built directly.
+    ** Without statistics the size of the table is not known, and the
+    ** conversion is left to deal with tables that turn out to be large. */
+    bHash = (db->flags & SQLITE4_HashJoin)!=0;
+    if( (pSrc->pTab->tabFlags & TF_HasStat1)!=0
+     && db->mxSorterMem>0
+     && (i64)pSrc->pTab->nRowEst*64 > db->mxSorterMem
+    ){
+      bHash = 0;
+    }
+
     for(pTerm=pWC->a; rc==SQLITE4_OK && pTerm<pWCEnd; pTerm++){
       if( pTerm->prereqRight & pNew->maskSelf ) continue;
       if( termCanDriveIndex(pTerm, pSrc, 0) ){
@@ -4646,17 +5032,35 @@ static int whereLoopAddBtree(
         pNew->u.btree.pIndex = 0;
         pNew->nLTerm = 1;
         pNew->aLTerm[0] = pTerm;
-        /* TUNING: One-time cost for computing the automatic index is
-        ** approximately 7*N*log2(N) where N is the number of rows in
-        ** the table being indexed. */
-        pNew->rSetup = rLogSize + rSize + 28;  assert( 28==whereCost(7) );
         /* TUNING: Each index lookup yields 20 rows in the table.  This
         ** is more than the usual guess of 10 rows, since we have no way
         ** of knowning how selective the index will ultimately be.  It would
         ** not be unreasonable to make this value much larger. */
         pNew->nOut = 43;  assert( 43==whereCost(20) );
-        pNew->rRun = whereCostAdd(rLogSize,pNew->nOut);
-        pNew->wsFlags = WHERE_AUTO_INDEX;
+        if( bHash && pTerm->prereqRight!=0
+         && !tableHasIndexOn(pSrc->pTab, pTerm->u.leftColumn)
+        ){
+          /* TUNING: If pTerm is a join constraint, and there is no index
+          ** that could be used for it instead, a hash table may be
+          ** built on the join columns. Building it costs about
+          ** 4*N, as each row is read, hashed and copied once. Since the
+          ** cost is proportional to N, the query planner prefers to
+          ** build the hash table on the smaller table of a join. Each
+          ** lookup costs about the same as visiting two rows. The loop
+          ** is in a class of its own (see WHERE_SORTIDX_HASH).  */
+          pNew->iSortIdx = WHERE_SORTIDX_HASH;
+          pNew->rSetup = rSize + 20;  assert( 20==whereCost(4) );
+          pNew->rRun = whereCostAdd(10,pNew->nOut);  assert( 10==whereCost(2) );
+          pNew->wsFlags = WHERE_AUTO_INDEX | WHERE_HASH_JOIN;
+        }else{
+          /* TUNING: One-time cost for computing the automatic index is
+          ** approximately 7*N*log2(N) where N is the number of rows in
+          ** the table being indexed. */
+          pNew->iSortIdx = 0;
+          pNew->rSetup = rLogSize + rSize + 28;  assert( 28==whereCost(7) );
+          pNew->rRun = whereCostAdd(rLogSize,pNew->nOut);
+          pNew->wsFlags = WHERE_AUTO_INDEX;
+        }
         pNew->prereq = mExtra | pTerm->prereqRight;
         rc = whereLoopInsert(pBuilder, pNew);
       }
@@ -4684,14 +5088,29 @@ static int whereLoopAddBtree(
   /* Loop through the set of indices being considered. */
   for(; rc==SQLITE4_OK && pProbe; pProbe=pProbe->pNext, iSortIdx++){
     int bCover = (pProbe!=pPk && 0==(pSrc->colUsed & ~columnsInIndex(pProbe)));
+    WhereCost rIdxSize = rSize;   /* Number of entries in index pProbe */
     if( pProbe->eIndexType==SQLITE4_INDEX_FTS5 ) continue;
     assert( pProbe->tnum>0 );
 
+    /* A partial index may only be used if the WHERE clause of the query
+    ** implies that of the index. It usually contains fewer entries than
+    ** the table has rows.  */
+    if( pProbe->pPartIdxWhere ){
+      if( !whereUsablePartialIndex(pSrc->iCursor, pBuilder->pWC,
+                                   pProbe->pPartIdxWhere)
+      ){
+        if( pSrc->pIndex ) break;
+        continue;
+      }
+      rIdxSize = whereCost(pProbe->aiRowEst[0]);
+      if( rIdxSize>rSize ) rIdxSize = rSize;
+    }
+
     pNew->u.btree.nEq = 0;
     pNew->nLTerm = 0;
     pNew->rSetup = 0;
     pNew->prereq = mExtra;
-    pNew->nOut = rSize;
+    pNew->nOut = rIdxSize;
     pNew->u.btree.pIndex = pProbe;
     pNew->wsFlags = WHERE_INDEXED;
     pNew->wsFlags |= (bCover ? WHERE_IDX_ONLY : 0); 
@@ -4702,7 +5121,7 @@ static int whereLoopAddBtree(
     assert( (pWInfo->wctrlFlags & WHERE_ONEPASS_DESIRED)==0 || b==0 );
     pNew->iSortIdx = b ? iSortIdx : 0;
 
-    if( pProbe==pPk || b || (bCover
+    if( pProbe==pPk || b || pProbe->pPartIdxWhere || (bCover
      && pProbe->bUnordered==0
      && (pWInfo->wctrlFlags & WHERE_ONEPASS_DESIRED)==0
 #if 0
@@ -4726,12 +5145,13 @@ static int whereLoopAddBtree(
         **     clause, then the cost is fudged down slightly so that this
         **     index is favored above other indices that have no hope of
         **     helping with the ORDER BY. */
-        pNew->rRun = 10 + whereCostAdd(rSize,rLogSize) - b;
+        pNew->rRun = 10 + whereCostAdd(rIdxSize,rLogSize) - b;
       }else{
-        assert( b!=0 ); 
+        assert( b!=0 || pProbe->pPartIdxWhere ); 
         /* TUNING: Cost of scanning a non-covering index is (N+1)*log2(N)
-         ** which we will simplify to just N*log2(N) */
-        pNew->rRun = rSize + rLogSize;
+         ** which we will simplify to just N*log2(N). For a partial index,
+         ** N is the number of entries in the index.  */
+        pNew->rRun = rIdxSize + rLogSize;
       }
       rc = whereLoopInsert(pBuilder, pNew);
       if( rc ) break;
@@ -5180,6 +5600,7 @@ static int wherePathSatisfiesOrderBy(
       if( (pIndex = pLoop->u.btree.pIndex)==0 
         || pIndex->bUnordered 
         || pIndex->eIndexType==SQLITE4_INDEX_FTS5 
+        || (pLoop->wsFlags & WHERE_SKIPSCAN)!=0
       ){
         return 0;
       }else{
@@ -5224,9 +5645,9 @@ static int wherePathSatisfiesOrderBy(
         ** WhereLoop is not well-ordered 
         */
         if( isOrderDistinct
-         && iColumn>=0
          && j>=pLoop->u.btree.nEq
-         && pIndex->pTable->aCol[iColumn].notNull==0
+         && (iColumn==XN_EXPR
+          || (iColumn>=0 && pIndex->pTable->aCol[iColumn].notNull==0))
         ){
           isOrderDistinct = 0;
         }
@@ -5242,10 +5663,15 @@ static int wherePathSatisfiesOrderBy(
           testcase( wctrlFlags & WHERE_GROUPBY );
           testcase( wctrlFlags & WHERE_DISTINCTBY );
           if( (wctrlFlags & (WHERE_GROUPBY|WHERE_DISTINCTBY))==0 ) bOnce = 0;
-          if( pOBExpr->op!=TK_COLUMN ) continue;
-          if( pOBExpr->iTable!=iCur ) continue;
-          if( pOBExpr->iColumn!=iColumn ) continue;
-          if( iColumn>=0 ){
+          if( iColumn==XN_EXPR ){
+            Expr *pIdxExpr = pIndex->aColExpr->a[j].pExpr;
+            if( sqlite4ExprCompare(pOBExpr, pIdxExpr, iCur) ) continue;
+          }else{
+            if( pOBExpr->op!=TK_COLUMN ) continue;
+            if( pOBExpr->iTable!=iCur ) continue;
+            if( pOBExpr->iColumn!=iColumn ) continue;
+          }
+          if( iColumn>=0 || iColumn==XN_EXPR ){
             const char *zIdxColl;
             pColl = sqlite4ExprCollSeq(pWInfo->pParse, pOrderBy->a[i].pExpr);
             if( !pColl ) pColl = db->pDfltColl;
@@ -5616,9 +6042,9 @@ static int whereShortCut(WhereLoopBuilder *pBuilder){
   pLoop->wsFlags = 0;
 
   for(pIdx=pTab->pIndex; pIdx; pIdx=pIdx->pNext){
-    if( pIdx->onError==OE_None ) continue;
+    if( pIdx->onError==OE_None || pIdx->pPartIdxWhere ) continue;
     for(j=0; j<pIdx->nColumn; j++){
-      pTerm = findTerm(pWC, iCur, pIdx->aiColumn[j], 0, WO_EQ, pIdx);
+      pTerm = findTerm(pWC, iCur, j, 0, WO_EQ, pIdx);
       if( pTerm==0 ) break;
       whereLoopResize(pWInfo->pParse->db, pLoop, j);
       pLoop->aLTerm[j] = pTerm;
@@ -5654,6 +6080,88 @@ static int whereShortCut(WhereLoopBuilder *pBuilder){
   return 0;
 }
 
+/*
+** Check if the outer loop of the join described by pWInfo should be run
+** in batches. If so, set the WHERE_BATCHED flag on the outer loop and the
+** WHERE_BATCH_PROBE flag on the loop nested inside it.
+**
+** A batched loop reads a batch of rows from its table, sorts them by the
+** key that the next loop uses to look up the inner index, then runs the
+** inner loops for each row in sorted order. This way the inner index is
+** probed in ascending key order instead of in the order in which the outer
+** rows are stored, which is much kinder to the storage layer caches when
+** the inner index is large. It is only worthwhile if the outer table is
+** large too, and if the order of the outer rows does not matter.
+**
+** The rows are stored in a sorter opened on the outer table's cursor, so
+** that the rest of the program can read them using OP_Column. Because of
+** this the outer table may not be accessed in any other way - for
+** example by a reference to its rowid.
+*/
+static void whereCheckBatched(WhereInfo *pWInfo){
+  WhereLevel *pLevel = &pWInfo->a[0];
+  WhereLoop *pOuter;              /* Outer loop, a full table scan */
+  WhereLoop *pInner;              /* Loop used to look up inner index */
+  struct SrcListItem *pItem;      /* FROM clause item for outer loop */
+  Table *pTab;                    /* Outer table */
+  Index *pIdx;                    /* Inner index */
+  int i;
+
+  if( (pWInfo->pParse->db->flags & SQLITE4_BatchLookup)==0 ) return;
+  if( pWInfo->nLevel<2 || pWInfo->bOBSat ) return;
+  if( pWInfo->eDistinct==WHERE_DISTINCT_ORDERED ) return;
+  if( pWInfo->wctrlFlags & (WHERE_ORDERBY_MIN|WHERE_ORDERBY_MAX
+        |WHERE_ONEPASS_DESIRED|WHERE_OMIT_OPEN_CLOSE|WHERE_ONETABLE_ONLY)
+  ){
+    return;
+  }
+
+  /* The outer loop must be a scan of an entire real table that has been
+  ** analyzed and found to be large.  */
+  pOuter = pLevel[0].pWLoop;
+  pItem = &pWInfo->pTabList->a[pLevel[0].iFrom];
+  pTab = pItem->pTab;
+  if( (pOuter->wsFlags & ~(WHERE_PRIMARY_KEY|WHERE_IN_ABLE))!=WHERE_INDEXED
+   || pOuter->u.btree.pIndex->eIndexType!=SQLITE4_INDEX_PRIMARYKEY
+   || (pTab->tabFlags & (TF_Ephemeral|TF_HasStat1))!=TF_HasStat1
+   || pTab->pSelect || IsVirtual(pTab) || IsKvstore(pTab)
+   || pTab->nRowEst<SQLITE4_WHERE_BATCH_SIZE
+   || (pItem->colUsed & MASKBIT(BMS-1))
+   || (pWInfo->revMask & 0x03)
+  ){
+    return;
+  }
+
+  /* The next loop must look up an index using only == constraints, the
+  ** right-hand sides of which are columns of the outer table.  */
+  pInner = pLevel[1].pWLoop;
+  if( (pInner->wsFlags & WHERE_INDEXED)==0
+   || (pInner->wsFlags & (WHERE_AUTO_INDEX|WHERE_COLUMN_IN|WHERE_COLUMN_NULL))
+   || pInner->u.btree.nEq==0
+  ){
+    return;
+  }
+  pIdx = pInner->u.btree.pIndex;
+  if( pIdx->eIndexType==SQLITE4_INDEX_FTS5 || pIdx->tnum==KVSTORE_ROOT ){
+    return;
+  }
+  for(i=0; i<pInner->u.btree.nEq; i++){
+    WhereTerm *pTerm = pInner->aLTerm[i];
+    Expr *pRight;
+    if( pTerm==0 || (pTerm->eOperator & WO_EQ)==0 ) return;
+    pRight = sqlite4ExprSkipCollate(pTerm->pExpr->pRight);
+    if( pRight->op!=TK_COLUMN
+     || pRight->iTable!=pItem->iCursor
+     || pRight->iColumn<0
+    ){
+      return;
+    }
+  }
+
+  pOuter->wsFlags |= WHERE_BATCHED;
+  pInner->wsFlags |= WHERE_BATCH_PROBE;
+}
+
 /*
 ** Generate the beginning of the loop used for WHERE clause processing.
 ** The return value is a pointer to an opaque structure that contains
@@ -6004,6 +6512,7 @@ WhereInfo *sqlite4WhereBegin(
   }
   WHERETRACE(0xffff,("*** Optimizer Finished ***\n"));
   pWInfo->pParse->nQueryLoop += pWInfo->nRowOut;
+  whereCheckBatched(pWInfo);
 
   /* If the caller is an UPDATE or DELETE statement that is requesting
   ** to use a one-pass algorithm, determine if this is appropriate.
@@ -6045,7 +6554,14 @@ WhereInfo *sqlite4WhereBegin(
     if( (pLoop->wsFlags & WHERE_IDX_ONLY)==0
          && (wctrlFlags & WHERE_OMIT_OPEN_CLOSE)==0 ){
       int op = pWInfo->okOnePass ? OP_OpenWrite : OP_OpenRead;
-      sqlite4OpenPrimaryKey(pParse, pTabItem->iCursor, iDb, pTab, op);
+      int iCsr = pTabItem->iCursor;
+      if( pLoop->wsFlags & WHERE_BATCHED ){
+        /* The table is scanned using a separate cursor. Cursor
+        ** pTabItem->iCursor is used by the sorter that holds each batch
+        ** of rows (see codeBatchedScan()).  */
+        iCsr = pLevel->iIdxCur = pParse->nTab++;
+      }
+      sqlite4OpenPrimaryKey(pParse, iCsr, iDb, pTab, op);
       testcase( !pWInfo->okOnePass && pTab->nCol==BMS-1 );
       testcase( !pWInfo->okOnePass && pTab->nCol==BMS );
     }
@@ -6057,7 +6573,9 @@ WhereInfo *sqlite4WhereBegin(
     if( pLoop->wsFlags & WHERE_INDEXED ){
       Index *pIx = pLoop->u.btree.pIndex;
       if( pIx->eIndexType==SQLITE4_INDEX_PRIMARYKEY ){
-        pLevel->iIdxCur = pTabItem->iCursor;
+        if( (pLoop->wsFlags & WHERE_BATCHED)==0 ){
+          pLevel->iIdxCur = pTabItem->iCursor;
+        }
       }else{
         /* FIXME:  As an optimization use pTabItem->iCursor if WHERE_IDX_ONLY */
         pLevel->iIdxCur = iIdxCur ? iIdxCur : pParse->nTab++;
@@ -6084,8 +6602,10 @@ WhereInfo *sqlite4WhereBegin(
   notReady = ~(Bitmask)0;
   for(ii=0; ii<nTabList; ii++){
     pLevel = &pWInfo->a[ii];
+    pLevel->iProfLoop = -1;
     explainOneScan(pParse, pTabList, pLevel, ii, pLevel->iFrom, wctrlFlags);
     notReady = codeOneLoopStart(pWInfo, ii, notReady);
+    sqlite4VdbeLoopAddr(v, pLevel->iProfLoop, VDBE_LOOP_BODY);
     pWInfo->iContinue = pLevel->addrCont;
   }
 
@@ -6121,10 +6641,17 @@ void sqlite4WhereEnd(WhereInfo *pWInfo){
     pLevel = &pWInfo->a[i];
     pLoop = pLevel->pWLoop;
     sqlite4VdbeResolveLabel(v, pLevel->addrCont);
+    sqlite4VdbeLoopAddr(v, pLevel->iProfLoop, VDBE_LOOP_CONT);
     if( pLevel->op!=OP_Noop ){
       sqlite4VdbeAddOp2(v, pLevel->op, pLevel->p1, pLevel->p2);
       sqlite4VdbeChangeP5(v, pLevel->p5);
     }
+    if( pLoop->wsFlags & WHERE_BATCHED ){
+      /* The current batch is finished. Fill the next one, if any. */
+      sqlite4VdbeAddOp2(v, OP_If, pLevel->regBatchEof, pLevel->addrBrk);
+      sqlite4VdbeAddOp2(v, OP_Next, pLevel->iIdxCur, pLevel->addrBatch);
+      sqlite4VdbeChangeP5(v, SQLITE4_STMTSTATUS_FULLSCAN_STEP);
+    }
     if( pLoop->wsFlags & WHERE_IN_ABLE && pLevel->u.in.nIn>0 ){
       struct InLoop *pIn;
       int j;
@@ -6155,6 +6682,7 @@ void sqlite4WhereEnd(WhereInfo *pWInfo){
       }
       sqlite4VdbeJumpHere(v, addr);
     }
+    sqlite4VdbeLoopAddr(v, pLevel->iProfLoop, VDBE_LOOP_END);
   }
 
   /* The "break" point is here, just past the end of the outer loop.
@@ -1973,6 +1973,67 @@ static int test_stmt_status(
   return TCL_OK;
 }
 
+/*
+** Usage:  sqlite4_stmt_profile  STMT  TYPE  INDEX
+**
+** TYPE is one of "OP", "LOOP" or "RESET". Return the profile counters
+** for the VM instruction or planner loop INDEX as a key/value list, or
+** the name of the error code if sqlite4_stmt_profile() fails.
+*/
+static int test_stmt_profile(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  sqlite4_stmt *pStmt;
+  sqlite4_profile_info prof;
+  int eType;
+  int iIdx;
+  int rc;
+  Tcl_Obj *pRet;
+
+  static const char *azType[] = { "OP", "LOOP", "RESET", 0 };
+  static const int aeType[] = {
+    SQLITE4_PROFILE_OP, SQLITE4_PROFILE_LOOP, SQLITE4_PROFILE_RESET
+  };
+  if( objc!=4 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "STMT TYPE INDEX");
+    return TCL_ERROR;
+  }
+  if( getStmtPointer(interp, Tcl_GetString(objv[1]), &pStmt) ) return TCL_ERROR;
+  if( Tcl_GetIndexFromObj(interp, objv[2], azType, "type", 0, &eType) ){
+    return TCL_ERROR;
+  }
+  if( Tcl_GetIntFromObj(interp, objv[3], &iIdx) ) return TCL_ERROR;
+
+  memset(&prof, 0, sizeof(prof));
+  rc = sqlite4_stmt_profile(pStmt, aeType[eType], iIdx, &prof);
+  if( rc!=SQLITE4_OK ){
+    Tcl_SetResult(interp, (char *)t1ErrorName(rc), TCL_STATIC);
+    return TCL_OK;
+  }
+  if( aeType[eType]==SQLITE4_PROFILE_RESET ) return TCL_OK;
+
+  pRet = Tcl_NewObj();
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("nexec", -1));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewWideIntObj(prof.nExec));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("nrow", -1));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewWideIntObj(prof.nRow));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("ncycle", -1));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewWideIntObj(prof.nCycle));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("nseek", -1));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewWideIntObj(prof.nSeek));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("nstep", -1));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewWideIntObj(prof.nStep));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("nbyte", -1));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewWideIntObj(prof.nByte));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("desc", -1));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj(prof.zDesc, -1));
+  Tcl_SetObjResult(interp, pRet);
+  return TCL_OK;
+}
+
 /*
 ** Usage:  sqlite4_next_stmt  DB  STMT
 **
@@ -2466,6 +2527,159 @@ static int test_bind_int64(
   return TCL_OK;
 }
 
+/*
+** Usage:   sqlite4_bind_array  STMT N TYPE LIST
+**
+** Test the sqlite4_bind_array interface. TYPE is one of "int", "double",
+** "text" or "blob". The values in LIST are copied into a buffer that
+** remains valid until another array is bound to parameter N of any
+** statement. For "int" and "double" arrays, empty list elements are
+** bound as NULL.
+*/
+static int test_bind_array(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  static void *apBuf[32];         /* Buffers for parameters 1 to 32 */
+  static const char *azType[] = { "int", "double", "text", "blob", 0 };
+  static const int aeType[] = {
+    SQLITE4_INTEGER, SQLITE4_FLOAT, SQLITE4_TEXT, SQLITE4_BLOB
+  };
+  sqlite4_stmt *pStmt;
+  int idx;
+  int eType;
+  int nRow;
+  Tcl_Obj **apElem;
+  int nByte;
+  char *pBuf;
+  int *anByte;
+  char *pData;
+  char *pCsr;
+  int i;
+  int rc;
+
+  if( objc!=5 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "STMT N TYPE LIST");
+    return TCL_ERROR;
+  }
+  if( getStmtPointer(interp, Tcl_GetString(objv[1]), &pStmt) ) return TCL_ERROR;
+  if( Tcl_GetIntFromObj(interp, objv[2], &idx) ) return TCL_ERROR;
+  if( Tcl_GetIndexFromObj(interp, objv[3], azType, "type", 0, &eType) ){
+    return TCL_ERROR;
+  }
+  if( Tcl_ListObjGetElements(interp, objv[4], &nRow, &apElem) ){
+    return TCL_ERROR;
+  }
+  if( idx<1 || idx>ArraySize(apBuf) ){
+    Tcl_AppendResult(interp, "parameter index out of range", 0);
+    return TCL_ERROR;
+  }
+
+  /* Allocate a buffer for the indicator or size array, the value array
+  ** and any text or blob data.  */
+  nByte = nRow * (sizeof(int) + sizeof(sqlite4_int64));
+  for(i=0; aeType[eType]==SQLITE4_TEXT && i<nRow; i++){
+    int n;
+    Tcl_GetStringFromObj(apElem[i], &n);
+    nByte += n + 1;
+  }
+  for(i=0; aeType[eType]==SQLITE4_BLOB && i<nRow; i++){
+    int n;
+    Tcl_GetByteArrayFromObj(apElem[i], &n);
+    nByte += n + 1;
+  }
+  pBuf = (char*)ckalloc(nByte + 1);
+  anByte = (int*)pBuf;
+  pData = &pBuf[nRow * sizeof(int)];
+  pCsr = &pData[nRow * sizeof(sqlite4_int64)];
+
+  for(i=0; i<nRow; i++){
+    Tcl_Obj *p = apElem[i];
+    int n = 0;
+    Tcl_GetStringFromObj(p, &n);
+    anByte[i] = (n==0 ? -1 : 0);
+    switch( aeType[eType] ){
+      case SQLITE4_INTEGER:
+        if( n && Tcl_GetWideIntFromObj(interp, p, &((sqlite4_int64*)pData)[i]) ){
+          ckfree(pBuf);
+          return TCL_ERROR;
+        }
+        break;
+      case SQLITE4_FLOAT:
+        if( n && Tcl_GetDoubleFromObj(interp, p, &((double*)pData)[i]) ){
+          ckfree(pBuf);
+          return TCL_ERROR;
+        }
+        break;
+      default: {
+        const char *z;
+        if( aeType[eType]==SQLITE4_TEXT ){
+          z = Tcl_GetStringFromObj(p, &n);
+        }else{
+          z = (const char*)Tcl_GetByteArrayFromObj(p, &n);
+        }
+        memcpy(pCsr, z, n);
+        pCsr[n] = '\0';
+        ((char**)pData)[i] = pCsr;
+        anByte[i] = n;
+        pCsr += n + 1;
+        break;
+      }
+    }
+  }
+
+  rc = sqlite4_bind_array(pStmt, idx, aeType[eType], pData, anByte, nRow);
+  if( rc!=SQLITE4_OK ){
+    ckfree(pBuf);
+    Tcl_SetResult(interp, (char *)t1ErrorName(rc), TCL_STATIC);
+    return TCL_ERROR;
+  }
+  if( apBuf[idx-1] ) ckfree(apBuf[idx-1]);
+  apBuf[idx-1] = pBuf;
+  return TCL_OK;
+}
+
+/*
+** Usage:   sqlite4_step_array  STMT NROW
+**
+** Test the sqlite4_step_array interface. Return a list containing the
+** name of the error code returned by sqlite4_step_array() followed by
+** the result of each row.
+*/
+static int test_step_array(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  sqlite4_stmt *pStmt;
+  int nRow;
+  int *aRc;
+  int rc;
+  int i;
+  Tcl_Obj *pRet;
+
+  if( objc!=3 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "STMT NROW");
+    return TCL_ERROR;
+  }
+  if( getStmtPointer(interp, Tcl_GetString(objv[1]), &pStmt) ) return TCL_ERROR;
+  if( Tcl_GetIntFromObj(interp, objv[2], &nRow) ) return TCL_ERROR;
+
+  aRc = (int*)ckalloc(sizeof(int) * (nRow+1));
+  rc = sqlite4_step_array(pStmt, nRow, aRc);
+  pRet = Tcl_NewObj();
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj(t1ErrorName(rc), -1));
+  for(i=0; rc!=SQLITE4_RANGE && rc!=SQLITE4_MISUSE && i<nRow; i++){
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj(t1ErrorName(aRc[i]),-1));
+  }
+  ckfree((char*)aRc);
+  Tcl_SetObjResult(interp, pRet);
+  return TCL_OK;
+}
+
 
 /*
 ** Usage:   sqlite4_bind_double  STMT N VALUE
@@ -3587,6 +3801,40 @@ static int test_db_release_memory(
   return TCL_OK;
 }
 
+/*
+** Usage:  sqlite4_rowcache_status DB DBNAME
+**
+** Return a list of two integers, the number of row cache hits and misses
+** for database DBNAME since the previous call.
+*/
+static int test_rowcache_status(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  sqlite4 *db;
+  int aStat[2];
+  int rc;
+  Tcl_Obj *pRet;
+  if( objc!=3 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "DB DBNAME");
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, Tcl_GetString(objv[1]), &db) ) return TCL_ERROR;
+  rc = sqlite4_kvstore_control(db, Tcl_GetString(objv[2]),
+      SQLITE4_KVCTRL_ROWCACHE_STATUS, (void*)aStat
+  );
+  if( rc!=SQLITE4_OK ){
+    Tcl_SetResult(interp, (char *)sqlite4TestErrorName(rc), TCL_STATIC);
+    return TCL_ERROR;
+  }
+  pRet = Tcl_NewObj();
+  Tcl_ListObjAppendElement(interp, pRet, Tcl_NewIntObj(aStat[0]));
+  Tcl_ListObjAppendElement(interp, pRet, Tcl_NewIntObj(aStat[1]));
+  Tcl_SetObjResult(interp, pRet);
+  return TCL_OK;
+}
 
 /*
 ** tclcmd:   working_64bit_int
@@ -4220,6 +4468,7 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
      { "sqlite4_bind_text",             test_bind_text     ,0 },
      { "sqlite4_bind_text16",           test_bind_text16   ,0 },
      { "sqlite4_bind_blob",             test_bind_blob     ,0 },
+     { "sqlite4_bind_array",            test_bind_array    ,0 },
      { "sqlite4_bind_parameter_count",  test_bind_parameter_count, 0},
      { "sqlite4_bind_parameter_name",   test_bind_parameter_name,  0},
      { "sqlite4_bind_parameter_index",  test_bind_parameter_index, 0},
@@ -4234,9 +4483,11 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
      { "sqlite4_prepare_tkt3134",       test_prepare_tkt3134, 0},
      { "sqlite4_finalize",              test_finalize      ,0 },
      { "sqlite4_stmt_status",           test_stmt_status   ,0 },
+     { "sqlite4_stmt_profile",          test_stmt_profile  ,0 },
      { "sqlite4_reset",                 test_reset         ,0 },
      { "sqlite4_changes",               test_changes       ,0 },
      { "sqlite4_step",                  test_step          ,0 },
+     { "sqlite4_step_array",            test_step_array    ,0 },
      { "sqlite4_stmt_sql",              test_stmt_sql      ,0 },
      { "sqlite4_next_stmt",             test_next_stmt     ,0 },
      { "sqlite4_stmt_readonly",         test_stmt_readonly ,0 },
@@ -4244,6 +4495,7 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
      { "uses_stmt_journal",             uses_stmt_journal ,0 },
 
      { "sqlite4_db_release_memory",     test_db_release_memory,  0},
+     { "sqlite4_rowcache_status",       test_rowcache_status,    0},
 
      { "sqlite4_limit",                 test_limit,                 0},
 
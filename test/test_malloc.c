@@ -935,6 +935,42 @@ static int test_db_config_lookaside(
   return TCL_OK;
 }
 
+#endif
+
+/*
+** Usage:    sqlite4_db_config_stmtcache  CONNECTION  SIZE
+**
+** Set the capacity of the statement cache of CONNECTION to SIZE, or leave
+** it unchanged if SIZE is negative. Return the capacity.
+*/
+static int test_db_config_stmtcache(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int rc;
+  int sz, res;
+  sqlite4 *db;
+  int getDbPointer(Tcl_Interp*, const char*, sqlite4**);
+  const char *sqlite4TestErrorName(int);
+  if( objc!=3 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "CONNECTION SIZE");
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, Tcl_GetString(objv[1]), &db) ) return TCL_ERROR;
+  if( Tcl_GetIntFromObj(interp, objv[2], &sz) ) return TCL_ERROR;
+  rc = sqlite4_db_config(db, SQLITE4_DBCONFIG_STMTCACHE_SIZE, sz, &res);
+  if( rc!=SQLITE4_OK ){
+    Tcl_AppendResult(interp, sqlite4TestErrorName(rc), (char*)0);
+    return TCL_ERROR;
+  }
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(res));
+  return TCL_OK;
+}
+
+#if 0
+
 /*
 ** tclcmd:     sqlite4_config_error  [DB]
 **
@@ -1026,6 +1062,8 @@ static int test_status(
   return TCL_OK;
 }
 
+#endif
+
 /*
 ** Usage:    sqlite4_db_status  DATABASE  OPCODE  RESETFLAG
 **
@@ -1055,7 +1093,10 @@ static int test_db_status(
     { "LOOKASIDE_MISS_SIZE", SQLITE4_DBSTATUS_LOOKASIDE_MISS_SIZE },
     { "LOOKASIDE_MISS_FULL", SQLITE4_DBSTATUS_LOOKASIDE_MISS_FULL },
     { "CACHE_HIT",           SQLITE4_DBSTATUS_CACHE_HIT           },
-    { "CACHE_MISS",          SQLITE4_DBSTATUS_CACHE_MISS          }
+    { "CACHE_MISS",          SQLITE4_DBSTATUS_CACHE_MISS          },
+    { "STMTCACHE_USED",      SQLITE4_DBSTATUS_STMTCACHE_USED      },
+    { "STMTCACHE_HIT",       SQLITE4_DBSTATUS_STMTCACHE_HIT       },
+    { "STMTCACHE_MISS",      SQLITE4_DBSTATUS_STMTCACHE_MISS      }
   };
   Tcl_Obj *pResult;
   if( objc!=4 ){
@@ -1087,6 +1128,8 @@ static int test_db_status(
   return TCL_OK;
 }
 
+#if 0
+
 /*
 ** install_malloc_faultsim BOOLEAN
 */
@@ -1353,7 +1396,6 @@ int Sqlitetest_malloc_Init(Tcl_Interp *interp){
      { "sqlite4_memdebug_malloc_count",  test_memdebug_malloc_count ,0 },
      { "sqlite4_memdebug_log",           test_memdebug_log             ,0 },
      { "sqlite4_env_status",             test_status                   ,0 },
-     { "sqlite4_db_status",              test_db_status                ,0 },
      { "install_malloc_faultsim",        test_install_malloc_faultsim  ,0 },
      { "sqlite4_env_config_memstatus",   test_config_memstatus         ,0 },
      { "sqlite4_envconfig_lookaside",    test_envconfig_lookaside      ,0 },
@@ -1361,6 +1403,8 @@ int Sqlitetest_malloc_Init(Tcl_Interp *interp){
      { "sqlite4_db_config_lookaside",    test_db_config_lookaside      ,0 },
      { "sqlite4_install_memsys3",        test_install_memsys3          ,0 },
 #endif
+     { "sqlite4_db_status",              test_db_status                ,0 },
+     { "sqlite4_db_config_stmtcache",    test_db_config_stmtcache      ,0 },
 
      { "test_mm_install",                test_mm_install               ,0 },
      { "test_mm_stat",                   test_mm_stat                  ,0 },
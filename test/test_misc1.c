@@ -15,6 +15,7 @@
 ** as there is not much point in binding to Tcl.
 */
 #include "sqliteInt.h"
+#include "vdbeInt.h"
 #include "tcl.h"
 #include <stdlib.h>
 #include <string.h>
@@ -146,6 +147,107 @@ error_out:
   return TCL_ERROR;
 }
 
+/*
+** Return the i-th of the integers used by c_intkey_test. The first few
+** are boundary values. The rest are pseudo-random, with a random number
+** of significant bits and of trailing decimal zeros.
+*/
+static sqlite4_int64 intkeyTestValue(int i, u64 *pState){
+  static const sqlite4_int64 aFixed[] = {
+    0, 1, -1, 9, 10, 11, 99, 100, 101, -100, 1000000, -1000001,
+    LARGEST_INT64, LARGEST_INT64-1, SMALLEST_INT64, SMALLEST_INT64+1,
+    1000000000000000000LL, -999999999999999999LL,
+  };
+  u64 x;
+  sqlite4_int64 v;
+  int nZero;
+
+  if( i<ArraySize(aFixed) ) return aFixed[i];
+  *pState = *pState * 6364136223846793005ULL + 1442695040888963407ULL;
+  x = *pState;
+  v = (sqlite4_int64)(x >> ((x & 63) | 1));
+  for(nZero=(int)((x>>8) % 8); nZero>0 && v<LARGEST_INT64/10; nZero--){
+    v = v*10;
+  }
+  return (x & 0x100) ? -v : v;
+}
+
+/*
+** Usage: c_intkey_test MODE N
+**
+** Exercise the key encoding of N integers. MODE must be one of:
+**
+**   check     Encode each value with both sqlite4VdbeEncodeIntKey() and the
+**             generic sqlite4VdbeEncodeNumKey(), and decode each with both
+**             sqlite4VdbeDecodeIntKey() and sqlite4VdbeDecodeNumericKey().
+**             Return an error if any of the results differ.
+**
+**   fast      Encode and decode each value using the integer routines.
+**
+**   generic   Encode and decode each value using the generic routines.
+**
+** The "fast" and "generic" modes are intended to be timed by the caller.
+** In all cases the result is the number of values processed.
+*/
+static int c_intkey_test(
+  ClientData clientData,
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int objc,              /* Number of arguments */
+  Tcl_Obj *CONST objv[]  /* Command arguments */
+){
+  static const char *azMode[] = { "check", "fast", "generic", 0 };
+  int iMode;
+  int nVal;
+  int i;
+  u64 iState = 1;
+  u8 aFast[16];
+  u8 aGeneric[16];
+
+  if( objc!=3 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "MODE N");
+    return TCL_ERROR;
+  }
+  if( Tcl_GetIndexFromObj(interp, objv[1], azMode, "mode", 0, &iMode) 
+   || Tcl_GetIntFromObj(interp, objv[2], &nVal)
+  ){
+    return TCL_ERROR;
+  }
+
+  for(i=0; i<nVal; i++){
+    sqlite4_int64 v = intkeyTestValue(i, &iState);
+    sqlite4_int64 iOut = 0;
+    sqlite4_num num;
+    int nFast = 0;
+    int nGeneric = 0;
+
+    if( iMode!=2 ){
+      nFast = sqlite4VdbeEncodeIntKey(aFast, v);
+      if( sqlite4VdbeDecodeIntKey(aFast, nFast, &iOut)!=nFast ) iOut = ~v;
+    }
+    if( iMode!=1 ){
+      nGeneric = sqlite4VdbeEncodeNumKey(aGeneric, sqlite4_num_from_int64(v));
+      if( sqlite4VdbeDecodeNumericKey(aGeneric, nGeneric, &num)!=nGeneric ){
+        iOut = ~v;
+      }else if( iMode==2 ){
+        iOut = sqlite4_num_to_int64(num, 0);
+      }else if( sqlite4_num_to_int64(num, 0)!=v ){
+        iOut = ~v;
+      }
+    }
+    if( iOut!=v
+     || (iMode==0 && (nFast!=nGeneric || memcmp(aFast, aGeneric, nFast)))
+    ){
+      char zBuf[64];
+      sqlite4_snprintf(zBuf, sizeof(zBuf), "%lld", v);
+      Tcl_AppendResult(interp, "key encoding mismatch for ", zBuf, 0);
+      return TCL_ERROR;
+    }
+  }
+
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(nVal));
+  return TCL_OK;
+}
+
 /*
 ** Register commands with the TCL interpreter.
 */
@@ -158,6 +260,7 @@ int Sqlitetest9_Init(Tcl_Interp *interp){
      { "c_misuse_test",    c_misuse_test, 0 },
      { "c_realloc_test",   c_realloc_test, 0 },
      { "c_collation_test", c_collation_test, 0 },
+     { "c_intkey_test",    c_intkey_test, 0 },
   };
   int i;
   for(i=0; i<sizeof(aObjCmd)/sizeof(aObjCmd[0]); i++){
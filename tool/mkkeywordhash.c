@@ -258,6 +258,7 @@ static Keyword aKeywordTable[] = {
   { "VIRTUAL",          "TK_VIRTUAL",      VTAB                   },
   { "WHEN",             "TK_WHEN",         ALWAYS                 },
   { "WHERE",            "TK_WHERE",        ALWAYS                 },
+  { "WITH",             "TK_WITH",         ALWAYS                 },
 };
 
 /* Number of keywords */
@@ -99,6 +99,7 @@ END {
     }
     used[op[name]] = 1;
     if( op[name]>max ) max = op[name]
+    opname[op[name]] = name
     printf "#define %-25s %15d", name, op[name]
     if( sameas[op[name]] ) {
       printf "   /* same as %-12s*/", sameas[op[name]]
@@ -158,4 +159,23 @@ END {
     if( i%8==7 ) printf("\\\n");
   }
   print "}"
+
+  # Generate the table of labels used by the computed-goto dispatch in
+  # sqlite4VdbeExec(). Unused opcode values, OP_Noop and OP_Explain are
+  # all handled by the "default:" case, which is labelled L_OP_Noop.
+  #
+  print "\n"
+  print "/* Jump table for SQLITE4_ENABLE_COMPUTED_GOTO builds. Each entry is"
+  print "** the address of the label placed before the \"case\" for the opcode"
+  print "** in vdbe.c."
+  print "*/"
+  print "#define OPLABEL_INITIALIZER {\\"
+  for(i=0; i<=max; i++){
+    name = opname[i]
+    if( !used[i] || name=="OP_Explain" ) name = "OP_Noop"
+    if( i%4==0 ) printf("/* %3d */",i)
+    printf " &&L_%s,", name
+    if( i%4==3 ) printf("\\\n");
+  }
+  print "}"
 }
@@ -257,6 +257,8 @@ foreach file {
    lsm_varint.c
 
    kv.c
+   kvcache.c
+   kvephm.c
    kvmem.c
    kvlsm.c
    rowset.c
@@ -273,6 +275,12 @@ foreach file {
    vdbeapi.c
    vdbecodec.c
    vdbecursor.c
+   vdbehash.c
+   vdbejoin.c
+   vdbeset.c
+   threads.c
+   vdbesort.c
+   vdbetopn.c
    vdbetrace.c
    vdbe.c
 